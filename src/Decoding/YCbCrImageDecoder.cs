@@ -27,7 +27,8 @@ namespace HeicFileTypePlus.Decoding
         public static void SetImageData(
             IImagingFactory factory,
             HeifImageHandle imageHandle,
-            Surface output)
+            Surface output,
+            HeifProgressCallback? progressCallback = null)
         {
             int bitDepth = imageHandle.BitDepth;
 
@@ -42,7 +43,8 @@ namespace HeicFileTypePlus.Decoding
                 decodeFormat = bitDepth == 8 ? HeifChroma.InterleavedRgb24 : HeifChroma.InterleavedRgb48LE;
             }
 
-            using (HeifImage image = imageHandle.Decode(HeifColorSpace.Rgb, decodeFormat))
+            // libheif converts the image to RGB as part of this decode.
+            using (HeifImage image = imageHandle.Decode(HeifColorSpace.Rgb, decodeFormat, progressCallback))
             {
                 RgbImageDecoder.SetImageData(factory, image, output);
             }
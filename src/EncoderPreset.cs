@@ -33,6 +33,10 @@ namespace HeicFileTypePlus
         Slow,
         Slower,
         VerySlow,
-        Placebo
+        Placebo,
+        /// <summary>
+        /// Selects the slowest preset that is predicted to encode the image within a time budget.
+        /// </summary>
+        Automatic
     }
 }
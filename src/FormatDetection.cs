@@ -16,6 +16,7 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+using HeicFileTypePlus.Interop;
 using PaintDotNet;
 using System;
 using System.IO;
@@ -25,6 +26,10 @@ namespace HeicFileTypePlus
 {
     internal static class FormatDetection
     {
+        // The 'ftyp' box is the first box in the file, a few hundred bytes is
+        // large enough to hold the box along with its compatible brand list.
+        private const int SniffBufferSize = 512;
+
         private static ReadOnlySpan<byte> BmpFileSignature => new byte[] { 0x42, 0x4D };
 
         private static ReadOnlySpan<byte> Gif87aFileSignature => new byte[] { 0x47, 0x49, 0x46, 0x38, 0x37, 0x61 };
@@ -39,6 +44,24 @@ namespace HeicFileTypePlus
 
         private static ReadOnlySpan<byte> TiffLittleEndianFileSignature => new byte[] { 0x49, 0x49, 0x2a, 0x00 };
 
+        /// <summary>
+        /// Determines the file type from the start of the file.
+        /// </summary>
+        /// <param name="stream">The stream.</param>
+        /// <returns>The file type.</returns>
+        /// <remarks>
+        /// This allows files that are not HEIF images to be rejected without creating a HEIF context.
+        /// </remarks>
+        [SkipLocalsInit]
+        internal static SniffedFileType SniffFileType(Stream stream)
+        {
+            Span<byte> header = stackalloc byte[SniffBufferSize];
+
+            int bytesRead = stream.ReadAtLeast(header, header.Length, throwOnEndOfStream: false);
+
+            return HeicNative.SniffFile(header.Slice(0, bytesRead)).fileType;
+        }
+
         /// <summary>
         /// Attempts to get an <see cref="IFileTypeInfo"/> from the file signature.
         /// </summary>
@@ -54,6 +77,19 @@ namespace HeicFileTypePlus
         {
             string name = TryGetFileTypeName(stream);
 
+            return TryGetFileTypeInfo(name, serviceProvider);
+        }
+
+        /// <summary>
+        /// Attempts to get the <see cref="IFileTypeInfo"/> with the specified name.
+        /// </summary>
+        /// <param name="name">The file type name.</param>
+        /// <returns>
+        ///   An <see cref="IFileTypeInfo"/> instance if a file type with the specified name supports loading;
+        ///   otherwise, <see langword="null"/>.
+        /// </returns>
+        internal static IFileTypeInfo? TryGetFileTypeInfo(string name, IServiceProvider? serviceProvider)
+        {
             IFileTypeInfo? fileTypeInfo = null;
 
             if (!string.IsNullOrEmpty(name))
@@ -16,6 +16,7 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+using HeicFileTypePlus.Interop;
 using PaintDotNet;
 using PaintDotNet.IndirectUI;
 using PaintDotNet.PropertySystem;
@@ -47,7 +48,7 @@ namespace HeicFileTypePlus
                     LoadExtensions = FileExtensions,
                     SaveExtensions = FileExtensions,
                     SupportsCancellation = true,
-                    SupportsLayers = false
+                    SupportsLayers = true
                 })
         {
             this.serviceProvider = host.Services;
@@ -57,9 +58,11 @@ namespace HeicFileTypePlus
         {
             Quality,
             Preset,
+            TimeBudget,
             Tuning,
             TUIntraDepth,
             YUVChromaSubsampling,
+            SaveLayers,
             ForumLink,
             GitHubLink,
             PluginVersion,
@@ -76,15 +79,22 @@ namespace HeicFileTypePlus
                 new Int32Property(PropertyNames.Quality, 90, 0, 100, false),
                 CreateChromaSubsampling(),
                 StaticListChoiceProperty.CreateForEnum(PropertyNames.Preset, EncoderPreset.Medium),
+                new Int32Property(PropertyNames.TimeBudget, 10, 1, 600, false),
                 CreateTuning(),
                 new Int32Property(PropertyNames.TUIntraDepth, 1, 1, 4, false),
+                new BooleanProperty(PropertyNames.SaveLayers, false),
                 new UriProperty(PropertyNames.ForumLink, new Uri("https://forums.getpaint.net/topic/116873-heic-filetype-plus/")),
                 new UriProperty(PropertyNames.GitHubLink, new Uri("https://github.com/0xC0000054/pdn-heicfiletype-plus")),
                 new StringProperty(PropertyNames.PluginVersion),
                 new StringProperty(PropertyNames.LibHeifVersion),
             };
 
-            return new PropertyCollection(props);
+            PropertyCollectionRule[] rules = new PropertyCollectionRule[]
+            {
+                new ReadOnlyBoundToValueRule<object, StaticListChoiceProperty>(PropertyNames.TimeBudget, PropertyNames.Preset, EncoderPreset.Automatic, true)
+            };
+
+            return new PropertyCollection(props, rules);
 
             static StaticListChoiceProperty CreateChromaSubsampling()
             {
@@ -95,7 +105,8 @@ namespace HeicFileTypePlus
                 {
                     YUVChromaSubsampling.Subsampling420,
                     YUVChromaSubsampling.Subsampling422,
-                    YUVChromaSubsampling.Subsampling444
+                    YUVChromaSubsampling.Subsampling444,
+                    YUVChromaSubsampling.Automatic
                 };
 
                 int defaultChoiceIndex = Array.IndexOf(valueChoices, YUVChromaSubsampling.Subsampling422);
@@ -134,6 +145,7 @@ namespace HeicFileTypePlus
             chromaSubsamplingInfo.SetValueDisplayName(YUVChromaSubsampling.Subsampling420, "4:2:0 (Best Compression)");
             chromaSubsamplingInfo.SetValueDisplayName(YUVChromaSubsampling.Subsampling422, "4:2:2");
             chromaSubsamplingInfo.SetValueDisplayName(YUVChromaSubsampling.Subsampling444, "4:4:4 (Best Quality)");
+            chromaSubsamplingInfo.SetValueDisplayName(YUVChromaSubsampling.Automatic, "Automatic");
 
             PropertyControlInfo presetInfo = configUI.FindControlForPropertyName(PropertyNames.Preset)!;
             presetInfo.ControlProperties[ControlInfoPropertyNames.DisplayName]!.Value = "Encoding Speed / Quality";
@@ -146,6 +158,9 @@ namespace HeicFileTypePlus
             presetInfo.SetValueDisplayName(EncoderPreset.Slower, "Slower");
             presetInfo.SetValueDisplayName(EncoderPreset.VerySlow, "Very Slow");
             presetInfo.SetValueDisplayName(EncoderPreset.Placebo, "Placebo");
+            presetInfo.SetValueDisplayName(EncoderPreset.Automatic, "Automatic (Time Budget)");
+
+            configUI.SetPropertyControlValue(PropertyNames.TimeBudget, ControlInfoPropertyNames.DisplayName, "Time Budget (Seconds)");
 
             configUI.SetPropertyControlValue(PropertyNames.Quality, ControlInfoPropertyNames.DisplayName, "Quality");
 
@@ -159,6 +174,9 @@ namespace HeicFileTypePlus
 
             configUI.SetPropertyControlValue(PropertyNames.TUIntraDepth, ControlInfoPropertyNames.DisplayName, "TU Intra Depth");
 
+            configUI.SetPropertyControlValue(PropertyNames.SaveLayers, ControlInfoPropertyNames.DisplayName, "Layers");
+            configUI.SetPropertyControlValue(PropertyNames.SaveLayers, ControlInfoPropertyNames.Description, "Save each layer as a separate image");
+
             PropertyControlInfo forumLinkInfo = configUI.FindControlForPropertyName(PropertyNames.ForumLink)!;
             forumLinkInfo.ControlProperties[ControlInfoPropertyNames.DisplayName]!.Value = "More Info";
             forumLinkInfo.ControlProperties[ControlInfoPropertyNames.Description]!.Value = "Forum Discussion";
@@ -188,10 +206,12 @@ namespace HeicFileTypePlus
             int quality = token.GetProperty<Int32Property>(PropertyNames.Quality)!.Value;
             YUVChromaSubsampling chromaSubsampling = (YUVChromaSubsampling)token.GetProperty(PropertyNames.YUVChromaSubsampling)!.Value!;
             EncoderPreset preset = (EncoderPreset)token.GetProperty(PropertyNames.Preset)!.Value!;
+            int timeBudgetSeconds = token.GetProperty<Int32Property>(PropertyNames.TimeBudget)!.Value;
             EncoderTuning tuning = (EncoderTuning)token.GetProperty(PropertyNames.Tuning)!.Value!;
             int tuIntraDepth = token.GetProperty<Int32Property>(PropertyNames.TUIntraDepth)!.Value;
+            bool saveLayers = token.GetProperty<BooleanProperty>(PropertyNames.SaveLayers)!.Value;
 
-            HeicSave.Save(input, output, scratchSurface, quality, chromaSubsampling, preset, tuning, tuIntraDepth, progressCallback);
+            HeicSave.Save(input, output, scratchSurface, quality, chromaSubsampling, preset, timeBudgetSeconds, tuning, tuIntraDepth, saveLayers, progressCallback);
         }
 
         /// <summary>
@@ -203,28 +223,44 @@ namespace HeicFileTypePlus
 
             long originalStreamPosition = input.Position;
 
-            try
+            SniffedFileType fileType = FormatDetection.SniffFileType(input);
+            input.Position = originalStreamPosition;
+
+            if (fileType == SniffedFileType.NotHeif || fileType == SniffedFileType.Jpeg)
             {
-                doc = HeicLoad.Load(input);
+                // Skip creating a HEIF context for files that are not HEIF images.
+                doc = LoadUsingOtherFileType(input, originalStreamPosition, "The HEIC file is invalid: No 'ftyp' box.");
             }
-            catch (NoFtypeBoxException ex)
+            else
             {
-                input.Position = originalStreamPosition;
-
-                IFileTypeInfo? fileTypeInfo = FormatDetection.TryGetFileTypeInfo(input, this.serviceProvider);
-
-                if (fileTypeInfo != null)
+                try
                 {
-                    input.Position = originalStreamPosition;
-                    doc = fileTypeInfo.GetInstance().Load(input);
+                    // Paint.NET does not pass a progress handler or a cancellation request to OnLoad,
+                    // the SupportsCancellation option only applies to saving.
+                    doc = HeicLoad.Load(input);
                 }
-                else
+                catch (NoFtypeBoxException ex)
                 {
-                    throw new FormatException(ex.Message);
+                    doc = LoadUsingOtherFileType(input, originalStreamPosition, ex.Message);
                 }
             }
 
             return doc;
         }
+
+        private Document LoadUsingOtherFileType(Stream input, long originalStreamPosition, string? errorMessage)
+        {
+            input.Position = originalStreamPosition;
+
+            IFileTypeInfo? fileTypeInfo = FormatDetection.TryGetFileTypeInfo(input, this.serviceProvider);
+
+            if (fileTypeInfo is null)
+            {
+                throw new FormatException(errorMessage);
+            }
+
+            input.Position = originalStreamPosition;
+            return fileTypeInfo.GetInstance().Load(input);
+        }
     }
 }
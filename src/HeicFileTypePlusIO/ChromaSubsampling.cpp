@@ -45,8 +45,27 @@
 #include <stdint.h>
 #include <math.h>
 #include "ChromaSubsampling.h"
+#include "ParallelFor.h"
+#include "Trace.h"
 #include "YUVConversionHelpers.h"
+#include <algorithm>
 #include <array>
+#include <cstdlib>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CHROMA_USE_SSE2 1
+#else
+#define CHROMA_USE_SSE2 0
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define CHROMA_USE_NEON 1
+#else
+#define CHROMA_USE_NEON 0
+#endif
 
 namespace
 {
@@ -95,6 +114,115 @@ namespace
         return  static_cast<uint8_t>(avifRoundf(v * 255.0f));
     }
 
+#if CHROMA_USE_SSE2
+    __m128i PackChannel(__m128i pixels0, __m128i pixels1, __m128i pixels2, __m128i pixels3, int shift)
+    {
+        const __m128i mask = _mm_set1_epi32(0xff);
+
+        const __m128i channel0 = _mm_and_si128(_mm_srli_epi32(pixels0, shift), mask);
+        const __m128i channel1 = _mm_and_si128(_mm_srli_epi32(pixels1, shift), mask);
+        const __m128i channel2 = _mm_and_si128(_mm_srli_epi32(pixels2, shift), mask);
+        const __m128i channel3 = _mm_and_si128(_mm_srli_epi32(pixels3, shift), mask);
+
+        // The values are in the [0, 255] range, so the saturating packs do not change them.
+        return _mm_packus_epi16(_mm_packs_epi32(channel0, channel1), _mm_packs_epi32(channel2, channel3));
+    }
+#endif
+
+    // The chroma analysis samples every eighth row of 2x2 blocks.
+    constexpr int ChromaAnalysisRowStep = 8;
+    // The number of sampled block rows that each thread processes at a time.
+    constexpr int ChromaAnalysisBandRows = 32;
+    // The sum of the four chroma differences in one direction of a 2x2 block that is
+    // considered to be visible detail, this is an average difference of 12 per sample.
+    constexpr int ChromaDetailThreshold = 48;
+    // The chroma detail is preserved when more than 1 in 32 of the blocks contain it.
+    constexpr uint64_t ChromaDetailBlockRatio = 32;
+
+    struct ChromaDetailCounts
+    {
+        uint64_t blocks;
+        uint64_t horizontalDetailBlocks;
+        uint64_t verticalDetailBlocks;
+    };
+
+    struct ChromaSample
+    {
+        int cb;
+        int cr;
+    };
+
+    ChromaSample GetChromaSample(const ColorBgra& pixel)
+    {
+        // An integer approximation of the BT.601 luma is sufficient to measure the chroma detail.
+        const int luma = ((77 * pixel.r) + (150 * pixel.g) + (29 * pixel.b)) >> 8;
+
+        return ChromaSample{ pixel.b - luma, pixel.r - luma };
+    }
+
+    int GetChromaDifference(const ChromaSample& a, const ChromaSample& b)
+    {
+        return std::abs(a.cb - b.cb) + std::abs(a.cr - b.cr);
+    }
+
+    void AddBlockChromaDetail(const ColorBgra* top, const ColorBgra* bottom, ChromaDetailCounts& counts)
+    {
+        const ChromaSample topLeft = GetChromaSample(top[0]);
+        const ChromaSample topRight = GetChromaSample(top[1]);
+        const ChromaSample bottomLeft = GetChromaSample(bottom[0]);
+        const ChromaSample bottomRight = GetChromaSample(bottom[1]);
+
+        const int horizontalDetail = GetChromaDifference(topLeft, topRight) + GetChromaDifference(bottomLeft, bottomRight);
+        const int verticalDetail = GetChromaDifference(topLeft, bottomLeft) + GetChromaDifference(topRight, bottomRight);
+
+        // The color of fully transparent pixels is not visible.
+        const uint64_t visible = (top[0].a | top[1].a | bottom[0].a | bottom[1].a) != 0;
+
+        counts.blocks += visible;
+        counts.horizontalDetailBlocks += visible & static_cast<uint64_t>(horizontalDetail > ChromaDetailThreshold);
+        counts.verticalDetailBlocks += visible & static_cast<uint64_t>(verticalDetail > ChromaDetailThreshold);
+    }
+
+    // Returns the number of pixels that were converted, the caller converts the remaining pixels.
+    int32_t ColorToIdentity8Simd(const ColorBgra* src, uint8_t* dstY, uint8_t* dstU, uint8_t* dstV, int32_t width)
+    {
+        int32_t x = 0;
+
+#if CHROMA_USE_SSE2
+        for (; x + 16 <= width; x += 16)
+        {
+            const __m128i* pixels = reinterpret_cast<const __m128i*>(src + x);
+
+            const __m128i pixels0 = _mm_loadu_si128(pixels);
+            const __m128i pixels1 = _mm_loadu_si128(pixels + 1);
+            const __m128i pixels2 = _mm_loadu_si128(pixels + 2);
+            const __m128i pixels3 = _mm_loadu_si128(pixels + 3);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dstY + x), PackChannel(pixels0, pixels1, pixels2, pixels3, 8));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dstU + x), PackChannel(pixels0, pixels1, pixels2, pixels3, 0));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dstV + x), PackChannel(pixels0, pixels1, pixels2, pixels3, 16));
+        }
+#elif CHROMA_USE_NEON
+        for (; x + 16 <= width; x += 16)
+        {
+            // The channels are de-interleaved in BGRA order.
+            const uint8x16x4_t pixels = vld4q_u8(reinterpret_cast<const uint8_t*>(src + x));
+
+            vst1q_u8(dstY + x, pixels.val[1]);
+            vst1q_u8(dstU + x, pixels.val[0]);
+            vst1q_u8(dstV + x, pixels.val[2]);
+        }
+#else
+        static_cast<void>(src);
+        static_cast<void>(dstY);
+        static_cast<void>(dstU);
+        static_cast<void>(dstV);
+        static_cast<void>(width);
+#endif
+
+        return x;
+    }
+
     constexpr std::array<float, 256> BuildUint8ToFloatLookupTable()
     {
         std::array<float, 256> table = {};
@@ -106,7 +234,10 @@ namespace
 
         return table;
     }
+}
 
+namespace ChromaSubsampling
+{
     void ColorToIdentity8(
         const BitmapData* bgraImage,
         uint8_t* yPlane,
@@ -123,7 +254,14 @@ namespace
             uint8_t* dstU = &uPlane[y * uPlaneStride];
             uint8_t* dstV = &vPlane[y * vPlaneStride];
 
-            for (int32_t x = 0; x < bgraImage->width; ++x)
+            const int32_t simdWidth = ColorToIdentity8Simd(src, dstY, dstU, dstV, bgraImage->width);
+
+            src += simdWidth;
+            dstY += simdWidth;
+            dstU += simdWidth;
+            dstV += simdWidth;
+
+            for (int32_t x = simdWidth; x < bgraImage->width; ++x)
             {
                 // RGB -> Identity GBR conversion
                 // Formulas 41-43 from https://www.itu.int/rec/T-REC-H.273-201612-I/en
@@ -303,6 +441,97 @@ namespace
         }
     }
 
+    bool HasTransparency(const BitmapData* image)
+    {
+        for (int32_t y = 0; y < image->height; y++)
+        {
+            ColorBgra* ptr = reinterpret_cast<ColorBgra*>(image->scan0 + (static_cast<intptr_t>(y) * image->stride));
+
+            for (int32_t x = 0; x < image->width; x++)
+            {
+                if (ptr->a < 255)
+                {
+                    return true;
+                }
+
+                ptr++;
+            }
+        }
+
+        return false;
+    }
+
+    YUVChromaSubsampling SelectChromaSubsampling(const BitmapData* image)
+    {
+        const int blockRows = image->height / 2;
+        const int blockColumns = image->width / 2;
+
+        if (blockRows == 0 || blockColumns == 0)
+        {
+            return YUVChromaSubsampling::Subsampling444;
+        }
+
+        // Only some of the rows of 2x2 blocks are sampled, this keeps the analysis cost
+        // to a small fraction of the YUV conversion.
+        const int sampledRows = (blockRows + ChromaAnalysisRowStep - 1) / ChromaAnalysisRowStep;
+        const int bandCount = (sampledRows + ChromaAnalysisBandRows - 1) / ChromaAnalysisBandRows;
+
+        std::vector<ChromaDetailCounts> bands(static_cast<size_t>(bandCount));
+
+        ParallelFor::Run(0, bandCount, 1, 0, [&](int begin, int end)
+        {
+            for (int band = begin; band < end; band++)
+            {
+                const int firstRow = band * ChromaAnalysisBandRows;
+                const int lastRow = std::min(firstRow + ChromaAnalysisBandRows, sampledRows);
+
+                ChromaDetailCounts& counts = bands[static_cast<size_t>(band)];
+
+                for (int row = firstRow; row < lastRow; row++)
+                {
+                    const int y = row * ChromaAnalysisRowStep * 2;
+
+                    const ColorBgra* top = reinterpret_cast<const ColorBgra*>(image->scan0 + (static_cast<intptr_t>(y) * image->stride));
+                    const ColorBgra* bottom = reinterpret_cast<const ColorBgra*>(image->scan0 + (static_cast<intptr_t>(y + 1) * image->stride));
+
+                    for (int column = 0; column < blockColumns; column++)
+                    {
+                        AddBlockChromaDetail(top + (column * 2), bottom + (column * 2), counts);
+                    }
+                }
+            }
+        });
+
+        ChromaDetailCounts total{};
+
+        for (const ChromaDetailCounts& band : bands)
+        {
+            total.blocks += band.blocks;
+            total.horizontalDetailBlocks += band.horizontalDetailBlocks;
+            total.verticalDetailBlocks += band.verticalDetailBlocks;
+        }
+
+        if (total.blocks == 0)
+        {
+            return YUVChromaSubsampling::Subsampling420;
+        }
+
+        // 4:2:2 halves the horizontal chroma resolution and 4:2:0 halves both directions.
+        if ((total.horizontalDetailBlocks * ChromaDetailBlockRatio) > total.blocks)
+        {
+            return YUVChromaSubsampling::Subsampling444;
+        }
+        else if ((total.verticalDetailBlocks * ChromaDetailBlockRatio) > total.blocks)
+        {
+            return YUVChromaSubsampling::Subsampling422;
+        }
+
+        return YUVChromaSubsampling::Subsampling420;
+    }
+}
+
+namespace
+{
     Status CreateHeifImage(int width, int height, heif_colorspace colorspace, heif_chroma chroma, ScopedHeifImage& image)
     {
         heif_image* heifImage = nullptr;
@@ -398,35 +627,37 @@ namespace
 
         return status;
     }
+}
 
-    bool HasTransparency(const BitmapData* image)
-    {
-        for (int32_t y = 0; y < image->height; y++)
-        {
-            ColorBgra* ptr = reinterpret_cast<ColorBgra*>(image->scan0 + (static_cast<intptr_t>(y) * image->stride));
-
-            for (int32_t x = 0; x < image->width; x++)
-            {
-                if (ptr->a < 255)
-                {
-                    return true;
-                }
 
-                ptr++;
-            }
-        }
-
-        return false;
-    }
+Status ConvertToHeifImage(
+    const BitmapData* bgraImage,
+    const CICPColorData& colorInfo,
+    YUVChromaSubsampling yuvFormat,
+    ScopedHeifImage& convertedImage)
+{
+    return ConvertToHeifImage(
+        bgraImage,
+        colorInfo,
+        yuvFormat,
+        ChromaSubsampling::HasTransparency(bgraImage),
+        convertedImage);
 }
 
-
 Status ConvertToHeifImage(
     const BitmapData* bgraImage,
     const CICPColorData& colorInfo,
     YUVChromaSubsampling yuvFormat,
+    bool hasTransparency,
     ScopedHeifImage& convertedImage)
 {
+    Trace::ScopedEvent traceEvent("ConvertToHeifImage");
+
+    if (yuvFormat == YUVChromaSubsampling::Automatic)
+    {
+        yuvFormat = ChromaSubsampling::SelectChromaSubsampling(bgraImage);
+    }
+
     heif_colorspace colorspace;
     heif_chroma chroma;
 
@@ -459,8 +690,6 @@ Status ConvertToHeifImage(
 
     if (status == Status::Ok)
     {
-        const bool hasTransparency = HasTransparency(bgraImage);
-
         status = CreateImagePlanes(heifImage.get(), bgraImage->width, bgraImage->height, colorspace, chroma, hasTransparency);
 
         if (status == Status::Ok)
@@ -470,7 +699,7 @@ Status ConvertToHeifImage(
                 int yPlaneStride;
                 uint8_t* yPlane = heif_image_get_plane(heifImage.get(), heif_channel_Y, &yPlaneStride);
 
-                MonoToY8(
+                ChromaSubsampling::MonoToY8(
                     bgraImage,
                     yPlane,
                     static_cast<intptr_t>(yPlaneStride));
@@ -489,7 +718,7 @@ Status ConvertToHeifImage(
                     // The IdentityMatrix format places the RGB values into the YUV planes
                     // without any conversion.
                     // This reduces the compression efficiency, but allows for fully lossless encoding.
-                    ColorToIdentity8(
+                    ChromaSubsampling::ColorToIdentity8(
                         bgraImage,
                         yPlane,
                         static_cast<intptr_t>(yPlaneStride),
@@ -500,7 +729,7 @@ Status ConvertToHeifImage(
                 }
                 else
                 {
-                    ColorToYUV8(
+                    ChromaSubsampling::ColorToYUV8(
                         bgraImage,
                         colorInfo,
                         yuvFormat,
@@ -518,7 +747,7 @@ Status ConvertToHeifImage(
                 int alphaPlaneStride;
                 uint8_t* alphaPlane = heif_image_get_plane(heifImage.get(), heif_channel_Alpha, &alphaPlaneStride);
 
-                AlphaToA8(
+                ChromaSubsampling::AlphaToA8(
                     bgraImage,
                     alphaPlane,
                     static_cast<intptr_t>(alphaPlaneStride));
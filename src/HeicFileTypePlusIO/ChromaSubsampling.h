@@ -21,10 +21,56 @@
 #include "HeicFileTypePlusIO.h"
 #include "scoped.h"
 
+// The individual conversion kernels are exposed for the benchmarks.
+namespace ChromaSubsampling
+{
+    void ColorToIdentity8(
+        const BitmapData* bgraImage,
+        uint8_t* yPlane,
+        size_t yPlaneStride,
+        uint8_t* uPlane,
+        size_t uPlaneStride,
+        uint8_t* vPlane,
+        size_t vPlaneStride);
 
+    void ColorToYUV8(
+        const BitmapData* bgraImage,
+        const CICPColorData& colorInfo,
+        YUVChromaSubsampling yuvFormat,
+        uint8_t* yPlane,
+        intptr_t yPlaneStride,
+        uint8_t* uPlane,
+        intptr_t uPlaneStride,
+        uint8_t* vPlane,
+        intptr_t vPlaneStride);
 
+    void MonoToY8(
+        const BitmapData* bgraImage,
+        uint8_t* yPlane,
+        intptr_t yPlaneStride);
+
+    void AlphaToA8(
+        const BitmapData* bgraImage,
+        uint8_t* yPlane,
+        intptr_t yPlaneStride);
+
+    bool HasTransparency(const BitmapData* image);
+
+    // Measures the high frequency chroma energy of the image and selects the chroma
+    // subsampling that preserves the detail, 4:2:0 is used when there is little detail.
+    YUVChromaSubsampling SelectChromaSubsampling(const BitmapData* image);
+}
+
+Status ConvertToHeifImage(
+    const BitmapData* bgraImage,
+    const CICPColorData& colorInfo,
+    YUVChromaSubsampling yuvFormat,
+    ScopedHeifImage& convertedImage);
+
+// The grid encoder uses this overload so that every tile has the same channels.
 Status ConvertToHeifImage(
     const BitmapData* bgraImage,
     const CICPColorData& colorInfo,
     YUVChromaSubsampling yuvFormat,
+    bool hasTransparency,
     ScopedHeifImage& convertedImage);
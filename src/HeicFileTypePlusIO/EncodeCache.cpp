@@ -0,0 +1,325 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "EncodeCache.h"
+#include "EncoderSession.h"
+#include "Hash.h"
+#include <list>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <utility>
+
+namespace
+{
+    constexpr size_t SecretSize = 192;
+
+    struct FingerprintSecret
+    {
+        uint8_t bytes[SecretSize];
+
+        FingerprintSecret()
+        {
+            std::random_device device;
+            uint32_t seed[16];
+
+            for (uint32_t& value : seed)
+            {
+                value = device();
+            }
+
+            XXH3_generateSecret(bytes, sizeof(bytes), seed, sizeof(seed));
+        }
+    };
+
+    const FingerprintSecret& GetFingerprintSecret()
+    {
+        static const FingerprintSecret secret;
+
+        return secret;
+    }
+
+    bool OptionsEqual(const EncoderOptions& a, const EncoderOptions& b)
+    {
+        return a.quality == b.quality
+            && a.yuvFormat == b.yuvFormat
+            && a.preset == b.preset
+            && a.tuning == b.tuning
+            && a.tuIntraDepth == b.tuIntraDepth
+            && a.memoryBudget == b.memoryBudget
+            && a.timeBudgetMilliseconds == b.timeBudgetMilliseconds;
+    }
+
+    bool ColorDataEquals(const CICPColorData& a, const CICPColorData& b)
+    {
+        return a.colorPrimaries == b.colorPrimaries
+            && a.transferCharacteristics == b.transferCharacteristics
+            && a.matrixCoefficients == b.matrixCoefficients
+            && a.fullRange == b.fullRange;
+    }
+
+    struct KeyEqual
+    {
+        bool operator()(const EncodeCache::Key& a, const EncodeCache::Key& b) const
+        {
+            return EncoderSessionCache::FingerprintEquals(a.imageFingerprint, b.imageFingerprint)
+                && EncoderSessionCache::FingerprintEquals(a.keyedFingerprint, b.keyedFingerprint)
+                && a.width == b.width
+                && a.height == b.height
+                && OptionsEqual(a.options, b.options)
+                && a.parameters == b.parameters
+                && ColorDataEquals(a.colorData, b.colorData)
+                && a.metadata == b.metadata;
+        }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const EncodeCache::Key& key) const
+        {
+            uint64_t hash = Hash::Mix(key.imageFingerprint.low64, key.imageFingerprint.high64);
+            hash = Hash::Mix(hash, static_cast<uint64_t>(key.options.quality));
+            hash = Hash::Mix(hash, static_cast<uint64_t>(key.options.yuvFormat));
+            hash = Hash::Mix(hash, static_cast<uint64_t>(key.options.preset));
+            hash = Hash::Mix(hash, static_cast<uint64_t>(key.options.tuning));
+            hash = Hash::HashBytes(key.parameters.data(), key.parameters.size(), hash);
+
+            return static_cast<size_t>(hash);
+        }
+    };
+
+    struct Entry
+    {
+        EncodeCache::Key key;
+        std::shared_ptr<const std::vector<uint8_t>> encodedData;
+        SaveInfo saveInfo;
+    };
+
+    using EntryList = std::list<Entry>;
+
+    struct CacheState
+    {
+        std::mutex mutex;
+        // The most recently used entry is at the front of the list.
+        EntryList entries;
+        std::unordered_map<EncodeCache::Key, EntryList::iterator, KeyHash, KeyEqual> index;
+        uint64_t maxBytes;
+        uint64_t bytes;
+        uint64_t hits;
+        uint64_t misses;
+    };
+
+    CacheState& GetCacheState()
+    {
+        static CacheState state{};
+
+        return state;
+    }
+
+    void AppendBlock(std::string& output, const uint8_t* data, int size)
+    {
+        const uint64_t length = data && size > 0 ? static_cast<uint64_t>(size) : 0;
+
+        // The block length is included so that the block boundaries are part of the comparison.
+        output.append(reinterpret_cast<const char*>(&length), sizeof(length));
+
+        if (length != 0)
+        {
+            output.append(reinterpret_cast<const char*>(data), static_cast<size_t>(length));
+        }
+    }
+
+    std::string SerializeMetadata(const EncoderMetadata* metadata)
+    {
+        std::string output;
+
+        AppendBlock(output, metadata->iccProfile, metadata->iccProfileSize);
+        AppendBlock(output, metadata->exif, metadata->exifSize);
+        AppendBlock(output, metadata->xmp, metadata->xmpSize);
+
+        return output;
+    }
+
+    uint64_t GetEntryBytes(const EncodeCache::Key& key, const std::vector<uint8_t>& encodedData)
+    {
+        return static_cast<uint64_t>(encodedData.size()) + static_cast<uint64_t>(key.metadata.size());
+    }
+
+    std::string SerializeParameters(const EncoderOptions* options)
+    {
+        std::string parameters;
+
+        if (options->parameters)
+        {
+            for (int32_t i = 0; i < options->parameterCount; i++)
+            {
+                const EncoderParameter& parameter = options->parameters[i];
+
+                parameters.append(parameter.name ? parameter.name : "");
+                parameters.push_back('\0');
+                parameters.append(parameter.value ? parameter.value : "");
+                parameters.push_back('\0');
+            }
+        }
+
+        return parameters;
+    }
+
+    void RemoveLeastRecentlyUsed(CacheState& state)
+    {
+        while (state.bytes > state.maxBytes && !state.entries.empty())
+        {
+            const Entry& entry = state.entries.back();
+
+            state.bytes -= GetEntryBytes(entry.key, *entry.encodedData);
+            state.index.erase(entry.key);
+            state.entries.pop_back();
+        }
+    }
+}
+
+EncodeCache::Lookup EncodeCache::Find(
+    const BitmapData* input,
+    const ImageAnalysis* analysis,
+    const EncoderOptions* options,
+    const EncoderMetadata* metadata,
+    const CICPColorData& colorData)
+{
+    Lookup lookup{};
+
+    CacheState& state = GetCacheState();
+
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+
+        lookup.enabled = state.maxBytes != 0;
+    }
+
+    if (!lookup.enabled)
+    {
+        return lookup;
+    }
+
+    ImageAnalysis imageAnalysis;
+
+    if (!analysis)
+    {
+        EncoderSessionCache::AnalyzeImage(input, &imageAnalysis);
+        analysis = &imageAnalysis;
+    }
+
+    const FingerprintSecret& secret = GetFingerprintSecret();
+
+    lookup.key.imageFingerprint = analysis->fingerprint;
+    lookup.key.keyedFingerprint = EncoderSessionCache::ComputeKeyedFingerprint(input, secret.bytes, sizeof(secret.bytes));
+    lookup.key.width = input->width;
+    lookup.key.height = input->height;
+    lookup.key.options = *options;
+    lookup.key.options.parameters = nullptr;
+    lookup.key.options.parameterCount = 0;
+    lookup.key.parameters = SerializeParameters(options);
+    lookup.key.colorData = colorData;
+    lookup.key.metadata = SerializeMetadata(metadata);
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    const auto item = state.index.find(lookup.key);
+
+    if (item != state.index.end())
+    {
+        state.entries.splice(state.entries.begin(), state.entries, item->second);
+        lookup.encodedData = item->second->encodedData;
+        lookup.saveInfo = item->second->saveInfo;
+        state.hits++;
+    }
+    else
+    {
+        state.misses++;
+    }
+
+    return lookup;
+}
+
+void EncodeCache::Add(const Lookup& lookup, std::vector<uint8_t>&& encodedData, const SaveInfo& saveInfo)
+{
+    if (!lookup.enabled || encodedData.empty())
+    {
+        return;
+    }
+
+    std::shared_ptr<const std::vector<uint8_t>> data = std::make_shared<const std::vector<uint8_t>>(std::move(encodedData));
+
+    CacheState& state = GetCacheState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    const uint64_t entryBytes = GetEntryBytes(lookup.key, *data);
+
+    // The limit may have changed since the lookup, files larger than the limit are not cached.
+    if (entryBytes > state.maxBytes || state.index.find(lookup.key) != state.index.end())
+    {
+        return;
+    }
+
+    state.entries.push_front(Entry{ lookup.key, data, saveInfo });
+
+    try
+    {
+        state.index.emplace(lookup.key, state.entries.begin());
+    }
+    catch (...)
+    {
+        state.entries.pop_front();
+        throw;
+    }
+
+    state.bytes += entryBytes;
+
+    RemoveLeastRecentlyUsed(state);
+}
+
+void EncodeCache::SetLimit(uint64_t maxBytes)
+{
+    CacheState& state = GetCacheState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    state.maxBytes = maxBytes;
+
+    RemoveLeastRecentlyUsed(state);
+}
+
+void EncodeCache::GetStatistics(EncodeCacheStatistics* statistics)
+{
+    CacheState& state = GetCacheState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    statistics->hits = state.hits;
+    statistics->misses = state.misses;
+    statistics->entryCount = static_cast<uint64_t>(state.entries.size());
+    statistics->bytes = state.bytes;
+    statistics->maxBytes = state.maxBytes;
+}
+
+void EncodeCache::Clear()
+{
+    CacheState& state = GetCacheState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    state.index.clear();
+    state.entries.clear();
+    state.bytes = 0;
+}
@@ -0,0 +1,75 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "HeicFileTypePlusIO.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// An in-memory LRU cache of encoded files, keyed by the image fingerprint and everything
+// else that affects the encoder output. Repeated saves of identical images skip the encoder
+// and write the cached file. The cache is disabled until SetEncodeCacheLimit is called.
+//
+// A hit must also match a second fingerprint that uses a secret generated for each process,
+// so images that collide with the unkeyed fingerprint cannot return another image's file.
+namespace EncodeCache
+{
+    struct Key
+    {
+        ImageFingerprint imageFingerprint;
+        ImageFingerprint keyedFingerprint;
+        int32_t width;
+        int32_t height;
+        // The parameters in the options are cleared, the caller owns their strings.
+        EncoderOptions options;
+        // The NUL separated names and values of the encoder parameters.
+        std::string parameters;
+        CICPColorData colorData;
+        // The ICC profile, EXIF and XMP blocks, these are compared byte for byte.
+        std::string metadata;
+    };
+
+    struct Lookup
+    {
+        bool enabled;
+        Key key;
+        // The cached file, this is null if the cache does not contain the encode.
+        std::shared_ptr<const std::vector<uint8_t>> encodedData;
+        // The settings that were used to encode the cached file.
+        SaveInfo saveInfo;
+    };
+
+    // The image is analyzed if the analysis is null.
+    Lookup Find(
+        const BitmapData* input,
+        const ImageAnalysis* analysis,
+        const EncoderOptions* options,
+        const EncoderMetadata* metadata,
+        const CICPColorData& colorData);
+
+    void Add(const Lookup& lookup, std::vector<uint8_t>&& encodedData, const SaveInfo& saveInfo);
+
+    // Sets the maximum size of the cached files, 0 disables the cache and removes all entries.
+    void SetLimit(uint64_t maxBytes);
+
+    void GetStatistics(EncodeCacheStatistics* statistics);
+
+    void Clear();
+}
@@ -0,0 +1,195 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "EncoderSession.h"
+#include "ChromaSubsampling.h"
+#include "Hash.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+    // The number of rows that each thread analyzes at a time.
+    constexpr int AnalysisBandHeight = 64;
+
+    struct BandAnalysis
+    {
+        XXH128_hash_t hash;
+        bool grayscale;
+        bool hasTransparency;
+    };
+
+    // The secret is null for the default XXH3 secret.
+    BandAnalysis AnalyzeBand(const BitmapData* input, int begin, int end, const uint8_t* secret, size_t secretSize)
+    {
+        BandAnalysis band{ {}, true, false };
+
+        XXH3_state_t state;
+        XXH3_INITSTATE(&state);
+
+        if (secret)
+        {
+            XXH3_128bits_reset_withSecret(&state, secret, secretSize);
+        }
+        else
+        {
+            XXH3_128bits_reset(&state);
+        }
+
+        const size_t rowBytes = static_cast<size_t>(input->width) * sizeof(ColorBgra);
+
+        for (int y = begin; y < end; y++)
+        {
+            const uint8_t* row = input->scan0 + (static_cast<intptr_t>(y) * input->stride);
+
+            XXH3_128bits_update(&state, row, rowBytes);
+
+            const ColorBgra* pixels = reinterpret_cast<const ColorBgra*>(row);
+
+            for (int x = 0; x < input->width; x++)
+            {
+                const ColorBgra& pixel = pixels[x];
+
+                band.grayscale &= (pixel.b == pixel.g) & (pixel.g == pixel.r);
+                band.hasTransparency |= pixel.a < 255;
+            }
+        }
+
+        band.hash = XXH3_128bits_digest(&state);
+
+        return band;
+    }
+
+    void AnalyzeBands(
+        const BitmapData* input,
+        const uint8_t* secret,
+        size_t secretSize,
+        ImageAnalysis* analysis)
+    {
+        const int bandCount = (input->height + AnalysisBandHeight - 1) / AnalysisBandHeight;
+
+        std::vector<BandAnalysis> bands(static_cast<size_t>(bandCount));
+
+        ParallelFor::Run(0, bandCount, 1, 0, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                const int top = i * AnalysisBandHeight;
+                const int bottom = std::min(top + AnalysisBandHeight, input->height);
+
+                bands[static_cast<size_t>(i)] = AnalyzeBand(input, top, bottom, secret, secretSize);
+            }
+        });
+
+        // The band hashes are combined in order so that the fingerprint does not depend on the thread count.
+        std::vector<uint64_t> hashes;
+        hashes.reserve((bands.size() * 2) + 2);
+        hashes.push_back(static_cast<uint64_t>(input->width));
+        hashes.push_back(static_cast<uint64_t>(input->height));
+
+        bool grayscale = true;
+        bool hasTransparency = false;
+
+        for (const BandAnalysis& band : bands)
+        {
+            hashes.push_back(band.hash.low64);
+            hashes.push_back(band.hash.high64);
+            grayscale &= band.grayscale;
+            hasTransparency |= band.hasTransparency;
+        }
+
+        const size_t hashBytes = hashes.size() * sizeof(uint64_t);
+        const XXH128_hash_t fingerprint = secret
+            ? XXH3_128bits_withSecret(hashes.data(), hashBytes, secret, secretSize)
+            : XXH3_128bits(hashes.data(), hashBytes);
+
+        analysis->fingerprint = ImageFingerprint{ fingerprint.low64, fingerprint.high64 };
+        analysis->grayscale = grayscale;
+        analysis->hasTransparency = hasTransparency;
+    }
+
+    bool ColorDataEquals(const CICPColorData& a, const CICPColorData& b)
+    {
+        return a.colorPrimaries == b.colorPrimaries
+            && a.transferCharacteristics == b.transferCharacteristics
+            && a.matrixCoefficients == b.matrixCoefficients
+            && a.fullRange == b.fullRange;
+    }
+}
+
+void EncoderSessionCache::AnalyzeImage(const BitmapData* input, ImageAnalysis* analysis)
+{
+    AnalyzeBands(input, nullptr, 0, analysis);
+}
+
+ImageFingerprint EncoderSessionCache::ComputeKeyedFingerprint(const BitmapData* input, const uint8_t* secret, size_t secretSize)
+{
+    ImageAnalysis analysis;
+
+    AnalyzeBands(input, secret, secretSize, &analysis);
+
+    return analysis.fingerprint;
+}
+
+bool EncoderSessionCache::FingerprintEquals(const ImageFingerprint& a, const ImageFingerprint& b)
+{
+    return a.low64 == b.low64 && a.high64 == b.high64;
+}
+
+Status EncoderSessionCache::GetConvertedImage(
+    EncoderSession* session,
+    const BitmapData* input,
+    const ImageAnalysis* analysis,
+    YUVChromaSubsampling yuvFormat,
+    const CICPColorData& colorData,
+    heif_image** image)
+{
+    if (session->hasImage
+        && FingerprintEquals(session->imageRevision, analysis->fingerprint)
+        && session->yuvFormat == yuvFormat
+        && ColorDataEquals(session->colorData, colorData))
+    {
+        *image = session->image.get();
+        return Status::Ok;
+    }
+
+    // Release the previous image before converting, the session only keeps one image.
+    session->hasImage = false;
+    session->image.reset();
+    session->imageCharge.reset();
+
+    ScopedHeifImage convertedImage;
+
+    Status status = ConvertToHeifImage(input, colorData, yuvFormat, analysis->hasTransparency, convertedImage);
+
+    if (status != Status::Ok)
+    {
+        return status;
+    }
+
+    session->imageCharge = std::make_unique<MemoryAccounting::ScopedCharge>(MemoryAccounting::GetImageSize(convertedImage.get()));
+    session->image = std::move(convertedImage);
+    session->imageRevision = analysis->fingerprint;
+    session->yuvFormat = yuvFormat;
+    session->colorData = colorData;
+    session->hasImage = true;
+
+    *image = session->image.get();
+    return Status::Ok;
+}
@@ -0,0 +1,62 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "HeicFileTypePlusIO.h"
+#include "MemoryAccounting.h"
+#include "scoped.h"
+#include <memory>
+#include <mutex>
+
+// Caches the converted image between the saves of a document, this allows the
+// save dialog preview to skip the image conversion when only the encoder
+// settings have changed.
+struct EncoderSession
+{
+    std::mutex mutex;
+    bool hasImage = false;
+    ImageFingerprint imageRevision = {};
+    YUVChromaSubsampling yuvFormat = YUVChromaSubsampling::Subsampling400;
+    CICPColorData colorData = {};
+    ScopedHeifImage image;
+    std::unique_ptr<MemoryAccounting::ScopedCharge> imageCharge;
+};
+
+namespace EncoderSessionCache
+{
+    // Computes the image fingerprint and the color information in a single pass over the image.
+    void AnalyzeImage(const BitmapData* input, ImageAnalysis* analysis);
+
+    // Computes a fingerprint of the image using the specified XXH3 secret, an image that
+    // collides with another image for this fingerprint cannot be constructed without the secret.
+    ImageFingerprint ComputeKeyedFingerprint(const BitmapData* input, const uint8_t* secret, size_t secretSize);
+
+    bool FingerprintEquals(const ImageFingerprint& a, const ImageFingerprint& b);
+
+    // Gets the converted image for the analyzed revision, the image is only converted when the
+    // revision, YUV format or color data differs from the cached image.
+    // The caller must hold the session mutex while it uses the image.
+    Status GetConvertedImage(
+        EncoderSession* session,
+        const BitmapData* input,
+        const ImageAnalysis* analysis,
+        YUVChromaSubsampling yuvFormat,
+        const CICPColorData& colorData,
+        heif_image** image);
+}
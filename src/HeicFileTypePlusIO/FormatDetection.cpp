@@ -0,0 +1,148 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "FormatDetection.h"
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+    bool IsImageSequenceBrand(heif_brand2 brand)
+    {
+        switch (brand)
+        {
+        case heif_brand2_hevc:
+        case heif_brand2_hevx:
+        case heif_brand2_hevs:
+        case heif_brand2_hevm:
+        case heif_brand2_msf1:
+        case heif_brand2_avis:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    SniffedFileType GetFileTypeFromBrand(heif_brand2 brand)
+    {
+        switch (brand)
+        {
+        case heif_brand2_heic:
+        case heif_brand2_heix:
+        case heif_brand2_heim:
+        case heif_brand2_heis:
+            return SniffedFileType::Heic;
+        case heif_brand2_avif:
+            return SniffedFileType::Avif;
+        default:
+            return IsImageSequenceBrand(brand) ? SniffedFileType::ImageSequence : SniffedFileType::Heif;
+        }
+    }
+
+    SniffedFileType GetFileTypeFromCompatibleBrands(const uint8_t* const data, int length)
+    {
+        SniffedFileType fileType = SniffedFileType::Unknown;
+
+        heif_brand2* brands = nullptr;
+        int brandCount = 0;
+
+        heif_error error = heif_list_compatible_brands(data, length, &brands, &brandCount);
+
+        if (error.code == heif_error_Ok)
+        {
+            for (int i = 0; i < brandCount; i++)
+            {
+                const SniffedFileType brandFileType = GetFileTypeFromBrand(brands[i]);
+
+                // The image brands take priority over the generic and image sequence brands.
+                if (brandFileType == SniffedFileType::Heic || brandFileType == SniffedFileType::Avif)
+                {
+                    fileType = brandFileType;
+                    break;
+                }
+                else if (brandFileType == SniffedFileType::ImageSequence)
+                {
+                    fileType = brandFileType;
+                }
+            }
+
+            heif_free_list_of_compatible_brands(brands);
+        }
+
+        return fileType;
+    }
+}
+
+Status FormatDetection::SniffFile(const uint8_t* const data, size_t length, SniffResult* const result)
+{
+    if (!result)
+    {
+        return Status::NullParameter;
+    }
+
+    *result = {};
+
+    // An empty stream is not a HEIF file, the managed code passes a null pointer for an empty span.
+    if (length == 0)
+    {
+        return Status::Ok;
+    }
+
+    if (!data)
+    {
+        return Status::NullParameter;
+    }
+
+    const int dataLength = static_cast<int>(std::min(length, static_cast<size_t>(std::numeric_limits<int>::max())));
+
+    const heif_filetype_result fileTypeResult = heif_check_filetype(data, dataLength);
+
+    if (fileTypeResult == heif_filetype_no)
+    {
+        result->fileType = dataLength >= 4 && heif_check_jpeg_filetype(data, dataLength) ? SniffedFileType::Jpeg : SniffedFileType::NotHeif;
+        return Status::Ok;
+    }
+
+    // The main brand is stored after the 'ftyp' box header, libheif needs at least 12 bytes to read it.
+    if (dataLength < 12)
+    {
+        result->fileType = SniffedFileType::Unknown;
+        return Status::Ok;
+    }
+
+    // heif_check_filetype also reports heif_filetype_maybe for the generic 'mif1' and 'mif2' brands,
+    // so the brands are read whenever the 'ftyp' box is present.
+    const heif_brand2 mainBrand = heif_read_main_brand(data, dataLength);
+
+    result->mainBrand = mainBrand;
+    result->fileType = GetFileTypeFromBrand(mainBrand);
+
+    if (result->fileType == SniffedFileType::Heif)
+    {
+        // Generic brands such as 'mif1' do not indicate the compression format,
+        // so the compatible brands are checked for an image brand.
+        result->fileType = GetFileTypeFromCompatibleBrands(data, dataLength);
+    }
+
+    result->supported = fileTypeResult == heif_filetype_yes_supported
+        || result->fileType == SniffedFileType::Heic
+        || result->fileType == SniffedFileType::Avif;
+
+    return Status::Ok;
+}
@@ -0,0 +1,64 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#define XXH_INLINE_ALL
+#include "xxhash.h"
+
+// A fast non-cryptographic 64-bit hash, used for the hash table lookups of the cache keys.
+// The image fingerprints use the 128-bit XXH3 hash from xxhash.h.
+namespace Hash
+{
+    constexpr uint64_t Prime = 0x9E3779B97F4A7C15ULL;
+
+    inline uint64_t Mix(uint64_t hash, uint64_t value)
+    {
+        hash = (hash ^ value) * Prime;
+        return hash ^ (hash >> 29);
+    }
+
+    inline uint64_t HashBytes(const void* data, size_t size, uint64_t seed)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        uint64_t hash = Mix(seed, static_cast<uint64_t>(size));
+        size_t offset = 0;
+
+        for (; offset + sizeof(uint64_t) <= size; offset += sizeof(uint64_t))
+        {
+            uint64_t value;
+            std::memcpy(&value, bytes + offset, sizeof(value));
+
+            hash = Mix(hash, value);
+        }
+
+        if (offset < size)
+        {
+            uint64_t value = 0;
+            std::memcpy(&value, bytes + offset, size - offset);
+
+            hash = Mix(hash, value);
+        }
+
+        return hash;
+    }
+}
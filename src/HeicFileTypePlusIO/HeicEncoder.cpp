@@ -18,11 +18,41 @@
 
 #include "HeicEncoder.h"
 #include "ChromaSubsampling.h"
+#include "EncoderSession.h"
 #include "HeicMetadata.h"
+#include "MemoryAccounting.h"
+#include "Metrics.h"
+#include "ParallelFor.h"
+#include "PresetSelection.h"
 #include "ProgressSteps.h"
+#include "Resampler.h"
+#include "ThreadBudget.h"
+#include "Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <vector>
 
 namespace
 {
+    using Clock = std::chrono::steady_clock;
+
+    struct PresetSelectionTiming
+    {
+        bool selected;
+        Clock::time_point encodeStart;
+        int32_t timeBudgetMilliseconds;
+    };
+
+    thread_local SaveInfo lastSaveInfo = {};
+    thread_local PresetSelectionTiming lastPresetSelection = {};
+
     Status GetEncoder(heif_context* context, ScopedHeifEncoder& scopedEncoder)
     {
         if (!context)
@@ -153,19 +183,15 @@ namespace
         return SetEncoderParameter(encoder, "chroma", chromaString);
     }
 
-    Status ConfigureEncoderSettings(heif_encoder* const encoder, const EncoderOptions* const options)
+    Status SetEncoderQuality(heif_encoder* const encoder, int quality)
     {
-        Status status = Status::Ok;
-
-        heif_error error;
-
-        // LibHeif requires the lossy quality to be always be set, if it has
-        // not been set the encoder will produce a corrupted image.
-        error = heif_encoder_set_lossy_quality(encoder, options->quality);
+        heif_error error = heif_encoder_set_lossy_quality(encoder, quality);
 
-        if (options->quality == 100 && error.code == heif_error_Ok)
+        if (error.code == heif_error_Ok)
         {
-            error = heif_encoder_set_lossless(encoder, true);
+            // The lossless mode is also cleared because the auto quality search
+            // reuses the encoder for different quality values.
+            error = heif_encoder_set_lossless(encoder, quality == 100);
         }
 
         if (error.code != heif_error_Ok)
@@ -173,13 +199,179 @@ namespace
             switch (error.code)
             {
             case heif_error_Memory_allocation_error:
-                status = Status::OutOfMemory;
-                break;
+                return Status::OutOfMemory;
             default:
-                status = Status::EncodeFailed;
+                return Status::EncodeFailed;
+            }
+        }
+
+        return Status::Ok;
+    }
+
+    Status ApplyEncoderParameters(heif_encoder* const encoder, const EncoderOptions* const options)
+    {
+        if (options->parameterCount < 0)
+        {
+            return Status::InvalidParameter;
+        }
+
+        if (options->parameterCount > 0 && !options->parameters)
+        {
+            return Status::NullParameter;
+        }
+
+        for (int32_t i = 0; i < options->parameterCount; i++)
+        {
+            const EncoderParameter& parameter = options->parameters[i];
+
+            if (!parameter.name || !parameter.value)
+            {
+                return Status::NullParameter;
+            }
+
+            heif_error error = heif_encoder_set_parameter(encoder, parameter.name, parameter.value);
+
+            if (error.code != heif_error_Ok)
+            {
+                switch (error.code)
+                {
+                case heif_error_Memory_allocation_error:
+                    return Status::OutOfMemory;
+                default:
+                    return Status::InvalidParameter;
+                }
+            }
+        }
+
+        return Status::Ok;
+    }
+
+    int GetMaxWavefrontThreads(int width, int height, EncoderPreset preset)
+    {
+        // The two fastest x265 presets use 32x32 CTUs, the others use 64x64 CTUs.
+        const int ctuSize = preset <= EncoderPreset::SuperFast ? 32 : 64;
+        const int columns = (width + ctuSize - 1) / ctuSize;
+        const int rows = (height + ctuSize - 1) / ctuSize;
+
+        // Each CTU row has to stay two CTUs behind the row above it, so a single frame
+        // cannot keep more than this many rows busy. One more thread runs the loop filters.
+        return std::min(rows, (columns + 1) / 2) + 1;
+    }
+
+    // Returns the slowest preset that is predicted to encode the images within the time budget,
+    // or the fastest preset if none of them fit. The ultra fast preset is not used because
+    // it can produce an image with an invalid size, the save dialog omits it for the same reason.
+    EncoderPreset SelectPreset(
+        const BitmapData* input,
+        const EncoderOptions* options,
+        int imageCount,
+        double& predictedMilliseconds)
+    {
+        const double megapixels = (static_cast<double>(input->width) * static_cast<double>(input->height) * imageCount) / 1000000.0;
+        const int encoderThreads = ThreadBudget::GetThreads(ThreadBudget::Operation::Encode);
+
+        EncoderOptions presetOptions = *options;
+
+        for (int i = static_cast<int>(EncoderPreset::Placebo); i >= static_cast<int>(EncoderPreset::SuperFast); i--)
+        {
+            presetOptions.preset = static_cast<EncoderPreset>(i);
+
+            const int threadCount = std::min(encoderThreads, GetMaxWavefrontThreads(input->width, input->height, presetOptions.preset));
+
+            predictedMilliseconds = PresetSelection::PredictMilliseconds(megapixels, &presetOptions, threadCount);
+
+            if (predictedMilliseconds <= options->timeBudgetMilliseconds)
+            {
+                break;
+            }
+        }
+
+        return presetOptions.preset;
+    }
+
+    // Applies the automatic selections to the options and records them for GetLastSaveInfo.
+    // The preset time budget is for all of the images, imageCount is the number of encodes.
+    EncoderOptions ResolveEncoderOptions(const BitmapData* input, const EncoderOptions* options, int imageCount)
+    {
+        EncoderOptions resolvedOptions = *options;
+
+        if (resolvedOptions.yuvFormat == YUVChromaSubsampling::Automatic)
+        {
+            resolvedOptions.yuvFormat = ChromaSubsampling::SelectChromaSubsampling(input);
+        }
+
+        double predictedMilliseconds = 0;
+
+        if (resolvedOptions.preset == EncoderPreset::Automatic)
+        {
+            resolvedOptions.preset = SelectPreset(input, &resolvedOptions, imageCount, predictedMilliseconds);
+
+            // The encode time starts after the selection, it does not include the calibration encode.
+            lastPresetSelection = { true, Clock::now(), options->timeBudgetMilliseconds };
+        }
+        else
+        {
+            lastPresetSelection = {};
+        }
+
+        lastSaveInfo.yuvFormat = resolvedOptions.yuvFormat;
+        lastSaveInfo.preset = resolvedOptions.preset;
+        lastSaveInfo.predictedEncodeMilliseconds = predictedMilliseconds;
+        lastSaveInfo.encodeMilliseconds = 0;
+
+        return resolvedOptions;
+    }
+
+    // encoderThreads is the number of threads that the encode can use, either the encoder share
+    // of the thread budget or the part of it that a concurrent encode was given.
+    Status ConfigureStillImageSettings(
+        heif_encoder* const encoder,
+        int width,
+        int height,
+        const EncoderOptions* const options,
+        const int encoderThreads)
+    {
+        // libheif applies the mainstillpicture profile, which already disables the lookahead and B-frames,
+        // and wavefront parallel processing is enabled by default. None of the settings below change the
+        // output, x265 produces the same bitstream with any number of threads.
+        // libheif only passes the x265 prefixed parameters through as strings.
+        const int wavefrontThreads = GetMaxWavefrontThreads(width, height, options->preset);
+
+        // A still image is a single frame so it cannot use more than one frame thread.
+        Status status = SetEncoderParameter(encoder, "x265:frame-threads", "1");
+
+        if (status == Status::Ok)
+        {
+            // An image with few CTU rows cannot keep the thread share busy with the wavefront alone,
+            // the parallel mode decision also distributes the mode analysis of each CU to the pool.
+            const bool parallelModeDecision = wavefrontThreads < encoderThreads;
+
+            status = SetEncoderParameter(encoder, "x265:pmode", parallelModeDecision ? "1" : "0");
+
+            if (status == Status::Ok)
+            {
+                // The x265 thread pool is sized to the thread count, without the parallel mode decision
+                // the wavefront alone can keep that many threads busy.
+                status = SetEncoderParameter(encoder, "x265:pools", std::to_string(encoderThreads).c_str());
             }
         }
 
+        return status;
+    }
+
+    Status ConfigureEncoderSettings(
+        heif_encoder* const encoder,
+        int width,
+        int height,
+        const EncoderOptions* const options,
+        const int encoderThreads)
+    {
+        Status status = Status::Ok;
+
+        // LibHeif requires the lossy quality to be always be set, if it has
+        // not been set the encoder will produce a corrupted image.
+        status = SetEncoderQuality(encoder, options->quality);
+
         if (status == Status::Ok)
         {
             status = SetChromaSubsampling(encoder, options->yuvFormat);
@@ -199,6 +391,17 @@ namespace
                     {
                         status = SetEncoderParameter(encoder, "tu-intra-depth", options->tuIntraDepth);
                     }
+
+                    if (status == Status::Ok)
+                    {
+                        status = ConfigureStillImageSettings(encoder, width, height, options, encoderThreads);
+                    }
+
+                    if (status == Status::Ok)
+                    {
+                        // The caller's parameters are applied last so that they can override any of the settings above.
+                        status = ApplyEncoderParameters(encoder, options);
+                    }
                 }
             }
         }
@@ -210,6 +413,7 @@ namespace
         heif_context* const context,
         heif_image* const image,
         const EncoderOptions* const  options,
+        const int encoderThreads,
         ScopedHeifImageHandle& encodedImage)
     {
         if (!context || !image || !options)
@@ -217,16 +421,28 @@ namespace
             return Status::NullParameter;
         }
 
+        Trace::ScopedEvent traceEvent("EncodeImage");
+
         ScopedHeifEncoder encoder;
 
         Status status = GetEncoder(context, encoder);
 
         if (status == Status::Ok)
         {
-            status = ConfigureEncoderSettings(encoder.get(), options);
+            status = ConfigureEncoderSettings(
+                encoder.get(),
+                heif_image_get_primary_width(image),
+                heif_image_get_primary_height(image),
+                options,
+                encoderThreads);
 
             if (status == Status::Ok)
             {
+                MemoryAccounting::ScopedCharge encoderCharge(MemoryAccounting::EstimateEncoderWorkingSet(
+                    heif_image_get_primary_width(image),
+                    heif_image_get_primary_height(image),
+                    options));
+
                 heif_image_handle* outputImage;
 
                 heif_error error = heif_context_encode_image(context, image, encoder.get(), nullptr, &outputImage);
@@ -264,6 +480,8 @@ namespace
             return Status::NullParameter;
         }
 
+        Trace::ScopedEvent traceEvent("AddColorProfile");
+
         Status status = Status::Ok;
 
         if (iccProfile && iccProfileSize)
@@ -291,6 +509,8 @@ namespace
             return Status::NullParameter;
         }
 
+        Trace::ScopedEvent traceEvent("AddExifAndXmpMetadata");
+
         Status status = AddExifToImage(context, image, metadata->exif, metadata->exifSize);
 
         if (status == Status::Ok)
@@ -300,76 +520,1637 @@ namespace
 
         return status;
     }
-}
 
-Status HeicEncoder::Encode(
-    heif_context* const context,
-    const BitmapData* input,
-    const EncoderOptions* options,
-    const EncoderMetadata* metadata,
-    const CICPColorData& colorData,
-    const ProgressProc progressCallback)
-{
-    if (!context || !input || !options || !metadata)
+    // The upper limit for AutoQualityOptions::maxEncodes.
+    constexpr int MaxAutoQualityEncodes = 16;
+
+    struct AutoQualityProbe
     {
-        return Status::NullParameter;
+        ScopedHeifContext context;
+        ScopedHeifImageHandle imageHandle;
+        size_t fileSize = 0;
+        int quality = 0;
+        double similarity = 0.0;
+    };
+
+    heif_error WriteToMemory(heif_context* /*ctx*/, const void* data, size_t size, void* userdata)
+    {
+        static heif_error Success = { heif_error_Ok, heif_suberror_Unspecified, "Success" };
+
+        std::vector<uint8_t>* buffer = static_cast<std::vector<uint8_t>*>(userdata);
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+        Trace::CountWrite(size);
+        MemoryAccounting::ChargeTransient(size);
+
+        buffer->assign(bytes, bytes + size);
+
+        return Success;
     }
 
-    if (progressCallback)
+    Status GetEncodeStatus(const heif_error& error)
     {
-        if (!progressCallback(BeforeImageConversion))
+        switch (error.code)
         {
-            return Status::UserCanceled;
+        case heif_error_Ok:
+            return Status::Ok;
+        case heif_error_Memory_allocation_error:
+            return Status::OutOfMemory;
+        default:
+            return Status::EncodeFailed;
         }
     }
 
-    try
+    // Returns the number of encodes that a binary search of the quality range requires.
+    int GetDefaultMaxEncodes(int minQuality, int maxQuality)
     {
-        ScopedHeifImage yuvImage;
+        const int count = (maxQuality - minQuality) + 1;
+        int maxEncodes = 1;
 
-        Status status = ConvertToHeifImage(input, colorData, options->yuvFormat, yuvImage);
+        while ((1 << maxEncodes) < count + 1)
+        {
+            maxEncodes++;
+        }
 
-        if (status == Status::Ok)
+        return maxEncodes;
+    }
+
+    int GetMaxEncodes(const AutoQualityOptions* autoQualityOptions)
+    {
+        return autoQualityOptions->maxEncodes > 0
+            ? std::min(autoQualityOptions->maxEncodes, MaxAutoQualityEncodes)
+            : GetDefaultMaxEncodes(autoQualityOptions->minQuality, autoQualityOptions->maxQuality);
+    }
+
+    // Decodes the probe and measures the similarity of its luma plane to the source image.
+    Status MeasureProbe(
+        heif_image* const sourceImage,
+        const std::vector<uint8_t>& encodedData,
+        AutoQualityMetric metric,
+        double& similarity)
+    {
+        Trace::ScopedEvent traceEvent("MeasureAutoQualityProbe");
+
+        ScopedHeifContext decodeContext(heif_context_alloc());
+
+        if (!decodeContext)
         {
-            if (progressCallback)
-            {
-                if (!progressCallback(BeforeCompression))
-                {
-                    return Status::UserCanceled;
-                }
-            }
+            return Status::OutOfMemory;
+        }
 
-            status = AddColorProfile(yuvImage.get(), colorData, metadata->iccProfile, metadata->iccProfileSize);
+        heif_error error = heif_context_read_from_memory_without_copy(
+            decodeContext.get(),
+            encodedData.data(),
+            encodedData.size(),
+            nullptr);
 
-            if (status == Status::Ok)
-            {
-                ScopedHeifImageHandle encodedImage;
+        if (error.code != heif_error_Ok)
+        {
+            return error.code == heif_error_Memory_allocation_error ? Status::OutOfMemory : Status::EncodeFailed;
+        }
 
-                status = EncodeImage(context, yuvImage.get(), options, encodedImage);
+        heif_image_handle* primaryImageHandle;
 
-                if (status == Status::Ok)
-                {
-                    status = AddExifAndXmpMetadata(context, encodedImage.get(), metadata);
+        error = heif_context_get_primary_image_handle(decodeContext.get(), &primaryImageHandle);
 
-                    if (progressCallback && status == Status::Ok)
-                    {
-                        if (!progressCallback(AfterCompression))
-                        {
-                            status = Status::UserCanceled;
-                        }
-                    }
-                }
-            }
+        if (error.code != heif_error_Ok)
+        {
+            return error.code == heif_error_Memory_allocation_error ? Status::OutOfMemory : Status::EncodeFailed;
         }
 
-        return status;
+        ScopedHeifImageHandle imageHandle(primaryImageHandle);
+
+        heif_image* decodedImage;
+
+        {
+            MemoryAccounting::ScopedCharge decoderCharge(MemoryAccounting::EstimateDecoderWorkingSet(
+                heif_image_get_primary_width(sourceImage),
+                heif_image_get_primary_height(sourceImage),
+                heif_image_get_chroma_format(sourceImage)));
+
+            // Decoding to the format of the source image avoids a color conversion.
+            error = heif_decode_image(
+                imageHandle.get(),
+                &decodedImage,
+                heif_image_get_colorspace(sourceImage),
+                heif_image_get_chroma_format(sourceImage),
+                nullptr);
+        }
+
+        if (error.code != heif_error_Ok)
+        {
+            return error.code == heif_error_Memory_allocation_error ? Status::OutOfMemory : Status::DecodeFailed;
+        }
+
+        ScopedHeifImage image(decodedImage);
+        MemoryAccounting::ScopedCharge imageCharge(MemoryAccounting::GetImageSize(image.get()));
+
+        int sourceStride;
+        int decodedStride;
+        const uint8_t* sourceLuma = heif_image_get_plane_readonly(sourceImage, heif_channel_Y, &sourceStride);
+        const uint8_t* decodedLuma = heif_image_get_plane_readonly(image.get(), heif_channel_Y, &decodedStride);
+
+        const int width = heif_image_get_width(sourceImage, heif_channel_Y);
+        const int height = heif_image_get_height(sourceImage, heif_channel_Y);
+
+        if (!sourceLuma
+            || !decodedLuma
+            || heif_image_get_width(image.get(), heif_channel_Y) != width
+            || heif_image_get_height(image.get(), heif_channel_Y) != height)
+        {
+            return Status::EncodeFailed;
+        }
+
+        // The metrics use a float copy of both planes.
+        MemoryAccounting::ScopedCharge metricsCharge(static_cast<uint64_t>(width) * static_cast<uint64_t>(height) * 2 * sizeof(float));
+
+        similarity = Metrics::ComputePlaneSimilarity(
+            sourceLuma,
+            sourceStride,
+            decodedLuma,
+            decodedStride,
+            width,
+            height,
+            metric == AutoQualityMetric::MsSsim,
+            0);
+
+        return Status::Ok;
     }
-    catch (const std::bad_alloc&)
+
+    Status EncodeProbe(
+        heif_encoder* const encoder,
+        heif_image* const image,
+        int quality,
+        const EncoderOptions* const options,
+        const AutoQualityOptions* const autoQualityOptions,
+        std::vector<uint8_t>& encodedData,
+        AutoQualityProbe& probe)
     {
-        return Status::OutOfMemory;
+        Status status = SetEncoderQuality(encoder, quality);
+
+        if (status != Status::Ok)
+        {
+            return status;
+        }
+
+        probe.context.reset(heif_context_alloc());
+
+        if (!probe.context)
+        {
+            return Status::OutOfMemory;
+        }
+
+        heif_image_handle* outputImage;
+
+        {
+            Trace::ScopedEvent traceEvent("EncodeImage");
+            MemoryAccounting::ScopedCharge encoderCharge(MemoryAccounting::EstimateEncoderWorkingSet(
+                heif_image_get_primary_width(image),
+                heif_image_get_primary_height(image),
+                options));
+
+            status = GetEncodeStatus(heif_context_encode_image(probe.context.get(), image, encoder, nullptr, &outputImage));
+        }
+
+        if (status != Status::Ok)
+        {
+            return status;
+        }
+
+        probe.imageHandle.reset(outputImage);
+
+        heif_writer writer{};
+        writer.writer_api_version = 1;
+        writer.write = WriteToMemory;
+
+        {
+            Trace::ScopedEvent traceEvent("heif_context_write");
+
+            status = GetEncodeStatus(heif_context_write(probe.context.get(), &writer, &encodedData));
+        }
+
+        if (status != Status::Ok)
+        {
+            return status;
+        }
+
+        probe.quality = quality;
+        probe.fileSize = encodedData.size();
+
+        return MeasureProbe(image, encodedData, autoQualityOptions->metric, probe.similarity);
     }
-    catch (...)
+
+    // HEIF requires all of the grid tiles to have the same size, the tiles in the last row and column
+    // extend past the image and the grid output size crops them.
+    constexpr int GridTileSize = 512;
+    // The grid box stores the row and column counts in 8 bits.
+    constexpr int MaxGridTileCount = 256;
+
+    struct GridLayout
     {
-        return Status::EncodeFailed;
+        int columns;
+        int rows;
+        int tileWidth;
+        int tileHeight;
+    };
+
+    void GetGridTileSize(int length, int& tileSize, int& tileCount)
+    {
+        // An image that would need more tiles than the grid can store uses larger tiles, the tile
+        // size is always even so that it can be used with the subsampled chroma formats.
+        const int minimumTileSize = (length + MaxGridTileCount - 1) / MaxGridTileCount;
+
+        tileSize = std::max(GridTileSize, (minimumTileSize + 1) & ~1);
+
+        if (length < tileSize)
+        {
+            // A single row or column does not need to be padded to the full tile size.
+            tileSize = (length + 1) & ~1;
+        }
+
+        tileCount = (length + tileSize - 1) / tileSize;
+    }
+
+    bool TryGetGridLayout(int width, int height, GridLayout& layout)
+    {
+        GetGridTileSize(width, layout.tileWidth, layout.columns);
+        GetGridTileSize(height, layout.tileHeight, layout.rows);
+
+        return layout.columns > 1 || layout.rows > 1;
+    }
+
+    // Copies the part of a tile that is inside the image into the tile buffer,
+    // the pixels past the image edge repeat the last column and row.
+    void CopyEdgeTile(
+        const BitmapData* const input,
+        int x,
+        int y,
+        const GridLayout& layout,
+        std::vector<ColorBgra>& buffer,
+        BitmapData& tileInput)
+    {
+        const int copyWidth = std::min(layout.tileWidth, input->width - x);
+        const int copyHeight = std::min(layout.tileHeight, input->height - y);
+
+        buffer.resize(static_cast<size_t>(layout.tileWidth) * static_cast<size_t>(layout.tileHeight));
+
+        for (int row = 0; row < layout.tileHeight; row++)
+        {
+            const ColorBgra* source = reinterpret_cast<const ColorBgra*>(
+                input->scan0
+                + (static_cast<intptr_t>(y + std::min(row, copyHeight - 1)) * input->stride)
+                + (static_cast<intptr_t>(x) * static_cast<intptr_t>(sizeof(ColorBgra))));
+            ColorBgra* destination = buffer.data() + (static_cast<size_t>(row) * static_cast<size_t>(layout.tileWidth));
+
+            std::copy(source, source + copyWidth, destination);
+            std::fill(destination + copyWidth, destination + layout.tileWidth, source[copyWidth - 1]);
+        }
+
+        tileInput.scan0 = reinterpret_cast<uint8_t*>(buffer.data());
+        tileInput.width = layout.tileWidth;
+        tileInput.height = layout.tileHeight;
+        tileInput.stride = layout.tileWidth * static_cast<int32_t>(sizeof(ColorBgra));
     }
+
+    Status EncodeGrid(
+        heif_context* const context,
+        const BitmapData* const input,
+        const EncoderOptions* const options,
+        const EncoderMetadata* const metadata,
+        const CICPColorData& colorData,
+        const GridLayout& layout,
+        const ProgressProc progressCallback,
+        const int encoderThreads,
+        ScopedHeifImageHandle& encodedImage)
+    {
+        // Every tile must have the same channels.
+        const bool hasTransparency = ChromaSubsampling::HasTransparency(input);
+        const size_t tileCount = static_cast<size_t>(layout.columns) * static_cast<size_t>(layout.rows);
+
+        std::vector<ScopedHeifImage> tiles(tileCount);
+        std::vector<ColorBgra> edgeTile;
+        MemoryAccounting::ScopedCharge tilesCharge(0);
+
+        for (int row = 0; row < layout.rows; row++)
+        {
+            for (int column = 0; column < layout.columns; column++)
+            {
+                const size_t index = (static_cast<size_t>(row) * static_cast<size_t>(layout.columns)) + static_cast<size_t>(column);
+
+                const int x = column * layout.tileWidth;
+                const int y = row * layout.tileHeight;
+
+                BitmapData tileInput{};
+
+                if ((x + layout.tileWidth) > input->width || (y + layout.tileHeight) > input->height)
+                {
+                    CopyEdgeTile(input, x, y, layout, edgeTile, tileInput);
+                }
+                else
+                {
+                    tileInput.scan0 = input->scan0
+                                    + (static_cast<intptr_t>(y) * input->stride)
+                                    + (static_cast<intptr_t>(x) * static_cast<intptr_t>(sizeof(ColorBgra)));
+                    tileInput.width = layout.tileWidth;
+                    tileInput.height = layout.tileHeight;
+                    tileInput.stride = input->stride;
+                }
+
+                Status status = ConvertToHeifImage(&tileInput, colorData, options->yuvFormat, hasTransparency, tiles[index]);
+
+                if (status == Status::Ok)
+                {
+                    status = AddColorProfile(tiles[index].get(), colorData, metadata->iccProfile, metadata->iccProfileSize);
+                }
+
+                if (status != Status::Ok)
+                {
+                    return status;
+                }
+
+                tilesCharge.Increase(MemoryAccounting::GetImageSize(tiles[index].get()));
+            }
+        }
+
+        if (progressCallback)
+        {
+            if (!progressCallback(BeforeCompression))
+            {
+                return Status::UserCanceled;
+            }
+        }
+
+        ScopedHeifEncoder encoder;
+
+        Status status = GetEncoder(context, encoder);
+
+        if (status == Status::Ok)
+        {
+            status = ConfigureEncoderSettings(encoder.get(), layout.tileWidth, layout.tileHeight, options, encoderThreads);
+        }
+
+        if (status != Status::Ok)
+        {
+            return status;
+        }
+
+        Trace::ScopedEvent traceEvent("EncodeImage");
+        MemoryAccounting::ScopedCharge encoderCharge(MemoryAccounting::EstimateEncoderWorkingSet(
+            layout.tileWidth,
+            layout.tileHeight,
+            options));
+
+        heif_image_handle* outputImage;
+
+        // The grid output size is the image size, the decoder crops the padded edge tiles to it.
+        status = GetEncodeStatus(heif_context_add_grid_image(
+            context,
+            static_cast<uint32_t>(input->width),
+            static_cast<uint32_t>(input->height),
+            static_cast<uint32_t>(layout.columns),
+            static_cast<uint32_t>(layout.rows),
+            nullptr,
+            &outputImage));
+
+        if (status != Status::Ok)
+        {
+            return status;
+        }
+
+        encodedImage.reset(outputImage);
+
+        for (int row = 0; row < layout.rows; row++)
+        {
+            for (int column = 0; column < layout.columns; column++)
+            {
+                const size_t index = (static_cast<size_t>(row) * static_cast<size_t>(layout.columns)) + static_cast<size_t>(column);
+
+                status = GetEncodeStatus(heif_context_add_image_tile(
+                    context,
+                    encodedImage.get(),
+                    static_cast<uint32_t>(column),
+                    static_cast<uint32_t>(row),
+                    tiles[index].get(),
+                    encoder.get()));
+
+                if (status != Status::Ok)
+                {
+                    return status;
+                }
+            }
+        }
+
+        return Status::Ok;
+    }
+
+    Status CompressImage(
+        heif_context* const context,
+        heif_image* const image,
+        const EncoderOptions* const options,
+        const EncoderMetadata* const metadata,
+        const CICPColorData& colorData,
+        const ProgressProc progressCallback,
+        const int encoderThreads,
+        ScopedHeifImageHandle& encodedImage)
+    {
+        if (progressCallback)
+        {
+            if (!progressCallback(BeforeCompression))
+            {
+                return Status::UserCanceled;
+            }
+        }
+
+        Status status = AddColorProfile(image, colorData, metadata->iccProfile, metadata->iccProfileSize);
+
+        if (status == Status::Ok)
+        {
+            status = EncodeImage(context, image, options, encoderThreads, encodedImage);
+        }
+
+        return status;
+    }
+
+    Status FinishEncode(
+        heif_context* const context,
+        heif_image_handle* const encodedImage,
+        const EncoderMetadata* const metadata,
+        const ProgressProc progressCallback)
+    {
+        Status status = AddExifAndXmpMetadata(context, encodedImage, metadata);
+
+        if (progressCallback && status == Status::Ok)
+        {
+            if (!progressCallback(AfterCompression))
+            {
+                status = Status::UserCanceled;
+            }
+        }
+
+        return status;
+    }
+
+    struct ParameterDescription
+    {
+        std::string name;
+        EncoderParameterType type;
+        bool hasMinimum;
+        bool hasMaximum;
+        int32_t minimum;
+        int32_t maximum;
+        std::vector<int32_t> validIntegers;
+        std::vector<std::string> validStrings;
+        bool hasDefault;
+        std::string defaultValue;
+    };
+
+    ParameterDescription DescribeParameter(heif_encoder* const encoder, const heif_encoder_parameter* const parameter)
+    {
+        ParameterDescription description{};
+        description.name = heif_encoder_parameter_get_name(parameter);
+
+        switch (heif_encoder_parameter_get_type(parameter))
+        {
+        case heif_encoder_parameter_type_integer:
+        {
+            description.type = EncoderParameterType::Integer;
+
+            int hasMinimum = 0;
+            int hasMaximum = 0;
+            int minimum = 0;
+            int maximum = 0;
+            int validValueCount = 0;
+            const int* validValues = nullptr;
+
+            heif_error error = heif_encoder_parameter_get_valid_integer_values(
+                parameter,
+                &hasMinimum,
+                &hasMaximum,
+                &minimum,
+                &maximum,
+                &validValueCount,
+                &validValues);
+
+            if (error.code == heif_error_Ok)
+            {
+                description.hasMinimum = hasMinimum != 0;
+                description.hasMaximum = hasMaximum != 0;
+                description.minimum = minimum;
+                description.maximum = maximum;
+
+                if (validValueCount > 0 && validValues)
+                {
+                    description.validIntegers.assign(validValues, validValues + validValueCount);
+                }
+            }
+            break;
+        }
+        case heif_encoder_parameter_type_boolean:
+            description.type = EncoderParameterType::Boolean;
+            break;
+        case heif_encoder_parameter_type_string:
+        default:
+        {
+            description.type = EncoderParameterType::String;
+
+            const char* const* validValues = nullptr;
+
+            heif_error error = heif_encoder_parameter_get_valid_string_values(parameter, &validValues);
+
+            if (error.code == heif_error_Ok && validValues)
+            {
+                for (const char* const* value = validValues; *value; value++)
+                {
+                    description.validStrings.emplace_back(*value);
+                }
+            }
+            break;
+        }
+        }
+
+        if (heif_encoder_has_default(encoder, description.name.c_str()))
+        {
+            // The encoder was just created, so the current value is the default value.
+            char value[256]{};
+
+            heif_error error = heif_encoder_get_parameter(encoder, description.name.c_str(), value, static_cast<int>(sizeof(value)));
+
+            if (error.code == heif_error_Ok)
+            {
+                description.hasDefault = true;
+                description.defaultValue = value;
+            }
+        }
+
+        return description;
+    }
+
+    // Copies the string to the arena and returns its address.
+    const char* CopyString(const std::string& value, uint8_t* const arena, size_t& offset)
+    {
+        char* const destination = reinterpret_cast<char*>(arena + offset);
+
+        std::copy(value.begin(), value.end(), destination);
+        destination[value.size()] = '\0';
+        offset += value.size() + 1;
+
+        return destination;
+    }
+
+    struct LayerEncodeState
+    {
+        std::mutex mutex;
+        std::condition_variable imageAdded;
+        // The index of the image that can be added to the context, only the thread that is
+        // encoding this image uses the context. It is protected by the mutex.
+        int32_t nextImage = 0;
+        // The first error, it is read without the mutex so that the conversions can stop early.
+        std::atomic<Status> status{ Status::Ok };
+    };
+
+    // Converts the image on the calling thread and then waits for its turn to compress it,
+    // libheif does not support adding images to a context from multiple threads.
+    // The images are added in order so that the layer order is preserved in the file.
+    // The mutex is not held while the image is compressed, so the other threads can convert
+    // their images at the same time. Each compression uses the encoder share of the thread
+    // budget through the x265 pool size that ConfigureStillImageSettings sets.
+    // The layer metadata is null for the composite image.
+    void EncodeLayerImage(
+        heif_context* const context,
+        const BitmapData* const input,
+        const int32_t index,
+        const int32_t imageCount,
+        const EncoderOptions& options,
+        const EncoderMetadata* const metadata,
+        const LayerMetadata* const layerMetadata,
+        const CICPColorData& colorData,
+        const ProgressProc progressCallback,
+        LayerEncodeState& state)
+    {
+        Status status = Status::Ok;
+        EncoderOptions imageOptions = options;
+        ScopedHeifImage yuvImage;
+        MemoryAccounting::ScopedCharge imageCharge(0);
+
+        // Skip the conversion when an earlier image has already failed.
+        status = state.status.load(std::memory_order_acquire);
+
+        if (status == Status::Ok)
+        {
+            try
+            {
+                if (imageOptions.yuvFormat == YUVChromaSubsampling::Automatic)
+                {
+                    imageOptions.yuvFormat = ChromaSubsampling::SelectChromaSubsampling(input);
+                }
+
+                status = ConvertToHeifImage(input, colorData, imageOptions.yuvFormat, yuvImage);
+
+                if (status == Status::Ok)
+                {
+                    imageCharge.Increase(MemoryAccounting::GetImageSize(yuvImage.get()));
+
+                    status = AddColorProfile(yuvImage.get(), colorData, metadata->iccProfile, metadata->iccProfileSize);
+                }
+            }
+            catch (const std::bad_alloc&)
+            {
+                status = Status::OutOfMemory;
+            }
+            catch (...)
+            {
+                status = Status::EncodeFailed;
+            }
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(state.mutex);
+
+            state.imageAdded.wait(lock, [&]() { return state.nextImage == index; });
+        }
+
+        // nextImage is not advanced until this image has been added, so the other threads
+        // cannot use the context until then.
+        if (state.status.load(std::memory_order_acquire) == Status::Ok && status == Status::Ok)
+        {
+            try
+            {
+                ScopedHeifImageHandle encodedImage;
+
+                status = EncodeImage(
+                    context,
+                    yuvImage.get(),
+                    &imageOptions,
+                    ThreadBudget::GetThreads(ThreadBudget::Operation::Encode),
+                    encodedImage);
+
+                yuvImage.reset();
+                imageCharge.Reset();
+
+                if (status == Status::Ok && index == 0)
+                {
+                    // The first image is the flattened image, it is the image that
+                    // viewers without layer support show.
+                    heif_context_set_primary_image(context, encodedImage.get());
+
+                    status = AddExifAndXmpMetadata(context, encodedImage.get(), metadata);
+                }
+                else if (status == Status::Ok && layerMetadata)
+                {
+                    status = AddXmpToImage(context, encodedImage.get(), layerMetadata->xmp, layerMetadata->xmpSize);
+                }
+
+                if (status == Status::Ok && progressCallback)
+                {
+                    const double progress = BeforeCompression
+                        + ((AfterCompression - BeforeCompression) * static_cast<double>(index + 1) / static_cast<double>(imageCount));
+
+                    if (!progressCallback(progress))
+                    {
+                        status = Status::UserCanceled;
+                    }
+                }
+            }
+            catch (const std::bad_alloc&)
+            {
+                status = Status::OutOfMemory;
+            }
+            catch (...)
+            {
+                status = Status::EncodeFailed;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+
+            if (status != Status::Ok)
+            {
+                Status expected = Status::Ok;
+
+                state.status.compare_exchange_strong(expected, status, std::memory_order_acq_rel);
+            }
+
+            state.nextImage++;
+        }
+
+        state.imageAdded.notify_all();
+    }
+
+    // encoderThreads is the number of threads that the x265 encoder uses.
+    Status EncodeSingleImage(
+        heif_context* const context,
+        const BitmapData* input,
+        const EncoderOptions* options,
+        const EncoderMetadata* metadata,
+        const CICPColorData& colorData,
+        const ProgressProc progressCallback,
+        const int encoderThreads)
+    {
+        if (!context || !input || !options || !metadata)
+        {
+            return Status::NullParameter;
+        }
+
+        const EncoderOptions resolvedOptions = ResolveEncoderOptions(input, options, 1);
+        options = &resolvedOptions;
+
+        GridLayout gridLayout{};
+        bool encodeAsGrid = false;
+
+        if (options->memoryBudget != 0)
+        {
+            const uint64_t requiredBytes = MemoryAccounting::EstimateEncodeBytes(
+                input->width,
+                input->height,
+                input->width,
+                input->height,
+                options);
+
+            if (requiredBytes > options->memoryBudget)
+            {
+                // A grid image limits the encoder working set to the size of a tile.
+                if (!TryGetGridLayout(input->width, input->height, gridLayout))
+                {
+                    return MemoryAccounting::ReportBudgetFailure(
+                        MemoryBudgetFailureReason::EncodeBudgetExceeded,
+                        requiredBytes,
+                        options->memoryBudget);
+                }
+
+                const uint64_t gridRequiredBytes = MemoryAccounting::EstimateEncodeBytes(
+                    input->width,
+                    input->height,
+                    gridLayout.tileWidth,
+                    gridLayout.tileHeight,
+                    options);
+
+                if (gridRequiredBytes > options->memoryBudget)
+                {
+                    return MemoryAccounting::ReportBudgetFailure(
+                        MemoryBudgetFailureReason::EncodeBudgetExceeded,
+                        gridRequiredBytes,
+                        options->memoryBudget);
+                }
+
+                encodeAsGrid = true;
+            }
+        }
+
+        if (progressCallback)
+        {
+            if (!progressCallback(BeforeImageConversion))
+            {
+                return Status::UserCanceled;
+            }
+        }
+
+        try
+        {
+            ScopedHeifImageHandle encodedImage;
+
+            if (encodeAsGrid)
+            {
+                Status status = EncodeGrid(context, input, options, metadata, colorData, gridLayout, progressCallback, encoderThreads, encodedImage);
+
+                if (status == Status::Ok)
+                {
+                    status = FinishEncode(context, encodedImage.get(), metadata, progressCallback);
+                }
+
+                return status;
+            }
+
+            ScopedHeifImage yuvImage;
+
+            Status status = ConvertToHeifImage(input, colorData, options->yuvFormat, yuvImage);
+            MemoryAccounting::ScopedCharge imageCharge(MemoryAccounting::GetImageSize(yuvImage.get()));
+
+            if (status == Status::Ok)
+            {
+                status = CompressImage(context, yuvImage.get(), options, metadata, colorData, progressCallback, encoderThreads, encodedImage);
+
+                if (status == Status::Ok)
+                {
+                    // The YCbCr image is no longer needed, it is released before the file is written.
+                    yuvImage.reset();
+                    imageCharge.Reset();
+
+                    status = FinishEncode(context, encodedImage.get(), metadata, progressCallback);
+                }
+            }
+
+            return status;
+        }
+        catch (const std::bad_alloc&)
+        {
+            return Status::OutOfMemory;
+        }
+        catch (...)
+        {
+            return Status::EncodeFailed;
+        }
+    }
+}
+
+Status HeicEncoder::Encode(
+    heif_context* const context,
+    const BitmapData* input,
+    const EncoderOptions* options,
+    const EncoderMetadata* metadata,
+    const CICPColorData& colorData,
+    const ProgressProc progressCallback)
+{
+    return EncodeSingleImage(
+        context,
+        input,
+        options,
+        metadata,
+        colorData,
+        progressCallback,
+        ThreadBudget::GetThreads(ThreadBudget::Operation::Encode));
+}
+
+Status HeicEncoder::EncodeWithSession(
+    heif_context* const context,
+    EncoderSession* session,
+    const BitmapData* input,
+    const ImageAnalysis* analysis,
+    const EncoderOptions* options,
+    const EncoderMetadata* metadata,
+    const CICPColorData& colorData,
+    const ProgressProc progressCallback)
+{
+    if (!context || !session || !input || !analysis || !options || !metadata)
+    {
+        return Status::NullParameter;
+    }
+
+    const EncoderOptions resolvedOptions = ResolveEncoderOptions(input, options, 1);
+    options = &resolvedOptions;
+
+    if (options->memoryBudget != 0)
+    {
+        // The session keeps the full converted image, so a grid image cannot be used.
+        const uint64_t requiredBytes = MemoryAccounting::EstimateEncodeBytes(
+            input->width,
+            input->height,
+            input->width,
+            input->height,
+            options);
+
+        if (requiredBytes > options->memoryBudget)
+        {
+            return MemoryAccounting::ReportBudgetFailure(
+                MemoryBudgetFailureReason::EncodeBudgetExceeded,
+                requiredBytes,
+                options->memoryBudget);
+        }
+    }
+
+    if (progressCallback)
+    {
+        if (!progressCallback(BeforeImageConversion))
+        {
+            return Status::UserCanceled;
+        }
+    }
+
+    try
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+
+        heif_image* image = nullptr;
+
+        Status status = EncoderSessionCache::GetConvertedImage(session, input, analysis, options->yuvFormat, colorData, &image);
+
+        if (status == Status::Ok)
+        {
+            ScopedHeifImageHandle encodedImage;
+
+            status = CompressImage(
+                context,
+                image,
+                options,
+                metadata,
+                colorData,
+                progressCallback,
+                ThreadBudget::GetThreads(ThreadBudget::Operation::Encode),
+                encodedImage);
+
+            if (status == Status::Ok)
+            {
+                status = FinishEncode(context, encodedImage.get(), metadata, progressCallback);
+            }
+        }
+
+        return status;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return Status::OutOfMemory;
+    }
+    catch (...)
+    {
+        return Status::EncodeFailed;
+    }
+}
+
+Status HeicEncoder::EncodeAutoQuality(
+    const BitmapData* input,
+    const EncoderOptions* options,
+    const AutoQualityOptions* autoQualityOptions,
+    const EncoderMetadata* metadata,
+    const CICPColorData& colorData,
+    const ProgressProc progressCallback,
+    ScopedHeifContext& outputContext,
+    AutoQualityResult* result)
+{
+    if (!input || !options || !autoQualityOptions || !metadata || !result)
+    {
+        return Status::NullParameter;
+    }
+
+    if (autoQualityOptions->minQuality < 0
+        || autoQualityOptions->maxQuality > 100
+        || autoQualityOptions->minQuality > autoQualityOptions->maxQuality
+        || autoQualityOptions->maxEncodes < 0)
+    {
+        return Status::InvalidParameter;
+    }
+
+    // The time budget is for all of the probes that the search can encode.
+    const EncoderOptions resolvedOptions = ResolveEncoderOptions(input, options, GetMaxEncodes(autoQualityOptions));
+    options = &resolvedOptions;
+
+    if (options->memoryBudget != 0)
+    {
+        // The search cannot use a grid image because each probe is decoded and measured.
+        const uint64_t requiredBytes = MemoryAccounting::EstimateAutoQualityEncodeBytes(input->width, input->height, options);
+
+        if (requiredBytes > options->memoryBudget)
+        {
+            return MemoryAccounting::ReportBudgetFailure(
+                MemoryBudgetFailureReason::EncodeBudgetExceeded,
+                requiredBytes,
+                options->memoryBudget);
+        }
+    }
+
+    if (progressCallback)
+    {
+        if (!progressCallback(BeforeImageConversion))
+        {
+            return Status::UserCanceled;
+        }
+    }
+
+    try
+    {
+        ScopedHeifImage yuvImage;
+
+        Status status = ConvertToHeifImage(input, colorData, options->yuvFormat, yuvImage);
+        MemoryAccounting::ScopedCharge imageCharge(MemoryAccounting::GetImageSize(yuvImage.get()));
+
+        if (status != Status::Ok)
+        {
+            return status;
+        }
+
+        if (progressCallback)
+        {
+            if (!progressCallback(BeforeCompression))
+            {
+                return Status::UserCanceled;
+            }
+        }
+
+        status = AddColorProfile(yuvImage.get(), colorData, metadata->iccProfile, metadata->iccProfileSize);
+
+        if (status != Status::Ok)
+        {
+            return status;
+        }
+
+        // Each probe is encoded into a new context, this context is only used to create the encoder.
+        ScopedHeifContext encoderContext(heif_context_alloc());
+
+        if (!encoderContext)
+        {
+            return Status::OutOfMemory;
+        }
+
+        ScopedHeifEncoder encoder;
+
+        status = GetEncoder(encoderContext.get(), encoder);
+
+        if (status != Status::Ok)
+        {
+            return status;
+        }
+
+        status = ConfigureEncoderSettings(
+            encoder.get(),
+            input->width,
+            input->height,
+            options,
+            ThreadBudget::GetThreads(ThreadBudget::Operation::Encode));
+
+        if (status != Status::Ok)
+        {
+            return status;
+        }
+
+        const int maxEncodes = GetMaxEncodes(autoQualityOptions);
+
+        // The quality values in [low, high] have not been ruled out by the search.
+        int low = autoQualityOptions->minQuality;
+        int high = autoQualityOptions->maxQuality;
+        int encodeCount = 0;
+
+        // The smallest image that meets the target, and the highest quality image that does not.
+        AutoQualityProbe best;
+        AutoQualityProbe fallback;
+        std::vector<uint8_t> encodedData;
+
+        while (low <= high && encodeCount < maxEncodes)
+        {
+            // The last encode uses the highest remaining quality when none of the images met
+            // the target, this gives the search the best chance of producing a usable image.
+            const int quality = (encodeCount == maxEncodes - 1 && !best.context) ? high : low + ((high - low) / 2);
+
+            AutoQualityProbe probe;
+
+            status = EncodeProbe(encoder.get(), yuvImage.get(), quality, options, autoQualityOptions, encodedData, probe);
+
+            if (status != Status::Ok)
+            {
+                return status;
+            }
+
+            encodeCount++;
+
+            if (probe.similarity >= autoQualityOptions->target)
+            {
+                if (!best.context || probe.fileSize <= best.fileSize)
+                {
+                    best = std::move(probe);
+                }
+
+                high = quality - 1;
+            }
+            else
+            {
+                if (!fallback.context || probe.quality > fallback.quality)
+                {
+                    fallback = std::move(probe);
+                }
+
+                low = quality + 1;
+            }
+
+            if (progressCallback)
+            {
+                const double progressRange = AfterCompression - BeforeCompression;
+
+                if (!progressCallback(BeforeCompression + (progressRange * encodeCount / maxEncodes)))
+                {
+                    return Status::UserCanceled;
+                }
+            }
+        }
+
+        const bool targetMet = static_cast<bool>(best.context);
+        AutoQualityProbe& selected = targetMet ? best : fallback;
+
+        status = AddExifAndXmpMetadata(selected.context.get(), selected.imageHandle.get(), metadata);
+
+        if (status == Status::Ok)
+        {
+            result->quality = selected.quality;
+            result->similarity = selected.similarity;
+            result->encodeCount = encodeCount;
+            result->targetMet = targetMet;
+
+            outputContext = std::move(selected.context);
+
+            if (progressCallback)
+            {
+                if (!progressCallback(AfterCompression))
+                {
+                    status = Status::UserCanceled;
+                }
+            }
+        }
+
+        return status;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return Status::OutOfMemory;
+    }
+    catch (...)
+    {
+        return Status::EncodeFailed;
+    }
+}
+
+Status HeicEncoder::EncodeLayers(
+    heif_context* const context,
+    const BitmapData* composite,
+    const BitmapData* layers,
+    const LayerMetadata* layerMetadata,
+    int32_t layerCount,
+    const EncoderOptions* options,
+    const EncoderMetadata* metadata,
+    const CICPColorData& colorData,
+    const ProgressProc progressCallback)
+{
+    if (!context || !composite || !layers || !layerMetadata || !options || !metadata)
+    {
+        return Status::NullParameter;
+    }
+
+    if (layerCount <= 0)
+    {
+        return Status::InvalidParameter;
+    }
+
+    const int32_t imageCount = layerCount + 1;
+    int threadCount = ThreadBudget::GetThreads(ThreadBudget::Operation::Kernel);
+
+    if (options->memoryBudget != 0)
+    {
+        uint64_t imageBytes = MemoryAccounting::EstimateEncodeBytes(
+            composite->width,
+            composite->height,
+            composite->width,
+            composite->height,
+            options);
+
+        for (int32_t i = 0; i < layerCount; i++)
+        {
+            imageBytes = std::max(imageBytes, MemoryAccounting::EstimateEncodeBytes(
+                layers[i].width,
+                layers[i].height,
+                layers[i].width,
+                layers[i].height,
+                options));
+        }
+
+        if (imageBytes > options->memoryBudget)
+        {
+            return MemoryAccounting::ReportBudgetFailure(
+                MemoryBudgetFailureReason::EncodeBudgetExceeded,
+                imageBytes,
+                options->memoryBudget);
+        }
+
+        // Each thread can hold a converted image while it waits to be compressed.
+        threadCount = static_cast<int>(std::min<uint64_t>(options->memoryBudget / imageBytes, static_cast<uint64_t>(threadCount)));
+    }
+
+    // The composite image is resolved on the calling thread so that GetLastSaveInfo reports it.
+    // The layers have the same size as the composite and use the preset that was selected for all of the images.
+    const EncoderOptions compositeOptions = ResolveEncoderOptions(composite, options, imageCount);
+
+    EncoderOptions layerOptions = *options;
+    layerOptions.preset = compositeOptions.preset;
+
+    if (progressCallback)
+    {
+        if (!progressCallback(BeforeImageConversion))
+        {
+            return Status::UserCanceled;
+        }
+    }
+
+    try
+    {
+        LayerEncodeState state;
+
+        ParallelFor::Run(0, imageCount, 1, threadCount, [&](int begin, int end)
+        {
+            for (int32_t index = begin; index < end; index++)
+            {
+                if (index == 0)
+                {
+                    EncodeLayerImage(context, composite, index, imageCount, compositeOptions, metadata, nullptr, colorData, progressCallback, state);
+                }
+                else
+                {
+                    EncodeLayerImage(
+                        context,
+                        &layers[index - 1],
+                        index,
+                        imageCount,
+                        layerOptions,
+                        metadata,
+                        &layerMetadata[index - 1],
+                        colorData,
+                        progressCallback,
+                        state);
+                }
+            }
+        });
+
+        return state.status.load();
+    }
+    catch (const std::bad_alloc&)
+    {
+        return Status::OutOfMemory;
+    }
+    catch (...)
+    {
+        return Status::EncodeFailed;
+    }
+}
+
+Status HeicEncoder::EncodeRenditions(
+    const BitmapData* input,
+    const RenditionTarget* targets,
+    int32_t targetCount,
+    const EncoderOptions* options,
+    const EncoderMetadata* metadata,
+    const CICPColorData& colorData,
+    const ProgressProc progressCallback,
+    std::vector<ScopedHeifContext>& contexts)
+{
+    if (!input || !targets || !options || !metadata)
+    {
+        return Status::NullParameter;
+    }
+
+    if (targetCount <= 0)
+    {
+        return Status::InvalidParameter;
+    }
+
+    for (int32_t i = 0; i < targetCount; i++)
+    {
+        const RenditionTarget& target = targets[i];
+
+        if (target.width <= 0
+            || target.height <= 0
+            || target.width > input->width
+            || target.height > input->height
+            || target.quality < 0
+            || target.quality > 100)
+        {
+            return Status::InvalidParameter;
+        }
+    }
+
+    // The chroma subsampling is selected once from the full size image.
+    EncoderOptions sharedOptions = *options;
+
+    if (sharedOptions.yuvFormat == YUVChromaSubsampling::Automatic)
+    {
+        sharedOptions.yuvFormat = ChromaSubsampling::SelectChromaSubsampling(input);
+    }
+
+    if (progressCallback)
+    {
+        if (!progressCallback(BeforeImageConversion))
+        {
+            return Status::UserCanceled;
+        }
+    }
+
+    try
+    {
+        // The targets are processed from the largest to the smallest.
+        std::vector<int32_t> order(static_cast<size_t>(targetCount));
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [targets](int32_t a, int32_t b)
+        {
+            return (static_cast<int64_t>(targets[a].width) * targets[a].height) > (static_cast<int64_t>(targets[b].width) * targets[b].height);
+        });
+
+        std::vector<std::vector<ColorBgra>> pixels(static_cast<size_t>(targetCount));
+        std::vector<BitmapData> images(static_cast<size_t>(targetCount));
+        MemoryAccounting::ScopedCharge pixelsCharge(0);
+
+        {
+            Trace::ScopedEvent traceEvent("DownscaleRenditions");
+
+            for (size_t i = 0; i < order.size(); i++)
+            {
+                const int32_t index = order[i];
+                const RenditionTarget& target = targets[index];
+
+                // Each target is downscaled from the smallest of the larger images that covers it.
+                const BitmapData* source = input;
+
+                for (size_t j = 0; j < i; j++)
+                {
+                    const BitmapData& image = images[order[j]];
+
+                    if (image.width >= target.width && image.height >= target.height)
+                    {
+                        source = &image;
+                    }
+                }
+
+                if (source->width == target.width && source->height == target.height)
+                {
+                    images[index] = *source;
+                    continue;
+                }
+
+                pixels[index].resize(static_cast<size_t>(target.width) * static_cast<size_t>(target.height));
+                pixelsCharge.Increase(pixels[index].size() * sizeof(ColorBgra));
+
+                images[index] =
+                {
+                    reinterpret_cast<uint8_t*>(pixels[index].data()),
+                    target.width,
+                    target.height,
+                    target.width * static_cast<int32_t>(sizeof(ColorBgra))
+                };
+
+                Resampler::Downscale(source, &images[index]);
+            }
+        }
+
+        const int encoderThreads = ThreadBudget::GetThreads(ThreadBudget::Operation::Encode);
+        int workerCount = std::min(targetCount, ThreadBudget::GetThreads(ThreadBudget::Operation::Kernel));
+        double totalPixels = 0;
+
+        for (int32_t i = 0; i < targetCount; i++)
+        {
+            totalPixels += static_cast<double>(targets[i].width) * static_cast<double>(targets[i].height);
+        }
+
+        if (sharedOptions.memoryBudget != 0)
+        {
+            const RenditionTarget& largest = targets[order[0]];
+            const uint64_t largestBytes = MemoryAccounting::EstimateEncodeBytes(
+                largest.width,
+                largest.height,
+                largest.width,
+                largest.height,
+                &sharedOptions);
+
+            workerCount = static_cast<int>(std::clamp<uint64_t>(sharedOptions.memoryBudget / largestBytes, 1, static_cast<uint64_t>(workerCount)));
+        }
+
+        struct RenditionEncode
+        {
+            EncoderOptions options;
+            int encoderThreads;
+        };
+
+        std::vector<RenditionEncode> encodes(static_cast<size_t>(targetCount));
+
+        for (int32_t i = 0; i < targetCount; i++)
+        {
+            const RenditionTarget& target = targets[i];
+            RenditionEncode& encode = encodes[i];
+
+            encode.options = sharedOptions;
+            encode.options.quality = target.quality;
+            encode.options.preset = target.preset;
+
+            // The renditions are encoded at the same time, so the encoder threads are divided by their size.
+            // ConfigureStillImageSettings sizes the x265 pool and selects the parallel mode decision from this share.
+            const double share = (static_cast<double>(target.width) * static_cast<double>(target.height)) / totalPixels;
+
+            encode.encoderThreads = std::clamp(static_cast<int>(std::lround(encoderThreads * share)), 1, encoderThreads);
+        }
+
+        // GetLastSaveInfo reports the settings of the largest rendition.
+        // ParallelFor also runs chunks on this thread, where Encode overwrites lastSaveInfo,
+        // so it is assigned after all of the encodes have finished.
+        SaveInfo renditionSaveInfo = {};
+        renditionSaveInfo.yuvFormat = sharedOptions.yuvFormat;
+        renditionSaveInfo.preset = targets[order[0]].preset;
+
+        contexts.clear();
+        contexts.resize(static_cast<size_t>(targetCount));
+
+        std::mutex mutex;
+        Status status = Status::Ok;
+        int32_t completedCount = 0;
+
+        ParallelFor::Run(0, targetCount, 1, workerCount, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                const int32_t index = order[i];
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+
+                    // Skip the encode when an earlier target has already failed.
+                    if (status != Status::Ok)
+                    {
+                        return;
+                    }
+                }
+
+                ScopedHeifContext context(heif_context_alloc());
+                Status encodeStatus = Status::OutOfMemory;
+
+                if (context)
+                {
+                    encodeStatus = EncodeSingleImage(
+                        context.get(),
+                        &images[index],
+                        &encodes[index].options,
+                        metadata,
+                        colorData,
+                        nullptr,
+                        encodes[index].encoderThreads);
+
+                    if (encodeStatus == Status::Ok)
+                    {
+                        RecordEncodeTime();
+                    }
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+
+                if (encodeStatus == Status::Ok)
+                {
+                    contexts[index] = std::move(context);
+                    completedCount++;
+
+                    if (progressCallback)
+                    {
+                        const double progress = BeforeImageConversion
+                            + ((AfterCompression - BeforeImageConversion) * static_cast<double>(completedCount) / static_cast<double>(targetCount));
+
+                        if (!progressCallback(progress))
+                        {
+                            encodeStatus = Status::UserCanceled;
+                        }
+                    }
+                }
+
+                if (status == Status::Ok)
+                {
+                    status = encodeStatus;
+                }
+            }
+        });
+
+        lastSaveInfo = renditionSaveInfo;
+
+        return status;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return Status::OutOfMemory;
+    }
+    catch (...)
+    {
+        return Status::EncodeFailed;
+    }
+}
+
+Status HeicEncoder::GetParameterList(EncoderParameterList* list)
+{
+    if (!list)
+    {
+        return Status::NullParameter;
+    }
+
+    *list = {};
+
+    try
+    {
+        ScopedHeifContext context(heif_context_alloc());
+        ScopedHeifEncoder encoder;
+
+        Status status = GetEncoder(context.get(), encoder);
+
+        if (status != Status::Ok)
+        {
+            return status;
+        }
+
+        std::vector<ParameterDescription> descriptions;
+
+        for (const heif_encoder_parameter* const* parameter = heif_encoder_list_parameters(encoder.get()); *parameter; parameter++)
+        {
+            descriptions.push_back(DescribeParameter(encoder.get(), *parameter));
+        }
+
+        // The arena contains the parameter list, followed by the string pointer arrays,
+        // the integer arrays and the strings.
+        size_t pointerCount = 0;
+        size_t integerCount = 0;
+        size_t stringBytes = 0;
+
+        for (const ParameterDescription& description : descriptions)
+        {
+            pointerCount += description.validStrings.size();
+            integerCount += description.validIntegers.size();
+            stringBytes += description.name.size() + 1;
+
+            for (const std::string& value : description.validStrings)
+            {
+                stringBytes += value.size() + 1;
+            }
+
+            if (description.hasDefault)
+            {
+                stringBytes += description.defaultValue.size() + 1;
+            }
+        }
+
+        const size_t pointerOffset = descriptions.size() * sizeof(EncoderParameterInfo);
+        const size_t integerOffset = pointerOffset + (pointerCount * sizeof(const char*));
+        const size_t stringOffset = integerOffset + (integerCount * sizeof(int32_t));
+        const size_t arenaSize = stringOffset + stringBytes;
+
+        if (arenaSize == 0)
+        {
+            return Status::Ok;
+        }
+
+        uint8_t* const arena = new uint8_t[arenaSize];
+
+        EncoderParameterInfo* const parameters = reinterpret_cast<EncoderParameterInfo*>(arena);
+        const char** nextPointer = reinterpret_cast<const char**>(arena + pointerOffset);
+        int32_t* nextInteger = reinterpret_cast<int32_t*>(arena + integerOffset);
+        size_t nextString = stringOffset;
+
+        for (size_t i = 0; i < descriptions.size(); i++)
+        {
+            const ParameterDescription& description = descriptions[i];
+            EncoderParameterInfo& info = parameters[i];
+
+            info.name = CopyString(description.name, arena, nextString);
+            info.type = description.type;
+            info.hasMinimum = description.hasMinimum;
+            info.hasMaximum = description.hasMaximum;
+            info.minimum = description.minimum;
+            info.maximum = description.maximum;
+
+            info.validIntegers = description.validIntegers.empty() ? nullptr : nextInteger;
+            info.validIntegerCount = static_cast<int32_t>(description.validIntegers.size());
+            nextInteger = std::copy(description.validIntegers.begin(), description.validIntegers.end(), nextInteger);
+
+            info.validStrings = description.validStrings.empty() ? nullptr : nextPointer;
+            info.validStringCount = static_cast<int32_t>(description.validStrings.size());
+
+            for (const std::string& value : description.validStrings)
+            {
+                *nextPointer++ = CopyString(value, arena, nextString);
+            }
+
+            info.defaultValue = description.hasDefault ? CopyString(description.defaultValue, arena, nextString) : nullptr;
+        }
+
+        list->parameters = parameters;
+        list->count = static_cast<int32_t>(descriptions.size());
+        list->arena = arena;
+        list->arenaSize = arenaSize;
+
+        return Status::Ok;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return Status::OutOfMemory;
+    }
+    catch (...)
+    {
+        return Status::UnknownError;
+    }
+}
+
+void HeicEncoder::FreeParameterList(EncoderParameterList* list)
+{
+    if (list)
+    {
+        delete[] list->arena;
+        *list = {};
+    }
+}
+
+SaveInfo HeicEncoder::GetLastSaveInfo()
+{
+    return lastSaveInfo;
+}
+
+void HeicEncoder::RecordEncodeTime()
+{
+    if (lastPresetSelection.selected)
+    {
+        lastSaveInfo.encodeMilliseconds = std::chrono::duration<double, std::milli>(Clock::now() - lastPresetSelection.encodeStart).count();
+
+        PresetSelection::RecordEncode(
+            lastSaveInfo.predictedEncodeMilliseconds,
+            lastSaveInfo.encodeMilliseconds,
+            lastPresetSelection.timeBudgetMilliseconds);
+
+        lastPresetSelection = {};
+    }
+}
+
+void HeicEncoder::SetLastSaveInfo(const SaveInfo& info)
+{
+    lastSaveInfo = info;
 }
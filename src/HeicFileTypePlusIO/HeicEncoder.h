@@ -20,6 +20,7 @@
 
 #include "HeicFileTypePlusIO.h"
 #include "scoped.h"
+#include <vector>
 
 namespace HeicEncoder
 {
@@ -30,4 +31,69 @@ namespace HeicEncoder
         const EncoderMetadata* metadata,
         const CICPColorData& colorData,
         const ProgressProc progressCallback);
+
+    // Encodes the image using the converted image that is cached in the session,
+    // the image is only converted when the analyzed revision, YUV format or color data changes.
+    Status EncodeWithSession(
+        heif_context* const context,
+        EncoderSession* session,
+        const BitmapData* input,
+        const ImageAnalysis* analysis,
+        const EncoderOptions* options,
+        const EncoderMetadata* metadata,
+        const CICPColorData& colorData,
+        const ProgressProc progressCallback);
+
+    // Searches for the lowest quality that meets the similarity target, the image
+    // is only converted once and the same encoder is used for every quality.
+    // The output context contains the selected image and its metadata.
+    Status EncodeAutoQuality(
+        const BitmapData* input,
+        const EncoderOptions* options,
+        const AutoQualityOptions* autoQualityOptions,
+        const EncoderMetadata* metadata,
+        const CICPColorData& colorData,
+        const ProgressProc progressCallback,
+        ScopedHeifContext& outputContext,
+        AutoQualityResult* result);
+
+    // Encodes the composite as the primary image followed by each layer as a top-level image.
+    // The images are converted in parallel and compressed in order.
+    Status EncodeLayers(
+        heif_context* const context,
+        const BitmapData* composite,
+        const BitmapData* layers,
+        const LayerMetadata* layerMetadata,
+        int32_t layerCount,
+        const EncoderOptions* options,
+        const EncoderMetadata* metadata,
+        const CICPColorData& colorData,
+        const ProgressProc progressCallback);
+
+    // Downscales the input to each target size and encodes the targets in parallel, each into its own context.
+    // The x265 threads are divided between the targets by their size.
+    Status EncodeRenditions(
+        const BitmapData* input,
+        const RenditionTarget* targets,
+        int32_t targetCount,
+        const EncoderOptions* options,
+        const EncoderMetadata* metadata,
+        const CICPColorData& colorData,
+        const ProgressProc progressCallback,
+        std::vector<ScopedHeifContext>& contexts);
+
+    // The list is stored in a single arena that FreeParameterList releases.
+    Status GetParameterList(EncoderParameterList* list);
+
+    void FreeParameterList(EncoderParameterList* list);
+
+    // Gets the settings that the last encode on the calling thread used.
+    SaveInfo GetLastSaveInfo();
+
+    // Records the time that the last encode on the calling thread took when its preset
+    // was selected from a time budget, this is called after the encode has succeeded.
+    void RecordEncodeTime();
+
+    // The encode cache restores the settings of the cached file.
+    void SetLastSaveInfo(const SaveInfo& info);
 }
@@ -20,10 +20,21 @@
 //
 
 #include "HeicFileTypePlusIO.h"
+#include "EncodeCache.h"
+#include "EncoderSession.h"
+#include "FormatDetection.h"
+#include "Metrics.h"
 #include "HeicEncoder.h"
 #include "HeicMetadata.h"
+#include "HeicProbe.h"
 #include "HeicReader.h"
 #include "HeicWriter.h"
+#include "MemoryAccounting.h"
+#include "PlanePool.h"
+#include "PresetSelection.h"
+#include "ThreadBudget.h"
+#include "Trace.h"
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -55,36 +66,49 @@ bool __stdcall DeleteImageHandle(heif_image_handle* handle)
 
 bool __stdcall DeleteImage(heif_image* handle)
 {
+    MemoryAccounting::Release(MemoryAccounting::GetImageSize(handle));
+
     heif_image_release(handle);
 
     return true;
 }
 
+Status __stdcall SniffFile(const uint8_t* data, size_t length, SniffResult* result)
+{
+    return FormatDetection::SniffFile(data, length, result);
+}
+
+Status __stdcall ComputeImageMetrics(
+    const BitmapData* reference,
+    const BitmapData* distorted,
+    const MetricsOptions* options,
+    ImageQualityMetrics* metrics)
+{
+    MemoryAccounting::ScopedOperation memoryOperation;
+    ThreadBudget::ScopedOperation threadOperation;
+
+    return Metrics::ComputeImageMetrics(reference, distorted, options, metrics);
+}
+
 Status __stdcall LoadFileIntoContext(
     heif_context* context,
     IOCallbacks* callbacks,
     const CopyErrorDetails copyErrorDetails)
 {
+    MemoryAccounting::ScopedOperation memoryOperation;
+    ThreadBudget::ScopedOperation threadOperation;
+
     return HeicReader::LoadFileIntoContext(context, callbacks, copyErrorDetails);
 }
 
-Status __stdcall GetPrimaryImage(
-    heif_context* context,
-    heif_image_handle** primaryImageHandle,
-    ImageHandleInfo* info,
-    const CopyErrorDetails copyErrorDetails)
+namespace
 {
-    if (!context || !primaryImageHandle || !info)
-    {
-        return Status::NullParameter;
-    }
-
-    heif_error error = heif_context_get_primary_image_handle(context, primaryImageHandle);
-
-    if (error.code != heif_error_Ok)
+    Status GetImageHandleStatus(const heif_error& error, const CopyErrorDetails copyErrorDetails)
     {
         switch (error.code)
         {
+        case heif_error_Ok:
+            return Status::Ok;
         case heif_error_Memory_allocation_error:
             return Status::OutOfMemory;
         case heif_error_Unsupported_feature:
@@ -104,28 +128,124 @@ Status __stdcall GetPrimaryImage(
             return Status::InvalidFile;
         }
     }
+}
 
-    info->width = heif_image_handle_get_width(*primaryImageHandle);
-    info->height = heif_image_handle_get_height(*primaryImageHandle);
-    info->bitDepth = heif_image_handle_get_luma_bits_per_pixel(*primaryImageHandle);
+Status __stdcall GetPrimaryImage(
+    heif_context* context,
+    heif_image_handle** primaryImageHandle,
+    ImageHandleInfo* info,
+    const CopyErrorDetails copyErrorDetails)
+{
+    if (!context || !primaryImageHandle || !info)
+    {
+        return Status::NullParameter;
+    }
+
+    Trace::ScopedEvent traceEvent("GetPrimaryImage");
 
-    switch (heif_image_handle_get_color_profile_type(*primaryImageHandle))
+    heif_error error = heif_context_get_primary_image_handle(context, primaryImageHandle);
+
+    if (error.code != heif_error_Ok)
     {
-    case heif_color_profile_type_prof:
-    case heif_color_profile_type_rICC:
-        info->colorProfileType = ImageHandleColorProfileType::Icc;
-        break;
-    case heif_color_profile_type_nclx:
-        info->colorProfileType = ImageHandleColorProfileType::Cicp;
-        break;
-    case heif_color_profile_type_not_present:
-    default:
-        info->colorProfileType = ImageHandleColorProfileType::NotPresent;
-        break;
+        return GetImageHandleStatus(error, copyErrorDetails);
     }
 
-    info->hasAlpha = heif_image_handle_has_alpha_channel(*primaryImageHandle);
-    info->isAlphaChannelPremultiplied = info->hasAlpha && heif_image_handle_is_premultiplied_alpha(*primaryImageHandle);
+    HeicReader::GetImageHandleInfo(*primaryImageHandle, info);
+
+    return Status::Ok;
+}
+
+Status __stdcall GetImage(
+    heif_context* context,
+    heif_item_id id,
+    heif_image_handle** imageHandle,
+    ImageHandleInfo* info,
+    const CopyErrorDetails copyErrorDetails)
+{
+    if (!context || !imageHandle || !info)
+    {
+        return Status::NullParameter;
+    }
+
+    Trace::ScopedEvent traceEvent("GetImage");
+
+    heif_error error = heif_context_get_image_handle(context, id, imageHandle);
+
+    if (error.code != heif_error_Ok)
+    {
+        return GetImageHandleStatus(error, copyErrorDetails);
+    }
+
+    HeicReader::GetImageHandleInfo(*imageHandle, info);
+
+    return Status::Ok;
+}
+
+Status __stdcall GetTopLevelImageCount(heif_context* context, int32_t* count)
+{
+    if (!context || !count)
+    {
+        return Status::NullParameter;
+    }
+
+    *count = heif_context_get_number_of_top_level_images(context);
+    return Status::Ok;
+}
+
+Status __stdcall GetTopLevelImageIds(heif_context* context, heif_item_id* ids, int32_t count)
+{
+    if (!context || !ids)
+    {
+        return Status::NullParameter;
+    }
+
+    if (count != heif_context_get_number_of_top_level_images(context))
+    {
+        return Status::BufferTooSmall;
+    }
+
+    if (count == 0)
+    {
+        return Status::Ok;
+    }
+
+    heif_item_id primaryId;
+
+    heif_error error = heif_context_get_primary_image_ID(context, &primaryId);
+
+    if (error.code != heif_error_Ok)
+    {
+        return Status::InvalidFile;
+    }
+
+    heif_context_get_list_of_top_level_image_IDs(context, ids, count);
+
+    // Move the primary image to the front, the other images keep the file order.
+    heif_item_id* primary = std::find(ids, ids + count, primaryId);
+
+    if (primary != ids + count)
+    {
+        std::rotate(ids, primary, primary + 1);
+    }
+
+    return Status::Ok;
+}
+
+Status __stdcall SetConcurrentDecodes(heif_context* context, int32_t imageCount)
+{
+    if (!context)
+    {
+        return Status::NullParameter;
+    }
+
+    if (imageCount <= 0)
+    {
+        return Status::InvalidParameter;
+    }
+
+    ThreadBudget::ScopedOperation threadOperation;
+
+    HeicReader::SetConcurrentDecodes(context, imageCount);
 
     return Status::Ok;
 }
@@ -134,34 +254,29 @@ Status __stdcall DecodeImage(
     heif_image_handle* const imageHandle,
     heif_colorspace colorSpace,
     heif_chroma chroma,
+    uint64_t memoryBudget,
     heif_image** outputImage,
-    DecodedImageInfo* info)
+    DecodedImageInfo* info,
+    const ProgressProc progress)
 {
     if (!imageHandle || !outputImage || !info)
     {
         return Status::NullParameter;
     }
 
-    ScopedHeifDecodingOptions options(heif_decoding_options_alloc());
+    MemoryAccounting::ScopedOperation memoryOperation;
+    ThreadBudget::ScopedOperation threadOperation;
 
-    if (!options)
-    {
-        return Status::OutOfMemory;
-    }
+    Status status = HeicReader::DecodeImage(imageHandle, colorSpace, chroma, memoryBudget, progress, outputImage);
 
-    heif_error error = heif_decode_image(imageHandle, outputImage, colorSpace, chroma, options.get());
-
-    if (error.code != heif_error_Ok)
+    if (status != Status::Ok)
     {
-        switch (error.code)
-        {
-        case heif_error_Memory_allocation_error:
-            return Status::OutOfMemory;
-        default:
-            return Status::DecodeFailed;
-        }
+        return status;
     }
 
+    // The image is charged until the caller releases it with DeleteImage.
+    MemoryAccounting::Charge(MemoryAccounting::GetImageSize(*outputImage));
+
     info->colorSpace = heif_image_get_colorspace(*outputImage);
     info->chroma = heif_image_get_chroma_format(*outputImage);
     return Status::Ok;
@@ -172,173 +287,425 @@ uint8_t* __stdcall GetHeifImageChannel(heif_image* image, heif_channel channel,
     return heif_image_get_plane(image, channel, channelStride);
 }
 
-Status __stdcall GetICCProfileSize(heif_image_handle* imageHandle, size_t* size)
+Status __stdcall GetCICPColorData(heif_image_handle* imageHandle, CICPColorData* data)
 {
-    if (!imageHandle || !size)
+    if (!imageHandle || !data)
     {
         return Status::NullParameter;
     }
 
-    *size = heif_image_handle_get_raw_color_profile_size(imageHandle);
+    return HeicReader::GetCICPColorData(imageHandle, data);
+}
 
-    return Status::Ok;
+Status __stdcall GetAllMetadata(heif_image_handle* imageHandle, MetadataBundle* bundle)
+{
+    return GetMetadataBundle(imageHandle, bundle);
 }
 
-Status __stdcall GetICCProfile(heif_image_handle* imageHandle, uint8_t* buffer, size_t bufferSize)
+void __stdcall FreeMetadataBundle(MetadataBundle* bundle)
 {
-    if (!imageHandle || !buffer)
+    ReleaseMetadataBundle(bundle);
+}
+
+Status __stdcall ProbeFile(
+    IOCallbacks* callbacks,
+    ProbeResult* result,
+    const CopyErrorDetails copyErrorDetails)
+{
+    return HeicProbe::ProbeFile(callbacks, result, copyErrorDetails);
+}
+
+void __stdcall FreeProbeResult(ProbeResult* result)
+{
+    HeicProbe::FreeProbeResult(result);
+}
+
+Status __stdcall SaveToFile(
+    const BitmapData* input,
+    const EncoderOptions* options,
+    const EncoderMetadata* metadata,
+    const CICPColorData* colorData,
+    IOCallbacks* callbacks,
+    const ProgressProc progress)
+{
+    if (!input || !options || !metadata || !colorData || !callbacks)
     {
         return Status::NullParameter;
     }
 
-    if (bufferSize < heif_image_handle_get_raw_color_profile_size(imageHandle))
+    MemoryAccounting::ScopedOperation memoryOperation;
+    ThreadBudget::ScopedOperation threadOperation;
+
+    try
     {
-        return Status::BufferTooSmall;
-    }
+        const EncodeCache::Lookup cacheLookup = EncodeCache::Find(input, nullptr, options, metadata, *colorData);
+
+        if (cacheLookup.encodedData)
+        {
+            HeicEncoder::SetLastSaveInfo(cacheLookup.saveInfo);
 
-    heif_error error = heif_image_handle_get_raw_color_profile(imageHandle, buffer);
+            return HeicWriter::SaveToFile({ nullptr, cacheLookup.encodedData.get(), nullptr }, callbacks, progress);
+        }
 
-    if (error.code != heif_error_Ok)
-    {
-        switch (error.code)
+        ScopedHeifContext context(heif_context_alloc());
+
+        Status status = HeicEncoder::Encode(context.get(), input, options, metadata, *colorData, progress);
+
+        if (status == Status::Ok)
         {
-        case heif_error_Memory_allocation_error:
-            return Status::OutOfMemory;
-        default:
-            return Status::ColorInformationError;
+            HeicEncoder::RecordEncodeTime();
+
+            std::vector<uint8_t> encodedData;
+
+            status = HeicWriter::SaveToFile(
+                { context.get(), nullptr, cacheLookup.enabled ? &encodedData : nullptr },
+                callbacks,
+                progress);
+
+            if (status == Status::Ok)
+            {
+                EncodeCache::Add(cacheLookup, std::move(encodedData), HeicEncoder::GetLastSaveInfo());
+            }
         }
-    }
 
-    return Status::Ok;
+        return status;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return Status::OutOfMemory;
+    }
+    catch (...)
+    {
+        return Status::EncodeFailed;
+    }
 }
 
-Status __stdcall GetCICPColorData(heif_image_handle* imageHandle, CICPColorData* data)
+Status __stdcall SaveLayersToFile(
+    const BitmapData* composite,
+    const BitmapData* layers,
+    const LayerMetadata* layerMetadata,
+    int32_t layerCount,
+    const EncoderOptions* options,
+    const EncoderMetadata* metadata,
+    const CICPColorData* colorData,
+    IOCallbacks* callbacks,
+    const ProgressProc progress)
 {
-    if (!imageHandle || !data)
+    if (!composite || !layers || !layerMetadata || !options || !metadata || !colorData || !callbacks)
     {
         return Status::NullParameter;
     }
 
-    heif_color_profile_nclx* nclxProfile;
+    MemoryAccounting::ScopedOperation memoryOperation;
+    ThreadBudget::ScopedOperation threadOperation;
 
-    heif_error error = heif_image_handle_get_nclx_color_profile(imageHandle, &nclxProfile);
-
-    if (error.code == heif_error_Ok)
+    try
     {
-        data->colorPrimaries = nclxProfile->color_primaries;
-        data->transferCharacteristics = nclxProfile->transfer_characteristics;
-        data->matrixCoefficients = nclxProfile->matrix_coefficients;
-        data->fullRange = nclxProfile->full_range_flag;
+        ScopedHeifContext context(heif_context_alloc());
+
+        Status status = HeicEncoder::EncodeLayers(
+            context.get(),
+            composite,
+            layers,
+            layerMetadata,
+            layerCount,
+            options,
+            metadata,
+            *colorData,
+            progress);
+
+        if (status == Status::Ok)
+        {
+            HeicEncoder::RecordEncodeTime();
 
-        heif_nclx_color_profile_free(nclxProfile);
+            status = HeicWriter::SaveToFile({ context.get(), nullptr, nullptr }, callbacks, progress);
+        }
+
+        return status;
     }
-    else if (error.code == heif_error_Color_profile_does_not_exist)
+    catch (const std::bad_alloc&)
     {
-        data->colorPrimaries = heif_color_primaries_unspecified;
-        data->transferCharacteristics = heif_transfer_characteristic_unspecified;
-        data->matrixCoefficients = heif_matrix_coefficients_unspecified;
-        data->fullRange = false;
+        return Status::OutOfMemory;
     }
-    else
+    catch (...)
     {
-        switch (error.code)
+        return Status::EncodeFailed;
+    }
+}
+
+Status __stdcall SaveToFileAutoQuality(
+    const BitmapData* input,
+    const EncoderOptions* options,
+    const AutoQualityOptions* autoQualityOptions,
+    const EncoderMetadata* metadata,
+    const CICPColorData* colorData,
+    IOCallbacks* callbacks,
+    const ProgressProc progress,
+    AutoQualityResult* result)
+{
+    if (!input || !options || !autoQualityOptions || !metadata || !colorData || !callbacks || !result)
+    {
+        return Status::NullParameter;
+    }
+
+    MemoryAccounting::ScopedOperation memoryOperation;
+    ThreadBudget::ScopedOperation threadOperation;
+
+    try
+    {
+        ScopedHeifContext context;
+
+        Status status = HeicEncoder::EncodeAutoQuality(
+            input,
+            options,
+            autoQualityOptions,
+            metadata,
+            *colorData,
+            progress,
+            context,
+            result);
+
+        if (status == Status::Ok)
         {
-        case heif_error_Memory_allocation_error:
-            return Status::OutOfMemory;
-        default:
-            return Status::ColorInformationError;
+            HeicEncoder::RecordEncodeTime();
+
+            status = HeicWriter::SaveToFile({ context.get(), nullptr, nullptr }, callbacks, progress);
         }
-    }
 
-    return Status::Ok;
+        return status;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return Status::OutOfMemory;
+    }
+    catch (...)
+    {
+        return Status::EncodeFailed;
+    }
 }
 
-Status __stdcall GetMetadataId(heif_image_handle* imageHandle, MetadataType type, heif_item_id* id)
+Status __stdcall SaveRenditions(
+    const BitmapData* input,
+    const RenditionTarget* targets,
+    int32_t targetCount,
+    const EncoderOptions* options,
+    const EncoderMetadata* metadata,
+    const CICPColorData* colorData,
+    const ProgressProc progress)
 {
-    if (!imageHandle || !id)
+    if (!input || !targets || !options || !metadata || !colorData)
     {
         return Status::NullParameter;
     }
 
-    Status status;
+    for (int32_t i = 0; i < targetCount; i++)
+    {
+        if (!targets[i].callbacks)
+        {
+            return Status::NullParameter;
+        }
+    }
 
-    switch (type)
+    MemoryAccounting::ScopedOperation memoryOperation;
+    ThreadBudget::ScopedOperation threadOperation;
+
+    try
     {
-    case MetadataType::Exif:
-        status = GetExifMetadataID(imageHandle, id);
-        break;
-    case MetadataType::Xmp:
-        status = GetXmpMetadataID(imageHandle, id);
-        break;
-    default:
-        status = Status::InvalidParameter;
-        break;
+        std::vector<ScopedHeifContext> contexts;
+
+        Status status = HeicEncoder::EncodeRenditions(input, targets, targetCount, options, metadata, *colorData, progress, contexts);
+
+        // The files are written on the calling thread, the progress is reported after the last file.
+        for (int32_t i = 0; i < targetCount && status == Status::Ok; i++)
+        {
+            status = HeicWriter::SaveToFile(
+                { contexts[i].get(), nullptr, nullptr },
+                targets[i].callbacks,
+                i == targetCount - 1 ? progress : nullptr);
+        }
+
+        return status;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return Status::OutOfMemory;
+    }
+    catch (...)
+    {
+        return Status::EncodeFailed;
     }
+}
 
-    return status;
+Status __stdcall GetEncoderParameterList(EncoderParameterList* list)
+{
+    return HeicEncoder::GetParameterList(list);
+}
+
+void __stdcall FreeEncoderParameterList(EncoderParameterList* list)
+{
+    HeicEncoder::FreeParameterList(list);
 }
 
-Status __stdcall GetMetadataSize(heif_image_handle* imageHandle, heif_item_id id, size_t* size)
+EncoderSession* __stdcall CreateEncoderSession()
 {
-    if (!imageHandle || !size)
+    try
     {
-        return Status::NullParameter;
+        return new EncoderSession();
+    }
+    catch (...)
+    {
+        return nullptr;
     }
+}
 
-    *size = heif_image_handle_get_metadata_size(imageHandle, id);
-    return Status::Ok;
+bool __stdcall DeleteEncoderSession(EncoderSession* session)
+{
+    delete session;
+
+    return true;
 }
 
-Status __stdcall GetMetadata(heif_image_handle* imageHandle, heif_item_id id, uint8_t* buffer, size_t bufferSize)
+Status __stdcall AnalyzeImage(const BitmapData* input, ImageAnalysis* analysis)
 {
-    if (!imageHandle || !buffer)
+    if (!input || !analysis)
     {
         return Status::NullParameter;
     }
 
-    if (bufferSize < heif_image_handle_get_metadata_size(imageHandle, id))
+    try
     {
-        return Status::BufferTooSmall;
+        EncoderSessionCache::AnalyzeImage(input, analysis);
+
+        return Status::Ok;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return Status::OutOfMemory;
+    }
+    catch (...)
+    {
+        return Status::UnknownError;
+    }
+}
+
+Status __stdcall SaveToFileWithSession(
+    EncoderSession* session,
+    const BitmapData* input,
+    const ImageAnalysis* analysis,
+    const EncoderOptions* options,
+    const EncoderMetadata* metadata,
+    const CICPColorData* colorData,
+    IOCallbacks* callbacks,
+    const ProgressProc progress)
+{
+    if (!session || !input || !analysis || !options || !metadata || !colorData || !callbacks)
+    {
+        return Status::NullParameter;
     }
 
-    heif_error error = heif_image_handle_get_metadata(imageHandle, id, buffer);
+    MemoryAccounting::ScopedOperation memoryOperation;
+    ThreadBudget::ScopedOperation threadOperation;
 
-    if (error.code != heif_error_Ok)
+    try
     {
-        switch (error.code)
+        const EncodeCache::Lookup cacheLookup = EncodeCache::Find(input, analysis, options, metadata, *colorData);
+
+        if (cacheLookup.encodedData)
         {
-        case heif_error_Memory_allocation_error:
-            return Status::OutOfMemory;
-        default:
-            return Status::MetadataError;
+            HeicEncoder::SetLastSaveInfo(cacheLookup.saveInfo);
+
+            return HeicWriter::SaveToFile({ nullptr, cacheLookup.encodedData.get(), nullptr }, callbacks, progress);
         }
-    }
 
-    return Status::Ok;
+        ScopedHeifContext context(heif_context_alloc());
+
+        Status status = HeicEncoder::EncodeWithSession(
+            context.get(),
+            session,
+            input,
+            analysis,
+            options,
+            metadata,
+            *colorData,
+            progress);
+
+        if (status == Status::Ok)
+        {
+            HeicEncoder::RecordEncodeTime();
+
+            std::vector<uint8_t> encodedData;
+
+            status = HeicWriter::SaveToFile(
+                { context.get(), nullptr, cacheLookup.enabled ? &encodedData : nullptr },
+                callbacks,
+                progress);
+
+            if (status == Status::Ok)
+            {
+                EncodeCache::Add(cacheLookup, std::move(encodedData), HeicEncoder::GetLastSaveInfo());
+            }
+        }
+
+        return status;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return Status::OutOfMemory;
+    }
+    catch (...)
+    {
+        return Status::EncodeFailed;
+    }
 }
 
-Status __stdcall SaveToFile(
+Status __stdcall SaveToPath(
     const BitmapData* input,
     const EncoderOptions* options,
     const EncoderMetadata* metadata,
     const CICPColorData* colorData,
-    IOCallbacks* callbacks,
+    const char* path,
+    const FileOutputOptions* outputOptions,
     const ProgressProc progress)
 {
-    if (!input || !options || !metadata || !colorData || !callbacks)
+    if (!input || !options || !metadata || !colorData || !path || !outputOptions)
     {
         return Status::NullParameter;
     }
 
+    MemoryAccounting::ScopedOperation memoryOperation;
+    ThreadBudget::ScopedOperation threadOperation;
+
     try
     {
+        const EncodeCache::Lookup cacheLookup = EncodeCache::Find(input, nullptr, options, metadata, *colorData);
+
+        if (cacheLookup.encodedData)
+        {
+            HeicEncoder::SetLastSaveInfo(cacheLookup.saveInfo);
+
+            return HeicWriter::SaveToPath({ nullptr, cacheLookup.encodedData.get(), nullptr }, path, outputOptions, progress);
+        }
+
         ScopedHeifContext context(heif_context_alloc());
 
         Status status = HeicEncoder::Encode(context.get(), input, options, metadata, *colorData, progress);
 
         if (status == Status::Ok)
         {
-            status = HeicWriter::SaveToFile(context.get(), callbacks, progress);
+            HeicEncoder::RecordEncodeTime();
+
+            std::vector<uint8_t> encodedData;
+
+            status = HeicWriter::SaveToPath(
+                { context.get(), nullptr, cacheLookup.enabled ? &encodedData : nullptr },
+                path,
+                outputOptions,
+                progress);
+
+            if (status == Status::Ok)
+            {
+                EncodeCache::Add(cacheLookup, std::move(encodedData), HeicEncoder::GetLastSaveInfo());
+            }
         }
 
         return status;
@@ -353,6 +720,174 @@ Status __stdcall SaveToFile(
     }
 }
 
+void __stdcall FlushTrace()
+{
+    Trace::Flush();
+}
+
+Status __stdcall GetLastOperationMemoryUsage(MemoryUsage* usage)
+{
+    if (!usage)
+    {
+        return Status::NullParameter;
+    }
+
+    MemoryAccounting::GetLastOperationUsage(usage);
+
+    return Status::Ok;
+}
+
+Status __stdcall SetContextMemoryBudget(heif_context* context, uint64_t memoryBudget)
+{
+    if (!context)
+    {
+        return Status::NullParameter;
+    }
+
+    if (memoryBudget != 0)
+    {
+        heif_context_set_maximum_image_size_limit(context, MemoryAccounting::GetMaximumImageSize(memoryBudget));
+    }
+
+    return Status::Ok;
+}
+
+Status __stdcall GetLastMemoryBudgetFailure(MemoryBudgetFailure* failure)
+{
+    if (!failure)
+    {
+        return Status::NullParameter;
+    }
+
+    MemoryAccounting::GetLastBudgetFailure(failure);
+
+    return Status::Ok;
+}
+
+Status __stdcall SetThreadBudget(const ThreadBudgetOptions* options)
+{
+    return ThreadBudget::SetOptions(options);
+}
+
+Status __stdcall GetThreadBudget(ThreadBudgetOptions* options)
+{
+    if (!options)
+    {
+        return Status::NullParameter;
+    }
+
+    ThreadBudget::GetOptions(options);
+
+    return Status::Ok;
+}
+
+Status __stdcall GetPlanePoolStatistics(PlanePoolStatistics* statistics)
+{
+    if (!statistics)
+    {
+        return Status::NullParameter;
+    }
+
+    PlanePool::GetStatistics(statistics);
+
+    return Status::Ok;
+}
+
+Status __stdcall TrimPlanePool()
+{
+    PlanePool::Trim();
+
+    return Status::Ok;
+}
+
+Status __stdcall GetLastSaveInfo(SaveInfo* info)
+{
+    if (!info)
+    {
+        return Status::NullParameter;
+    }
+
+    *info = HeicEncoder::GetLastSaveInfo();
+
+    return Status::Ok;
+}
+
+Status __stdcall GetEncoderSpeedModel(EncoderSpeedModel* model)
+{
+    try
+    {
+        return PresetSelection::GetModel(model);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return Status::OutOfMemory;
+    }
+    catch (...)
+    {
+        return Status::UnknownError;
+    }
+}
+
+Status __stdcall SetEncoderSpeedModel(const EncoderSpeedModel* model)
+{
+    return PresetSelection::SetModel(model);
+}
+
+Status __stdcall GetPresetSelectionStatistics(PresetSelectionStatistics* statistics)
+{
+    if (!statistics)
+    {
+        return Status::NullParameter;
+    }
+
+    PresetSelection::GetStatistics(statistics);
+
+    return Status::Ok;
+}
+
+Status __stdcall SetEncodeCacheLimit(uint64_t maxBytes)
+{
+    EncodeCache::SetLimit(maxBytes);
+
+    return Status::Ok;
+}
+
+Status __stdcall GetEncodeCacheStatistics(EncodeCacheStatistics* statistics)
+{
+    if (!statistics)
+    {
+        return Status::NullParameter;
+    }
+
+    EncodeCache::GetStatistics(statistics);
+
+    return Status::Ok;
+}
+
+Status __stdcall ClearEncodeCache()
+{
+    EncodeCache::Clear();
+
+    return Status::Ok;
+}
+
+Status __stdcall GetProcessMemoryUsage(MemoryUsage* usage)
+{
+    if (!usage)
+    {
+        return Status::NullParameter;
+    }
+
+    MemoryAccounting::GetProcessUsage(usage);
+
+    return Status::Ok;
+}
+
+Status __stdcall EstimateMemory(int32_t width, int32_t height, const EncoderOptions* options, MemoryEstimate* estimate)
+{
+    return MemoryAccounting::EstimateMemory(width, height, options, estimate);
+}
+
 size_t __stdcall GetLibDe265VersionString(char* buffer, size_t length)
 {
     size_t result = 0;
@@ -18,11 +18,19 @@
 
 #pragma once
 
+#include "Platform.h"
+
+#if defined(_WIN32)
 #ifdef HEICFILETYPEPLUSIO_EXPORTS
 #define HEICFILETYPEPLUSIO_API __declspec(dllexport)
 #else
 #define HEICFILETYPEPLUSIO_API __declspec(dllimport)
 #endif
+#elif defined(HEICFILETYPEPLUSIO_EXPORTS)
+#define HEICFILETYPEPLUSIO_API __attribute__((visibility("default")))
+#else
+#define HEICFILETYPEPLUSIO_API
+#endif
 
 #include <stdint.h>
 #include "libheif/heif.h"
@@ -73,7 +81,9 @@ enum class YUVChromaSubsampling
     Subsampling420,
     Subsampling422,
     Subsampling444,
-    IdentityMatrix
+    IdentityMatrix,
+    // Selects 4:2:0, 4:2:2 or 4:4:4 from the amount of chroma detail in the image.
+    Automatic
 };
 
 struct CICPColorData
@@ -123,10 +133,13 @@ struct ColorBgra
     uint8_t a;
 };
 
+// This must be kept in sync with MetadataType.cs.
 enum class MetadataType
 {
     Exif,
-    Xmp
+    Xmp,
+    Mime,
+    Other
 };
 
 enum class EncoderPreset
@@ -140,7 +153,9 @@ enum class EncoderPreset
     Slow,
     Slower,
     VerySlow,
-    Placebo
+    Placebo,
+    // Selects the slowest preset that is predicted to fit the time budget in EncoderOptions.
+    Automatic
 };
 
 enum class EncoderTuning
@@ -152,6 +167,14 @@ enum class EncoderTuning
     None
 };
 
+// The value uses the heif_encoder_set_parameter format. The x265 parameters that libheif
+// does not list, e.g. wpp, pmode or ctu, are set using an x265: prefix.
+struct EncoderParameter
+{
+    const char* name;
+    const char* value;
+};
+
 struct EncoderOptions
 {
     int quality;
@@ -159,6 +182,108 @@ struct EncoderOptions
     EncoderPreset preset;
     EncoderTuning tuning;
     int tuIntraDepth;
+    // The maximum number of bytes that the encoder can use, 0 is unlimited.
+    // Images that do not fit are encoded as a grid of smaller tiles.
+    uint64_t memoryBudget;
+    // The encoder parameters that are applied after the preset and tuning,
+    // this can be null when the count is 0.
+    const EncoderParameter* parameters;
+    int32_t parameterCount;
+    // The time that EncoderPreset::Automatic selects the preset for, 0 or less selects the fastest preset.
+    int32_t timeBudgetMilliseconds;
+};
+
+enum class EncoderParameterType
+{
+    Integer,
+    Boolean,
+    String
+};
+
+struct EncoderParameterInfo
+{
+    const char* name;
+    EncoderParameterType type;
+    bool hasMinimum;
+    bool hasMaximum;
+    int32_t minimum;
+    int32_t maximum;
+    // The valid values of an integer parameter that is limited to a fixed set of values.
+    const int32_t* validIntegers;
+    int32_t validIntegerCount;
+    // The valid values of a string parameter, the count is 0 when all values are allowed.
+    const char* const* validStrings;
+    int32_t validStringCount;
+    // The default value in the heif_encoder_set_parameter format, or null if there is no default.
+    const char* defaultValue;
+};
+
+struct EncoderParameterList
+{
+    const EncoderParameterInfo* parameters;
+    int32_t count;
+    // A single buffer that contains the parameter list and all of its strings and values.
+    // It is owned by the native code and must be released with FreeEncoderParameterList.
+    uint8_t* arena;
+    uint64_t arenaSize;
+};
+
+enum class AutoQualityMetric
+{
+    Ssim,
+    MsSsim
+};
+
+// The settings that a save used after the automatic selections were applied.
+struct SaveInfo
+{
+    YUVChromaSubsampling yuvFormat;
+    EncoderPreset preset;
+    // The predicted and measured encode times when the preset was selected from a time budget, otherwise 0.
+    double predictedEncodeMilliseconds;
+    double encodeMilliseconds;
+};
+
+// The machine speed that EncoderPreset::Automatic uses to predict the encode time.
+struct EncoderSpeedModel
+{
+    // A model with a different version is ignored.
+    int32_t version;
+    // The megapixels per second that a single encoder thread compressed in the calibration encode.
+    double megapixelsPerSecond;
+};
+
+struct PresetSelectionStatistics
+{
+    // The number of encodes that used a preset selected from a time budget.
+    uint64_t selections;
+    // The encodes that took longer than their time budget.
+    uint64_t missedBudgets;
+    // The encodes where the measured time differed from the prediction by more than 50%.
+    uint64_t mispredictions;
+    // The mean of the measured time divided by the predicted time.
+    double meanTimeRatio;
+};
+
+struct AutoQualityOptions
+{
+    // The metric is measured on the luma plane of the decoded image.
+    AutoQualityMetric metric;
+    // The minimum similarity of the saved image, e.g. 0.98.
+    double target;
+    int32_t minQuality;
+    int32_t maxQuality;
+    // The maximum number of encodes, 0 uses the number required to search the whole quality range.
+    int32_t maxEncodes;
+};
+
+struct AutoQualityResult
+{
+    int32_t quality;
+    double similarity;
+    int32_t encodeCount;
+    // False if none of the encoded images met the target, the highest quality image is saved.
+    bool targetMet;
 };
 
 // This must be kept in sync with the NativeEncoderMetadata structure in EncoderMetadataCustomMarshaler.cs.
@@ -172,6 +297,209 @@ struct EncoderMetadata
     int32_t xmpSize;
 };
 
+// This must be kept in sync with SniffedFileType.cs.
+enum class SniffedFileType
+{
+    // The data does not start with a HEIF 'ftyp' box.
+    NotHeif,
+    // More data is required to determine the file type.
+    Unknown,
+    Heic,
+    Heif,
+    Avif,
+    ImageSequence,
+    // A JPEG image, these are sometimes saved with a HEIC file extension.
+    Jpeg
+};
+
+struct SniffResult
+{
+    SniffedFileType fileType;
+    uint32_t mainBrand;
+    // Indicates whether libheif has a decoder for the file.
+    bool supported;
+};
+
+enum class MetricsColorDomain
+{
+    Rgb,
+    // BT.709 full range YCbCr.
+    YCbCr
+};
+
+struct MetricsOptions
+{
+    MetricsColorDomain colorDomain;
+    bool computeMsSsim;
+    // The maximum number of threads to use, 0 uses all processors.
+    int32_t threadCount;
+};
+
+// The threads that are shared by all of the operations in the process, a value of 0 uses the default.
+struct ThreadBudgetOptions
+{
+    // The total number of threads, the default is the number of processors.
+    int32_t maxThreads;
+    // The maximum number of threads for a single operation of each type, the default is maxThreads.
+    int32_t encoderThreads;
+    int32_t decoderThreads;
+    int32_t kernelThreads;
+};
+
+struct MemoryUsage
+{
+    uint64_t currentBytes;
+    uint64_t peakBytes;
+};
+
+struct MemoryEstimate
+{
+    uint64_t encodeBytes;
+    uint64_t decodeBytes;
+};
+
+enum class MemoryBudgetFailureReason
+{
+    None,
+    // The image dimensions are larger than the context memory budget allows.
+    ImageTooLarge,
+    DecodeBudgetExceeded,
+    EncodeBudgetExceeded
+};
+
+struct MemoryBudgetFailure
+{
+    MemoryBudgetFailureReason reason;
+    uint64_t requiredBytes;
+    uint64_t budgetBytes;
+};
+
+struct PlanePoolStatistics
+{
+    // The number of buffer requests that reused a pooled buffer.
+    uint64_t hits;
+    // The number of buffer requests that allocated a new buffer.
+    uint64_t misses;
+    // The buffers that are held by the pool for reuse.
+    uint64_t retainedBuffers;
+    uint64_t retainedBytes;
+};
+
+// Elements 0 to 2 are the channels of the selected color domain, R, G, B or Y, Cb, Cr.
+// Element 3 combines the channels, YCbCr uses a 6:1:1 weighting and RGB weights the channels equally.
+// The PSNR of identical channels is infinity.
+struct EncodeCacheStatistics
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t entryCount;
+    uint64_t bytes;
+    uint64_t maxBytes;
+};
+
+struct ImageQualityMetrics
+{
+    double psnr[4];
+    double ssim[4];
+    double msSsim[4];
+};
+
+struct MetadataBlockLocation
+{
+    // The offset of the block from the start of the arena.
+    uint64_t offset;
+    uint64_t size;
+};
+
+// This must be kept in sync with MetadataBundle.cs.
+struct MetadataBlockInfo
+{
+    MetadataType type;
+    heif_item_id id;
+    MetadataBlockLocation data;
+    // The NUL-terminated content type string, the size includes the terminator.
+    MetadataBlockLocation contentType;
+};
+
+// This must be kept in sync with MetadataBundle.cs.
+struct MetadataBundle
+{
+    CICPColorData cicp;
+    MetadataBlockLocation iccProfile;
+    // The index of the first EXIF and XMP blocks in the block list, or -1 if not present.
+    int32_t exifIndex;
+    int32_t xmpIndex;
+    // The block list is stored at the start of the arena.
+    const MetadataBlockInfo* blocks;
+    int32_t blockCount;
+    // A single buffer that contains the block list and all of the metadata.
+    // It is owned by the native code and must be released with FreeMetadataBundle.
+    uint8_t* arena;
+    uint64_t arenaSize;
+};
+
+struct ProbeResult
+{
+    ImageHandleInfo imageInfo;
+    CICPColorData cicp;
+    MetadataBlockLocation iccProfile;
+    MetadataBlockLocation exif;
+    MetadataBlockLocation xmp;
+    // A single buffer that contains all of the metadata blocks.
+    // It is owned by the native code and must be released with FreeProbeResult.
+    uint8_t* arena;
+    uint64_t arenaSize;
+    // The total number of bytes that were read from the file.
+    uint64_t bytesRead;
+};
+
+// A 128-bit XXH3 hash, this must be kept in sync with ImageAnalysis.cs.
+struct ImageFingerprint
+{
+    uint64_t low64;
+    uint64_t high64;
+};
+
+// This must be kept in sync with ImageAnalysis.cs.
+struct ImageAnalysis
+{
+    // A hash of the image dimensions and pixels, the encoder session uses it as the image revision.
+    ImageFingerprint fingerprint;
+    bool grayscale;
+    bool hasTransparency;
+};
+
+// An opaque handle to the converted image cache used by SaveToFileWithSession.
+struct EncoderSession;
+
+// This must be kept in sync with LayerMetadata.cs.
+struct LayerMetadata
+{
+    // The XMP packet that stores the layer name, visibility, opacity and blend mode.
+    // It is attached to the layer image so that the layers can be restored when the file is loaded.
+    const uint8_t* xmp;
+    int32_t xmpSize;
+};
+
+struct RenditionTarget
+{
+    // The source image is downscaled to this size, it cannot be larger than the source.
+    int32_t width;
+    int32_t height;
+    int32_t quality;
+    EncoderPreset preset;
+    IOCallbacks* callbacks;
+};
+
+struct FileOutputOptions
+{
+    // Reserve the disk space for the output file before writing it.
+    bool preallocate;
+    // Write the image to a temporary file in the destination directory and
+    // rename it to the destination path once the write has completed.
+    bool atomicReplace;
+};
+
 HEICFILETYPEPLUSIO_API heif_context* __stdcall CreateContext();
 
 HEICFILETYPEPLUSIO_API bool __stdcall DeleteContext(heif_context* context);
@@ -180,6 +508,18 @@ HEICFILETYPEPLUSIO_API bool __stdcall DeleteImageHandle(heif_image_handle* handl
 
 HEICFILETYPEPLUSIO_API bool __stdcall DeleteImage(heif_image* handle);
 
+// Determines the file type from the start of the file without creating a context.
+// A few hundred bytes is enough to include the 'ftyp' box of most files.
+HEICFILETYPEPLUSIO_API Status __stdcall SniffFile(const uint8_t* data, size_t length, SniffResult* result);
+
+// Computes the PSNR, SSIM and optionally MS-SSIM of the distorted image compared to the reference image.
+// Both images must have the same dimensions, the alpha channel is ignored.
+HEICFILETYPEPLUSIO_API Status __stdcall ComputeImageMetrics(
+    const BitmapData* reference,
+    const BitmapData* distorted,
+    const MetricsOptions* options,
+    ImageQualityMetrics* metrics);
+
 HEICFILETYPEPLUSIO_API Status __stdcall LoadFileIntoContext(
     heif_context* context,
     IOCallbacks* callbacks,
@@ -191,26 +531,54 @@ HEICFILETYPEPLUSIO_API Status __stdcall GetPrimaryImage(
     ImageHandleInfo* info,
     const CopyErrorDetails copyErrorDetails);
 
+// Gets the handle of a top-level image, the image is decoded with DecodeImage.
+HEICFILETYPEPLUSIO_API Status __stdcall GetImage(
+    heif_context* context,
+    heif_item_id id,
+    heif_image_handle** imageHandle,
+    ImageHandleInfo* info,
+    const CopyErrorDetails copyErrorDetails);
+
+HEICFILETYPEPLUSIO_API Status __stdcall GetTopLevelImageCount(heif_context* context, int32_t* count);
+
+// Gets the item IDs of the top-level images, the primary image is always the first ID.
+HEICFILETYPEPLUSIO_API Status __stdcall GetTopLevelImageIds(heif_context* context, heif_item_id* ids, int32_t count);
+
+// Divides the decoder threads between the images that the caller decodes at the same time, including
+// the primary image. This must be called before any of the decodes start.
+HEICFILETYPEPLUSIO_API Status __stdcall SetConcurrentDecodes(heif_context* context, int32_t imageCount);
+
+// A memory budget of 0 is unlimited. When the conversion to the requested format does not fit in the
+// budget the image is decoded in its native format instead, the info reports the format that was used.
+// Reports the decoding progress through the callback. The cancellation is checked between the
+// decode stages: before libheif starts, and after it has decoded the tiles and the alpha image.
+// libheif cannot be stopped while it decodes, a cancellation during the decode discards the image
+// when heif_decode_image returns and UserCanceled is returned instead of the image.
 HEICFILETYPEPLUSIO_API Status __stdcall DecodeImage(
     heif_image_handle* const imageHandle,
     heif_colorspace colorSpace,
     heif_chroma chroma,
+    uint64_t memoryBudget,
     heif_image** outputImage,
-    DecodedImageInfo* info);
+    DecodedImageInfo* info,
+    const ProgressProc progress);
 
 HEICFILETYPEPLUSIO_API uint8_t* __stdcall GetHeifImageChannel(heif_image* image, heif_channel channel, int* channelStride);
 
-HEICFILETYPEPLUSIO_API Status __stdcall GetICCProfileSize(heif_image_handle* imageHandle, size_t* size);
-
-HEICFILETYPEPLUSIO_API Status __stdcall GetICCProfile(heif_image_handle* imageHandle, uint8_t* buffer, size_t bufferSize);
-
 HEICFILETYPEPLUSIO_API Status __stdcall GetCICPColorData(heif_image_handle* imageHandle, CICPColorData* data);
 
-HEICFILETYPEPLUSIO_API Status __stdcall GetMetadataId(heif_image_handle* imageHandle, MetadataType type, heif_item_id* id);
+// Reads the image properties and metadata of the primary image without decoding it.
+HEICFILETYPEPLUSIO_API Status __stdcall ProbeFile(
+    IOCallbacks* callbacks,
+    ProbeResult* result,
+    const CopyErrorDetails copyErrorDetails);
 
-HEICFILETYPEPLUSIO_API Status __stdcall GetMetadataSize(heif_image_handle* imageHandle, heif_item_id id, size_t* size);
+HEICFILETYPEPLUSIO_API void __stdcall FreeProbeResult(ProbeResult* result);
 
-HEICFILETYPEPLUSIO_API Status __stdcall GetMetadata(heif_image_handle* imageHandle, heif_item_id id, uint8_t* buffer, size_t bufferSize);
+// Reads the color information and all metadata blocks of the image in a single call.
+HEICFILETYPEPLUSIO_API Status __stdcall GetAllMetadata(heif_image_handle* imageHandle, MetadataBundle* bundle);
+
+HEICFILETYPEPLUSIO_API void __stdcall FreeMetadataBundle(MetadataBundle* bundle);
 
 HEICFILETYPEPLUSIO_API Status __stdcall SaveToFile(
     const BitmapData* input,
@@ -220,6 +588,143 @@ HEICFILETYPEPLUSIO_API Status __stdcall SaveToFile(
     IOCallbacks* callbacks,
     const ProgressProc progress);
 
+// Saves the image using the lowest quality in the range that meets the similarity target,
+// the quality in the encoder options is ignored.
+HEICFILETYPEPLUSIO_API Status __stdcall SaveToFileAutoQuality(
+    const BitmapData* input,
+    const EncoderOptions* options,
+    const AutoQualityOptions* autoQualityOptions,
+    const EncoderMetadata* metadata,
+    const CICPColorData* cicp,
+    IOCallbacks* callbacks,
+    const ProgressProc progress,
+    AutoQualityResult* result);
+
+// Saves the composite as the primary image and each layer as an additional top-level image.
+// The layers are ordered from the bottom layer to the top layer, each layer image has the XMP packet of its metadata.
+// The images are converted in parallel, but libheif can only add one image to a context at a time so the
+// images are compressed one after another.
+HEICFILETYPEPLUSIO_API Status __stdcall SaveLayersToFile(
+    const BitmapData* composite,
+    const BitmapData* layers,
+    const LayerMetadata* layerMetadata,
+    int32_t layerCount,
+    const EncoderOptions* options,
+    const EncoderMetadata* metadata,
+    const CICPColorData* cicp,
+    IOCallbacks* callbacks,
+    const ProgressProc progress);
+
+// Saves the image at several sizes, each target is written to its own callbacks.
+// The image is downscaled progressively from the largest target to the smallest, the chroma
+// subsampling analysis and the metadata are shared and the targets are encoded in parallel.
+// The quality and preset in the options are replaced by the values of each target.
+HEICFILETYPEPLUSIO_API Status __stdcall SaveRenditions(
+    const BitmapData* input,
+    const RenditionTarget* targets,
+    int32_t targetCount,
+    const EncoderOptions* options,
+    const EncoderMetadata* metadata,
+    const CICPColorData* cicp,
+    const ProgressProc progress);
+
+// Lists the parameters that the encoder supports, the x265 parameters that are
+// set using the x265: prefix are not included.
+HEICFILETYPEPLUSIO_API Status __stdcall GetEncoderParameterList(EncoderParameterList* list);
+
+HEICFILETYPEPLUSIO_API void __stdcall FreeEncoderParameterList(EncoderParameterList* list);
+
+HEICFILETYPEPLUSIO_API EncoderSession* __stdcall CreateEncoderSession();
+
+HEICFILETYPEPLUSIO_API bool __stdcall DeleteEncoderSession(EncoderSession* session);
+
+// Determines if the image is gray-scale or has transparency and computes its fingerprint, in a single pass.
+HEICFILETYPEPLUSIO_API Status __stdcall AnalyzeImage(const BitmapData* input, ImageAnalysis* analysis);
+
+// Saves the image using the converted image that is cached in the session, only the
+// compression is repeated when the fingerprint, YUV format and color data are unchanged.
+HEICFILETYPEPLUSIO_API Status __stdcall SaveToFileWithSession(
+    EncoderSession* session,
+    const BitmapData* input,
+    const ImageAnalysis* analysis,
+    const EncoderOptions* options,
+    const EncoderMetadata* metadata,
+    const CICPColorData* cicp,
+    IOCallbacks* callbacks,
+    const ProgressProc progress);
+
+// The path is a UTF-8 encoded string.
+HEICFILETYPEPLUSIO_API Status __stdcall SaveToPath(
+    const BitmapData* input,
+    const EncoderOptions* options,
+    const EncoderMetadata* metadata,
+    const CICPColorData* cicp,
+    const char* path,
+    const FileOutputOptions* outputOptions,
+    const ProgressProc progress);
+
+// Gets the memory used by the last load, decode or save operation on the calling thread.
+// The current bytes include the decoded image, which is charged until DeleteImage is called.
+HEICFILETYPEPLUSIO_API Status __stdcall GetLastOperationMemoryUsage(MemoryUsage* usage);
+
+// Limits the image size that LoadFileIntoContext accepts to the images that can be decoded within the budget.
+// This must be called before LoadFileIntoContext.
+HEICFILETYPEPLUSIO_API Status __stdcall SetContextMemoryBudget(heif_context* context, uint64_t memoryBudget);
+
+// Gets the reason that the last operation on the calling thread returned Status::OutOfMemory
+// because of its memory budget.
+HEICFILETYPEPLUSIO_API Status __stdcall GetLastMemoryBudgetFailure(MemoryBudgetFailure* failure);
+
+// The threads are divided equally between the operations that are running at the same time,
+// each operation is also limited to the thread count for its type.
+HEICFILETYPEPLUSIO_API Status __stdcall SetThreadBudget(const ThreadBudgetOptions* options);
+
+HEICFILETYPEPLUSIO_API Status __stdcall GetThreadBudget(ThreadBudgetOptions* options);
+
+// Gets the hit and miss counts of the staging buffer pool and the memory that it retains.
+HEICFILETYPEPLUSIO_API Status __stdcall GetPlanePoolStatistics(PlanePoolStatistics* statistics);
+
+// Frees the buffers that the staging buffer pool retains for reuse.
+HEICFILETYPEPLUSIO_API Status __stdcall TrimPlanePool();
+
+// Gets the settings that the last save on the calling thread used, e.g. the
+// chroma subsampling that YUVChromaSubsampling::Automatic selected.
+HEICFILETYPEPLUSIO_API Status __stdcall GetLastSaveInfo(SaveInfo* info);
+
+// Gets the speed model that EncoderPreset::Automatic uses, the model is calibrated
+// with a short encode the first time that it is used in the process.
+HEICFILETYPEPLUSIO_API Status __stdcall GetEncoderSpeedModel(EncoderSpeedModel* model);
+
+// Restores a speed model that GetEncoderSpeedModel returned, this allows the
+// host to keep the calibration between processes.
+HEICFILETYPEPLUSIO_API Status __stdcall SetEncoderSpeedModel(const EncoderSpeedModel* model);
+
+HEICFILETYPEPLUSIO_API Status __stdcall GetPresetSelectionStatistics(PresetSelectionStatistics* statistics);
+
+// Sets the maximum size of the files in the encode cache, 0 disables the cache.
+// When enabled, the save functions write the cached file for images that were previously
+// saved with the same options, color data and metadata instead of encoding them again.
+HEICFILETYPEPLUSIO_API Status __stdcall SetEncodeCacheLimit(uint64_t maxBytes);
+
+HEICFILETYPEPLUSIO_API Status __stdcall GetEncodeCacheStatistics(EncodeCacheStatistics* statistics);
+
+HEICFILETYPEPLUSIO_API Status __stdcall ClearEncodeCache();
+
+// Gets the memory used by all of the operations in the process.
+HEICFILETYPEPLUSIO_API Status __stdcall GetProcessMemoryUsage(MemoryUsage* usage);
+
+// Estimates the peak memory required to encode and decode an image with the specified options.
+// The estimate assumes that the image has an alpha channel, it does not include the BGRA input or output image.
+HEICFILETYPEPLUSIO_API Status __stdcall EstimateMemory(
+    int32_t width,
+    int32_t height,
+    const EncoderOptions* options,
+    MemoryEstimate* estimate);
+
+// Writes the trace events that have been recorded so far, this does nothing
+// unless the HEICFILETYPEPLUS_TRACE_FILE environment variable is set.
+HEICFILETYPEPLUSIO_API void __stdcall FlushTrace();
+
 HEICFILETYPEPLUSIO_API size_t __stdcall GetLibDe265VersionString(char* buffer, size_t length);
 
 HEICFILETYPEPLUSIO_API size_t __stdcall GetLibHeifVersionString(char* buffer, size_t length);
@@ -17,8 +17,54 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "HeicMetadata.h"
+#include "HeicReader.h"
+#include <new>
 #include <vector>
 
+namespace
+{
+    constexpr const char* XmpContentType = "application/rdf+xml";
+
+    struct MetadataBlockEntry
+    {
+        heif_item_id id;
+        MetadataType type;
+        const char* contentType;
+        size_t contentTypeSize;
+        size_t size;
+    };
+
+    MetadataType GetMetadataType(const char* itemType, const char* contentType)
+    {
+        if (itemType)
+        {
+            if (strcmp(itemType, "Exif") == 0)
+            {
+                return MetadataType::Exif;
+            }
+            else if (strcmp(itemType, "mime") == 0)
+            {
+                return contentType && strcmp(contentType, XmpContentType) == 0 ? MetadataType::Xmp : MetadataType::Mime;
+            }
+        }
+
+        return MetadataType::Other;
+    }
+
+    Status ToMetadataStatus(const heif_error& error)
+    {
+        switch (error.code)
+        {
+        case heif_error_Ok:
+            return Status::Ok;
+        case heif_error_Memory_allocation_error:
+            return Status::OutOfMemory;
+        default:
+            return Status::MetadataError;
+        }
+    }
+}
+
 
 Status AddExifToImage(heif_context* const context, heif_image_handle* const image, const uint8_t* exif, int exifSize)
 {
@@ -172,7 +218,7 @@ Status GetXmpMetadataID(heif_image_handle* const handle, heif_item_id* xmpId)
                 const heif_item_id id = ids[i];
                 const char* contentType = heif_image_handle_get_metadata_content_type(handle, id);
 
-                if (strcmp(contentType, "application/rdf+xml") == 0)
+                if (strcmp(contentType, XmpContentType) == 0)
                 {
                     *xmpId = id;
                     return Status::Ok;
@@ -191,3 +237,161 @@ Status GetXmpMetadataID(heif_image_handle* const handle, heif_item_id* xmpId)
 
     return Status::NoMatchingMetadata;
 }
+
+Status GetMetadataBundle(heif_image_handle* const handle, MetadataBundle* bundle)
+{
+    if (!handle || !bundle)
+    {
+        return Status::NullParameter;
+    }
+
+    *bundle = {};
+    bundle->exifIndex = -1;
+    bundle->xmpIndex = -1;
+
+    try
+    {
+        Status status = HeicReader::GetCICPColorData(handle, &bundle->cicp);
+
+        if (status != Status::Ok)
+        {
+            return status;
+        }
+
+        const int blockCount = heif_image_handle_get_number_of_metadata_blocks(handle, nullptr);
+
+        std::vector<heif_item_id> ids(static_cast<size_t>(blockCount));
+        std::vector<MetadataBlockEntry> entries;
+        entries.reserve(ids.size());
+
+        if (blockCount > 0 && heif_image_handle_get_list_of_metadata_block_IDs(handle, nullptr, ids.data(), blockCount) != blockCount)
+        {
+            return Status::MetadataError;
+        }
+
+        for (const heif_item_id id : ids)
+        {
+            const char* contentType = heif_image_handle_get_metadata_content_type(handle, id);
+
+            MetadataBlockEntry entry{};
+            entry.id = id;
+            entry.type = GetMetadataType(heif_image_handle_get_metadata_type(handle, id), contentType);
+            entry.contentType = contentType ? contentType : "";
+            entry.contentTypeSize = strlen(entry.contentType) + 1;
+            entry.size = heif_image_handle_get_metadata_size(handle, id);
+
+            entries.push_back(entry);
+        }
+
+        const heif_color_profile_type profileType = heif_image_handle_get_color_profile_type(handle);
+        const size_t iccProfileSize = profileType == heif_color_profile_type_prof || profileType == heif_color_profile_type_rICC
+            ? heif_image_handle_get_raw_color_profile_size(handle)
+            : 0;
+
+        // The arena layout is the block list, followed by the ICC profile, the metadata
+        // blocks and the content type strings.
+        uint64_t arenaSize = sizeof(MetadataBlockInfo) * entries.size();
+        const uint64_t iccProfileOffset = arenaSize;
+        arenaSize += iccProfileSize;
+
+        for (const MetadataBlockEntry& entry : entries)
+        {
+            arenaSize += entry.size + entry.contentTypeSize;
+        }
+
+        if (arenaSize == 0)
+        {
+            return Status::Ok;
+        }
+
+        // The block list is placed at the start of the arena, new[] returns memory that
+        // is suitably aligned for it.
+        uint8_t* arena = new (std::nothrow) uint8_t[arenaSize];
+
+        if (!arena)
+        {
+            return Status::OutOfMemory;
+        }
+
+        bundle->arena = arena;
+        bundle->arenaSize = arenaSize;
+
+        if (iccProfileSize > 0)
+        {
+            heif_error error = heif_image_handle_get_raw_color_profile(handle, arena + iccProfileOffset);
+
+            if (error.code != heif_error_Ok)
+            {
+                ReleaseMetadataBundle(bundle);
+                return error.code == heif_error_Memory_allocation_error ? Status::OutOfMemory : Status::ColorInformationError;
+            }
+
+            bundle->iccProfile = { iccProfileOffset, iccProfileSize };
+        }
+
+        MetadataBlockInfo* blocks = reinterpret_cast<MetadataBlockInfo*>(arena);
+        uint64_t offset = iccProfileOffset + iccProfileSize;
+
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            const MetadataBlockEntry& entry = entries[i];
+            MetadataBlockInfo& block = blocks[i];
+
+            block.type = entry.type;
+            block.id = entry.id;
+            block.data = { offset, entry.size };
+            offset += entry.size;
+
+            if (entry.size > 0)
+            {
+                status = ToMetadataStatus(heif_image_handle_get_metadata(handle, entry.id, arena + block.data.offset));
+
+                if (status != Status::Ok)
+                {
+                    ReleaseMetadataBundle(bundle);
+                    return status;
+                }
+            }
+
+            block.contentType = { offset, entry.contentTypeSize };
+            memcpy(arena + offset, entry.contentType, entry.contentTypeSize);
+            offset += entry.contentTypeSize;
+
+            if (entry.type == MetadataType::Exif && bundle->exifIndex == -1)
+            {
+                bundle->exifIndex = static_cast<int32_t>(i);
+            }
+            else if (entry.type == MetadataType::Xmp && bundle->xmpIndex == -1)
+            {
+                bundle->xmpIndex = static_cast<int32_t>(i);
+            }
+        }
+
+        bundle->blocks = blocks;
+        bundle->blockCount = static_cast<int32_t>(entries.size());
+    }
+    catch (const std::bad_alloc&)
+    {
+        ReleaseMetadataBundle(bundle);
+        return Status::OutOfMemory;
+    }
+    catch (...)
+    {
+        ReleaseMetadataBundle(bundle);
+        return Status::MetadataError;
+    }
+
+    return Status::Ok;
+}
+
+void ReleaseMetadataBundle(MetadataBundle* bundle)
+{
+    if (bundle)
+    {
+        delete[] bundle->arena;
+        bundle->arena = nullptr;
+        bundle->arenaSize = 0;
+        bundle->blocks = nullptr;
+        bundle->blockCount = 0;
+    }
+}
@@ -39,3 +39,7 @@ Status AddXmpToImage(
 Status GetExifMetadataID(heif_image_handle* const handle, heif_item_id* exifId);
 
 Status GetXmpMetadataID(heif_image_handle* const handle, heif_item_id* xmpId);
+
+Status GetMetadataBundle(heif_image_handle* const handle, MetadataBundle* bundle);
+
+void ReleaseMetadataBundle(MetadataBundle* bundle);
@@ -0,0 +1,249 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "HeicProbe.h"
+#include "HeicMetadata.h"
+#include "HeicReader.h"
+#include "scoped.h"
+#include <new>
+
+namespace
+{
+    struct MetadataSizes
+    {
+        size_t iccProfile;
+        heif_item_id exifId;
+        size_t exif;
+        heif_item_id xmpId;
+        size_t xmp;
+    };
+
+    Status GetMetadataSizes(heif_image_handle* const handle, const ImageHandleInfo& info, MetadataSizes& sizes)
+    {
+        sizes = {};
+
+        if (info.colorProfileType == ImageHandleColorProfileType::Icc)
+        {
+            sizes.iccProfile = heif_image_handle_get_raw_color_profile_size(handle);
+        }
+
+        Status status = GetExifMetadataID(handle, &sizes.exifId);
+
+        if (status == Status::Ok)
+        {
+            sizes.exif = heif_image_handle_get_metadata_size(handle, sizes.exifId);
+        }
+        else if (status != Status::NoMatchingMetadata)
+        {
+            return status;
+        }
+
+        status = GetXmpMetadataID(handle, &sizes.xmpId);
+
+        if (status == Status::Ok)
+        {
+            sizes.xmp = heif_image_handle_get_metadata_size(handle, sizes.xmpId);
+        }
+        else if (status != Status::NoMatchingMetadata)
+        {
+            return status;
+        }
+
+        return Status::Ok;
+    }
+
+    Status CopyMetadataBlock(
+        heif_image_handle* const handle,
+        heif_item_id id,
+        uint8_t* const arena,
+        MetadataBlockLocation& location)
+    {
+        if (location.size == 0)
+        {
+            return Status::Ok;
+        }
+
+        heif_error error = heif_image_handle_get_metadata(handle, id, arena + location.offset);
+
+        if (error.code != heif_error_Ok)
+        {
+            switch (error.code)
+            {
+            case heif_error_Memory_allocation_error:
+                return Status::OutOfMemory;
+            default:
+                return Status::MetadataError;
+            }
+        }
+
+        return Status::Ok;
+    }
+
+    Status FillMetadataArena(heif_image_handle* const handle, const MetadataSizes& sizes, ProbeResult* const result)
+    {
+        result->iccProfile = { 0, sizes.iccProfile };
+        result->exif = { result->iccProfile.offset + result->iccProfile.size, sizes.exif };
+        result->xmp = { result->exif.offset + result->exif.size, sizes.xmp };
+
+        const uint64_t arenaSize = result->xmp.offset + result->xmp.size;
+
+        if (arenaSize == 0)
+        {
+            return Status::Ok;
+        }
+
+        result->arena = new (std::nothrow) uint8_t[arenaSize];
+
+        if (!result->arena)
+        {
+            return Status::OutOfMemory;
+        }
+
+        result->arenaSize = arenaSize;
+
+        if (result->iccProfile.size > 0)
+        {
+            heif_error error = heif_image_handle_get_raw_color_profile(handle, result->arena + result->iccProfile.offset);
+
+            if (error.code != heif_error_Ok)
+            {
+                switch (error.code)
+                {
+                case heif_error_Memory_allocation_error:
+                    return Status::OutOfMemory;
+                default:
+                    return Status::ColorInformationError;
+                }
+            }
+        }
+
+        Status status = CopyMetadataBlock(handle, sizes.exifId, result->arena, result->exif);
+
+        if (status == Status::Ok)
+        {
+            status = CopyMetadataBlock(handle, sizes.xmpId, result->arena, result->xmp);
+        }
+
+        return status;
+    }
+}
+
+Status HeicProbe::ProbeFile(
+    IOCallbacks* const callbacks,
+    ProbeResult* const result,
+    const CopyErrorDetails copyErrorDetails)
+{
+    if (!callbacks || !result)
+    {
+        return Status::NullParameter;
+    }
+
+    *result = {};
+
+    try
+    {
+        // The reader state is declared first so that it outlives the context.
+        HeicReader::ReaderState state{ callbacks, 0 };
+
+        ScopedHeifContext context(heif_context_alloc());
+
+        if (!context)
+        {
+            return Status::OutOfMemory;
+        }
+
+        // libheif only reads the file header boxes when loading the context, the image
+        // data in the 'mdat' box is not read until an image is decoded.
+        Status status = HeicReader::LoadFileIntoContext(context.get(), &state, copyErrorDetails);
+
+        if (status == Status::Ok)
+        {
+            heif_image_handle* handle;
+
+            heif_error error = heif_context_get_primary_image_handle(context.get(), &handle);
+
+            if (error.code != heif_error_Ok)
+            {
+                switch (error.code)
+                {
+                case heif_error_Memory_allocation_error:
+                    status = Status::OutOfMemory;
+                    break;
+                default:
+                    if (copyErrorDetails)
+                    {
+                        copyErrorDetails(error.message);
+                    }
+                    status = Status::InvalidFile;
+                    break;
+                }
+            }
+
+            if (status == Status::Ok)
+            {
+                ScopedHeifImageHandle primaryImage(handle);
+
+                HeicReader::GetImageHandleInfo(primaryImage.get(), &result->imageInfo);
+
+                status = HeicReader::GetCICPColorData(primaryImage.get(), &result->cicp);
+
+                if (status == Status::Ok)
+                {
+                    MetadataSizes sizes;
+
+                    status = GetMetadataSizes(primaryImage.get(), result->imageInfo, sizes);
+
+                    if (status == Status::Ok)
+                    {
+                        status = FillMetadataArena(primaryImage.get(), sizes, result);
+                    }
+                }
+            }
+        }
+
+        result->bytesRead = state.bytesRead;
+
+        if (status != Status::Ok)
+        {
+            HeicProbe::FreeProbeResult(result);
+        }
+
+        return status;
+    }
+    catch (const std::bad_alloc&)
+    {
+        HeicProbe::FreeProbeResult(result);
+        return Status::OutOfMemory;
+    }
+    catch (...)
+    {
+        HeicProbe::FreeProbeResult(result);
+        return Status::UnknownError;
+    }
+}
+
+void HeicProbe::FreeProbeResult(ProbeResult* const result)
+{
+    if (result)
+    {
+        delete[] result->arena;
+        result->arena = nullptr;
+        result->arenaSize = 0;
+    }
+}
@@ -17,8 +17,15 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "HeicReader.h"
+#include "MemoryAccounting.h"
+#include "ThreadBudget.h"
+#include "Trace.h"
+#include "scoped.h"
+#include <algorithm>
 #include <stdexcept>
 
+using HeicReader::ReaderState;
+
 namespace
 {
     int64_t get_position(void* userdata)
@@ -32,6 +39,8 @@ namespace
     {
         const IOCallbacks* callbacks = static_cast<IOCallbacks*>(userdata);
 
+        Trace::CountRead(size);
+
         return callbacks->Read(data, size);
     }
 
@@ -49,6 +58,149 @@ namespace
 
         return target_size > length ? heif_reader_grow_status_size_beyond_eof : heif_reader_grow_status_size_reached;
     }
+
+    int64_t state_get_position(void* userdata)
+    {
+        return get_position(static_cast<ReaderState*>(userdata)->callbacks);
+    }
+
+    int state_read(void* data, size_t size, void* userdata)
+    {
+        ReaderState* state = static_cast<ReaderState*>(userdata);
+
+        const int result = read(data, size, state->callbacks);
+
+        if (result == 0)
+        {
+            state->bytesRead += size;
+        }
+
+        return result;
+    }
+
+    int state_seek(int64_t position, void* userdata)
+    {
+        return seek(position, static_cast<ReaderState*>(userdata)->callbacks);
+    }
+
+    heif_reader_grow_status state_wait_for_file_size(int64_t target_size, void* userdata)
+    {
+        return wait_for_file_size(target_size, static_cast<ReaderState*>(userdata)->callbacks);
+    }
+
+    Status ReadFromReader(
+        heif_context* const context,
+        const heif_reader* reader,
+        void* userdata,
+        const CopyErrorDetails copyErrorDetails)
+    {
+        Trace::ScopedEvent traceEvent("LoadFileIntoContext");
+
+        Status status = Status::Ok;
+
+        try
+        {
+            heif_context_set_max_decoding_threads(context, ThreadBudget::GetThreads(ThreadBudget::Operation::Decode));
+
+            const heif_error error = heif_context_read_from_reader(context, reader, userdata, nullptr);
+
+            if (error.code != heif_error_Ok)
+            {
+                switch (error.code)
+                {
+                case heif_error_Memory_allocation_error:
+                    if (error.subcode == heif_suberror_Security_limit_exceeded)
+                    {
+                        // The image is larger than the limit that SetContextMemoryBudget placed on the context.
+                        status = MemoryAccounting::ReportBudgetFailure(MemoryBudgetFailureReason::ImageTooLarge, 0, 0);
+                        break;
+                    }
+                    status = Status::OutOfMemory;
+                    break;
+                case heif_error_Unsupported_feature:
+                    if (copyErrorDetails)
+                    {
+                        copyErrorDetails(error.message);
+                    }
+                    status = Status::UnsupportedFeature;
+                    break;
+                case heif_error_Unsupported_filetype:
+                    status = Status::UnsupportedFormat;
+                    break;
+                case heif_error_Invalid_input:
+                    if (error.subcode == heif_suberror_No_ftyp_box)
+                    {
+                        status = Status::NoFtypBox;
+                        break;
+                    }
+                    [[fallthrough]];
+                default:
+                    if (copyErrorDetails)
+                    {
+                        copyErrorDetails(error.message);
+                    }
+                    status = Status::InvalidFile;
+                    break;
+                }
+            }
+        }
+        catch (const std::bad_alloc&)
+        {
+            return Status::OutOfMemory;
+        }
+        catch (...)
+        {
+            return Status::UnknownError;
+        }
+
+        return status;
+    }
+
+    struct DecodeProgressState
+    {
+        ProgressProc callback;
+        int maxProgress;
+        // Set when the callback cancels a progress report while libheif is decoding.
+        bool canceled;
+    };
+
+    void start_progress(heif_progress_step step, int max_progress, void* progress_user_data)
+    {
+        DecodeProgressState* state = static_cast<DecodeProgressState*>(progress_user_data);
+
+        if (step == heif_progress_step_total)
+        {
+            state->maxProgress = max_progress;
+        }
+    }
+
+    void on_progress(heif_progress_step step, int progress, void* progress_user_data)
+    {
+        DecodeProgressState* state = static_cast<DecodeProgressState*>(progress_user_data);
+
+        if (step == heif_progress_step_total && state->maxProgress > 0)
+        {
+            const double percent = (static_cast<double>(progress) / static_cast<double>(state->maxProgress)) * 100.0;
+
+            // The bundled libheif version does not have the cancel_decoding hook, so the decoder
+            // cannot be stopped between the tiles. The request is honored when heif_decode_image
+            // returns, before the image is passed on to the color conversion.
+            if (!state->canceled && !state->callback(percent))
+            {
+                state->canceled = true;
+            }
+        }
+    }
+
+    void end_progress(heif_progress_step step, void* progress_user_data)
+    {
+        DecodeProgressState* state = static_cast<DecodeProgressState*>(progress_user_data);
+
+        if (step == heif_progress_step_total)
+        {
+            state->maxProgress = 0;
+        }
+    }
 }
 
 Status HeicReader::LoadFileIntoContext(
@@ -61,57 +213,189 @@ Status HeicReader::LoadFileIntoContext(
         return Status::NullParameter;
     }
 
-    Status status = Status::Ok;
-
     static heif_reader reader = { 1, get_position, read, seek, wait_for_file_size };
 
-    try
+    return ReadFromReader(context, &reader, callbacks, copyErrorDetails);
+}
+
+Status HeicReader::LoadFileIntoContext(
+    heif_context* const context,
+    ReaderState* const state,
+    const CopyErrorDetails copyErrorDetails)
+{
+    if (!context || !state || !state->callbacks)
     {
-        const heif_error error = heif_context_read_from_reader(context, &reader, callbacks, nullptr);
+        return Status::NullParameter;
+    }
+
+    static heif_reader reader = { 1, state_get_position, state_read, state_seek, state_wait_for_file_size };
+
+    return ReadFromReader(context, &reader, state, copyErrorDetails);
+}
+
+void HeicReader::GetImageHandleInfo(heif_image_handle* const imageHandle, ImageHandleInfo* const info)
+{
+    info->width = heif_image_handle_get_width(imageHandle);
+    info->height = heif_image_handle_get_height(imageHandle);
+    info->bitDepth = heif_image_handle_get_luma_bits_per_pixel(imageHandle);
+
+    switch (heif_image_handle_get_color_profile_type(imageHandle))
+    {
+    case heif_color_profile_type_prof:
+    case heif_color_profile_type_rICC:
+        info->colorProfileType = ImageHandleColorProfileType::Icc;
+        break;
+    case heif_color_profile_type_nclx:
+        info->colorProfileType = ImageHandleColorProfileType::Cicp;
+        break;
+    case heif_color_profile_type_not_present:
+    default:
+        info->colorProfileType = ImageHandleColorProfileType::NotPresent;
+        break;
+    }
+
+    info->hasAlpha = heif_image_handle_has_alpha_channel(imageHandle);
+    info->isAlphaChannelPremultiplied = info->hasAlpha && heif_image_handle_is_premultiplied_alpha(imageHandle);
+}
+
+Status HeicReader::GetCICPColorData(heif_image_handle* const imageHandle, CICPColorData* const data)
+{
+    if (!imageHandle || !data)
+    {
+        return Status::NullParameter;
+    }
+
+    heif_color_profile_nclx* nclxProfile;
+
+    heif_error error = heif_image_handle_get_nclx_color_profile(imageHandle, &nclxProfile);
+
+    if (error.code == heif_error_Ok)
+    {
+        data->colorPrimaries = nclxProfile->color_primaries;
+        data->transferCharacteristics = nclxProfile->transfer_characteristics;
+        data->matrixCoefficients = nclxProfile->matrix_coefficients;
+        data->fullRange = nclxProfile->full_range_flag;
+
+        heif_nclx_color_profile_free(nclxProfile);
+    }
+    else if (error.code == heif_error_Color_profile_does_not_exist)
+    {
+        data->colorPrimaries = heif_color_primaries_unspecified;
+        data->transferCharacteristics = heif_transfer_characteristic_unspecified;
+        data->matrixCoefficients = heif_matrix_coefficients_unspecified;
+        data->fullRange = false;
+    }
+    else
+    {
+        switch (error.code)
+        {
+        case heif_error_Memory_allocation_error:
+            return Status::OutOfMemory;
+        default:
+            return Status::ColorInformationError;
+        }
+    }
+
+    return Status::Ok;
+}
+
+Status HeicReader::DecodeImage(
+    heif_image_handle* const imageHandle,
+    heif_colorspace colorSpace,
+    heif_chroma chroma,
+    uint64_t memoryBudget,
+    const ProgressProc progressCallback,
+    heif_image** outputImage)
+{
+    Trace::ScopedEvent traceEvent("DecodeImage");
+
+    if (memoryBudget != 0)
+    {
+        uint64_t requiredBytes = MemoryAccounting::EstimateDecodeBytes(imageHandle, colorSpace, chroma);
+
+        if (requiredBytes > memoryBudget && (colorSpace != heif_colorspace_undefined || chroma != heif_chroma_undefined))
+        {
+            // Decoding to the native format of the image avoids the memory used by the color conversion,
+            // the caller checks the DecodedImageInfo to determine the output format.
+            colorSpace = heif_colorspace_undefined;
+            chroma = heif_chroma_undefined;
+            requiredBytes = MemoryAccounting::EstimateDecodeBytes(imageHandle, colorSpace, chroma);
+        }
+
+        if (requiredBytes > memoryBudget)
+        {
+            return MemoryAccounting::ReportBudgetFailure(
+                MemoryBudgetFailureReason::DecodeBudgetExceeded,
+                requiredBytes,
+                memoryBudget);
+        }
+    }
+
+    ScopedHeifDecodingOptions options(heif_decoding_options_alloc());
+
+    if (!options)
+    {
+        return Status::OutOfMemory;
+    }
+
+    DecodeProgressState progressState{ progressCallback, 0, false };
+
+    if (progressCallback)
+    {
+        if (!progressCallback(0.0))
+        {
+            return Status::UserCanceled;
+        }
+
+        options->start_progress = start_progress;
+        options->on_progress = on_progress;
+        options->end_progress = end_progress;
+        options->progress_user_data = &progressState;
+    }
+
+    ScopedHeifImage image;
+
+    {
+        MemoryAccounting::ScopedCharge decoderCharge(MemoryAccounting::EstimateDecoderWorkingSet(
+            heif_image_handle_get_width(imageHandle),
+            heif_image_handle_get_height(imageHandle),
+            chroma));
+
+        heif_image* decodedImage = nullptr;
+
+        heif_error error = heif_decode_image(imageHandle, &decodedImage, colorSpace, chroma, options.get());
+
+        image.reset(decodedImage);
 
         if (error.code != heif_error_Ok)
         {
             switch (error.code)
             {
             case heif_error_Memory_allocation_error:
-                status = Status::OutOfMemory;
-                break;
-            case heif_error_Unsupported_feature:
-                if (copyErrorDetails)
-                {
-                    copyErrorDetails(error.message);
-                }
-                status = Status::UnsupportedFeature;
-                break;
-            case heif_error_Unsupported_filetype:
-                status = Status::UnsupportedFormat;
-                break;
-            case heif_error_Invalid_input:
-                if (error.subcode == heif_suberror_No_ftyp_box)
-                {
-                    status = Status::NoFtypBox;
-                    break;
-                }
-                [[fallthrough]];
+                return Status::OutOfMemory;
             default:
-                if (copyErrorDetails)
-                {
-                    copyErrorDetails(error.message);
-                }
-                status = Status::InvalidFile;
-                break;
+                return Status::DecodeFailed;
             }
         }
     }
-    catch (const std::bad_alloc&)
-    {
-        return Status::OutOfMemory;
-    }
-    catch (...)
+
+    if (progressCallback)
     {
-        return Status::UnknownError;
+        // The decoded image is discarded when the decode was canceled, the caller skips the color conversion.
+        if (progressState.canceled || !progressCallback(100.0))
+        {
+            return Status::UserCanceled;
+        }
     }
 
-    return status;
+    *outputImage = image.release();
+    return Status::Ok;
 }
 
+void HeicReader::SetConcurrentDecodes(heif_context* const context, int32_t imageCount)
+{
+    const int decoderThreads = ThreadBudget::GetThreads(ThreadBudget::Operation::Decode);
+    const int concurrentImages = std::clamp(static_cast<int>(imageCount), 1, decoderThreads);
+
+    heif_context_set_max_decoding_threads(context, std::max(decoderThreads / concurrentImages, 1));
+}
@@ -22,8 +22,37 @@
 
 namespace HeicReader
 {
+    struct ReaderState
+    {
+        IOCallbacks* callbacks;
+        uint64_t bytesRead;
+    };
+
     Status LoadFileIntoContext(
         heif_context* const context,
         IOCallbacks* const callbacks,
         const CopyErrorDetails copyErrorDetails);
+
+    // libheif reads the image data on demand, so the state must remain
+    // valid until the context is freed.
+    Status LoadFileIntoContext(
+        heif_context* const context,
+        ReaderState* const state,
+        const CopyErrorDetails copyErrorDetails);
+
+    void GetImageHandleInfo(heif_image_handle* const imageHandle, ImageHandleInfo* const info);
+
+    Status GetCICPColorData(heif_image_handle* const imageHandle, CICPColorData* const data);
+
+    Status DecodeImage(
+        heif_image_handle* const imageHandle,
+        heif_colorspace colorSpace,
+        heif_chroma chroma,
+        uint64_t memoryBudget,
+        const ProgressProc progressCallback,
+        heif_image** outputImage);
+
+    // Divides the decoder threads between the images that are decoded at the same time. libheif reads
+    // this setting while it decodes, so it must be set before any of the decodes start.
+    void SetConcurrentDecodes(heif_context* const context, int32_t imageCount);
 }
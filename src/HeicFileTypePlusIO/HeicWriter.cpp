@@ -17,10 +17,32 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "HeicWriter.h"
+#include "MemoryAccounting.h"
 #include "ProgressSteps.h"
+#include "Trace.h"
+#include <algorithm>
+#include <new>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 namespace
 {
+    // libheif passes the entire file to the writer in a single call, it is split into
+    // large chunks because WriteFile is limited to DWORD-sized requests and write
+    // may transfer less than the requested size on POSIX systems.
+    constexpr size_t MaxFileWriteChunkSize = 64 * 1024 * 1024;
+
     heif_error Write(heif_context* ctx,
         const void* data,
         size_t size,
@@ -31,20 +53,449 @@ namespace
 
         const IOCallbacks* callbacks = static_cast<IOCallbacks*>(userdata);
 
+        Trace::CountWrite(size);
+        MemoryAccounting::ChargeTransient(size);
+
         return callbacks->Write(data, size) == 0 ? Success : WriteError;
     }
+
+    struct CopyingWriterState
+    {
+        heif_writer* writer;
+        void* userdata;
+        std::vector<uint8_t>* fileCopy;
+    };
+
+    heif_error CopyAndWrite(heif_context* ctx,
+        const void* data,
+        size_t size,
+        void* userdata)
+    {
+        const CopyingWriterState* state = static_cast<CopyingWriterState*>(userdata);
+
+        try
+        {
+            const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+            state->fileCopy->assign(bytes, bytes + size);
+        }
+        catch (const std::bad_alloc&)
+        {
+            // The copy is only used for the encode cache, the file is still written.
+            state->fileCopy->clear();
+        }
+
+        return state->writer->write(ctx, data, size, state->userdata);
+    }
+
+    heif_error WriteOutput(const HeicWriter::OutputData& output, heif_writer* writer, void* userdata)
+    {
+        Trace::ScopedEvent traceEvent("heif_context_write");
+
+        if (!output.context)
+        {
+            // libheif also passes the entire file to the writer in a single call.
+            return writer->write(nullptr, output.encodedData->data(), output.encodedData->size(), userdata);
+        }
+
+        if (output.fileCopy)
+        {
+            CopyingWriterState state{ writer, userdata, output.fileCopy };
+            static heif_writer copyingWriter = { 1, CopyAndWrite };
+
+            return heif_context_write(output.context, &copyingWriter, &state);
+        }
+
+        return heif_context_write(output.context, writer, userdata);
+    }
+
+#ifdef _WIN32
+    struct ScopedFileHandle
+    {
+        explicit ScopedFileHandle(HANDLE handle) : handle(handle)
+        {
+        }
+
+        ~ScopedFileHandle()
+        {
+            close();
+        }
+
+        ScopedFileHandle(const ScopedFileHandle&) = delete;
+        ScopedFileHandle& operator=(const ScopedFileHandle&) = delete;
+
+        bool valid() const
+        {
+            return handle != INVALID_HANDLE_VALUE;
+        }
+
+        bool close()
+        {
+            bool result = true;
+
+            if (valid())
+            {
+                result = CloseHandle(handle) != FALSE;
+                handle = INVALID_HANDLE_VALUE;
+            }
+
+            return result;
+        }
+
+        HANDLE handle;
+    };
+
+    struct FileWriterState
+    {
+        HANDLE file;
+        bool preallocate;
+    };
+
+    heif_error WriteToFileHandle(heif_context* ctx,
+        const void* data,
+        size_t size,
+        void* userdata)
+    {
+        static heif_error Success = { heif_error_Ok, heif_suberror_Unspecified, "Success" };
+        static heif_error WriteError = { heif_error_Encoding_error, heif_suberror_Cannot_write_output_data, "Write error" };
+
+        const FileWriterState* state = static_cast<FileWriterState*>(userdata);
+
+        if (state->preallocate)
+        {
+            // The allocation size is only a hint to the file system, the write
+            // can still succeed if it cannot be applied.
+            FILE_ALLOCATION_INFO allocationInfo{};
+            allocationInfo.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+
+            SetFileInformationByHandle(state->file, FileAllocationInfo, &allocationInfo, sizeof(allocationInfo));
+        }
+
+        MemoryAccounting::ChargeTransient(size);
+
+        const uint8_t* buffer = static_cast<const uint8_t*>(data);
+        size_t remaining = size;
+
+        while (remaining > 0)
+        {
+            const DWORD chunkSize = static_cast<DWORD>(std::min(remaining, MaxFileWriteChunkSize));
+            DWORD bytesWritten = 0;
+
+            if (!WriteFile(state->file, buffer, chunkSize, &bytesWritten, nullptr) || bytesWritten != chunkSize)
+            {
+                return WriteError;
+            }
+
+            Trace::CountWrite(bytesWritten);
+
+            buffer += bytesWritten;
+            remaining -= bytesWritten;
+        }
+
+        return Success;
+    }
+
+    using NativePath = std::wstring;
+
+    bool ConvertToNativePath(const char* const utf8, std::wstring& utf16)
+    {
+        const int length = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, utf8, -1, nullptr, 0);
+
+        if (length <= 1)
+        {
+            return false;
+        }
+
+        utf16.resize(static_cast<size_t>(length));
+
+        if (MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, utf8, -1, utf16.data(), length) != length)
+        {
+            return false;
+        }
+
+        // Remove the NUL terminator that was included in the length.
+        utf16.pop_back();
+        return true;
+    }
+
+    std::wstring GetTemporaryFilePath(const std::wstring& path)
+    {
+        // The temporary file is placed in the same directory as the destination
+        // so that the final rename is not a copy across volumes.
+        return path
+            + L"."
+            + std::to_wstring(GetCurrentProcessId())
+            + L"-"
+            + std::to_wstring(GetCurrentThreadId())
+            + L".tmp";
+    }
+
+    Status WriteOutputToFile(
+        const HeicWriter::OutputData& output,
+        const std::wstring& path,
+        const FileOutputOptions* const outputOptions)
+    {
+        ScopedFileHandle file(CreateFileW(
+            path.c_str(),
+            GENERIC_WRITE,
+            0,
+            nullptr,
+            CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+            nullptr));
+
+        if (!file.valid())
+        {
+            return Status::WriteError;
+        }
+
+        FileWriterState state{ file.handle, outputOptions->preallocate };
+        static heif_writer writer = { 1, WriteToFileHandle };
+
+        const heif_error error = WriteOutput(output, &writer, &state);
+
+        Status status = Status::Ok;
+
+        if (error.code != heif_error_Ok)
+        {
+            switch (error.code)
+            {
+            case heif_error_Memory_allocation_error:
+                status = Status::OutOfMemory;
+                break;
+            default:
+                status = Status::WriteError;
+                break;
+            }
+        }
+
+        if (status == Status::Ok && outputOptions->atomicReplace)
+        {
+            // The data must be on disk before the rename makes the file visible,
+            // otherwise a crash could leave a truncated file at the destination path.
+            if (!FlushFileBuffers(file.handle))
+            {
+                status = Status::WriteError;
+            }
+        }
+
+        if (!file.close() && status == Status::Ok)
+        {
+            status = Status::WriteError;
+        }
+
+        if (status != Status::Ok)
+        {
+            DeleteFileW(path.c_str());
+        }
+
+        return status;
+    }
+
+    bool ReplaceFileWithTemporaryFile(const std::wstring& temporaryPath, const std::wstring& destinationPath)
+    {
+        if (!MoveFileExW(temporaryPath.c_str(), destinationPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+        {
+            DeleteFileW(temporaryPath.c_str());
+            return false;
+        }
+
+        return true;
+    }
+#else
+    struct ScopedFileDescriptor
+    {
+        explicit ScopedFileDescriptor(int fd) : fd(fd)
+        {
+        }
+
+        ~ScopedFileDescriptor()
+        {
+            close();
+        }
+
+        ScopedFileDescriptor(const ScopedFileDescriptor&) = delete;
+        ScopedFileDescriptor& operator=(const ScopedFileDescriptor&) = delete;
+
+        bool valid() const
+        {
+            return fd >= 0;
+        }
+
+        bool close()
+        {
+            bool result = true;
+
+            if (valid())
+            {
+                result = ::close(fd) == 0;
+                fd = -1;
+            }
+
+            return result;
+        }
+
+        int fd;
+    };
+
+    struct FileWriterState
+    {
+        int file;
+        bool preallocate;
+    };
+
+    heif_error WriteToFileDescriptor(heif_context* /*ctx*/,
+        const void* data,
+        size_t size,
+        void* userdata)
+    {
+        static heif_error Success = { heif_error_Ok, heif_suberror_Unspecified, "Success" };
+        static heif_error WriteError = { heif_error_Encoding_error, heif_suberror_Cannot_write_output_data, "Write error" };
+
+        const FileWriterState* state = static_cast<FileWriterState*>(userdata);
+
+#if defined(__linux__)
+        if (state->preallocate)
+        {
+            // The allocation is only a hint to the file system, the write
+            // can still succeed if it cannot be applied.
+            posix_fallocate(state->file, 0, static_cast<off_t>(size));
+        }
+#endif
+
+        MemoryAccounting::ChargeTransient(size);
+
+        const uint8_t* buffer = static_cast<const uint8_t*>(data);
+        size_t remaining = size;
+
+        while (remaining > 0)
+        {
+            const ssize_t bytesWritten = write(state->file, buffer, std::min(remaining, MaxFileWriteChunkSize));
+
+            if (bytesWritten < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+
+                return WriteError;
+            }
+
+            Trace::CountWrite(static_cast<size_t>(bytesWritten));
+
+            buffer += bytesWritten;
+            remaining -= static_cast<size_t>(bytesWritten);
+        }
+
+        return Success;
+    }
+
+    using NativePath = std::string;
+
+    bool ConvertToNativePath(const char* const utf8, std::string& path)
+    {
+        if (*utf8 == '\0')
+        {
+            return false;
+        }
+
+        path = utf8;
+        return true;
+    }
+
+    std::string GetTemporaryFilePath(const std::string& path)
+    {
+        static std::atomic<unsigned int> fileCounter = 0;
+
+        // The temporary file is placed in the same directory as the destination
+        // so that the final rename is atomic.
+        return path
+            + "."
+            + std::to_string(getpid())
+            + "-"
+            + std::to_string(fileCounter++)
+            + ".tmp";
+    }
+
+    Status WriteOutputToFile(
+        const HeicWriter::OutputData& output,
+        const std::string& path,
+        const FileOutputOptions* const outputOptions)
+    {
+        ScopedFileDescriptor file(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666));
+
+        if (!file.valid())
+        {
+            return Status::WriteError;
+        }
+
+        FileWriterState state{ file.fd, outputOptions->preallocate };
+        static heif_writer writer = { 1, WriteToFileDescriptor };
+
+        const heif_error error = WriteOutput(output, &writer, &state);
+
+        Status status = Status::Ok;
+
+        if (error.code != heif_error_Ok)
+        {
+            switch (error.code)
+            {
+            case heif_error_Memory_allocation_error:
+                status = Status::OutOfMemory;
+                break;
+            default:
+                status = Status::WriteError;
+                break;
+            }
+        }
+
+        if (status == Status::Ok && outputOptions->atomicReplace)
+        {
+            // The data must be on disk before the rename makes the file visible,
+            // otherwise a crash could leave a truncated file at the destination path.
+            if (fsync(file.fd) != 0)
+            {
+                status = Status::WriteError;
+            }
+        }
+
+        if (!file.close() && status == Status::Ok)
+        {
+            status = Status::WriteError;
+        }
+
+        if (status != Status::Ok)
+        {
+            unlink(path.c_str());
+        }
+
+        return status;
+    }
+
+    bool ReplaceFileWithTemporaryFile(const std::string& temporaryPath, const std::string& destinationPath)
+    {
+        if (rename(temporaryPath.c_str(), destinationPath.c_str()) != 0)
+        {
+            unlink(temporaryPath.c_str());
+            return false;
+        }
+
+        return true;
+    }
+#endif // _WIN32
 }
 
-Status HeicWriter::SaveToFile(heif_context* const context, IOCallbacks* const callbacks, const ProgressProc progressCallback)
+Status HeicWriter::SaveToFile(const OutputData& output, IOCallbacks* const callbacks, const ProgressProc progressCallback)
 {
-    if (!context || !callbacks)
+    if ((!output.context && !output.encodedData) || !callbacks)
     {
         return Status::NullParameter;
     }
 
     static heif_writer writer = { 1, Write };
 
-    heif_error error = heif_context_write(context, &writer, callbacks);
+    heif_error error = WriteOutput(output, &writer, callbacks);
 
     if (error.code != heif_error_Ok)
     {
@@ -67,3 +518,50 @@ Status HeicWriter::SaveToFile(heif_context* const context, IOCallbacks* const ca
 
     return Status::Ok;
 }
+
+Status HeicWriter::SaveToPath(
+    const OutputData& output,
+    const char* const path,
+    const FileOutputOptions* const outputOptions,
+    const ProgressProc progressCallback)
+{
+    if ((!output.context && !output.encodedData) || !path || !outputOptions)
+    {
+        return Status::NullParameter;
+    }
+
+    NativePath destinationPath;
+
+    if (!ConvertToNativePath(path, destinationPath))
+    {
+        return Status::InvalidParameter;
+    }
+
+    Status status;
+
+    if (outputOptions->atomicReplace)
+    {
+        const NativePath temporaryPath = GetTemporaryFilePath(destinationPath);
+
+        status = WriteOutputToFile(output, temporaryPath, outputOptions);
+
+        if (status == Status::Ok && !ReplaceFileWithTemporaryFile(temporaryPath, destinationPath))
+        {
+            status = Status::WriteError;
+        }
+    }
+    else
+    {
+        status = WriteOutputToFile(output, destinationPath, outputOptions);
+    }
+
+    if (status == Status::Ok && progressCallback)
+    {
+        if (!progressCallback(AfterFileWrite))
+        {
+            return Status::UserCanceled;
+        }
+    }
+
+    return status;
+}
@@ -20,8 +20,24 @@
 
 #include "HeicFileTypePlusIO.h"
 #include "scoped.h"
+#include <vector>
 
 namespace HeicWriter
 {
-    Status SaveToFile(heif_context* const context, IOCallbacks* const callbacks, const ProgressProc progressCallback);
+    // The output data is either an encoded context, or the file data of a cached encode when the context is null.
+    struct OutputData
+    {
+        heif_context* context;
+        const std::vector<uint8_t>* encodedData;
+        // If not null, receives a copy of the file that was written from the context.
+        std::vector<uint8_t>* fileCopy;
+    };
+
+    Status SaveToFile(const OutputData& output, IOCallbacks* const callbacks, const ProgressProc progressCallback);
+
+    Status SaveToPath(
+        const OutputData& output,
+        const char* const path,
+        const FileOutputOptions* const outputOptions,
+        const ProgressProc progressCallback);
 }
@@ -0,0 +1,408 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "MemoryAccounting.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+    struct OperationState
+    {
+        int depth;
+        uint64_t currentBytes;
+        uint64_t peakBytes;
+    };
+
+    thread_local OperationState operationState = {};
+    thread_local MemoryUsage lastOperationUsage = {};
+    thread_local MemoryBudgetFailure lastBudgetFailure = {};
+
+    std::atomic<uint64_t> processCurrentBytes{ 0 };
+    std::atomic<uint64_t> processPeakBytes{ 0 };
+
+    // The working set factors are approximations measured with 8-bit builds of
+    // x265 and libde265, they are relative to the size of the YCbCr planes.
+    constexpr uint64_t EncoderWorkingSetFactor = 6;
+    constexpr uint64_t DecoderWorkingSetFactor = 2;
+
+    // The smallest decode cost is a monochrome 8-bit image, the decoded image
+    // plus the decoder working set.
+    constexpr uint64_t MinimumDecodeBytesPerPixel = 1 + DecoderWorkingSetFactor + 1;
+
+    // The slower presets keep more analysis data for each CTU.
+    uint64_t GetEncoderAnalysisBytesPerPixel(EncoderPreset preset)
+    {
+        switch (preset)
+        {
+        case EncoderPreset::UltraFast:
+        case EncoderPreset::SuperFast:
+        case EncoderPreset::VeryFast:
+        case EncoderPreset::Faster:
+            return 1;
+        case EncoderPreset::Fast:
+        case EncoderPreset::Medium:
+            return 3;
+        case EncoderPreset::Slow:
+        case EncoderPreset::Slower:
+        case EncoderPreset::VerySlow:
+        case EncoderPreset::Placebo:
+        default:
+            return 4;
+        }
+    }
+
+    uint64_t GetYCbCrImageSize(int width, int height, YUVChromaSubsampling yuvFormat)
+    {
+        const uint64_t lumaSize = static_cast<uint64_t>(width) * static_cast<uint64_t>(height);
+        const uint64_t chromaWidth = (static_cast<uint64_t>(width) + 1) / 2;
+        const uint64_t chromaHeight = (static_cast<uint64_t>(height) + 1) / 2;
+
+        switch (yuvFormat)
+        {
+        case YUVChromaSubsampling::Subsampling400:
+            return lumaSize;
+        case YUVChromaSubsampling::Subsampling420:
+            return lumaSize + (2 * chromaWidth * chromaHeight);
+        case YUVChromaSubsampling::Subsampling422:
+            return lumaSize + (2 * chromaWidth * static_cast<uint64_t>(height));
+        case YUVChromaSubsampling::Subsampling444:
+        case YUVChromaSubsampling::IdentityMatrix:
+        case YUVChromaSubsampling::Automatic:
+        default:
+            // The automatic format is estimated using the largest format that it can select.
+            return lumaSize * 3;
+        }
+    }
+
+    YUVChromaSubsampling GetYUVFormat(heif_chroma chroma)
+    {
+        switch (chroma)
+        {
+        case heif_chroma_monochrome:
+            return YUVChromaSubsampling::Subsampling400;
+        case heif_chroma_420:
+            return YUVChromaSubsampling::Subsampling420;
+        case heif_chroma_422:
+            return YUVChromaSubsampling::Subsampling422;
+        default:
+            return YUVChromaSubsampling::Subsampling444;
+        }
+    }
+
+    heif_chroma GetHeifChroma(YUVChromaSubsampling yuvFormat)
+    {
+        switch (yuvFormat)
+        {
+        case YUVChromaSubsampling::Subsampling400:
+            return heif_chroma_monochrome;
+        case YUVChromaSubsampling::Subsampling420:
+            return heif_chroma_420;
+        case YUVChromaSubsampling::Subsampling422:
+            return heif_chroma_422;
+        case YUVChromaSubsampling::Subsampling444:
+        case YUVChromaSubsampling::IdentityMatrix:
+        case YUVChromaSubsampling::Automatic:
+        default:
+            return heif_chroma_444;
+        }
+    }
+
+    // The estimates assume that the image has an alpha channel.
+    uint64_t GetEncoderImageSize(int width, int height, YUVChromaSubsampling yuvFormat)
+    {
+        return GetYCbCrImageSize(width, height, yuvFormat) + (static_cast<uint64_t>(width) * static_cast<uint64_t>(height));
+    }
+
+    // The compressed size of a lossy image is assumed to be at most half of the uncompressed size.
+    uint64_t GetCompressedSize(uint64_t imageSize, const EncoderOptions* options)
+    {
+        return options->quality == 100 ? imageSize : imageSize / 2;
+    }
+
+    void UpdatePeak(std::atomic<uint64_t>& peak, uint64_t value)
+    {
+        uint64_t current = peak.load(std::memory_order_relaxed);
+
+        while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        {
+        }
+    }
+}
+
+MemoryAccounting::ScopedOperation::ScopedOperation()
+{
+    if (operationState.depth == 0)
+    {
+        operationState.currentBytes = 0;
+        operationState.peakBytes = 0;
+        lastBudgetFailure = {};
+    }
+
+    operationState.depth++;
+}
+
+MemoryAccounting::ScopedOperation::~ScopedOperation()
+{
+    operationState.depth--;
+
+    if (operationState.depth == 0)
+    {
+        lastOperationUsage.currentBytes = operationState.currentBytes;
+        lastOperationUsage.peakBytes = operationState.peakBytes;
+    }
+}
+
+MemoryAccounting::ScopedCharge::ScopedCharge(uint64_t bytes) : bytes(bytes)
+{
+    Charge(bytes);
+}
+
+MemoryAccounting::ScopedCharge::~ScopedCharge()
+{
+    MemoryAccounting::Release(bytes);
+}
+
+void MemoryAccounting::ScopedCharge::Increase(uint64_t additionalBytes)
+{
+    Charge(additionalBytes);
+    bytes += additionalBytes;
+}
+
+void MemoryAccounting::ScopedCharge::Reset()
+{
+    MemoryAccounting::Release(bytes);
+    bytes = 0;
+}
+
+void MemoryAccounting::Charge(uint64_t bytes)
+{
+    operationState.currentBytes += bytes;
+    operationState.peakBytes = std::max(operationState.peakBytes, operationState.currentBytes);
+
+    const uint64_t processBytes = processCurrentBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    UpdatePeak(processPeakBytes, processBytes);
+}
+
+void MemoryAccounting::Release(uint64_t bytes)
+{
+    // A decoded image can be released by a different operation than the one that created it.
+    operationState.currentBytes -= std::min(operationState.currentBytes, bytes);
+
+    processCurrentBytes.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void MemoryAccounting::ChargeTransient(uint64_t bytes)
+{
+    operationState.peakBytes = std::max(operationState.peakBytes, operationState.currentBytes + bytes);
+
+    UpdatePeak(processPeakBytes, processCurrentBytes.load(std::memory_order_relaxed) + bytes);
+}
+
+uint64_t MemoryAccounting::GetImageSize(const heif_image* image)
+{
+    if (!image)
+    {
+        return 0;
+    }
+
+    static const heif_channel channels[] =
+    {
+        heif_channel_Y,
+        heif_channel_Cb,
+        heif_channel_Cr,
+        heif_channel_R,
+        heif_channel_G,
+        heif_channel_B,
+        heif_channel_Alpha,
+        heif_channel_interleaved
+    };
+
+    uint64_t size = 0;
+
+    for (const heif_channel channel : channels)
+    {
+        if (heif_image_has_channel(image, channel))
+        {
+            int stride;
+
+            if (heif_image_get_plane_readonly(image, channel, &stride))
+            {
+                size += static_cast<uint64_t>(stride) * static_cast<uint64_t>(heif_image_get_height(image, channel));
+            }
+        }
+    }
+
+    return size;
+}
+
+uint64_t MemoryAccounting::EstimateEncoderWorkingSet(int width, int height, const EncoderOptions* options)
+{
+    const uint64_t pixelCount = static_cast<uint64_t>(width) * static_cast<uint64_t>(height);
+    const uint64_t imageSize = GetYCbCrImageSize(width, height, options->yuvFormat);
+
+    return (imageSize * EncoderWorkingSetFactor) + (pixelCount * GetEncoderAnalysisBytesPerPixel(options->preset));
+}
+
+uint64_t MemoryAccounting::EstimateDecoderWorkingSet(int width, int height, heif_chroma chroma)
+{
+    const uint64_t pixelCount = static_cast<uint64_t>(width) * static_cast<uint64_t>(height);
+
+    // libde265 also keeps metadata for every 4x4 block, this is about a byte per pixel.
+    return (GetYCbCrImageSize(width, height, GetYUVFormat(chroma)) * DecoderWorkingSetFactor) + pixelCount;
+}
+
+uint64_t MemoryAccounting::EstimateEncodeBytes(int width, int height, int tileWidth, int tileHeight, const EncoderOptions* options)
+{
+    const uint64_t imageSize = GetEncoderImageSize(width, height, options->yuvFormat);
+    const uint64_t compressedSize = GetCompressedSize(imageSize, options);
+
+    // The YCbCr image is released after it has been encoded, the compressed data is
+    // then copied into the output buffer when the file is written.
+    const uint64_t encodeBytes = imageSize + EstimateEncoderWorkingSet(tileWidth, tileHeight, options) + compressedSize;
+
+    return std::max(encodeBytes, compressedSize * 2);
+}
+
+uint64_t MemoryAccounting::EstimateAutoQualityEncodeBytes(int width, int height, const EncoderOptions* options)
+{
+    const uint64_t pixelCount = static_cast<uint64_t>(width) * static_cast<uint64_t>(height);
+    const uint64_t imageSize = GetEncoderImageSize(width, height, options->yuvFormat);
+    const uint64_t compressedSize = GetCompressedSize(imageSize, options);
+
+    // The selected probe, the current probe and its serialized copy.
+    const uint64_t probeBytes = compressedSize * 3;
+    const uint64_t encodeBytes = imageSize + EstimateEncoderWorkingSet(width, height, options) + probeBytes;
+    // The decoded probe and the float copies of the luma planes that the metrics use.
+    const uint64_t measureBytes = imageSize
+                                + imageSize
+                                + EstimateDecoderWorkingSet(width, height, GetHeifChroma(options->yuvFormat))
+                                + probeBytes
+                                + (pixelCount * 2 * sizeof(float));
+
+    return std::max(encodeBytes, measureBytes);
+}
+
+uint64_t MemoryAccounting::EstimateDecodeBytes(heif_image_handle* imageHandle, heif_colorspace colorspace, heif_chroma chroma)
+{
+    const int width = heif_image_handle_get_width(imageHandle);
+    const int height = heif_image_handle_get_height(imageHandle);
+    const uint64_t pixelCount = static_cast<uint64_t>(width) * static_cast<uint64_t>(height);
+    const uint64_t bytesPerSample = heif_image_handle_get_luma_bits_per_pixel(imageHandle) > 8 ? 2 : 1;
+    const bool hasAlpha = heif_image_handle_has_alpha_channel(imageHandle) != 0;
+
+    heif_colorspace nativeColorspace = heif_colorspace_undefined;
+    heif_chroma nativeChroma = heif_chroma_undefined;
+
+    if (heif_image_handle_get_preferred_decoding_colorspace(imageHandle, &nativeColorspace, &nativeChroma).code != heif_error_Ok)
+    {
+        // The 4:4:4 estimate is the largest.
+        nativeChroma = heif_chroma_444;
+    }
+
+    const uint64_t alphaSize = hasAlpha ? pixelCount * bytesPerSample : 0;
+    const uint64_t nativeImageSize = (GetYCbCrImageSize(width, height, GetYUVFormat(nativeChroma)) * bytesPerSample) + alphaSize;
+
+    uint64_t convertedImageSize = 0;
+
+    if (colorspace != heif_colorspace_undefined && chroma != nativeChroma)
+    {
+        switch (chroma)
+        {
+        case heif_chroma_interleaved_RGB:
+            convertedImageSize = pixelCount * 3;
+            break;
+        case heif_chroma_interleaved_RGBA:
+            convertedImageSize = pixelCount * 4;
+            break;
+        case heif_chroma_interleaved_RRGGBB_BE:
+        case heif_chroma_interleaved_RRGGBB_LE:
+            convertedImageSize = pixelCount * 6;
+            break;
+        case heif_chroma_interleaved_RRGGBBAA_BE:
+        case heif_chroma_interleaved_RRGGBBAA_LE:
+            convertedImageSize = pixelCount * 8;
+            break;
+        default:
+            convertedImageSize = (GetYCbCrImageSize(width, height, GetYUVFormat(chroma)) * bytesPerSample) + alphaSize;
+            break;
+        }
+    }
+
+    return nativeImageSize
+         + (EstimateDecoderWorkingSet(width, height, nativeChroma) * bytesPerSample)
+         + convertedImageSize;
+}
+
+int MemoryAccounting::GetMaximumImageSize(uint64_t memoryBudget)
+{
+    const double maximumPixelCount = static_cast<double>(memoryBudget / MinimumDecodeBytesPerPixel);
+    const double maximumSize = std::floor(std::sqrt(maximumPixelCount));
+
+    return static_cast<int>(std::min(maximumSize, static_cast<double>(std::numeric_limits<int>::max())));
+}
+
+Status MemoryAccounting::ReportBudgetFailure(MemoryBudgetFailureReason reason, uint64_t requiredBytes, uint64_t budgetBytes)
+{
+    lastBudgetFailure.reason = reason;
+    lastBudgetFailure.requiredBytes = requiredBytes;
+    lastBudgetFailure.budgetBytes = budgetBytes;
+
+    return Status::OutOfMemory;
+}
+
+void MemoryAccounting::GetLastBudgetFailure(MemoryBudgetFailure* failure)
+{
+    *failure = lastBudgetFailure;
+}
+
+void MemoryAccounting::GetLastOperationUsage(MemoryUsage* usage)
+{
+    *usage = lastOperationUsage;
+}
+
+void MemoryAccounting::GetProcessUsage(MemoryUsage* usage)
+{
+    usage->currentBytes = processCurrentBytes.load(std::memory_order_relaxed);
+    usage->peakBytes = processPeakBytes.load(std::memory_order_relaxed);
+}
+
+Status MemoryAccounting::EstimateMemory(int32_t width, int32_t height, const EncoderOptions* options, MemoryEstimate* estimate)
+{
+    if (!options || !estimate)
+    {
+        return Status::NullParameter;
+    }
+
+    if (width <= 0 || height <= 0)
+    {
+        return Status::InvalidParameter;
+    }
+
+    const uint64_t imageSize = GetEncoderImageSize(width, height, options->yuvFormat);
+
+    estimate->encodeBytes = EstimateEncodeBytes(width, height, width, height, options);
+    estimate->decodeBytes = imageSize
+                          + EstimateDecoderWorkingSet(width, height, GetHeifChroma(options->yuvFormat))
+                          + GetCompressedSize(imageSize, options);
+
+    return Status::Ok;
+}
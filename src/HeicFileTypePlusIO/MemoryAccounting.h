@@ -0,0 +1,100 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include "HeicFileTypePlusIO.h"
+
+// Tracks the memory used by the native operations.
+// libheif does not allow its allocator to be replaced, so the buffers that libheif,
+// x265 and libde265 allocate internally are charged using estimates.
+namespace MemoryAccounting
+{
+    // Starts the accounting for an exported operation on the current thread,
+    // nested operations are included in the outermost operation.
+    class ScopedOperation
+    {
+    public:
+        ScopedOperation();
+        ~ScopedOperation();
+
+        ScopedOperation(const ScopedOperation&) = delete;
+        ScopedOperation& operator=(const ScopedOperation&) = delete;
+    };
+
+    // Charges the specified number of bytes for the lifetime of the object.
+    class ScopedCharge
+    {
+    public:
+        explicit ScopedCharge(uint64_t bytes);
+        ~ScopedCharge();
+
+        void Increase(uint64_t additionalBytes);
+
+        // Releases the charge before the object is destroyed, this is used when a buffer is freed early.
+        void Reset();
+
+        ScopedCharge(const ScopedCharge&) = delete;
+        ScopedCharge& operator=(const ScopedCharge&) = delete;
+
+    private:
+        uint64_t bytes;
+    };
+
+    void Charge(uint64_t bytes);
+
+    void Release(uint64_t bytes);
+
+    // Records a buffer that only exists for the duration of a call, e.g. the
+    // file data that libheif passes to the writer.
+    void ChargeTransient(uint64_t bytes);
+
+    // Returns the total size of the image planes.
+    uint64_t GetImageSize(const heif_image* image);
+
+    uint64_t EstimateEncoderWorkingSet(int width, int height, const EncoderOptions* options);
+
+    // Estimates the peak memory of encoding the image as a single image or as a grid of tiles.
+    uint64_t EstimateEncodeBytes(int width, int height, int tileWidth, int tileHeight, const EncoderOptions* options);
+
+    // The auto quality search also keeps the best probe and decodes each probe.
+    uint64_t EstimateAutoQualityEncodeBytes(int width, int height, const EncoderOptions* options);
+
+    // Estimates the peak memory of decoding the image to the specified format.
+    uint64_t EstimateDecodeBytes(heif_image_handle* imageHandle, heif_colorspace colorspace, heif_chroma chroma);
+
+    // Returns the maximum image width and height that can be decoded within the budget.
+    int GetMaximumImageSize(uint64_t memoryBudget);
+
+    // Records the reason for GetLastBudgetFailure and returns Status::OutOfMemory.
+    Status ReportBudgetFailure(MemoryBudgetFailureReason reason, uint64_t requiredBytes, uint64_t budgetBytes);
+
+    void GetLastBudgetFailure(MemoryBudgetFailure* failure);
+
+    // An undefined chroma format uses the 4:4:4 estimate, which is the largest.
+    uint64_t EstimateDecoderWorkingSet(int width, int height, heif_chroma chroma);
+
+    // Returns the usage of the last operation that completed on the current thread.
+    void GetLastOperationUsage(MemoryUsage* usage);
+
+    // Returns the usage of all of the operations in the process.
+    void GetProcessUsage(MemoryUsage* usage);
+
+    Status EstimateMemory(int32_t width, int32_t height, const EncoderOptions* options, MemoryEstimate* estimate);
+}
@@ -0,0 +1,683 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "Metrics.h"
+#include "ParallelFor.h"
+#include "PlanePool.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <new>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define METRICS_USE_SSE2 1
+#else
+#define METRICS_USE_SSE2 0
+#endif
+
+namespace
+{
+    constexpr int ChannelCount = 3;
+    constexpr int CombinedIndex = 3;
+
+    // SSIM uses an 11x11 Gaussian window with a standard deviation of 1.5,
+    // as described in the paper by Wang et al.
+    constexpr int GaussianSize = 11;
+    constexpr int GaussianRadius = GaussianSize / 2;
+    constexpr float C1 = (0.01f * 255.0f) * (0.01f * 255.0f);
+    constexpr float C2 = (0.03f * 255.0f) * (0.03f * 255.0f);
+
+    // The weights for each MS-SSIM scale, from the paper by Wang, Simoncelli and Bovik.
+    constexpr std::array<double, 5> MsSsimWeights = { 0.0448, 0.2856, 0.3001, 0.2363, 0.1333 };
+
+    // The number of SSIM output rows that each thread processes at a time.
+    constexpr int SsimBandHeight = 32;
+
+    struct Plane
+    {
+        PlanePool::Buffer buffer;
+        int width = 0;
+        int height = 0;
+
+        void Allocate(int planeWidth, int planeHeight)
+        {
+            width = planeWidth;
+            height = planeHeight;
+            buffer = PlanePool::Acquire(Size() * sizeof(float));
+        }
+
+        size_t Size() const
+        {
+            return static_cast<size_t>(width) * static_cast<size_t>(height);
+        }
+
+        float* Data() const
+        {
+            return static_cast<float*>(buffer.data());
+        }
+
+        float* Row(int y)
+        {
+            return Data() + (static_cast<size_t>(y) * static_cast<size_t>(width));
+        }
+
+        const float* Row(int y) const
+        {
+            return Data() + (static_cast<size_t>(y) * static_cast<size_t>(width));
+        }
+    };
+
+    struct SsimSums
+    {
+        double ssim;
+        double contrastStructure;
+    };
+
+    std::array<float, GaussianSize> CreateGaussianKernel()
+    {
+        std::array<float, GaussianSize> kernel{};
+        double sum = 0.0;
+
+        for (int i = 0; i < GaussianSize; i++)
+        {
+            const double x = static_cast<double>(i - GaussianRadius);
+            const double value = std::exp(-(x * x) / (2.0 * 1.5 * 1.5));
+
+            kernel[i] = static_cast<float>(value);
+            sum += value;
+        }
+
+        for (float& value : kernel)
+        {
+            value = static_cast<float>(value / sum);
+        }
+
+        return kernel;
+    }
+
+    const std::array<float, GaussianSize> GaussianKernel = CreateGaussianKernel();
+
+    void ConvertToPlanes(const BitmapData* image, MetricsColorDomain colorDomain, Plane (&planes)[ChannelCount], int threadCount)
+    {
+        for (Plane& plane : planes)
+        {
+            plane.Allocate(image->width, image->height);
+        }
+
+        ParallelFor::Run(0, image->height, 64, threadCount, [&](int begin, int end)
+        {
+            for (int y = begin; y < end; y++)
+            {
+                const ColorBgra* src = reinterpret_cast<const ColorBgra*>(image->scan0 + (static_cast<intptr_t>(y) * image->stride));
+                float* dst0 = planes[0].Row(y);
+                float* dst1 = planes[1].Row(y);
+                float* dst2 = planes[2].Row(y);
+
+                if (colorDomain == MetricsColorDomain::YCbCr)
+                {
+                    // BT.709 full range, the chroma channels are offset to the [0, 255] range.
+                    for (int x = 0; x < image->width; x++)
+                    {
+                        const float r = src[x].r;
+                        const float g = src[x].g;
+                        const float b = src[x].b;
+
+                        const float luma = (0.2126f * r) + (0.7152f * g) + (0.0722f * b);
+
+                        dst0[x] = luma;
+                        dst1[x] = ((b - luma) / 1.8556f) + 128.0f;
+                        dst2[x] = ((r - luma) / 1.5748f) + 128.0f;
+                    }
+                }
+                else
+                {
+                    for (int x = 0; x < image->width; x++)
+                    {
+                        dst0[x] = src[x].r;
+                        dst1[x] = src[x].g;
+                        dst2[x] = src[x].b;
+                    }
+                }
+            }
+        });
+    }
+
+    double SumSquaredError(const float* a, const float* b, int count)
+    {
+        int x = 0;
+        double sum = 0.0;
+
+#if METRICS_USE_SSE2
+        // The partial sums are flushed to double precision for every row to limit
+        // the float rounding error on large images.
+        __m128 accumulator = _mm_setzero_ps();
+
+        for (; x + 4 <= count; x += 4)
+        {
+            const __m128 difference = _mm_sub_ps(_mm_loadu_ps(a + x), _mm_loadu_ps(b + x));
+            accumulator = _mm_add_ps(accumulator, _mm_mul_ps(difference, difference));
+        }
+
+        alignas(16) float partial[4];
+        _mm_store_ps(partial, accumulator);
+        sum = static_cast<double>(partial[0]) + partial[1] + partial[2] + partial[3];
+#endif
+
+        for (; x < count; x++)
+        {
+            const double difference = static_cast<double>(a[x]) - b[x];
+            sum += difference * difference;
+        }
+
+        return sum;
+    }
+
+    double ComputeMeanSquaredError(const Plane& a, const Plane& b, int threadCount)
+    {
+        std::vector<double> rowSums(static_cast<size_t>(a.height));
+
+        ParallelFor::Run(0, a.height, 64, threadCount, [&](int begin, int end)
+        {
+            for (int y = begin; y < end; y++)
+            {
+                rowSums[y] = SumSquaredError(a.Row(y), b.Row(y), a.width);
+            }
+        });
+
+        double sum = 0.0;
+
+        for (double value : rowSums)
+        {
+            sum += value;
+        }
+
+        return sum / (static_cast<double>(a.width) * static_cast<double>(a.height));
+    }
+
+    double MeanSquaredErrorToPsnr(double mse)
+    {
+        if (mse <= 0.0)
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+
+        return 10.0 * std::log10((255.0 * 255.0) / mse);
+    }
+
+    // dst[x] = sum(kernel[k] * src[x + k]), for x in [0, width - GaussianSize].
+    void FilterHorizontal(const float* src, float* dst, int outputWidth)
+    {
+        int x = 0;
+
+#if METRICS_USE_SSE2
+        for (; x + 4 <= outputWidth; x += 4)
+        {
+            __m128 sum = _mm_setzero_ps();
+
+            for (int k = 0; k < GaussianSize; k++)
+            {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(GaussianKernel[k]), _mm_loadu_ps(src + x + k)));
+            }
+
+            _mm_storeu_ps(dst + x, sum);
+        }
+#endif
+
+        for (; x < outputWidth; x++)
+        {
+            float sum = 0.0f;
+
+            for (int k = 0; k < GaussianSize; k++)
+            {
+                sum += GaussianKernel[k] * src[x + k];
+            }
+
+            dst[x] = sum;
+        }
+    }
+
+    // dst[x] = sum(kernel[k] * rows[k][x]).
+    void FilterVertical(const float* const* rows, float* dst, int width)
+    {
+        int x = 0;
+
+#if METRICS_USE_SSE2
+        for (; x + 4 <= width; x += 4)
+        {
+            __m128 sum = _mm_setzero_ps();
+
+            for (int k = 0; k < GaussianSize; k++)
+            {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(GaussianKernel[k]), _mm_loadu_ps(rows[k] + x)));
+            }
+
+            _mm_storeu_ps(dst + x, sum);
+        }
+#endif
+
+        for (; x < width; x++)
+        {
+            float sum = 0.0f;
+
+            for (int k = 0; k < GaussianSize; k++)
+            {
+                sum += GaussianKernel[k] * rows[k][x];
+            }
+
+            dst[x] = sum;
+        }
+    }
+
+    SsimSums ComputeSsimRow(
+        const float* meanA,
+        const float* meanB,
+        const float* meanAA,
+        const float* meanBB,
+        const float* meanAB,
+        int width)
+    {
+        int x = 0;
+        double ssimSum = 0.0;
+        double contrastStructureSum = 0.0;
+
+#if METRICS_USE_SSE2
+        const __m128 c1 = _mm_set1_ps(C1);
+        const __m128 c2 = _mm_set1_ps(C2);
+        const __m128 two = _mm_set1_ps(2.0f);
+        __m128 ssimAccumulator = _mm_setzero_ps();
+        __m128 contrastStructureAccumulator = _mm_setzero_ps();
+
+        for (; x + 4 <= width; x += 4)
+        {
+            const __m128 muA = _mm_loadu_ps(meanA + x);
+            const __m128 muB = _mm_loadu_ps(meanB + x);
+            const __m128 muAA = _mm_mul_ps(muA, muA);
+            const __m128 muBB = _mm_mul_ps(muB, muB);
+            const __m128 muAB = _mm_mul_ps(muA, muB);
+
+            const __m128 varianceA = _mm_sub_ps(_mm_loadu_ps(meanAA + x), muAA);
+            const __m128 varianceB = _mm_sub_ps(_mm_loadu_ps(meanBB + x), muBB);
+            const __m128 covariance = _mm_sub_ps(_mm_loadu_ps(meanAB + x), muAB);
+
+            const __m128 luminance = _mm_div_ps(_mm_add_ps(_mm_mul_ps(two, muAB), c1), _mm_add_ps(_mm_add_ps(muAA, muBB), c1));
+            const __m128 contrastStructure = _mm_div_ps(_mm_add_ps(_mm_mul_ps(two, covariance), c2), _mm_add_ps(_mm_add_ps(varianceA, varianceB), c2));
+
+            ssimAccumulator = _mm_add_ps(ssimAccumulator, _mm_mul_ps(luminance, contrastStructure));
+            contrastStructureAccumulator = _mm_add_ps(contrastStructureAccumulator, contrastStructure);
+        }
+
+        alignas(16) float partial[4];
+        _mm_store_ps(partial, ssimAccumulator);
+        ssimSum = static_cast<double>(partial[0]) + partial[1] + partial[2] + partial[3];
+        _mm_store_ps(partial, contrastStructureAccumulator);
+        contrastStructureSum = static_cast<double>(partial[0]) + partial[1] + partial[2] + partial[3];
+#endif
+
+        for (; x < width; x++)
+        {
+            const float muA = meanA[x];
+            const float muB = meanB[x];
+
+            const float varianceA = meanAA[x] - (muA * muA);
+            const float varianceB = meanBB[x] - (muB * muB);
+            const float covariance = meanAB[x] - (muA * muB);
+
+            const float luminance = ((2.0f * muA * muB) + C1) / ((muA * muA) + (muB * muB) + C1);
+            const float contrastStructure = ((2.0f * covariance) + C2) / (varianceA + varianceB + C2);
+
+            ssimSum += luminance * contrastStructure;
+            contrastStructureSum += contrastStructure;
+        }
+
+        return SsimSums{ ssimSum, contrastStructureSum };
+    }
+
+    // Computes the SSIM sums for the output rows in [begin, end), the output
+    // only covers the area where the Gaussian window fits inside the image.
+    SsimSums ComputeSsimBand(const Plane& a, const Plane& b, int begin, int end)
+    {
+        const int outputWidth = a.width - (GaussianSize - 1);
+        const int inputRows = (end - begin) + (GaussianSize - 1);
+
+        // The horizontally filtered values of a, b, a*a, b*b and a*b.
+        std::array<Plane, 5> filtered;
+
+        for (Plane& plane : filtered)
+        {
+            plane.Allocate(outputWidth, inputRows);
+        }
+
+        std::vector<float> products(static_cast<size_t>(a.width));
+
+        for (int row = 0; row < inputRows; row++)
+        {
+            const float* rowA = a.Row(begin + row);
+            const float* rowB = b.Row(begin + row);
+
+            FilterHorizontal(rowA, filtered[0].Row(row), outputWidth);
+            FilterHorizontal(rowB, filtered[1].Row(row), outputWidth);
+
+            for (int x = 0; x < a.width; x++)
+            {
+                products[x] = rowA[x] * rowA[x];
+            }
+            FilterHorizontal(products.data(), filtered[2].Row(row), outputWidth);
+
+            for (int x = 0; x < a.width; x++)
+            {
+                products[x] = rowB[x] * rowB[x];
+            }
+            FilterHorizontal(products.data(), filtered[3].Row(row), outputWidth);
+
+            for (int x = 0; x < a.width; x++)
+            {
+                products[x] = rowA[x] * rowB[x];
+            }
+            FilterHorizontal(products.data(), filtered[4].Row(row), outputWidth);
+        }
+
+        std::array<std::vector<float>, 5> means;
+
+        for (std::vector<float>& mean : means)
+        {
+            mean.resize(static_cast<size_t>(outputWidth));
+        }
+
+        SsimSums sums = { 0.0, 0.0 };
+
+        for (int row = 0; row < end - begin; row++)
+        {
+            for (size_t i = 0; i < means.size(); i++)
+            {
+                const float* rows[GaussianSize];
+
+                for (int k = 0; k < GaussianSize; k++)
+                {
+                    rows[k] = filtered[i].Row(row + k);
+                }
+
+                FilterVertical(rows, means[i].data(), outputWidth);
+            }
+
+            const SsimSums rowSums = ComputeSsimRow(
+                means[0].data(),
+                means[1].data(),
+                means[2].data(),
+                means[3].data(),
+                means[4].data(),
+                outputWidth);
+
+            sums.ssim += rowSums.ssim;
+            sums.contrastStructure += rowSums.contrastStructure;
+        }
+
+        return sums;
+    }
+
+    // Images that are smaller than the Gaussian window use a single window covering the whole image.
+    SsimSums ComputeGlobalSsim(const Plane& a, const Plane& b)
+    {
+        const double count = static_cast<double>(a.Size());
+        double sumA = 0.0;
+        double sumB = 0.0;
+        double sumAA = 0.0;
+        double sumBB = 0.0;
+        double sumAB = 0.0;
+
+        const float* dataA = a.Data();
+        const float* dataB = b.Data();
+
+        for (size_t i = 0; i < a.Size(); i++)
+        {
+            const double valueA = dataA[i];
+            const double valueB = dataB[i];
+
+            sumA += valueA;
+            sumB += valueB;
+            sumAA += valueA * valueA;
+            sumBB += valueB * valueB;
+            sumAB += valueA * valueB;
+        }
+
+        const double muA = sumA / count;
+        const double muB = sumB / count;
+        const double varianceA = (sumAA / count) - (muA * muA);
+        const double varianceB = (sumBB / count) - (muB * muB);
+        const double covariance = (sumAB / count) - (muA * muB);
+
+        const double luminance = ((2.0 * muA * muB) + C1) / ((muA * muA) + (muB * muB) + C1);
+        const double contrastStructure = ((2.0 * covariance) + C2) / (varianceA + varianceB + C2);
+
+        return SsimSums{ luminance * contrastStructure, contrastStructure };
+    }
+
+    // Returns the mean SSIM and contrast-structure values of the plane.
+    SsimSums ComputeSsim(const Plane& a, const Plane& b, int threadCount)
+    {
+        const int outputWidth = a.width - (GaussianSize - 1);
+        const int outputHeight = a.height - (GaussianSize - 1);
+
+        if (outputWidth <= 0 || outputHeight <= 0)
+        {
+            return ComputeGlobalSsim(a, b);
+        }
+
+        const int bandCount = (outputHeight + SsimBandHeight - 1) / SsimBandHeight;
+        std::vector<SsimSums> bandSums(static_cast<size_t>(bandCount));
+
+        ParallelFor::Run(0, bandCount, 1, threadCount, [&](int begin, int end)
+        {
+            for (int band = begin; band < end; band++)
+            {
+                const int bandStart = band * SsimBandHeight;
+                const int bandEnd = std::min(bandStart + SsimBandHeight, outputHeight);
+
+                bandSums[band] = ComputeSsimBand(a, b, bandStart, bandEnd);
+            }
+        });
+
+        SsimSums total = { 0.0, 0.0 };
+
+        for (const SsimSums& sums : bandSums)
+        {
+            total.ssim += sums.ssim;
+            total.contrastStructure += sums.contrastStructure;
+        }
+
+        const double count = static_cast<double>(outputWidth) * static_cast<double>(outputHeight);
+
+        return SsimSums{ total.ssim / count, total.contrastStructure / count };
+    }
+
+    void Downsample(const Plane& src, Plane& dst)
+    {
+        dst.Allocate(src.width / 2, src.height / 2);
+
+        for (int y = 0; y < dst.height; y++)
+        {
+            const float* srcRow0 = src.Row(y * 2);
+            const float* srcRow1 = src.Row((y * 2) + 1);
+            float* dstRow = dst.Row(y);
+
+            for (int x = 0; x < dst.width; x++)
+            {
+                dstRow[x] = (srcRow0[x * 2] + srcRow0[(x * 2) + 1] + srcRow1[x * 2] + srcRow1[(x * 2) + 1]) * 0.25f;
+            }
+        }
+    }
+
+    double ComputeMsSsim(const Plane& a, const Plane& b, int threadCount)
+    {
+        Plane scaledA;
+        Plane scaledB;
+        const Plane* currentA = &a;
+        const Plane* currentB = &b;
+
+        double result = 1.0;
+        double weightSum = 0.0;
+
+        for (size_t scale = 0; scale < MsSsimWeights.size(); scale++)
+        {
+            const SsimSums sums = ComputeSsim(*currentA, *currentB, threadCount);
+            const bool lastScale = scale + 1 == MsSsimWeights.size()
+                                || (currentA->width / 2) < GaussianSize
+                                || (currentA->height / 2) < GaussianSize;
+
+            // The luminance term is only included at the coarsest scale.
+            const double value = std::max(lastScale ? sums.ssim : sums.contrastStructure, 0.0);
+
+            result *= std::pow(value, MsSsimWeights[scale]);
+            weightSum += MsSsimWeights[scale];
+
+            if (lastScale)
+            {
+                break;
+            }
+
+            Plane nextA;
+            Plane nextB;
+            Downsample(*currentA, nextA);
+            Downsample(*currentB, nextB);
+
+            scaledA = std::move(nextA);
+            scaledB = std::move(nextB);
+            currentA = &scaledA;
+            currentB = &scaledB;
+        }
+
+        // Images that are too small for all of the scales use the weights of the scales
+        // that were computed, normalized so that they add up to 1.
+        return std::pow(result, 1.0 / weightSum);
+    }
+
+    double CombineChannels(const double (&values)[4], MetricsColorDomain colorDomain)
+    {
+        if (colorDomain == MetricsColorDomain::YCbCr)
+        {
+            // Luma is weighted higher than chroma, this is the 6:1:1 weighting used by video codec comparisons.
+            return ((6.0 * values[0]) + values[1] + values[2]) / 8.0;
+        }
+
+        return (values[0] + values[1] + values[2]) / 3.0;
+    }
+}
+
+Status Metrics::ComputeImageMetrics(
+    const BitmapData* reference,
+    const BitmapData* distorted,
+    const MetricsOptions* options,
+    ImageQualityMetrics* metrics)
+{
+    if (!reference || !distorted || !options || !metrics)
+    {
+        return Status::NullParameter;
+    }
+
+    if (reference->width != distorted->width
+        || reference->height != distorted->height
+        || reference->width <= 0
+        || reference->height <= 0)
+    {
+        return Status::InvalidParameter;
+    }
+
+    *metrics = {};
+
+    try
+    {
+        Plane referencePlanes[ChannelCount];
+        Plane distortedPlanes[ChannelCount];
+
+        ConvertToPlanes(reference, options->colorDomain, referencePlanes, options->threadCount);
+        ConvertToPlanes(distorted, options->colorDomain, distortedPlanes, options->threadCount);
+
+        double meanSquaredError[4];
+
+        for (int i = 0; i < ChannelCount; i++)
+        {
+            meanSquaredError[i] = ComputeMeanSquaredError(referencePlanes[i], distortedPlanes[i], options->threadCount);
+            metrics->psnr[i] = MeanSquaredErrorToPsnr(meanSquaredError[i]);
+            metrics->ssim[i] = ComputeSsim(referencePlanes[i], distortedPlanes[i], options->threadCount).ssim;
+
+            if (options->computeMsSsim)
+            {
+                metrics->msSsim[i] = ComputeMsSsim(referencePlanes[i], distortedPlanes[i], options->threadCount);
+            }
+        }
+
+        metrics->psnr[CombinedIndex] = MeanSquaredErrorToPsnr(CombineChannels(meanSquaredError, options->colorDomain));
+        metrics->ssim[CombinedIndex] = CombineChannels(metrics->ssim, options->colorDomain);
+
+        if (options->computeMsSsim)
+        {
+            metrics->msSsim[CombinedIndex] = CombineChannels(metrics->msSsim, options->colorDomain);
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        return Status::OutOfMemory;
+    }
+    catch (...)
+    {
+        return Status::UnknownError;
+    }
+
+    return Status::Ok;
+}
+
+double Metrics::ComputePlaneSimilarity(
+    const uint8_t* reference,
+    int referenceStride,
+    const uint8_t* distorted,
+    int distortedStride,
+    int width,
+    int height,
+    bool multiScale,
+    int threadCount)
+{
+    Plane referencePlane;
+    Plane distortedPlane;
+
+    referencePlane.Allocate(width, height);
+    distortedPlane.Allocate(width, height);
+
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t* referenceRow = reference + (static_cast<intptr_t>(y) * referenceStride);
+        const uint8_t* distortedRow = distorted + (static_cast<intptr_t>(y) * distortedStride);
+        float* referenceDst = referencePlane.Row(y);
+        float* distortedDst = distortedPlane.Row(y);
+
+        for (int x = 0; x < width; x++)
+        {
+            referenceDst[x] = referenceRow[x];
+            distortedDst[x] = distortedRow[x];
+        }
+    }
+
+    if (multiScale)
+    {
+        return ComputeMsSsim(referencePlane, distortedPlane, threadCount);
+    }
+
+    return ComputeSsim(referencePlane, distortedPlane, threadCount).ssim;
+}
@@ -0,0 +1,45 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include "HeicFileTypePlusIO.h"
+#include <stdint.h>
+
+namespace Metrics
+{
+    Status ComputeImageMetrics(
+        const BitmapData* reference,
+        const BitmapData* distorted,
+        const MetricsOptions* options,
+        ImageQualityMetrics* metrics);
+
+    // Computes the SSIM, or MS-SSIM, of a single 8-bit image plane.
+    // This is used to compare the YCbCr planes that the encoder works with, it throws
+    // std::bad_alloc if there is not enough memory.
+    double ComputePlaneSimilarity(
+        const uint8_t* reference,
+        int referenceStride,
+        const uint8_t* distorted,
+        int distortedStride,
+        int width,
+        int height,
+        bool multiScale,
+        int threadCount);
+}
@@ -0,0 +1,221 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "ParallelFor.h"
+#include "ThreadBudget.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct Job
+    {
+        const std::function<void(int, int)>* body;
+        int begin;
+        int end;
+        int grainSize;
+        int chunkCount;
+        std::atomic<int> nextChunk;
+
+        std::mutex mutex;
+        std::condition_variable finished;
+        int activeThreads;
+        std::exception_ptr exception;
+    };
+
+    // The threads claim the chunks of a job from a shared counter, so a thread that
+    // finishes its chunks early takes the remaining chunks from the slower threads.
+    void RunChunks(Job& job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            job.activeThreads++;
+        }
+
+        try
+        {
+            for (int chunk = job.nextChunk++; chunk < job.chunkCount; chunk = job.nextChunk++)
+            {
+                const int chunkBegin = job.begin + (chunk * job.grainSize);
+                const int chunkEnd = std::min(chunkBegin + job.grainSize, job.end);
+
+                (*job.body)(chunkBegin, chunkEnd);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(job.mutex);
+
+            if (!job.exception)
+            {
+                job.exception = std::current_exception();
+            }
+
+            // Stop the other threads from starting new chunks.
+            job.nextChunk = job.chunkCount;
+        }
+
+        std::lock_guard<std::mutex> lock(job.mutex);
+
+        if (--job.activeThreads == 0)
+        {
+            job.finished.notify_all();
+        }
+    }
+
+    // The worker threads are shared by all of the operations, this avoids creating
+    // new threads for every parallel loop.
+    class WorkerPool
+    {
+    public:
+        // Queues the job for up to helperCount worker threads, the pool grows to the thread budget.
+        void Submit(const std::shared_ptr<Job>& job, int helperCount)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            const size_t workerCount = static_cast<size_t>(std::max(ThreadBudget::GetMaxThreads() - 1, 0));
+
+            try
+            {
+                while (workers.size() < workerCount)
+                {
+                    workers.emplace_back(&WorkerPool::WorkerLoop, this);
+                    workers.back().detach();
+                }
+            }
+            catch (const std::system_error&)
+            {
+                // Continue with the threads that were started.
+            }
+
+            if (workers.empty())
+            {
+                return;
+            }
+
+            for (int i = 0; i < helperCount; i++)
+            {
+                queue.push_back(job);
+            }
+
+            workAvailable.notify_all();
+        }
+
+    private:
+        void WorkerLoop()
+        {
+            for (;;)
+            {
+                std::shared_ptr<Job> job;
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+
+                    workAvailable.wait(lock, [this]() { return !queue.empty(); });
+
+                    job = std::move(queue.front());
+                    queue.pop_front();
+                }
+
+                // A worker that starts after the other threads have claimed all of the chunks
+                // returns without calling the body.
+                RunChunks(*job);
+            }
+        }
+
+        std::mutex mutex;
+        std::condition_variable workAvailable;
+        std::deque<std::shared_ptr<Job>> queue;
+        std::vector<std::thread> workers;
+    };
+
+    WorkerPool& GetWorkerPool()
+    {
+        // The pool is never destroyed, the worker threads cannot be joined while the
+        // DLL is being unloaded.
+        static WorkerPool* pool = new WorkerPool();
+
+        return *pool;
+    }
+}
+
+int ParallelFor::GetProcessorCount()
+{
+    const unsigned int count = std::thread::hardware_concurrency();
+
+    return count > 0 ? static_cast<int>(count) : 1;
+}
+
+void ParallelFor::Run(int begin, int end, int grainSize, int threadCount, const std::function<void(int, int)>& body)
+{
+    if (end <= begin)
+    {
+        return;
+    }
+
+    grainSize = std::max(grainSize, 1);
+
+    const int chunkCount = ((end - begin) + grainSize - 1) / grainSize;
+
+    if (threadCount <= 0)
+    {
+        threadCount = ThreadBudget::GetThreads(ThreadBudget::Operation::Kernel);
+    }
+
+    threadCount = std::min(threadCount, chunkCount);
+
+    if (threadCount <= 1)
+    {
+        body(begin, end);
+        return;
+    }
+
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->body = &body;
+    job->begin = begin;
+    job->end = end;
+    job->grainSize = grainSize;
+    job->chunkCount = chunkCount;
+    job->nextChunk = 0;
+    job->activeThreads = 0;
+
+    GetWorkerPool().Submit(job, threadCount - 1);
+
+    // The calling thread also processes chunks, so the loop completes even when
+    // all of the worker threads are busy with other jobs.
+    RunChunks(*job);
+
+    {
+        std::unique_lock<std::mutex> lock(job->mutex);
+
+        job->finished.wait(lock, [&]() { return job->activeThreads == 0; });
+    }
+
+    if (job->exception)
+    {
+        std::rethrow_exception(job->exception);
+    }
+}
@@ -0,0 +1,34 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <functional>
+
+namespace ParallelFor
+{
+    // Returns the number of hardware threads, or 1 if it cannot be determined.
+    int GetProcessorCount();
+
+    // Splits [begin, end) into chunks of at least grainSize items and processes them on up
+    // to threadCount threads from the shared worker pool, the calling thread also processes chunks.
+    // A threadCount of 0 uses the kernel share of the thread budget. An exception thrown by the body is rethrown
+    // on the calling thread after all of the threads have finished.
+    void Run(int begin, int end, int grainSize, int threadCount, const std::function<void(int, int)>& body);
+}
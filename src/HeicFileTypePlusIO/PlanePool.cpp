@@ -0,0 +1,242 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "PlanePool.h"
+#include "MemoryAccounting.h"
+#include <array>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    // The buckets are powers of two, starting at 4 KB.
+    constexpr int MinimumBucketShift = 12;
+    constexpr int BucketCount = 48 - MinimumBucketShift;
+
+    // The pool keeps a limited number of buffers so that a single large image
+    // does not keep its memory for the lifetime of the process.
+    constexpr size_t MaxBuffersPerBucket = 8;
+    constexpr uint64_t MaxRetainedBytes = 256ULL * 1024 * 1024;
+
+    struct PoolState
+    {
+        std::mutex mutex;
+        std::array<std::vector<void*>, BucketCount> buckets;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t retainedBuffers;
+        uint64_t retainedBytes;
+    };
+
+    PoolState& GetPoolState()
+    {
+        // The state is never destroyed so that buffers can be returned during process shutdown.
+        static PoolState* const state = new PoolState();
+
+        return *state;
+    }
+
+    size_t GetBucketSize(int bucket)
+    {
+        return static_cast<size_t>(1) << (bucket + MinimumBucketShift);
+    }
+
+    int GetBucket(size_t size)
+    {
+        int bucket = 0;
+
+        while (bucket < BucketCount && GetBucketSize(bucket) < size)
+        {
+            bucket++;
+        }
+
+        return bucket;
+    }
+
+    void* AllocateAligned(size_t size)
+    {
+        return ::operator new(size, std::align_val_t(PlanePool::Alignment), std::nothrow);
+    }
+
+    void FreeAligned(void* buffer)
+    {
+        ::operator delete(buffer, std::align_val_t(PlanePool::Alignment));
+    }
+}
+
+PlanePool::Buffer::Buffer() noexcept : buffer(nullptr), bufferSize(0), bucket(0)
+{
+}
+
+PlanePool::Buffer::Buffer(void* buffer, size_t size, int bucket) noexcept
+    : buffer(buffer), bufferSize(size), bucket(bucket)
+{
+}
+
+PlanePool::Buffer::~Buffer()
+{
+    Return();
+}
+
+PlanePool::Buffer::Buffer(Buffer&& other) noexcept
+    : buffer(std::exchange(other.buffer, nullptr)),
+      bufferSize(std::exchange(other.bufferSize, 0)),
+      bucket(other.bucket)
+{
+}
+
+PlanePool::Buffer& PlanePool::Buffer::operator=(Buffer&& other) noexcept
+{
+    if (this != &other)
+    {
+        Return();
+
+        buffer = std::exchange(other.buffer, nullptr);
+        bufferSize = std::exchange(other.bufferSize, 0);
+        bucket = other.bucket;
+    }
+
+    return *this;
+}
+
+void PlanePool::Buffer::Return() noexcept
+{
+    if (!buffer)
+    {
+        return;
+    }
+
+    const size_t capacity = GetBucketSize(bucket);
+
+    MemoryAccounting::Release(capacity);
+
+    bool retained = false;
+
+    {
+        PoolState& state = GetPoolState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+
+        std::vector<void*>& freeBuffers = state.buckets[bucket];
+
+        if (freeBuffers.size() < MaxBuffersPerBucket && (state.retainedBytes + capacity) <= MaxRetainedBytes)
+        {
+            try
+            {
+                freeBuffers.push_back(buffer);
+                state.retainedBuffers++;
+                state.retainedBytes += capacity;
+                retained = true;
+            }
+            catch (const std::bad_alloc&)
+            {
+                // The buffer is freed below.
+            }
+        }
+    }
+
+    if (!retained)
+    {
+        FreeAligned(buffer);
+    }
+
+    buffer = nullptr;
+    bufferSize = 0;
+}
+
+PlanePool::Buffer PlanePool::Acquire(size_t size)
+{
+    const int bucket = GetBucket(size);
+
+    if (bucket >= BucketCount)
+    {
+        throw std::bad_alloc();
+    }
+
+    const size_t capacity = GetBucketSize(bucket);
+    void* buffer = nullptr;
+
+    {
+        PoolState& state = GetPoolState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+
+        std::vector<void*>& freeBuffers = state.buckets[bucket];
+
+        if (!freeBuffers.empty())
+        {
+            buffer = freeBuffers.back();
+            freeBuffers.pop_back();
+
+            state.hits++;
+            state.retainedBuffers--;
+            state.retainedBytes -= capacity;
+        }
+        else
+        {
+            state.misses++;
+        }
+    }
+
+    if (!buffer)
+    {
+        buffer = AllocateAligned(capacity);
+
+        if (!buffer)
+        {
+            throw std::bad_alloc();
+        }
+    }
+
+    MemoryAccounting::Charge(capacity);
+
+    return Buffer(buffer, size, bucket);
+}
+
+void PlanePool::GetStatistics(PlanePoolStatistics* statistics)
+{
+    PoolState& state = GetPoolState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    statistics->hits = state.hits;
+    statistics->misses = state.misses;
+    statistics->retainedBuffers = state.retainedBuffers;
+    statistics->retainedBytes = state.retainedBytes;
+}
+
+void PlanePool::Trim()
+{
+    std::array<std::vector<void*>, BucketCount> buckets;
+
+    {
+        PoolState& state = GetPoolState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+
+        buckets.swap(state.buckets);
+        state.retainedBuffers = 0;
+        state.retainedBytes = 0;
+    }
+
+    for (const std::vector<void*>& freeBuffers : buckets)
+    {
+        for (void* buffer : freeBuffers)
+        {
+            FreeAligned(buffer);
+        }
+    }
+}
@@ -0,0 +1,75 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "HeicFileTypePlusIO.h"
+#include <cstddef>
+
+// A size-bucketed pool of the 64-byte aligned staging buffers that the plugin uses
+// for image planes, the buffers are reused across operations to avoid repeatedly
+// allocating and freeing large blocks.
+// libheif does not support caller-provided plane memory, so the planes of a heif_image
+// are always allocated by libheif.
+namespace PlanePool
+{
+    constexpr size_t Alignment = 64;
+
+    // A buffer that is returned to the pool when it is destroyed.
+    // The contents of a buffer are not initialized.
+    class Buffer
+    {
+    public:
+        Buffer() noexcept;
+        ~Buffer();
+
+        Buffer(Buffer&& other) noexcept;
+        Buffer& operator=(Buffer&& other) noexcept;
+
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+
+        void* data() const noexcept
+        {
+            return buffer;
+        }
+
+        size_t size() const noexcept
+        {
+            return bufferSize;
+        }
+
+    private:
+        friend Buffer Acquire(size_t size);
+
+        Buffer(void* buffer, size_t size, int bucket) noexcept;
+
+        void Return() noexcept;
+
+        void* buffer;
+        size_t bufferSize;
+        int bucket;
+    };
+
+    // Gets a buffer of at least the specified size, throws std::bad_alloc on failure.
+    Buffer Acquire(size_t size);
+
+    void GetStatistics(PlanePoolStatistics* statistics);
+
+    void Trim();
+}
@@ -0,0 +1,56 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// Compatibility definitions that allow the native code to be built
+// with compilers other than MSVC, e.g. for profiling on Linux.
+
+#if !defined(_WIN32)
+
+#ifndef __stdcall
+#define __stdcall
+#endif // !__stdcall
+
+#endif // !_WIN32
+
+#if !defined(_MSC_VER) && !defined(__STDC_LIB_EXT1__)
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+inline int memcpy_s(void* dest, size_t destSize, const void* src, size_t count)
+{
+    if (!dest || (!src && count > 0))
+    {
+        return EINVAL;
+    }
+
+    if (count > destSize)
+    {
+        memset(dest, 0, destSize);
+        return ERANGE;
+    }
+
+    memcpy(dest, src, count);
+    return 0;
+}
+
+#endif // !_MSC_VER && !__STDC_LIB_EXT1__
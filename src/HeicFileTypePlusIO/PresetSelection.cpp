@@ -0,0 +1,327 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "PresetSelection.h"
+#include "HeicEncoder.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    constexpr int32_t SpeedModelVersion = 1;
+    constexpr int CalibrationImageSize = 256;
+    constexpr int CalibrationEncodes = 2;
+    // The speed that is used when the calibration encode fails, it is not cached.
+    constexpr double DefaultMegapixelsPerSecond = 0.5;
+    // The fraction of each additional thread that the wavefront parallelism gains.
+    constexpr double ParallelEfficiency = 0.75;
+    constexpr double MispredictionTolerance = 0.5;
+
+    struct SelectionState
+    {
+        std::mutex mutex;
+        double megapixelsPerSecond;
+        uint64_t selections;
+        uint64_t missedBudgets;
+        uint64_t mispredictions;
+        double timeRatioSum;
+    };
+
+    SelectionState& GetSelectionState()
+    {
+        static SelectionState state{};
+
+        return state;
+    }
+
+    // The costs are relative to the calibration encode, they were measured with single frame
+    // intra encodes of photographic content. The presets up to medium mostly change the
+    // inter prediction settings, so they take about the same time for an intra frame.
+    double GetPresetCost(EncoderPreset preset)
+    {
+        switch (preset)
+        {
+        case EncoderPreset::Slow:
+            return 2.2;
+        case EncoderPreset::Slower:
+        case EncoderPreset::VerySlow:
+            return 2.8;
+        case EncoderPreset::Placebo:
+            return 3.8;
+        case EncoderPreset::UltraFast:
+        case EncoderPreset::SuperFast:
+        case EncoderPreset::VeryFast:
+        case EncoderPreset::Faster:
+        case EncoderPreset::Fast:
+        case EncoderPreset::Medium:
+        default:
+            return 1.0;
+        }
+    }
+
+    double GetChromaCost(YUVChromaSubsampling yuvFormat)
+    {
+        switch (yuvFormat)
+        {
+        case YUVChromaSubsampling::Subsampling400:
+            return 0.75;
+        case YUVChromaSubsampling::Subsampling422:
+            return 1.22;
+        case YUVChromaSubsampling::Subsampling444:
+        case YUVChromaSubsampling::IdentityMatrix:
+            return 1.25;
+        case YUVChromaSubsampling::Subsampling420:
+        default:
+            return 1.0;
+        }
+    }
+
+    double GetTuningCost(EncoderTuning tuning)
+    {
+        switch (tuning)
+        {
+        case EncoderTuning::FilmGrain:
+            return 0.75;
+        case EncoderTuning::FastDecode:
+            return 0.88;
+        case EncoderTuning::PSNR:
+        case EncoderTuning::SSIM:
+        case EncoderTuning::None:
+        default:
+            return 1.0;
+        }
+    }
+
+    double GetQualityCost(int quality)
+    {
+        // The cost at every 10 quality steps, the lower qualities produce fewer coefficients to code.
+        // The highest qualities skip most of the rate-distortion optimized quantization.
+        static const double QualityCosts[] = { 0.15, 0.19, 0.24, 0.3, 0.45, 0.6, 0.7, 0.77, 0.83, 1.0, 0.65 };
+
+        const int clampedQuality = std::clamp(quality, 0, 100);
+        const int index = std::min(clampedQuality / 10, 9);
+        const double fraction = (clampedQuality - (index * 10)) / 10.0;
+
+        return QualityCosts[index] + ((QualityCosts[index + 1] - QualityCosts[index]) * fraction);
+    }
+
+    void CreateCalibrationImage(std::vector<ColorBgra>& pixels)
+    {
+        pixels.resize(static_cast<size_t>(CalibrationImageSize) * CalibrationImageSize);
+
+        uint32_t seed = 1;
+
+        for (int y = 0; y < CalibrationImageSize; y++)
+        {
+            for (int x = 0; x < CalibrationImageSize; x++)
+            {
+                // Smooth gradients with a small amount of noise, similar to a photo.
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+
+                const int noise = static_cast<int>(seed & 15) - 8;
+
+                ColorBgra& pixel = pixels[(static_cast<size_t>(y) * CalibrationImageSize) + x];
+                pixel.r = static_cast<uint8_t>(std::clamp(x + noise, 0, 255));
+                pixel.g = static_cast<uint8_t>(std::clamp(y + noise, 0, 255));
+                pixel.b = static_cast<uint8_t>(std::clamp(((x + y) / 2) + noise, 0, 255));
+                pixel.a = 255;
+            }
+        }
+    }
+
+    // Returns 0 if the calibration encode failed.
+    double MeasureMegapixelsPerSecond()
+    {
+        Trace::ScopedEvent traceEvent("CalibrateEncoderSpeed");
+
+        std::vector<ColorBgra> pixels;
+        CreateCalibrationImage(pixels);
+
+        const BitmapData input =
+        {
+            reinterpret_cast<uint8_t*>(pixels.data()),
+            CalibrationImageSize,
+            CalibrationImageSize,
+            CalibrationImageSize * static_cast<int32_t>(sizeof(ColorBgra))
+        };
+
+        // The calibration uses a single x265 thread, the predictions are scaled by the thread count.
+        const EncoderParameter parameters[] = { { "x265:pools", "1" } };
+        const EncoderOptions options =
+        {
+            90,
+            YUVChromaSubsampling::Subsampling420,
+            EncoderPreset::Medium,
+            EncoderTuning::None,
+            1,
+            0,
+            parameters,
+            1,
+            0
+        };
+        const EncoderMetadata metadata{};
+        const CICPColorData colorData =
+        {
+            heif_color_primaries_ITU_R_BT_709_5,
+            heif_transfer_characteristic_IEC_61966_2_1,
+            heif_matrix_coefficients_ITU_R_BT_709_5,
+            true
+        };
+
+        double fastestSeconds = std::numeric_limits<double>::max();
+
+        // The fastest encode is used, the first one includes the encoder start up.
+        for (int i = 0; i < CalibrationEncodes; i++)
+        {
+            ScopedHeifContext context(heif_context_alloc());
+
+            if (!context)
+            {
+                return 0;
+            }
+
+            const Clock::time_point start = Clock::now();
+
+            if (HeicEncoder::Encode(context.get(), &input, &options, &metadata, colorData, nullptr) != Status::Ok)
+            {
+                return 0;
+            }
+
+            fastestSeconds = std::min(fastestSeconds, std::chrono::duration<double>(Clock::now() - start).count());
+        }
+
+        const double megapixels = (static_cast<double>(CalibrationImageSize) * CalibrationImageSize) / 1000000.0;
+
+        return megapixels / std::max(fastestSeconds, 0.001);
+    }
+
+    double GetMegapixelsPerSecond()
+    {
+        SelectionState& state = GetSelectionState();
+
+        // The lock is held during the calibration so that concurrent saves only calibrate once.
+        std::lock_guard<std::mutex> lock(state.mutex);
+
+        if (state.megapixelsPerSecond <= 0)
+        {
+            state.megapixelsPerSecond = MeasureMegapixelsPerSecond();
+        }
+
+        return state.megapixelsPerSecond > 0 ? state.megapixelsPerSecond : DefaultMegapixelsPerSecond;
+    }
+}
+
+double PresetSelection::PredictMilliseconds(double megapixels, const EncoderOptions* options, int threadCount)
+{
+    const double cost = megapixels
+                      * GetPresetCost(options->preset)
+                      * GetChromaCost(options->yuvFormat)
+                      * GetTuningCost(options->tuning)
+                      * GetQualityCost(options->quality);
+    const double speedup = 1.0 + (std::max(threadCount - 1, 0) * ParallelEfficiency);
+
+    return (cost * 1000.0) / (GetMegapixelsPerSecond() * speedup);
+}
+
+void PresetSelection::RecordEncode(double predictedMilliseconds, double encodeMilliseconds, int32_t timeBudgetMilliseconds)
+{
+    SelectionState& state = GetSelectionState();
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    const double timeRatio = encodeMilliseconds / std::max(predictedMilliseconds, 1.0);
+
+    state.selections++;
+    state.timeRatioSum += timeRatio;
+
+    if (encodeMilliseconds > timeBudgetMilliseconds)
+    {
+        state.missedBudgets++;
+    }
+
+    if (std::abs(timeRatio - 1.0) > MispredictionTolerance)
+    {
+        state.mispredictions++;
+    }
+}
+
+Status PresetSelection::GetModel(EncoderSpeedModel* model)
+{
+    if (!model)
+    {
+        return Status::NullParameter;
+    }
+
+    GetMegapixelsPerSecond();
+
+    SelectionState& state = GetSelectionState();
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    if (state.megapixelsPerSecond <= 0)
+    {
+        return Status::EncodeFailed;
+    }
+
+    model->version = SpeedModelVersion;
+    model->megapixelsPerSecond = state.megapixelsPerSecond;
+
+    return Status::Ok;
+}
+
+Status PresetSelection::SetModel(const EncoderSpeedModel* model)
+{
+    if (!model)
+    {
+        return Status::NullParameter;
+    }
+
+    if (model->version != SpeedModelVersion || !(model->megapixelsPerSecond > 0) || !std::isfinite(model->megapixelsPerSecond))
+    {
+        return Status::InvalidParameter;
+    }
+
+    SelectionState& state = GetSelectionState();
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    state.megapixelsPerSecond = model->megapixelsPerSecond;
+
+    return Status::Ok;
+}
+
+void PresetSelection::GetStatistics(PresetSelectionStatistics* statistics)
+{
+    SelectionState& state = GetSelectionState();
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    statistics->selections = state.selections;
+    statistics->missedBudgets = state.missedBudgets;
+    statistics->mispredictions = state.mispredictions;
+    statistics->meanTimeRatio = state.selections > 0 ? state.timeRatioSum / static_cast<double>(state.selections) : 0.0;
+}
@@ -0,0 +1,40 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "HeicFileTypePlusIO.h"
+
+// Predicts the encode time of the x265 presets for EncoderPreset::Automatic.
+// The machine speed is measured with a small calibration encode the first time
+// that it is needed, the preset, chroma, tuning and quality costs are fixed.
+namespace PresetSelection
+{
+    // Predicts the time that encoding the megapixels with the options takes,
+    // threadCount is the number of threads that the x265 thread pool can keep busy.
+    double PredictMilliseconds(double megapixels, const EncoderOptions* options, int threadCount);
+
+    // Records the measured time of an encode that used a selected preset.
+    void RecordEncode(double predictedMilliseconds, double encodeMilliseconds, int32_t timeBudgetMilliseconds);
+
+    Status GetModel(EncoderSpeedModel* model);
+
+    Status SetModel(const EncoderSpeedModel* model);
+
+    void GetStatistics(PresetSelectionStatistics* statistics);
+}
@@ -0,0 +1,153 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "Resampler.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace
+{
+    // The source pixels that contribute to each destination pixel along one axis,
+    // the weights of each destination pixel add up to 1.
+    struct AxisWeights
+    {
+        std::vector<int> firstSource;
+        std::vector<int> weightOffset;
+        std::vector<float> weights;
+    };
+
+    AxisWeights ComputeAxisWeights(int sourceSize, int destinationSize)
+    {
+        AxisWeights axis;
+        axis.firstSource.resize(destinationSize);
+        axis.weightOffset.resize(static_cast<size_t>(destinationSize) + 1);
+
+        const double scale = static_cast<double>(sourceSize) / static_cast<double>(destinationSize);
+
+        for (int i = 0; i < destinationSize; i++)
+        {
+            const double begin = i * scale;
+            const double end = (i + 1) * scale;
+            const int first = static_cast<int>(std::floor(begin));
+            const int last = std::min(static_cast<int>(std::ceil(end)), sourceSize);
+
+            axis.firstSource[i] = first;
+            axis.weightOffset[i] = static_cast<int>(axis.weights.size());
+
+            for (int source = first; source < last; source++)
+            {
+                const double coverage = std::min(end, source + 1.0) - std::max(begin, static_cast<double>(source));
+
+                axis.weights.push_back(static_cast<float>(coverage / scale));
+            }
+        }
+
+        axis.weightOffset[destinationSize] = static_cast<int>(axis.weights.size());
+
+        return axis;
+    }
+
+    // Adds the horizontally resampled source row to the premultiplied BGRA accumulator.
+    void AccumulateRow(const ColorBgra* sourceRow, const AxisWeights& horizontal, float rowWeight, float* accumulator, int width)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            const int first = horizontal.firstSource[x];
+            const int begin = horizontal.weightOffset[x];
+            const int end = horizontal.weightOffset[x + 1];
+
+            float b = 0;
+            float g = 0;
+            float r = 0;
+            float a = 0;
+
+            for (int i = begin; i < end; i++)
+            {
+                const ColorBgra& pixel = sourceRow[first + (i - begin)];
+                const float weight = horizontal.weights[i] * pixel.a;
+
+                b += weight * pixel.b;
+                g += weight * pixel.g;
+                r += weight * pixel.r;
+                a += weight;
+            }
+
+            float* sum = accumulator + (static_cast<size_t>(x) * 4);
+
+            sum[0] += rowWeight * b;
+            sum[1] += rowWeight * g;
+            sum[2] += rowWeight * r;
+            sum[3] += rowWeight * a;
+        }
+    }
+
+    uint8_t ToByte(float value)
+    {
+        return static_cast<uint8_t>(std::clamp(value + 0.5f, 0.0f, 255.0f));
+    }
+}
+
+void Resampler::Downscale(const BitmapData* source, const BitmapData* destination)
+{
+    const AxisWeights horizontal = ComputeAxisWeights(source->width, destination->width);
+    const AxisWeights vertical = ComputeAxisWeights(source->height, destination->height);
+    const int width = destination->width;
+
+    ParallelFor::Run(0, destination->height, 8, 0, [&](int begin, int end)
+    {
+        std::vector<float> accumulator(static_cast<size_t>(width) * 4);
+
+        for (int y = begin; y < end; y++)
+        {
+            std::fill(accumulator.begin(), accumulator.end(), 0.0f);
+
+            const int firstRow = vertical.firstSource[y];
+
+            for (int i = vertical.weightOffset[y]; i < vertical.weightOffset[y + 1]; i++)
+            {
+                const int sourceY = firstRow + (i - vertical.weightOffset[y]);
+                const ColorBgra* sourceRow = reinterpret_cast<const ColorBgra*>(source->scan0 + (static_cast<int64_t>(sourceY) * source->stride));
+
+                AccumulateRow(sourceRow, horizontal, vertical.weights[i], accumulator.data(), width);
+            }
+
+            ColorBgra* destinationRow = reinterpret_cast<ColorBgra*>(destination->scan0 + (static_cast<int64_t>(y) * destination->stride));
+
+            for (int x = 0; x < width; x++)
+            {
+                const float* sum = accumulator.data() + (static_cast<size_t>(x) * 4);
+                ColorBgra& pixel = destinationRow[x];
+
+                if (sum[3] > 0)
+                {
+                    // The alpha sum is the average alpha multiplied by 255.
+                    pixel.b = ToByte(sum[0] / sum[3]);
+                    pixel.g = ToByte(sum[1] / sum[3]);
+                    pixel.r = ToByte(sum[2] / sum[3]);
+                    pixel.a = ToByte(sum[3] / 255.0f);
+                }
+                else
+                {
+                    pixel = {};
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,120 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "ThreadBudget.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <atomic>
+
+namespace
+{
+    // A value of 0 uses the default.
+    std::atomic<int> maxThreadsOption = 0;
+    std::atomic<int> encoderThreadsOption = 0;
+    std::atomic<int> decoderThreadsOption = 0;
+    std::atomic<int> kernelThreadsOption = 0;
+
+    std::atomic<int> activeOperations = 0;
+    thread_local int operationDepth = 0;
+
+    int ResolveOperationThreads(int value, int maxThreads)
+    {
+        return value > 0 ? std::min(value, maxThreads) : maxThreads;
+    }
+}
+
+ThreadBudget::ScopedOperation::ScopedOperation()
+{
+    if (operationDepth++ == 0)
+    {
+        activeOperations++;
+    }
+}
+
+ThreadBudget::ScopedOperation::~ScopedOperation()
+{
+    if (--operationDepth == 0)
+    {
+        activeOperations--;
+    }
+}
+
+Status ThreadBudget::SetOptions(const ThreadBudgetOptions* options)
+{
+    if (!options)
+    {
+        return Status::NullParameter;
+    }
+
+    if (options->maxThreads < 0
+        || options->encoderThreads < 0
+        || options->decoderThreads < 0
+        || options->kernelThreads < 0)
+    {
+        return Status::InvalidParameter;
+    }
+
+    maxThreadsOption = options->maxThreads;
+    encoderThreadsOption = options->encoderThreads;
+    decoderThreadsOption = options->decoderThreads;
+    kernelThreadsOption = options->kernelThreads;
+
+    return Status::Ok;
+}
+
+void ThreadBudget::GetOptions(ThreadBudgetOptions* options)
+{
+    const int maxThreads = GetMaxThreads();
+
+    options->maxThreads = maxThreads;
+    options->encoderThreads = ResolveOperationThreads(encoderThreadsOption, maxThreads);
+    options->decoderThreads = ResolveOperationThreads(decoderThreadsOption, maxThreads);
+    options->kernelThreads = ResolveOperationThreads(kernelThreadsOption, maxThreads);
+}
+
+int ThreadBudget::GetMaxThreads()
+{
+    const int maxThreads = maxThreadsOption;
+
+    return maxThreads > 0 ? maxThreads : ParallelFor::GetProcessorCount();
+}
+
+int ThreadBudget::GetThreads(Operation operation)
+{
+    const int maxThreads = GetMaxThreads();
+    const int operationCount = std::max(activeOperations.load(), 1);
+    const int sharedThreads = std::max(maxThreads / operationCount, 1);
+
+    int operationThreads;
+
+    switch (operation)
+    {
+    case Operation::Encode:
+        operationThreads = ResolveOperationThreads(encoderThreadsOption, maxThreads);
+        break;
+    case Operation::Decode:
+        operationThreads = ResolveOperationThreads(decoderThreadsOption, maxThreads);
+        break;
+    case Operation::Kernel:
+    default:
+        operationThreads = ResolveOperationThreads(kernelThreadsOption, maxThreads);
+        break;
+    }
+
+    return std::min(sharedThreads, operationThreads);
+}
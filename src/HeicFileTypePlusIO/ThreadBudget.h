@@ -0,0 +1,56 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "HeicFileTypePlusIO.h"
+
+// Divides the threads between the libheif decoders, the x265 encoder and the
+// conversion kernels of all of the operations that run at the same time.
+namespace ThreadBudget
+{
+    enum class Operation
+    {
+        Encode,
+        Decode,
+        Kernel
+    };
+
+    // Marks an exported operation as running on the current thread,
+    // nested operations are included in the outermost operation.
+    class ScopedOperation
+    {
+    public:
+        ScopedOperation();
+        ~ScopedOperation();
+
+        ScopedOperation(const ScopedOperation&) = delete;
+        ScopedOperation& operator=(const ScopedOperation&) = delete;
+    };
+
+    Status SetOptions(const ThreadBudgetOptions* options);
+
+    // Gets the options with the default values resolved.
+    void GetOptions(ThreadBudgetOptions* options);
+
+    int GetMaxThreads();
+
+    // Returns the number of threads that the operation can use, the maximum thread count is
+    // shared equally between the operations that are running and limited to the operation share.
+    int GetThreads(Operation operation);
+}
@@ -0,0 +1,408 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "Trace.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#endif
+
+namespace
+{
+    // The events are recorded in a per-thread buffer without any locking, the buffer is
+    // published to a lock-free list when the outermost event on the thread ends or the
+    // buffer is full. Only Flush takes a lock, to serialize the writes to the file.
+    // Publishing copies the events into a chunk of the exact size, so the thread buffer
+    // keeps its capacity and is only allocated once per thread.
+    constexpr size_t EventsPerChunk = 4096;
+
+    struct IoCounters
+    {
+        uint64_t readCalls;
+        uint64_t bytesRead;
+        uint64_t writeCalls;
+        uint64_t bytesWritten;
+    };
+
+    struct Event
+    {
+        const char* name;
+        uint64_t timestamp;
+        IoCounters io;
+        uint32_t threadId;
+        char phase;
+    };
+
+    struct EventChunk
+    {
+        EventChunk* next;
+        std::vector<Event> events;
+    };
+
+    std::atomic<EventChunk*> publishedChunks{ nullptr };
+
+    uint32_t GetCurrentThreadIdentifier()
+    {
+#if defined(_WIN32)
+        return static_cast<uint32_t>(GetCurrentThreadId());
+#elif defined(__linux__)
+        return static_cast<uint32_t>(syscall(SYS_gettid));
+#else
+        static std::atomic<uint32_t> nextThreadId{ 1 };
+
+        return nextThreadId.fetch_add(1, std::memory_order_relaxed);
+#endif
+    }
+
+    uint32_t GetCurrentProcessIdentifier()
+    {
+#ifdef _WIN32
+        return static_cast<uint32_t>(GetCurrentProcessId());
+#else
+        return static_cast<uint32_t>(getpid());
+#endif
+    }
+
+    uint64_t GetTimestamp()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    struct ThreadBuffer
+    {
+        std::vector<Event> events;
+        IoCounters io{};
+        uint32_t threadId = GetCurrentThreadIdentifier();
+        int depth = 0;
+
+        ~ThreadBuffer()
+        {
+            Publish();
+        }
+
+        void Record(const char* name, char phase, const IoCounters& eventIo) noexcept
+        {
+            try
+            {
+                if (events.capacity() == 0)
+                {
+                    events.reserve(EventsPerChunk);
+                }
+
+                events.push_back(Event{ name, GetTimestamp(), eventIo, threadId, phase });
+
+                if (events.size() >= EventsPerChunk)
+                {
+                    Publish();
+                }
+            }
+            catch (...)
+            {
+                // The event is dropped if there is not enough memory to record it.
+            }
+        }
+
+        void Publish() noexcept
+        {
+            if (events.empty())
+            {
+                return;
+            }
+
+            EventChunk* chunk = new (std::nothrow) EventChunk();
+
+            if (!chunk)
+            {
+                return;
+            }
+
+            try
+            {
+                chunk->events.assign(events.begin(), events.end());
+            }
+            catch (...)
+            {
+                // The events are dropped if there is not enough memory to publish them.
+                delete chunk;
+                events.clear();
+                return;
+            }
+
+            events.clear();
+            chunk->next = publishedChunks.load(std::memory_order_relaxed);
+
+            while (!publishedChunks.compare_exchange_weak(
+                chunk->next,
+                chunk,
+                std::memory_order_release,
+                std::memory_order_relaxed))
+            {
+            }
+        }
+    };
+
+    ThreadBuffer& GetThreadBuffer()
+    {
+        // The buffer is function-local so that it is only created on the threads that record events.
+        thread_local ThreadBuffer buffer;
+
+        return buffer;
+    }
+
+    FILE* OpenTraceFile()
+    {
+#ifdef _WIN32
+        const wchar_t* const name = L"HEICFILETYPEPLUS_TRACE_FILE";
+        const DWORD requiredLength = GetEnvironmentVariableW(name, nullptr, 0);
+
+        if (requiredLength <= 1)
+        {
+            return nullptr;
+        }
+
+        std::wstring path(requiredLength, L'\0');
+
+        const DWORD length = GetEnvironmentVariableW(name, &path[0], requiredLength);
+
+        if (length == 0 || length >= requiredLength)
+        {
+            return nullptr;
+        }
+
+        path.resize(length);
+
+        FILE* file = nullptr;
+
+        return _wfopen_s(&file, path.c_str(), L"wb") == 0 ? file : nullptr;
+#else
+        const char* path = std::getenv("HEICFILETYPEPLUS_TRACE_FILE");
+
+        return path && path[0] != '\0' ? std::fopen(path, "wb") : nullptr;
+#endif
+    }
+
+    class TraceWriter
+    {
+    public:
+        TraceWriter() : file(OpenTraceFile()), processId(GetCurrentProcessIdentifier()), eventCount(0)
+        {
+            if (file)
+            {
+                std::fputs("[\n", file);
+            }
+        }
+
+        ~TraceWriter()
+        {
+            if (file)
+            {
+                Flush();
+
+                // The closing bracket is optional in the trace event format, it is only
+                // written here so that the file is also valid JSON.
+                std::fputs("\n]\n", file);
+                std::fclose(file);
+                file = nullptr;
+            }
+        }
+
+        TraceWriter(const TraceWriter&) = delete;
+        TraceWriter& operator=(const TraceWriter&) = delete;
+
+        bool IsOpen() const
+        {
+            return file != nullptr;
+        }
+
+        void Flush()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (!file)
+            {
+                return;
+            }
+
+            EventChunk* chunks = publishedChunks.exchange(nullptr, std::memory_order_acquire);
+
+            // The list is in reverse publication order.
+            EventChunk* ordered = nullptr;
+
+            while (chunks)
+            {
+                EventChunk* next = chunks->next;
+                chunks->next = ordered;
+                ordered = chunks;
+                chunks = next;
+            }
+
+            while (ordered)
+            {
+                for (const Event& event : ordered->events)
+                {
+                    WriteEvent(event);
+                }
+
+                EventChunk* next = ordered->next;
+                delete ordered;
+                ordered = next;
+            }
+
+            std::fflush(file);
+        }
+
+    private:
+        void WriteEvent(const Event& event)
+        {
+            std::fprintf(
+                file,
+                "%s{\"name\":\"%s\",\"cat\":\"heic\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%u,\"tid\":%u",
+                eventCount > 0 ? ",\n" : "",
+                event.name,
+                event.phase,
+                static_cast<double>(event.timestamp) / 1000.0,
+                processId,
+                event.threadId);
+
+            const IoCounters& io = event.io;
+
+            if (io.readCalls != 0 || io.writeCalls != 0)
+            {
+                std::fprintf(
+                    file,
+                    ",\"args\":{\"readCalls\":%llu,\"bytesRead\":%llu,\"writeCalls\":%llu,\"bytesWritten\":%llu}",
+                    static_cast<unsigned long long>(io.readCalls),
+                    static_cast<unsigned long long>(io.bytesRead),
+                    static_cast<unsigned long long>(io.writeCalls),
+                    static_cast<unsigned long long>(io.bytesWritten));
+            }
+
+            std::fputs("}", file);
+            eventCount++;
+        }
+
+        FILE* file;
+        const uint32_t processId;
+        uint64_t eventCount;
+        std::mutex mutex;
+    };
+
+    TraceWriter& GetTraceWriter()
+    {
+        // The writer is flushed and closed when the library is unloaded.
+        static TraceWriter writer;
+
+        return writer;
+    }
+}
+
+bool Trace::IsEnabled()
+{
+    static const bool enabled = GetTraceWriter().IsOpen();
+
+    return enabled;
+}
+
+void Trace::CountRead(size_t bytes)
+{
+    if (IsEnabled())
+    {
+        IoCounters& io = GetThreadBuffer().io;
+
+        io.readCalls++;
+        io.bytesRead += bytes;
+    }
+}
+
+void Trace::CountWrite(size_t bytes)
+{
+    if (IsEnabled())
+    {
+        IoCounters& io = GetThreadBuffer().io;
+
+        io.writeCalls++;
+        io.bytesWritten += bytes;
+    }
+}
+
+void Trace::Flush()
+{
+    if (IsEnabled())
+    {
+        GetThreadBuffer().Publish();
+        GetTraceWriter().Flush();
+    }
+}
+
+Trace::ScopedEvent::ScopedEvent(const char* name)
+    : name(name), enabled(IsEnabled()), startReadCalls(0), startBytesRead(0), startWriteCalls(0), startBytesWritten(0)
+{
+    if (enabled)
+    {
+        ThreadBuffer& buffer = GetThreadBuffer();
+
+        startReadCalls = buffer.io.readCalls;
+        startBytesRead = buffer.io.bytesRead;
+        startWriteCalls = buffer.io.writeCalls;
+        startBytesWritten = buffer.io.bytesWritten;
+
+        buffer.depth++;
+        buffer.Record(name, 'B', IoCounters{});
+    }
+}
+
+Trace::ScopedEvent::~ScopedEvent()
+{
+    if (enabled)
+    {
+        ThreadBuffer& buffer = GetThreadBuffer();
+
+        const IoCounters io =
+        {
+            buffer.io.readCalls - startReadCalls,
+            buffer.io.bytesRead - startBytesRead,
+            buffer.io.writeCalls - startWriteCalls,
+            buffer.io.bytesWritten - startBytesWritten
+        };
+
+        buffer.Record(name, 'E', io);
+        buffer.depth--;
+
+        if (buffer.depth == 0)
+        {
+            buffer.Publish();
+        }
+    }
+}
@@ -0,0 +1,59 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Records Chrome trace event JSON for the native load and save stages.
+// Tracing is enabled by setting the HEICFILETYPEPLUS_TRACE_FILE environment variable
+// to the output file path, the file can be opened in chrome://tracing or Perfetto.
+namespace Trace
+{
+    bool IsEnabled();
+
+    // Counts the I/O callback calls on the current thread, the totals
+    // are added to the arguments of the enclosing events.
+    void CountRead(size_t bytes);
+    void CountWrite(size_t bytes);
+
+    // Writes the recorded events to the trace file.
+    void Flush();
+
+    // Records a begin event when it is constructed and an end event when it is destroyed.
+    // The name must be a string literal.
+    class ScopedEvent
+    {
+    public:
+        explicit ScopedEvent(const char* name);
+        ~ScopedEvent();
+
+        ScopedEvent(const ScopedEvent&) = delete;
+        ScopedEvent& operator=(const ScopedEvent&) = delete;
+
+    private:
+        const char* name;
+        bool enabled;
+        uint64_t startReadCalls;
+        uint64_t startBytesRead;
+        uint64_t startWriteCalls;
+        uint64_t startBytesWritten;
+    };
+}
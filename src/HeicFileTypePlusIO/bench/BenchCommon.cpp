@@ -0,0 +1,270 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "BenchCommon.h"
+#include "HeicReader.h"
+#include "scoped.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <Psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+    const char* const ChromaNames[] = { "400", "420", "422", "444", "identity", "auto" };
+
+    const char* const PresetNames[] =
+    {
+        "ultrafast", "superfast", "veryfast", "faster", "fast", "medium", "slow", "slower", "veryslow", "placebo", "auto"
+    };
+
+    const char* const TuningNames[] = { "psnr", "ssim", "grain", "fastdecode", "none" };
+
+    template <typename T, size_t N>
+    bool ParseName(const std::string& value, const char* const (&names)[N], T& result)
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            if (value == names[i])
+            {
+                result = static_cast<T>(i);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    template <typename T, size_t N>
+    const char* GetName(T value, const char* const (&names)[N])
+    {
+        const size_t index = static_cast<size_t>(value);
+
+        return index < N ? names[index] : "unknown";
+    }
+}
+
+void OwnedBitmap::Allocate(int width, int height)
+{
+    const size_t stride = static_cast<size_t>(width) * sizeof(ColorBgra);
+
+    pixels.resize(stride * static_cast<size_t>(height));
+    data.scan0 = pixels.data();
+    data.width = width;
+    data.height = height;
+    data.stride = static_cast<int32_t>(stride);
+}
+
+void CreateSyntheticImage(int width, int height, SyntheticContent content, OwnedBitmap& bitmap)
+{
+    bitmap.Allocate(width, height);
+
+    uint32_t seed = 0x12345678;
+
+    for (int y = 0; y < height; y++)
+    {
+        ColorBgra* row = reinterpret_cast<ColorBgra*>(bitmap.data.scan0 + (static_cast<size_t>(y) * bitmap.data.stride));
+
+        for (int x = 0; x < width; x++)
+        {
+            if (content == SyntheticContent::Graphics)
+            {
+                // Blocks of flat color separated by one pixel wide lines.
+                const bool line = (x % 64) == 0 || (y % 48) == 0;
+                const uint32_t block = static_cast<uint32_t>(((x / 64) * 7) + ((y / 48) * 13));
+
+                row[x].b = line ? 0 : static_cast<uint8_t>(block * 37);
+                row[x].g = line ? 0 : static_cast<uint8_t>(block * 91);
+                row[x].r = line ? 0 : static_cast<uint8_t>(block * 53);
+                row[x].a = 255;
+            }
+            else
+            {
+                // Smooth gradients with a small amount of noise approximate the
+                // content of a photograph better than a flat color.
+                seed = seed * 1664525 + 1013904223;
+                const int noise = static_cast<int>(seed >> 28) - 8;
+
+                row[x].b = static_cast<uint8_t>(std::clamp((x * 255) / std::max(width - 1, 1) + noise, 0, 255));
+                row[x].g = static_cast<uint8_t>(std::clamp((y * 255) / std::max(height - 1, 1) + noise, 0, 255));
+                row[x].r = static_cast<uint8_t>(std::clamp(((x + y) * 255) / std::max(width + height - 2, 1) + noise, 0, 255));
+                row[x].a = content == SyntheticContent::Transparent ? static_cast<uint8_t>((x * 255) / std::max(width - 1, 1)) : 255;
+            }
+        }
+    }
+}
+
+bool LoadHeifImage(const std::string& path, OwnedBitmap& bitmap)
+{
+    ScopedHeifContext context(heif_context_alloc());
+
+    if (!context)
+    {
+        return false;
+    }
+
+    heif_error error = heif_context_read_from_file(context.get(), path.c_str(), nullptr);
+
+    if (error.code != heif_error_Ok)
+    {
+        std::fprintf(stderr, "Unable to read %s: %s\n", path.c_str(), error.message);
+        return false;
+    }
+
+    heif_image_handle* primaryImage = nullptr;
+
+    error = heif_context_get_primary_image_handle(context.get(), &primaryImage);
+
+    if (error.code != heif_error_Ok)
+    {
+        std::fprintf(stderr, "Unable to get the primary image: %s\n", error.message);
+        return false;
+    }
+
+    ScopedHeifImageHandle imageHandle(primaryImage);
+    heif_image* decodedImage = nullptr;
+
+    if (HeicReader::DecodeImage(imageHandle.get(), heif_colorspace_RGB, heif_chroma_interleaved_RGBA, 0, nullptr, &decodedImage) != Status::Ok)
+    {
+        std::fprintf(stderr, "Unable to decode %s.\n", path.c_str());
+        return false;
+    }
+
+    ScopedHeifImage image(decodedImage);
+
+    const int width = heif_image_get_primary_width(image.get());
+    const int height = heif_image_get_primary_height(image.get());
+    int srcStride = 0;
+    const uint8_t* src = heif_image_get_plane_readonly(image.get(), heif_channel_interleaved, &srcStride);
+
+    bitmap.Allocate(width, height);
+
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t* srcRow = src + (static_cast<size_t>(y) * srcStride);
+        ColorBgra* dstRow = reinterpret_cast<ColorBgra*>(bitmap.data.scan0 + (static_cast<size_t>(y) * bitmap.data.stride));
+
+        for (int x = 0; x < width; x++)
+        {
+            dstRow[x].r = srcRow[0];
+            dstRow[x].g = srcRow[1];
+            dstRow[x].b = srcRow[2];
+            dstRow[x].a = srcRow[3];
+            srcRow += 4;
+        }
+    }
+
+    return true;
+}
+
+CICPColorData GetSrgbColorData(YUVChromaSubsampling yuvFormat)
+{
+    return CICPColorData
+    {
+        heif_color_primaries_ITU_R_BT_709_5,
+        heif_transfer_characteristic_IEC_61966_2_1,
+        yuvFormat == YUVChromaSubsampling::IdentityMatrix ? heif_matrix_coefficients_RGB_GBR : heif_matrix_coefficients_ITU_R_BT_709_5,
+        true
+    };
+}
+
+bool ParseChroma(const std::string& value, YUVChromaSubsampling& chroma)
+{
+    return ParseName(value, ChromaNames, chroma);
+}
+
+bool ParsePreset(const std::string& value, EncoderPreset& preset)
+{
+    return ParseName(value, PresetNames, preset);
+}
+
+bool ParseTuning(const std::string& value, EncoderTuning& tuning)
+{
+    return ParseName(value, TuningNames, tuning);
+}
+
+const char* GetChromaName(YUVChromaSubsampling chroma)
+{
+    return GetName(chroma, ChromaNames);
+}
+
+const char* GetPresetName(EncoderPreset preset)
+{
+    return GetName(preset, PresetNames);
+}
+
+const char* GetTuningName(EncoderTuning tuning)
+{
+    return GetName(tuning, TuningNames);
+}
+
+void ResetPeakMemoryUsage()
+{
+#if defined(__linux__)
+    // Writing 5 to clear_refs resets the peak resident set size of the process.
+    std::ofstream clearRefs("/proc/self/clear_refs");
+
+    if (clearRefs)
+    {
+        clearRefs << "5";
+    }
+#endif
+}
+
+uint64_t GetPeakMemoryUsageKilobytes()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters{};
+
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return counters.PeakWorkingSetSize / 1024;
+    }
+
+    return 0;
+#elif defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+
+    while (std::getline(status, line))
+    {
+        if (line.rfind("VmHWM:", 0) == 0)
+        {
+            return std::strtoull(line.c_str() + 6, nullptr, 10);
+        }
+    }
+
+    return 0;
+#else
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    // ru_maxrss is in bytes on macOS.
+    return static_cast<uint64_t>(usage.ru_maxrss) / 1024;
+#endif
+}
@@ -0,0 +1,66 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include "HeicFileTypePlusIO.h"
+#include <string>
+#include <vector>
+
+struct OwnedBitmap
+{
+    std::vector<uint8_t> pixels;
+    BitmapData data{};
+
+    void Allocate(int width, int height);
+};
+
+enum class SyntheticContent
+{
+    // Smooth gradients with a small amount of noise.
+    Photo,
+    // Flat colors with hard edges, similar to screenshots and line art.
+    Graphics,
+    // The Photo content with a varying alpha channel.
+    Transparent
+};
+
+void CreateSyntheticImage(int width, int height, SyntheticContent content, OwnedBitmap& bitmap);
+
+// Decodes the primary image of a HEIF file to BGRA.
+bool LoadHeifImage(const std::string& path, OwnedBitmap& bitmap);
+
+CICPColorData GetSrgbColorData(YUVChromaSubsampling yuvFormat);
+
+bool ParseChroma(const std::string& value, YUVChromaSubsampling& chroma);
+
+bool ParsePreset(const std::string& value, EncoderPreset& preset);
+
+bool ParseTuning(const std::string& value, EncoderTuning& tuning);
+
+const char* GetChromaName(YUVChromaSubsampling chroma);
+
+const char* GetPresetName(EncoderPreset preset);
+
+const char* GetTuningName(EncoderTuning tuning);
+
+// Resets the peak memory usage where the platform allows it.
+void ResetPeakMemoryUsage();
+
+uint64_t GetPeakMemoryUsageKilobytes();
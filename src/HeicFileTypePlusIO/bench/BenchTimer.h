@@ -0,0 +1,81 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <chrono>
+#include <stdint.h>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define HEICBENCH_HAS_CYCLE_COUNTER 1
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define HEICBENCH_HAS_CYCLE_COUNTER 1
+#else
+#define HEICBENCH_HAS_CYCLE_COUNTER 0
+#endif
+
+// Measures the wall clock time and, on x86, the time stamp counter.
+// The time stamp counter runs at a constant rate on modern processors, so the
+// cycle counts are reference cycles rather than core clock cycles.
+class BenchTimer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr bool HasCycleCounter = HEICBENCH_HAS_CYCLE_COUNTER != 0;
+
+    void Start()
+    {
+        startCycles = ReadCycleCounter();
+        startTime = Clock::now();
+    }
+
+    void Stop()
+    {
+        endTime = Clock::now();
+        endCycles = ReadCycleCounter();
+    }
+
+    double ElapsedSeconds() const
+    {
+        return std::chrono::duration<double>(endTime - startTime).count();
+    }
+
+    uint64_t ElapsedCycles() const
+    {
+        return endCycles - startCycles;
+    }
+
+private:
+    static uint64_t ReadCycleCounter()
+    {
+#if HEICBENCH_HAS_CYCLE_COUNTER
+        return __rdtsc();
+#else
+        return 0;
+#endif
+    }
+
+    Clock::time_point startTime;
+    Clock::time_point endTime;
+    uint64_t startCycles = 0;
+    uint64_t endCycles = 0;
+};
@@ -0,0 +1,725 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// heic-bench: a command line driver that runs the plugin's encode and decode
+// paths outside of Paint.NET and prints the time spent in each stage.
+
+#include "BenchCommon.h"
+#include "HeicEncoder.h"
+#include "HeicReader.h"
+#include "HeicWriter.h"
+#include "PresetSelection.h"
+#include "Resampler.h"
+#include "ProgressSteps.h"
+#include "ThreadBudget.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <numeric>
+#include <string>
+#include <vector>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct BenchOptions
+    {
+        std::string inputPath;
+        std::string outputPath;
+        int syntheticWidth = 4032;
+        int syntheticHeight = 3024;
+        int iterations = 3;
+        EncoderOptions encoder =
+        {
+            90,
+            YUVChromaSubsampling::Subsampling422,
+            EncoderPreset::Medium,
+            EncoderTuning::None,
+            1,
+            0,
+            nullptr,
+            0,
+            0
+        };
+        // The storage for the --param values that the encoder options point to.
+        std::vector<std::string> parameterNames;
+        std::vector<std::string> parameterValues;
+        std::vector<EncoderParameter> parameters;
+        bool listParameters = false;
+        // The thread budget, 0 is the number of processors.
+        int threads = 0;
+        bool wholeThreadBudget = false;
+        // The sizes and qualities of --renditions.
+        std::string renditionList;
+        std::vector<RenditionTarget> renditions;
+    };
+
+    // The encoder progress callback does not have a user data parameter, the
+    // benchmark is single threaded so the timestamps are stored in a global.
+    struct EncodeTimestamps
+    {
+        Clock::time_point beforeImageConversion;
+        Clock::time_point beforeCompression;
+        Clock::time_point afterCompression;
+    };
+
+    EncodeTimestamps encodeTimestamps;
+
+    bool __stdcall RecordEncodeProgress(double progress)
+    {
+        const Clock::time_point now = Clock::now();
+
+        if (progress == BeforeImageConversion)
+        {
+            encodeTimestamps.beforeImageConversion = now;
+        }
+        else if (progress == BeforeCompression)
+        {
+            encodeTimestamps.beforeCompression = now;
+        }
+        else if (progress == AfterCompression)
+        {
+            encodeTimestamps.afterCompression = now;
+        }
+
+        return true;
+    }
+
+    double ElapsedMilliseconds(Clock::time_point start, Clock::time_point end)
+    {
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    struct StageTimings
+    {
+        const char* name;
+        std::vector<double> samples;
+    };
+
+    enum Stage
+    {
+        ColorConversion,
+        Compression,
+        Serialization,
+        Parsing,
+        Decoding,
+        FileWrite
+    };
+
+    heif_error WriteToVector(heif_context* /*ctx*/, const void* data, size_t size, void* userdata)
+    {
+        std::vector<uint8_t>* output = static_cast<std::vector<uint8_t>*>(userdata);
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+        output->assign(bytes, bytes + size);
+
+        return heif_error{ heif_error_Ok, heif_suberror_Unspecified, "Success" };
+    }
+
+    bool RunIteration(const BenchOptions& options, const BitmapData& input, std::vector<StageTimings>& timings, size_t& encodedSize)
+    {
+        const CICPColorData colorData = GetSrgbColorData(options.encoder.yuvFormat);
+        const EncoderMetadata metadata{};
+
+        std::vector<uint8_t> encoded;
+
+        {
+            ScopedHeifContext context(heif_context_alloc());
+
+            if (!context)
+            {
+                return false;
+            }
+
+            Status status = HeicEncoder::Encode(context.get(), &input, &options.encoder, &metadata, colorData, RecordEncodeProgress);
+
+            if (status != Status::Ok)
+            {
+                std::fprintf(stderr, "Encoding failed with status %d.\n", static_cast<int>(status));
+                return false;
+            }
+
+            HeicEncoder::RecordEncodeTime();
+
+            timings[ColorConversion].samples.push_back(ElapsedMilliseconds(encodeTimestamps.beforeImageConversion, encodeTimestamps.beforeCompression));
+            timings[Compression].samples.push_back(ElapsedMilliseconds(encodeTimestamps.beforeCompression, encodeTimestamps.afterCompression));
+
+            Clock::time_point start = Clock::now();
+
+            heif_writer writer = { 1, WriteToVector };
+            heif_error error = heif_context_write(context.get(), &writer, &encoded);
+
+            if (error.code != heif_error_Ok)
+            {
+                std::fprintf(stderr, "Writing failed: %s\n", error.message);
+                return false;
+            }
+
+            timings[Serialization].samples.push_back(ElapsedMilliseconds(start, Clock::now()));
+
+            if (!options.outputPath.empty())
+            {
+                const FileOutputOptions outputOptions = { true, false };
+
+                start = Clock::now();
+
+                status = HeicWriter::SaveToPath({ context.get(), nullptr, nullptr }, options.outputPath.c_str(), &outputOptions, nullptr);
+
+                if (status != Status::Ok)
+                {
+                    std::fprintf(stderr, "Unable to write %s, status %d.\n", options.outputPath.c_str(), static_cast<int>(status));
+                    return false;
+                }
+
+                timings[FileWrite].samples.push_back(ElapsedMilliseconds(start, Clock::now()));
+            }
+        }
+
+        encodedSize = encoded.size();
+
+        Clock::time_point start = Clock::now();
+
+        ScopedHeifContext context(heif_context_alloc());
+
+        if (!context)
+        {
+            return false;
+        }
+
+        heif_error error = heif_context_read_from_memory_without_copy(context.get(), encoded.data(), encoded.size(), nullptr);
+
+        if (error.code != heif_error_Ok)
+        {
+            std::fprintf(stderr, "Parsing failed: %s\n", error.message);
+            return false;
+        }
+
+        heif_image_handle* primaryImage = nullptr;
+
+        error = heif_context_get_primary_image_handle(context.get(), &primaryImage);
+
+        if (error.code != heif_error_Ok)
+        {
+            std::fprintf(stderr, "Unable to get the primary image: %s\n", error.message);
+            return false;
+        }
+
+        ScopedHeifImageHandle imageHandle(primaryImage);
+
+        timings[Parsing].samples.push_back(ElapsedMilliseconds(start, Clock::now()));
+
+        start = Clock::now();
+
+        heif_image* decodedImage = nullptr;
+
+        if (HeicReader::DecodeImage(imageHandle.get(), heif_colorspace_RGB, heif_chroma_interleaved_RGBA, 0, nullptr, &decodedImage) != Status::Ok)
+        {
+            std::fprintf(stderr, "Decoding failed.\n");
+            return false;
+        }
+
+        ScopedHeifImage image(decodedImage);
+
+        timings[Decoding].samples.push_back(ElapsedMilliseconds(start, Clock::now()));
+
+        return true;
+    }
+
+    void PrintTimings(const std::vector<StageTimings>& timings, const BitmapData& input)
+    {
+        const double megapixels = (static_cast<double>(input.width) * static_cast<double>(input.height)) / 1e6;
+
+        std::printf("%-18s %10s %10s %10s %10s\n", "stage", "min ms", "median ms", "mean ms", "MP/s");
+
+        for (const StageTimings& stage : timings)
+        {
+            if (stage.samples.empty())
+            {
+                continue;
+            }
+
+            std::vector<double> sorted = stage.samples;
+            std::sort(sorted.begin(), sorted.end());
+
+            const double minimum = sorted.front();
+            const double median = sorted[sorted.size() / 2];
+            const double mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / static_cast<double>(sorted.size());
+            const double throughput = median > 0.0 ? megapixels / (median / 1000.0) : 0.0;
+
+            std::printf("%-18s %10.2f %10.2f %10.2f %10.2f\n", stage.name, minimum, median, mean, throughput);
+        }
+    }
+
+    bool PrintEncoderParameters()
+    {
+        EncoderParameterList list;
+
+        const Status status = HeicEncoder::GetParameterList(&list);
+
+        if (status != Status::Ok)
+        {
+            std::fprintf(stderr, "Unable to list the encoder parameters, status %d.\n", static_cast<int>(status));
+            return false;
+        }
+
+        for (int32_t i = 0; i < list.count; i++)
+        {
+            const EncoderParameterInfo& info = list.parameters[i];
+
+            std::printf("%-20s", info.name);
+
+            switch (info.type)
+            {
+            case EncoderParameterType::Integer:
+                std::printf(" integer");
+
+                if (info.hasMinimum || info.hasMaximum)
+                {
+                    std::printf(" [%d, %d]", info.minimum, info.maximum);
+                }
+
+                for (int32_t j = 0; j < info.validIntegerCount; j++)
+                {
+                    std::printf("%s%d", j == 0 ? " {" : ", ", info.validIntegers[j]);
+                }
+
+                if (info.validIntegerCount > 0)
+                {
+                    std::printf("}");
+                }
+                break;
+            case EncoderParameterType::Boolean:
+                std::printf(" boolean");
+                break;
+            case EncoderParameterType::String:
+                std::printf(" string");
+
+                for (int32_t j = 0; j < info.validStringCount; j++)
+                {
+                    std::printf("%s%s", j == 0 ? " {" : ", ", info.validStrings[j]);
+                }
+
+                if (info.validStringCount > 0)
+                {
+                    std::printf("}");
+                }
+                break;
+            }
+
+            if (info.defaultValue)
+            {
+                std::printf(" default %s", info.defaultValue);
+            }
+
+            std::printf("\n");
+        }
+
+        HeicEncoder::FreeParameterList(&list);
+
+        return true;
+    }
+
+    bool ParseSize(const char* value, int& width, int& height)
+    {
+        return std::sscanf(value, "%dx%d", &width, &height) == 2 && width > 0 && height > 0;
+    }
+
+    bool ParseRenditions(const std::string& value, EncoderPreset preset, std::vector<RenditionTarget>& renditions)
+    {
+        size_t start = 0;
+
+        while (start <= value.size())
+        {
+            const size_t end = std::min(value.find(',', start), value.size());
+            const std::string item = value.substr(start, end - start);
+
+            RenditionTarget target{};
+            target.preset = preset;
+
+            if (std::sscanf(item.c_str(), "%dx%d:%d", &target.width, &target.height, &target.quality) != 3
+                || target.width <= 0
+                || target.height <= 0
+                || target.quality < 0
+                || target.quality > 100)
+            {
+                return false;
+            }
+
+            renditions.push_back(target);
+            start = end + 1;
+        }
+
+        return !renditions.empty();
+    }
+
+    size_t GetEncodedSize(heif_context* context)
+    {
+        std::vector<uint8_t> encoded;
+
+        heif_writer writer = { 1, WriteToVector };
+        heif_error error = heif_context_write(context, &writer, &encoded);
+
+        return error.code == heif_error_Ok ? encoded.size() : 0;
+    }
+
+    // Compares SaveRenditions with downscaling the full size image and encoding each target separately.
+    bool RunRenditions(const BenchOptions& options, const BitmapData& input)
+    {
+        const CICPColorData colorData = GetSrgbColorData(options.encoder.yuvFormat);
+        const EncoderMetadata metadata{};
+        const int32_t targetCount = static_cast<int32_t>(options.renditions.size());
+
+        for (int i = 0; i < options.iterations; i++)
+        {
+            std::vector<ScopedHeifContext> contexts;
+
+            Clock::time_point start = Clock::now();
+
+            Status status = HeicEncoder::EncodeRenditions(
+                &input,
+                options.renditions.data(),
+                targetCount,
+                &options.encoder,
+                &metadata,
+                colorData,
+                nullptr,
+                contexts);
+
+            if (status != Status::Ok)
+            {
+                std::fprintf(stderr, "Encoding the renditions failed with status %d.\n", static_cast<int>(status));
+                return false;
+            }
+
+            const double sharedMilliseconds = ElapsedMilliseconds(start, Clock::now());
+
+            std::vector<ScopedHeifContext> separateContexts;
+
+            start = Clock::now();
+
+            for (const RenditionTarget& target : options.renditions)
+            {
+                OwnedBitmap bitmap;
+                bitmap.Allocate(target.width, target.height);
+
+                Resampler::Downscale(&input, &bitmap.data);
+
+                EncoderOptions encoderOptions = options.encoder;
+                encoderOptions.quality = target.quality;
+
+                separateContexts.emplace_back(heif_context_alloc());
+
+                status = HeicEncoder::Encode(separateContexts.back().get(), &bitmap.data, &encoderOptions, &metadata, colorData, nullptr);
+
+                if (status != Status::Ok)
+                {
+                    std::fprintf(stderr, "Encoding failed with status %d.\n", static_cast<int>(status));
+                    return false;
+                }
+            }
+
+            const double separateMilliseconds = ElapsedMilliseconds(start, Clock::now());
+
+            std::printf("iteration %d: renditions %.2f ms, separate encodes %.2f ms\n", i + 1, sharedMilliseconds, separateMilliseconds);
+
+            for (int32_t j = 0; j < targetCount; j++)
+            {
+                const RenditionTarget& target = options.renditions[j];
+
+                std::printf("  %dx%d q%d: %zu bytes, separate %zu bytes\n",
+                    target.width,
+                    target.height,
+                    target.quality,
+                    GetEncodedSize(contexts[j].get()),
+                    GetEncodedSize(separateContexts[j].get()));
+            }
+        }
+
+        return true;
+    }
+
+    void PrintUsage()
+    {
+        std::fprintf(stderr,
+            "Usage: heic-bench [options] [input.heic]\n"
+            "\n"
+            "Encodes the input image, or a synthetic image when no input is specified,\n"
+            "and decodes the result, printing the time taken by each stage.\n"
+            "\n"
+            "Options:\n"
+            "  --size WxH            Synthetic image size (default 4032x3024)\n"
+            "  --iterations N        Number of encode/decode iterations (default 3)\n"
+            "  --quality N           Encoder quality, 0-100 (default 90)\n"
+            "  --chroma MODE         400, 420, 422, 444 or identity (default 422)\n"
+            "  --preset NAME         x265 preset, ultrafast to placebo or auto (default medium)\n"
+            "  --time-budget MS      The encode time that the auto preset is selected for\n"
+            "  --tuning NAME         none, psnr, ssim, grain or fastdecode (default none)\n"
+            "  --tu-intra-depth N    TU intra depth, 1-4 (default 1)\n"
+            "  --output PATH         Also write the encoded image to PATH\n"
+            "  --param NAME=VALUE    Set an encoder parameter after the preset, can be repeated,\n"
+            "                        x265 parameters that are not listed use an x265: prefix\n"
+            "  --list-parameters     Print the parameters that the encoder lists and exit\n"
+            "  --renditions LIST     Encode renditions, e.g. 3840x2160:80,1920x1080:70,320x180:60,\n"
+            "                        and compare them with separate encodes\n"
+            "  --threads N           Thread budget (default the number of processors)\n"
+            "  --whole-thread-budget Size the x265 thread pool to the whole encoder thread\n"
+            "                        share instead of the still image wavefront limit\n");
+    }
+
+    bool ParseArguments(int argc, char** argv, BenchOptions& options)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string arg = argv[i];
+            const bool hasValue = i + 1 < argc;
+
+            if (arg == "--help" || arg == "-h")
+            {
+                return false;
+            }
+            else if (arg == "--list-parameters")
+            {
+                options.listParameters = true;
+            }
+            else if (arg == "--whole-thread-budget")
+            {
+                options.wholeThreadBudget = true;
+            }
+            else if (arg.rfind("--", 0) == 0 && !hasValue)
+            {
+                std::fprintf(stderr, "Missing value for %s.\n", arg.c_str());
+                return false;
+            }
+            else if (arg == "--size")
+            {
+                if (!ParseSize(argv[++i], options.syntheticWidth, options.syntheticHeight))
+                {
+                    std::fprintf(stderr, "Invalid image size: %s\n", argv[i]);
+                    return false;
+                }
+            }
+            else if (arg == "--renditions")
+            {
+                options.renditionList = argv[++i];
+            }
+            else if (arg == "--threads")
+            {
+                options.threads = std::max(1, std::atoi(argv[++i]));
+            }
+            else if (arg == "--iterations")
+            {
+                options.iterations = std::max(1, std::atoi(argv[++i]));
+            }
+            else if (arg == "--quality")
+            {
+                options.encoder.quality = std::clamp(std::atoi(argv[++i]), 0, 100);
+            }
+            else if (arg == "--chroma")
+            {
+                if (!ParseChroma(argv[++i], options.encoder.yuvFormat))
+                {
+                    std::fprintf(stderr, "Invalid chroma subsampling: %s\n", argv[i]);
+                    return false;
+                }
+            }
+            else if (arg == "--preset")
+            {
+                if (!ParsePreset(argv[++i], options.encoder.preset))
+                {
+                    std::fprintf(stderr, "Invalid preset: %s\n", argv[i]);
+                    return false;
+                }
+            }
+            else if (arg == "--time-budget")
+            {
+                options.encoder.timeBudgetMilliseconds = std::max(0, std::atoi(argv[++i]));
+            }
+            else if (arg == "--tuning")
+            {
+                if (!ParseTuning(argv[++i], options.encoder.tuning))
+                {
+                    std::fprintf(stderr, "Invalid tuning: %s\n", argv[i]);
+                    return false;
+                }
+            }
+            else if (arg == "--tu-intra-depth")
+            {
+                options.encoder.tuIntraDepth = std::clamp(std::atoi(argv[++i]), 1, 4);
+            }
+            else if (arg == "--output")
+            {
+                options.outputPath = argv[++i];
+            }
+            else if (arg == "--param")
+            {
+                const std::string parameter = argv[++i];
+                const size_t separator = parameter.find('=');
+
+                if (separator == std::string::npos || separator == 0)
+                {
+                    std::fprintf(stderr, "Invalid encoder parameter: %s\n", argv[i]);
+                    return false;
+                }
+
+                options.parameterNames.push_back(parameter.substr(0, separator));
+                options.parameterValues.push_back(parameter.substr(separator + 1));
+            }
+            else if (arg.rfind("--", 0) == 0)
+            {
+                std::fprintf(stderr, "Unknown option: %s\n", arg.c_str());
+                return false;
+            }
+            else
+            {
+                options.inputPath = arg;
+            }
+        }
+
+        // The renditions are parsed last because they use the preset from the command line.
+        if (!options.renditionList.empty()
+            && !ParseRenditions(options.renditionList, options.encoder.preset, options.renditions))
+        {
+            std::fprintf(stderr, "Invalid renditions: %s\n", options.renditionList.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    bool ConfigureEncoder(BenchOptions& options)
+    {
+        const ThreadBudgetOptions budget = { options.threads, 0, 0, 0 };
+
+        if (ThreadBudget::SetOptions(&budget) != Status::Ok)
+        {
+            std::fprintf(stderr, "Invalid thread budget: %d\n", options.threads);
+            return false;
+        }
+
+        if (options.wholeThreadBudget)
+        {
+            // The parameters from the command line are applied after this one and can still override it.
+            options.parameterNames.insert(options.parameterNames.begin(), "x265:pools");
+            options.parameterValues.insert(
+                options.parameterValues.begin(),
+                std::to_string(ThreadBudget::GetThreads(ThreadBudget::Operation::Encode)));
+        }
+
+        for (size_t i = 0; i < options.parameterNames.size(); i++)
+        {
+            options.parameters.push_back({ options.parameterNames[i].c_str(), options.parameterValues[i].c_str() });
+        }
+
+        options.encoder.parameters = options.parameters.data();
+        options.encoder.parameterCount = static_cast<int32_t>(options.parameters.size());
+
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+
+    if (!ParseArguments(argc, argv, options))
+    {
+        PrintUsage();
+        return EXIT_FAILURE;
+    }
+
+    if (options.listParameters)
+    {
+        return PrintEncoderParameters() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (!ConfigureEncoder(options))
+    {
+        return EXIT_FAILURE;
+    }
+
+    OwnedBitmap input;
+
+    if (options.inputPath.empty())
+    {
+        CreateSyntheticImage(options.syntheticWidth, options.syntheticHeight, SyntheticContent::Photo, input);
+    }
+    else if (!LoadHeifImage(options.inputPath, input))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (!options.renditions.empty())
+    {
+        return RunRenditions(options, input.data) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    std::vector<StageTimings> timings =
+    {
+        { "color conversion", {} },
+        { "compression", {} },
+        { "serialization", {} },
+        { "parsing", {} },
+        { "decoding", {} },
+        { "file write", {} }
+    };
+
+    size_t encodedSize = 0;
+
+    // The input image is included in the peak, it is the same for every encoder configuration.
+    ResetPeakMemoryUsage();
+
+    for (int i = 0; i < options.iterations; i++)
+    {
+        if (!RunIteration(options, input.data, timings, encodedSize))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::printf("image: %dx%d, encoded size: %zu bytes, iterations: %d, peak memory: %llu KB\n",
+        input.data.width,
+        input.data.height,
+        encodedSize,
+        options.iterations,
+        static_cast<unsigned long long>(GetPeakMemoryUsageKilobytes()));
+    PrintTimings(timings, input.data);
+
+    if (options.encoder.preset == EncoderPreset::Automatic)
+    {
+        const SaveInfo saveInfo = HeicEncoder::GetLastSaveInfo();
+        PresetSelectionStatistics statistics;
+
+        PresetSelection::GetStatistics(&statistics);
+
+        std::printf("selected preset: %s, predicted: %.2f ms, last encode: %.2f ms, missed budgets: %llu/%llu, mispredictions: %llu, mean time ratio: %.2f\n",
+            GetPresetName(saveInfo.preset),
+            saveInfo.predictedEncodeMilliseconds,
+            saveInfo.encodeMilliseconds,
+            static_cast<unsigned long long>(statistics.missedBudgets),
+            static_cast<unsigned long long>(statistics.selections),
+            static_cast<unsigned long long>(statistics.mispredictions),
+            statistics.meanTimeRatio);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,530 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// heic-kernel-bench: measures the throughput of the color conversion kernels
+// used by the save path and checks their output against a scalar reference.
+
+#include "BenchTimer.h"
+#include "ChromaSubsampling.h"
+#include "YUVConversionHelpers.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace
+{
+    constexpr double MinimumRunSeconds = 0.25;
+    constexpr int MinimumRuns = 3;
+
+    struct ImageLayout
+    {
+        const char* name;
+        bool oddDimensions;
+        int32_t stridePadding;
+    };
+
+    const ImageLayout ImageLayouts[] =
+    {
+        { "tight", false, 0 },
+        { "padded", false, 64 },
+        { "odd", true, 60 },
+    };
+
+    struct TestImage
+    {
+        std::vector<uint8_t> pixels;
+        BitmapData data{};
+    };
+
+    struct Plane
+    {
+        std::vector<uint8_t> pixels;
+        int width = 0;
+        int height = 0;
+        intptr_t stride = 0;
+
+        void Allocate(int planeWidth, int planeHeight)
+        {
+            width = planeWidth;
+            height = planeHeight;
+            // Padding the stride matches the alignment libheif uses for its planes.
+            stride = (static_cast<intptr_t>(planeWidth) + 63) & ~static_cast<intptr_t>(63);
+            pixels.assign(static_cast<size_t>(stride) * static_cast<size_t>(planeHeight), 0);
+        }
+
+        uint8_t* Data()
+        {
+            return pixels.data();
+        }
+
+        uint8_t At(int x, int y) const
+        {
+            return pixels[static_cast<size_t>(x) + (static_cast<size_t>(y) * static_cast<size_t>(stride))];
+        }
+    };
+
+    struct YUVPlanes
+    {
+        Plane y;
+        Plane u;
+        Plane v;
+    };
+
+    struct BenchResult
+    {
+        double seconds;
+        uint64_t cycles;
+    };
+
+    bool failed = false;
+
+    void CreateTestImage(int width, int height, int32_t stridePadding, TestImage& image)
+    {
+        const int32_t stride = (width * 4) + stridePadding;
+
+        image.pixels.assign(static_cast<size_t>(stride) * static_cast<size_t>(height), 0xCD);
+        image.data.scan0 = image.pixels.data();
+        image.data.width = width;
+        image.data.height = height;
+        image.data.stride = stride;
+
+        uint32_t seed = 0x9E3779B9;
+
+        for (int y = 0; y < height; y++)
+        {
+            ColorBgra* row = reinterpret_cast<ColorBgra*>(image.data.scan0 + (static_cast<size_t>(y) * stride));
+
+            for (int x = 0; x < width; x++)
+            {
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+
+                row[x].b = static_cast<uint8_t>(seed);
+                row[x].g = static_cast<uint8_t>(seed >> 8);
+                row[x].r = static_cast<uint8_t>(seed >> 16);
+                row[x].a = 255;
+            }
+        }
+    }
+
+    const ColorBgra& GetPixel(const BitmapData& image, int x, int y)
+    {
+        return reinterpret_cast<const ColorBgra*>(image.scan0 + (static_cast<intptr_t>(y) * image.stride))[x];
+    }
+
+    BenchResult Measure(const std::function<void()>& kernel)
+    {
+        BenchResult best = { 0.0, 0 };
+        double total = 0.0;
+        int runs = 0;
+
+        while (runs < MinimumRuns || total < MinimumRunSeconds)
+        {
+            BenchTimer timer;
+
+            timer.Start();
+            kernel();
+            timer.Stop();
+
+            const double seconds = timer.ElapsedSeconds();
+
+            if (runs == 0 || seconds < best.seconds)
+            {
+                best.seconds = seconds;
+                best.cycles = timer.ElapsedCycles();
+            }
+
+            total += seconds;
+            runs++;
+        }
+
+        return best;
+    }
+
+    void Report(const char* kernel, const char* layout, const BitmapData& image, const BenchResult& result, const char* check)
+    {
+        const double pixels = static_cast<double>(image.width) * static_cast<double>(image.height);
+        const double megapixelsPerSecond = (pixels / 1e6) / result.seconds;
+        const double sourceBytes = pixels * sizeof(ColorBgra);
+
+        char bytesPerCycle[32] = "n/a";
+
+        if (BenchTimer::HasCycleCounter && result.cycles > 0)
+        {
+            std::snprintf(bytesPerCycle, sizeof(bytesPerCycle), "%.3f", sourceBytes / static_cast<double>(result.cycles));
+        }
+
+        std::printf("%-18s %-7s %6dx%-6d %10.3f %10.1f %12s  %s\n",
+            kernel,
+            layout,
+            image.width,
+            image.height,
+            result.seconds * 1000.0,
+            megapixelsPerSecond,
+            bytesPerCycle,
+            check);
+    }
+
+    const char* CheckResult(bool passed)
+    {
+        if (!passed)
+        {
+            failed = true;
+        }
+
+        return passed ? "ok" : "MISMATCH";
+    }
+
+    // The reference conversion uses double precision and converts each pixel on its own,
+    // optimized kernels may differ from it by one due to rounding.
+    double ToUNorm(double value, bool chroma)
+    {
+        if (chroma)
+        {
+            value += 0.5;
+        }
+
+        return std::floor((std::clamp(value, 0.0, 1.0) * 255.0) + 0.5);
+    }
+
+    bool VerifyYUV(const BitmapData& image, const CICPColorData& colorInfo, YUVChromaSubsampling format, const YUVPlanes& planes)
+    {
+        YUVCoefficiants coefficiants;
+        GetYUVCoefficiants(colorInfo, coefficiants);
+
+        const double kr = coefficiants.kr;
+        const double kg = coefficiants.kg;
+        const double kb = coefficiants.kb;
+
+        const int chromaShiftX = format == YUVChromaSubsampling::Subsampling444 ? 0 : 1;
+        const int chromaShiftY = format == YUVChromaSubsampling::Subsampling420 ? 1 : 0;
+
+        std::vector<double> sumU(static_cast<size_t>(planes.u.width) * planes.u.height, 0.0);
+        std::vector<double> sumV(sumU.size(), 0.0);
+        std::vector<int> count(sumU.size(), 0);
+
+        for (int y = 0; y < image.height; y++)
+        {
+            for (int x = 0; x < image.width; x++)
+            {
+                const ColorBgra& pixel = GetPixel(image, x, y);
+
+                const double r = pixel.r / 255.0;
+                const double g = pixel.g / 255.0;
+                const double b = pixel.b / 255.0;
+
+                const double luma = (kr * r) + (kg * g) + (kb * b);
+
+                if (std::abs(ToUNorm(luma, false) - planes.y.At(x, y)) > 1.0)
+                {
+                    return false;
+                }
+
+                const size_t index = static_cast<size_t>(x >> chromaShiftX) + (static_cast<size_t>(y >> chromaShiftY) * planes.u.width);
+
+                sumU[index] += (b - luma) / (2.0 * (1.0 - kb));
+                sumV[index] += (r - luma) / (2.0 * (1.0 - kr));
+                count[index]++;
+            }
+        }
+
+        for (int y = 0; y < planes.u.height; y++)
+        {
+            for (int x = 0; x < planes.u.width; x++)
+            {
+                const size_t index = static_cast<size_t>(x) + (static_cast<size_t>(y) * planes.u.width);
+
+                if (std::abs(ToUNorm(sumU[index] / count[index], true) - planes.u.At(x, y)) > 1.0
+                    || std::abs(ToUNorm(sumV[index] / count[index], true) - planes.v.At(x, y)) > 1.0)
+                {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    bool VerifyChannel(const BitmapData& image, const Plane& plane, uint8_t ColorBgra::* channel)
+    {
+        for (int y = 0; y < image.height; y++)
+        {
+            for (int x = 0; x < image.width; x++)
+            {
+                if (plane.At(x, y) != GetPixel(image, x, y).*channel)
+                {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    void BenchColorToYUV8(const char* layout, const BitmapData& image, YUVChromaSubsampling format, const char* name)
+    {
+        const CICPColorData colorInfo =
+        {
+            heif_color_primaries_ITU_R_BT_709_5,
+            heif_transfer_characteristic_IEC_61966_2_1,
+            heif_matrix_coefficients_ITU_R_BT_709_5,
+            true
+        };
+
+        const int chromaWidth = format == YUVChromaSubsampling::Subsampling444 ? image.width : (image.width + 1) / 2;
+        const int chromaHeight = format == YUVChromaSubsampling::Subsampling420 ? (image.height + 1) / 2 : image.height;
+
+        YUVPlanes planes;
+        planes.y.Allocate(image.width, image.height);
+        planes.u.Allocate(chromaWidth, chromaHeight);
+        planes.v.Allocate(chromaWidth, chromaHeight);
+
+        auto kernel = [&]()
+        {
+            ChromaSubsampling::ColorToYUV8(
+                &image,
+                colorInfo,
+                format,
+                planes.y.Data(),
+                planes.y.stride,
+                planes.u.Data(),
+                planes.u.stride,
+                planes.v.Data(),
+                planes.v.stride);
+        };
+
+        kernel();
+        const bool passed = VerifyYUV(image, colorInfo, format, planes);
+
+        Report(name, layout, image, Measure(kernel), CheckResult(passed));
+    }
+
+    void BenchColorToIdentity8(const char* layout, const BitmapData& image)
+    {
+        YUVPlanes planes;
+        planes.y.Allocate(image.width, image.height);
+        planes.u.Allocate(image.width, image.height);
+        planes.v.Allocate(image.width, image.height);
+
+        auto kernel = [&]()
+        {
+            ChromaSubsampling::ColorToIdentity8(
+                &image,
+                planes.y.Data(),
+                static_cast<size_t>(planes.y.stride),
+                planes.u.Data(),
+                static_cast<size_t>(planes.u.stride),
+                planes.v.Data(),
+                static_cast<size_t>(planes.v.stride));
+        };
+
+        kernel();
+        const bool passed = VerifyChannel(image, planes.y, &ColorBgra::g)
+                         && VerifyChannel(image, planes.u, &ColorBgra::b)
+                         && VerifyChannel(image, planes.v, &ColorBgra::r);
+
+        Report("ColorToIdentity8", layout, image, Measure(kernel), CheckResult(passed));
+    }
+
+    void BenchSinglePlane(const char* layout, const BitmapData& image, bool alpha)
+    {
+        Plane plane;
+        plane.Allocate(image.width, image.height);
+
+        auto kernel = [&]()
+        {
+            if (alpha)
+            {
+                ChromaSubsampling::AlphaToA8(&image, plane.Data(), plane.stride);
+            }
+            else
+            {
+                ChromaSubsampling::MonoToY8(&image, plane.Data(), plane.stride);
+            }
+        };
+
+        kernel();
+        const bool passed = VerifyChannel(image, plane, alpha ? &ColorBgra::a : &ColorBgra::r);
+
+        Report(alpha ? "AlphaToA8" : "MonoToY8", layout, image, Measure(kernel), CheckResult(passed));
+    }
+
+    void BenchHasTransparency(const char* layout, BitmapData& image)
+    {
+        // An opaque image is the worst case because every pixel must be checked.
+        bool result = true;
+
+        auto kernel = [&]()
+        {
+            result = ChromaSubsampling::HasTransparency(&image);
+        };
+
+        const BenchResult benchResult = Measure(kernel);
+
+        ColorBgra& lastPixel = const_cast<ColorBgra&>(GetPixel(image, image.width - 1, image.height - 1));
+        lastPixel.a = 254;
+        const bool detectsLastPixel = ChromaSubsampling::HasTransparency(&image);
+        lastPixel.a = 255;
+
+        Report("HasTransparency", layout, image, benchResult, CheckResult(!result && detectsLastPixel));
+    }
+
+    void BenchGetYUVCoefficiants()
+    {
+        const heif_matrix_coefficients matrices[] =
+        {
+            heif_matrix_coefficients_RGB_GBR,
+            heif_matrix_coefficients_ITU_R_BT_709_5,
+            heif_matrix_coefficients_unspecified,
+            heif_matrix_coefficients_US_FCC_T47,
+            heif_matrix_coefficients_ITU_R_BT_470_6_System_B_G,
+            heif_matrix_coefficients_ITU_R_BT_601_6,
+            heif_matrix_coefficients_SMPTE_240M,
+            heif_matrix_coefficients_YCgCo,
+            heif_matrix_coefficients_ITU_R_BT_2020_2_non_constant_luminance,
+        };
+
+        constexpr int CallsPerRun = 100000;
+
+        bool passed = true;
+
+        for (heif_matrix_coefficients matrix : matrices)
+        {
+            const CICPColorData colorInfo = { heif_color_primaries_ITU_R_BT_709_5, heif_transfer_characteristic_IEC_61966_2_1, matrix, true };
+            YUVCoefficiants coefficiants;
+
+            GetYUVCoefficiants(colorInfo, coefficiants);
+
+            if (std::abs((coefficiants.kr + coefficiants.kg + coefficiants.kb) - 1.0f) > 1e-6f)
+            {
+                passed = false;
+            }
+
+            if (matrix == heif_matrix_coefficients_ITU_R_BT_709_5
+                && (coefficiants.kr != 0.2126f || coefficiants.kb != 0.0722f))
+            {
+                passed = false;
+            }
+        }
+
+        volatile float sink = 0.0f;
+
+        auto kernel = [&]()
+        {
+            for (int i = 0; i < CallsPerRun; i++)
+            {
+                const CICPColorData colorInfo =
+                {
+                    heif_color_primaries_ITU_R_BT_709_5,
+                    heif_transfer_characteristic_IEC_61966_2_1,
+                    matrices[static_cast<size_t>(i) % std::size(matrices)],
+                    true
+                };
+                YUVCoefficiants coefficiants;
+
+                GetYUVCoefficiants(colorInfo, coefficiants);
+                sink = sink + coefficiants.kr;
+            }
+        };
+
+        const BenchResult result = Measure(kernel);
+
+        std::printf("%-18s %.1f ns/call  %s\n\n", "GetYUVCoefficiants", (result.seconds * 1e9) / CallsPerRun, CheckResult(passed));
+    }
+
+    void GetImageSize(double megapixels, bool oddDimensions, int& width, int& height)
+    {
+        // Use a 4:3 aspect ratio, which is common for camera images.
+        width = static_cast<int>(std::sqrt(megapixels * 1e6 * 4.0 / 3.0)) & ~1;
+        height = static_cast<int>((static_cast<int64_t>(width) * 3) / 4) & ~1;
+
+        if (oddDimensions)
+        {
+            width |= 1;
+            height |= 1;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    double maxMegapixels = 24.0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--max-mp") == 0 && i + 1 < argc)
+        {
+            maxMegapixels = std::atof(argv[++i]);
+        }
+        else
+        {
+            std::fprintf(stderr,
+                "Usage: heic-kernel-bench [--max-mp N]\n"
+                "\n"
+                "Runs the color conversion kernels on 1 to N megapixel images (default 24, up to 100).\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    const double sizes[] = { 1.0, 4.0, 12.0, 24.0, 50.0, 100.0 };
+
+    BenchGetYUVCoefficiants();
+
+    std::printf("%-18s %-7s %13s %10s %10s %12s  %s\n", "kernel", "layout", "size", "best ms", "MP/s", "bytes/cycle", "check");
+
+    for (double megapixels : sizes)
+    {
+        if (megapixels > maxMegapixels)
+        {
+            break;
+        }
+
+        for (const ImageLayout& layout : ImageLayouts)
+        {
+            int width;
+            int height;
+            GetImageSize(megapixels, layout.oddDimensions, width, height);
+
+            TestImage image;
+            CreateTestImage(width, height, layout.stridePadding, image);
+
+            BenchColorToYUV8(layout.name, image.data, YUVChromaSubsampling::Subsampling420, "ColorToYUV8 420");
+            BenchColorToYUV8(layout.name, image.data, YUVChromaSubsampling::Subsampling422, "ColorToYUV8 422");
+            BenchColorToYUV8(layout.name, image.data, YUVChromaSubsampling::Subsampling444, "ColorToYUV8 444");
+            BenchColorToIdentity8(layout.name, image.data);
+            BenchSinglePlane(layout.name, image.data, false);
+            BenchSinglePlane(layout.name, image.data, true);
+            BenchHasTransparency(layout.name, image.data);
+        }
+    }
+
+    if (failed)
+    {
+        std::fprintf(stderr, "One or more kernels did not match the reference output.\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
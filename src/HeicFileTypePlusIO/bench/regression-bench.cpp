@@ -0,0 +1,797 @@
+// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// heic-regression: encodes and decodes a fixed corpus with every combination of
+// the encoder options and checks the results against a stored baseline.
+
+#include "BenchCommon.h"
+#include "HeicEncoder.h"
+#include "HeicReader.h"
+#include "HeicWriter.h"
+#include "Metrics.h"
+#include "scoped.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct CorpusImage
+    {
+        std::string name;
+        OwnedBitmap bitmap;
+    };
+
+    struct Thresholds
+    {
+        // Relative increases, e.g. 0.15 is 15%.
+        double encodeTime = 0.15;
+        double decodeTime = 0.15;
+        double size = 0.02;
+        // Absolute decreases.
+        double psnr = 0.1;
+        double ssim = 0.002;
+    };
+
+    struct HarnessOptions
+    {
+        std::vector<std::string> inputPaths;
+        std::string jsonPath;
+        std::string baselinePath;
+        int syntheticWidth = 640;
+        int syntheticHeight = 480;
+        int quality = 90;
+        int iterations = 1;
+        std::vector<EncoderPreset> presets;
+        std::vector<EncoderTuning> tunings;
+        std::vector<YUVChromaSubsampling> chromaFormats;
+        std::vector<int> tuIntraDepths = { 1, 2, 4 };
+        Thresholds thresholds;
+    };
+
+    struct Result
+    {
+        std::string image;
+        EncoderOptions options{};
+        double encodeMilliseconds = 0.0;
+        double decodeMilliseconds = 0.0;
+        uint64_t bytes = 0;
+        uint64_t peakRssKilobytes = 0;
+        double psnr = 0.0;
+        double ssim = 0.0;
+
+        std::string Key() const
+        {
+            std::ostringstream key;
+
+            key << image << '|'
+                << GetPresetName(options.preset) << '|'
+                << GetTuningName(options.tuning) << '|'
+                << GetChromaName(options.yuvFormat) << '|'
+                << options.tuIntraDepth << '|'
+                << options.quality;
+
+            return key.str();
+        }
+    };
+
+    // The IOCallbacks structure does not have a user data parameter, the harness is
+    // single threaded so the file is kept in a global buffer.
+    struct MemoryFile
+    {
+        std::vector<uint8_t> data;
+        size_t position = 0;
+    };
+
+    MemoryFile memoryFile;
+
+    int32_t __stdcall MemoryRead(void* buffer, const size_t count)
+    {
+        if (count > memoryFile.data.size() - std::min(memoryFile.position, memoryFile.data.size()))
+        {
+            return -1;
+        }
+
+        std::memcpy(buffer, memoryFile.data.data() + memoryFile.position, count);
+        memoryFile.position += count;
+        return 0;
+    }
+
+    int32_t __stdcall MemoryWrite(const void* buffer, const size_t count)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(buffer);
+
+        memoryFile.data.insert(memoryFile.data.end(), bytes, bytes + count);
+        memoryFile.position = memoryFile.data.size();
+        return 0;
+    }
+
+    int32_t __stdcall MemorySeek(const int64_t position)
+    {
+        if (position < 0 || static_cast<uint64_t>(position) > memoryFile.data.size())
+        {
+            return -1;
+        }
+
+        memoryFile.position = static_cast<size_t>(position);
+        return 0;
+    }
+
+    int64_t __stdcall MemoryGetPosition()
+    {
+        return static_cast<int64_t>(memoryFile.position);
+    }
+
+    int64_t __stdcall MemoryGetSize()
+    {
+        return static_cast<int64_t>(memoryFile.data.size());
+    }
+
+    IOCallbacks memoryCallbacks = { MemoryRead, MemoryWrite, MemorySeek, MemoryGetPosition, MemoryGetSize };
+
+    double ElapsedMilliseconds(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    bool Encode(const BitmapData& image, const EncoderOptions& options)
+    {
+        ScopedHeifContext context(heif_context_alloc());
+
+        if (!context)
+        {
+            return false;
+        }
+
+        const EncoderMetadata metadata{};
+
+        memoryFile.data.clear();
+        memoryFile.position = 0;
+
+        Status status = HeicEncoder::Encode(context.get(), &image, &options, &metadata, GetSrgbColorData(options.yuvFormat), nullptr);
+
+        if (status == Status::Ok)
+        {
+            status = HeicWriter::SaveToFile({ context.get(), nullptr, nullptr }, &memoryCallbacks, nullptr);
+        }
+
+        if (status != Status::Ok)
+        {
+            std::fprintf(stderr, "Encoding failed with status %d.\n", static_cast<int>(status));
+            return false;
+        }
+
+        return true;
+    }
+
+    bool Decode(OwnedBitmap& output)
+    {
+        ScopedHeifContext context(heif_context_alloc());
+
+        if (!context)
+        {
+            return false;
+        }
+
+        memoryFile.position = 0;
+
+        if (HeicReader::LoadFileIntoContext(context.get(), &memoryCallbacks, nullptr) != Status::Ok)
+        {
+            std::fprintf(stderr, "Unable to read the encoded image.\n");
+            return false;
+        }
+
+        heif_image_handle* primaryImage = nullptr;
+
+        if (heif_context_get_primary_image_handle(context.get(), &primaryImage).code != heif_error_Ok)
+        {
+            std::fprintf(stderr, "Unable to get the primary image.\n");
+            return false;
+        }
+
+        ScopedHeifImageHandle imageHandle(primaryImage);
+        heif_image* decodedImage = nullptr;
+
+        if (HeicReader::DecodeImage(imageHandle.get(), heif_colorspace_RGB, heif_chroma_interleaved_RGBA, 0, nullptr, &decodedImage) != Status::Ok)
+        {
+            std::fprintf(stderr, "Decoding failed.\n");
+            return false;
+        }
+
+        ScopedHeifImage image(decodedImage);
+
+        const int width = heif_image_get_primary_width(image.get());
+        const int height = heif_image_get_primary_height(image.get());
+        int srcStride = 0;
+        const uint8_t* src = heif_image_get_plane_readonly(image.get(), heif_channel_interleaved, &srcStride);
+
+        output.Allocate(width, height);
+
+        for (int y = 0; y < height; y++)
+        {
+            const uint8_t* srcRow = src + (static_cast<size_t>(y) * srcStride);
+            ColorBgra* dstRow = reinterpret_cast<ColorBgra*>(output.data.scan0 + (static_cast<size_t>(y) * output.data.stride));
+
+            for (int x = 0; x < width; x++)
+            {
+                dstRow[x].r = srcRow[0];
+                dstRow[x].g = srcRow[1];
+                dstRow[x].b = srcRow[2];
+                dstRow[x].a = srcRow[3];
+                srcRow += 4;
+            }
+        }
+
+        return true;
+    }
+
+    bool RunConfiguration(const CorpusImage& image, const EncoderOptions& options, int iterations, Result& result)
+    {
+        result.image = image.name;
+        result.options = options;
+        result.encodeMilliseconds = 0.0;
+        result.decodeMilliseconds = 0.0;
+
+        OwnedBitmap decoded;
+
+        ResetPeakMemoryUsage();
+
+        for (int i = 0; i < iterations; i++)
+        {
+            Clock::time_point start = Clock::now();
+
+            if (!Encode(image.bitmap.data, options))
+            {
+                return false;
+            }
+
+            const double encodeMilliseconds = ElapsedMilliseconds(start);
+
+            start = Clock::now();
+
+            if (!Decode(decoded))
+            {
+                return false;
+            }
+
+            const double decodeMilliseconds = ElapsedMilliseconds(start);
+
+            // The fastest run is the least affected by other activity on the machine.
+            if (i == 0 || encodeMilliseconds < result.encodeMilliseconds)
+            {
+                result.encodeMilliseconds = encodeMilliseconds;
+            }
+
+            if (i == 0 || decodeMilliseconds < result.decodeMilliseconds)
+            {
+                result.decodeMilliseconds = decodeMilliseconds;
+            }
+        }
+
+        result.peakRssKilobytes = GetPeakMemoryUsageKilobytes();
+        result.bytes = memoryFile.data.size();
+
+        // The PSNR is measured on the RGB channels and the SSIM on the luma channel.
+        MetricsOptions metricsOptions{};
+        metricsOptions.colorDomain = MetricsColorDomain::Rgb;
+        ImageQualityMetrics metrics{};
+
+        if (Metrics::ComputeImageMetrics(&image.bitmap.data, &decoded.data, &metricsOptions, &metrics) != Status::Ok)
+        {
+            std::fprintf(stderr, "Failed to compute the image quality metrics.\n");
+            return false;
+        }
+
+        result.psnr = metrics.psnr[3];
+
+        metricsOptions.colorDomain = MetricsColorDomain::YCbCr;
+
+        if (Metrics::ComputeImageMetrics(&image.bitmap.data, &decoded.data, &metricsOptions, &metrics) != Status::Ok)
+        {
+            std::fprintf(stderr, "Failed to compute the image quality metrics.\n");
+            return false;
+        }
+
+        result.ssim = metrics.ssim[0];
+
+        return true;
+    }
+
+    std::string EscapeJsonString(const std::string& value)
+    {
+        std::string escaped;
+
+        for (char c : value)
+        {
+            if (c == '"' || c == '\\')
+            {
+                escaped.push_back('\\');
+            }
+
+            escaped.push_back(c);
+        }
+
+        return escaped;
+    }
+
+    // Each result is written on its own line, ReadBaseline depends on this.
+    bool WriteJson(const std::string& path, const std::vector<Result>& results)
+    {
+        std::ofstream output(path);
+
+        if (!output)
+        {
+            std::fprintf(stderr, "Unable to create %s\n", path.c_str());
+            return false;
+        }
+
+        output << "{\n  \"results\": [\n";
+
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const Result& result = results[i];
+            // JSON does not support infinity, lossless images use a PSNR of 999.
+            const double psnr = std::isinf(result.psnr) ? 999.0 : result.psnr;
+
+            char numbers[512];
+            std::snprintf(numbers, sizeof(numbers),
+                "\"quality\": %d, \"encodeMs\": %.3f, \"decodeMs\": %.3f, \"bytes\": %llu, \"peakRssKb\": %llu, \"psnr\": %.4f, \"ssim\": %.6f",
+                result.options.quality,
+                result.encodeMilliseconds,
+                result.decodeMilliseconds,
+                static_cast<unsigned long long>(result.bytes),
+                static_cast<unsigned long long>(result.peakRssKilobytes),
+                psnr,
+                result.ssim);
+
+            output << "    { \"image\": \"" << EscapeJsonString(result.image)
+                   << "\", \"preset\": \"" << GetPresetName(result.options.preset)
+                   << "\", \"tuning\": \"" << GetTuningName(result.options.tuning)
+                   << "\", \"chroma\": \"" << GetChromaName(result.options.yuvFormat)
+                   << "\", \"tuIntraDepth\": " << result.options.tuIntraDepth
+                   << ", " << numbers << " }"
+                   << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+
+        output << "  ]\n}\n";
+
+        return static_cast<bool>(output);
+    }
+
+    std::string GetJsonString(const std::string& line, const char* name)
+    {
+        const std::string key = std::string("\"") + name + "\": \"";
+        const size_t start = line.find(key);
+
+        if (start == std::string::npos)
+        {
+            return std::string();
+        }
+
+        std::string value;
+
+        for (size_t i = start + key.size(); i < line.size() && line[i] != '"'; i++)
+        {
+            if (line[i] == '\\' && i + 1 < line.size())
+            {
+                i++;
+            }
+
+            value.push_back(line[i]);
+        }
+
+        return value;
+    }
+
+    double GetJsonNumber(const std::string& line, const char* name)
+    {
+        const std::string key = std::string("\"") + name + "\": ";
+        const size_t start = line.find(key);
+
+        return start != std::string::npos ? std::strtod(line.c_str() + start + key.size(), nullptr) : 0.0;
+    }
+
+    // Reads a baseline file that was written by WriteJson.
+    bool ReadBaseline(const std::string& path, std::map<std::string, Result>& baseline)
+    {
+        std::ifstream input(path);
+
+        if (!input)
+        {
+            std::fprintf(stderr, "Unable to open %s\n", path.c_str());
+            return false;
+        }
+
+        std::string line;
+
+        while (std::getline(input, line))
+        {
+            if (line.find("\"image\":") == std::string::npos)
+            {
+                continue;
+            }
+
+            Result result;
+            result.image = GetJsonString(line, "image");
+
+            if (!ParsePreset(GetJsonString(line, "preset"), result.options.preset)
+                || !ParseTuning(GetJsonString(line, "tuning"), result.options.tuning)
+                || !ParseChroma(GetJsonString(line, "chroma"), result.options.yuvFormat))
+            {
+                std::fprintf(stderr, "Invalid baseline entry: %s\n", line.c_str());
+                return false;
+            }
+
+            result.options.tuIntraDepth = static_cast<int>(GetJsonNumber(line, "tuIntraDepth"));
+            result.options.quality = static_cast<int>(GetJsonNumber(line, "quality"));
+            result.encodeMilliseconds = GetJsonNumber(line, "encodeMs");
+            result.decodeMilliseconds = GetJsonNumber(line, "decodeMs");
+            result.bytes = static_cast<uint64_t>(GetJsonNumber(line, "bytes"));
+            result.peakRssKilobytes = static_cast<uint64_t>(GetJsonNumber(line, "peakRssKb"));
+            result.psnr = GetJsonNumber(line, "psnr");
+            result.ssim = GetJsonNumber(line, "ssim");
+
+            baseline.emplace(result.Key(), result);
+        }
+
+        return true;
+    }
+
+    int CompareWithBaseline(const std::vector<Result>& results, const std::map<std::string, Result>& baseline, const Thresholds& thresholds)
+    {
+        int regressions = 0;
+
+        for (const Result& result : results)
+        {
+            auto it = baseline.find(result.Key());
+
+            if (it == baseline.end())
+            {
+                continue;
+            }
+
+            const Result& expected = it->second;
+            const double psnr = std::isinf(result.psnr) ? 999.0 : result.psnr;
+
+            auto report = [&](const char* metric, double baselineValue, double currentValue)
+            {
+                std::printf("REGRESSION %s: %s %.4f -> %.4f\n", result.Key().c_str(), metric, baselineValue, currentValue);
+                regressions++;
+            };
+
+            if (result.encodeMilliseconds > expected.encodeMilliseconds * (1.0 + thresholds.encodeTime))
+            {
+                report("encodeMs", expected.encodeMilliseconds, result.encodeMilliseconds);
+            }
+
+            if (result.decodeMilliseconds > expected.decodeMilliseconds * (1.0 + thresholds.decodeTime))
+            {
+                report("decodeMs", expected.decodeMilliseconds, result.decodeMilliseconds);
+            }
+
+            if (static_cast<double>(result.bytes) > static_cast<double>(expected.bytes) * (1.0 + thresholds.size))
+            {
+                report("bytes", static_cast<double>(expected.bytes), static_cast<double>(result.bytes));
+            }
+
+            if (psnr < expected.psnr - thresholds.psnr)
+            {
+                report("psnr", expected.psnr, psnr);
+            }
+
+            if (result.ssim < expected.ssim - thresholds.ssim)
+            {
+                report("ssim", expected.ssim, result.ssim);
+            }
+        }
+
+        return regressions;
+    }
+
+    template <typename T>
+    bool ParseList(const std::string& value, bool (*parse)(const std::string&, T&), std::vector<T>& list)
+    {
+        std::istringstream stream(value);
+        std::string item;
+
+        list.clear();
+
+        while (std::getline(stream, item, ','))
+        {
+            T parsed;
+
+            if (!parse(item, parsed))
+            {
+                std::fprintf(stderr, "Invalid value: %s\n", item.c_str());
+                return false;
+            }
+
+            list.push_back(parsed);
+        }
+
+        return !list.empty();
+    }
+
+    bool ParseDepth(const std::string& value, int& depth)
+    {
+        depth = std::atoi(value.c_str());
+
+        return depth >= 1 && depth <= 4;
+    }
+
+    void PrintUsage()
+    {
+        std::fprintf(stderr,
+            "Usage: heic-regression [options] [input.heic ...]\n"
+            "\n"
+            "Encodes and decodes the synthetic corpus and any input images with every\n"
+            "combination of the selected encoder options.\n"
+            "\n"
+            "Options:\n"
+            "  --size WxH                  Synthetic image size (default 640x480)\n"
+            "  --quality N                 Encoder quality (default 90)\n"
+            "  --iterations N              Runs per configuration, the fastest is reported (default 1)\n"
+            "  --presets a,b,...           Presets to test (default all)\n"
+            "  --tunings a,b,...           Tunings to test (default all)\n"
+            "  --chroma a,b,...            Chroma formats to test (default all)\n"
+            "  --tu-intra-depths a,b,...   TU intra depths to test (default 1,2,4)\n"
+            "  --json PATH                 Write the results to PATH\n"
+            "  --baseline PATH             Fail if the results regress compared to PATH\n"
+            "  --max-time-regression F     Allowed relative time increase (default 0.15)\n"
+            "  --max-size-regression F     Allowed relative size increase (default 0.02)\n"
+            "  --max-psnr-drop DB          Allowed PSNR decrease (default 0.1)\n"
+            "  --max-ssim-drop F           Allowed SSIM decrease (default 0.002)\n");
+    }
+
+    bool ParseArguments(int argc, char** argv, HarnessOptions& options)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string arg = argv[i];
+
+            if (arg.rfind("--", 0) != 0)
+            {
+                options.inputPaths.push_back(arg);
+                continue;
+            }
+
+            if (arg == "--help" || i + 1 >= argc)
+            {
+                return false;
+            }
+
+            const std::string value = argv[++i];
+            bool valid = true;
+
+            if (arg == "--size")
+            {
+                valid = std::sscanf(value.c_str(), "%dx%d", &options.syntheticWidth, &options.syntheticHeight) == 2
+                     && options.syntheticWidth > 0
+                     && options.syntheticHeight > 0;
+            }
+            else if (arg == "--quality")
+            {
+                options.quality = std::clamp(std::atoi(value.c_str()), 0, 100);
+            }
+            else if (arg == "--iterations")
+            {
+                options.iterations = std::max(1, std::atoi(value.c_str()));
+            }
+            else if (arg == "--presets")
+            {
+                valid = ParseList(value, ParsePreset, options.presets);
+            }
+            else if (arg == "--tunings")
+            {
+                valid = ParseList(value, ParseTuning, options.tunings);
+            }
+            else if (arg == "--chroma")
+            {
+                valid = ParseList(value, ParseChroma, options.chromaFormats);
+            }
+            else if (arg == "--tu-intra-depths")
+            {
+                valid = ParseList(value, ParseDepth, options.tuIntraDepths);
+            }
+            else if (arg == "--json")
+            {
+                options.jsonPath = value;
+            }
+            else if (arg == "--baseline")
+            {
+                options.baselinePath = value;
+            }
+            else if (arg == "--max-time-regression")
+            {
+                options.thresholds.encodeTime = std::atof(value.c_str());
+                options.thresholds.decodeTime = options.thresholds.encodeTime;
+            }
+            else if (arg == "--max-size-regression")
+            {
+                options.thresholds.size = std::atof(value.c_str());
+            }
+            else if (arg == "--max-psnr-drop")
+            {
+                options.thresholds.psnr = std::atof(value.c_str());
+            }
+            else if (arg == "--max-ssim-drop")
+            {
+                options.thresholds.ssim = std::atof(value.c_str());
+            }
+            else
+            {
+                valid = false;
+            }
+
+            if (!valid)
+            {
+                std::fprintf(stderr, "Invalid option: %s %s\n", arg.c_str(), value.c_str());
+                return false;
+            }
+        }
+
+        if (options.presets.empty())
+        {
+            for (int i = static_cast<int>(EncoderPreset::UltraFast); i <= static_cast<int>(EncoderPreset::Placebo); i++)
+            {
+                options.presets.push_back(static_cast<EncoderPreset>(i));
+            }
+        }
+
+        if (options.tunings.empty())
+        {
+            for (int i = static_cast<int>(EncoderTuning::PSNR); i <= static_cast<int>(EncoderTuning::None); i++)
+            {
+                options.tunings.push_back(static_cast<EncoderTuning>(i));
+            }
+        }
+
+        if (options.chromaFormats.empty())
+        {
+            for (int i = static_cast<int>(YUVChromaSubsampling::Subsampling400); i <= static_cast<int>(YUVChromaSubsampling::IdentityMatrix); i++)
+            {
+                options.chromaFormats.push_back(static_cast<YUVChromaSubsampling>(i));
+            }
+        }
+
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    HarnessOptions options;
+
+    if (!ParseArguments(argc, argv, options))
+    {
+        PrintUsage();
+        return EXIT_FAILURE;
+    }
+
+    std::vector<CorpusImage> corpus(3);
+
+    corpus[0].name = "synthetic-photo";
+    CreateSyntheticImage(options.syntheticWidth, options.syntheticHeight, SyntheticContent::Photo, corpus[0].bitmap);
+    corpus[1].name = "synthetic-graphics";
+    CreateSyntheticImage(options.syntheticWidth, options.syntheticHeight, SyntheticContent::Graphics, corpus[1].bitmap);
+    corpus[2].name = "synthetic-transparent";
+    CreateSyntheticImage(options.syntheticWidth, options.syntheticHeight, SyntheticContent::Transparent, corpus[2].bitmap);
+
+    for (const std::string& path : options.inputPaths)
+    {
+        CorpusImage image;
+        image.name = path.substr(path.find_last_of("/\\") + 1);
+
+        if (!LoadHeifImage(path, image.bitmap))
+        {
+            return EXIT_FAILURE;
+        }
+
+        corpus.push_back(std::move(image));
+    }
+
+    std::vector<Result> results;
+
+    std::printf("%-24s %-10s %-10s %-8s %5s %10s %10s %10s %10s %8s %8s\n",
+        "image", "preset", "tuning", "chroma", "tu", "encode ms", "decode ms", "bytes", "peak KB", "psnr", "ssim");
+
+    for (const CorpusImage& image : corpus)
+    {
+        for (EncoderPreset preset : options.presets)
+        {
+            for (EncoderTuning tuning : options.tunings)
+            {
+                for (YUVChromaSubsampling chroma : options.chromaFormats)
+                {
+                    for (int tuIntraDepth : options.tuIntraDepths)
+                    {
+                        const EncoderOptions encoderOptions =
+                        {
+                            options.quality,
+                            chroma,
+                            preset,
+                            tuning,
+                            tuIntraDepth,
+                            0,
+                            nullptr,
+                            0,
+                            0
+                        };
+                        Result result;
+
+                        if (!RunConfiguration(image, encoderOptions, options.iterations, result))
+                        {
+                            return EXIT_FAILURE;
+                        }
+
+                        std::printf("%-24s %-10s %-10s %-8s %5d %10.2f %10.2f %10llu %10llu %8.3f %8.5f\n",
+                            result.image.c_str(),
+                            GetPresetName(preset),
+                            GetTuningName(tuning),
+                            GetChromaName(chroma),
+                            tuIntraDepth,
+                            result.encodeMilliseconds,
+                            result.decodeMilliseconds,
+                            static_cast<unsigned long long>(result.bytes),
+                            static_cast<unsigned long long>(result.peakRssKilobytes),
+                            result.psnr,
+                            result.ssim);
+
+                        results.push_back(std::move(result));
+                    }
+                }
+            }
+        }
+    }
+
+    if (!options.jsonPath.empty() && !WriteJson(options.jsonPath, results))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (!options.baselinePath.empty())
+    {
+        std::map<std::string, Result> baseline;
+
+        if (!ReadBaseline(options.baselinePath, baseline))
+        {
+            return EXIT_FAILURE;
+        }
+
+        const int regressions = CompareWithBaseline(results, baseline, options.thresholds);
+
+        if (regressions > 0)
+        {
+            std::fprintf(stderr, "%d regression(s) compared to the baseline.\n", regressions);
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
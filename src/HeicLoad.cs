@@ -25,12 +25,23 @@ using System;
 using System.Buffers.Binary;
 using System.Collections.Generic;
 using System.IO;
+using System.Text;
+using System.Threading.Tasks;
 
 namespace HeicFileTypePlus
 {
     internal static class HeicLoad
     {
-        public static Document Load(Stream input)
+        /// <summary>
+        /// Loads the HEIF image from the stream.
+        /// </summary>
+        /// <param name="input">The input stream.</param>
+        /// <param name="progressEventHandler">
+        /// The progress handler, the load is canceled between the decode stages when it throws an <see cref="OperationCanceledException"/>.
+        /// </param>
+        /// <returns>The loaded document.</returns>
+        /// <exception cref="OperationCanceledException">The load was canceled.</exception>
+        public static Document Load(Stream input, ProgressEventHandler? progressEventHandler = null)
         {
             Document? doc = null;
 
@@ -40,63 +51,220 @@ namespace HeicFileTypePlus
             {
                 HeicNative.LoadFileIntoContext(context, fileIO);
 
-                HeifImageHandle? primaryImageHandle = null;
-                Surface? surface = null;
-                bool disposeSurface = true;
+                List<HeifImageHandle> imageHandles = new();
+                List<LayerImage> layerImages = new();
+                Task? additionalImagesTask = null;
 
                 try
                 {
-                    primaryImageHandle = HeicNative.GetPrimaryImage(context);
+                    HeifImageHandle primaryImageHandle = HeicNative.GetPrimaryImage(context);
+                    imageHandles.Add(primaryImageHandle);
 
-                    surface = new Surface(primaryImageHandle.Width, primaryImageHandle.Height);
+                    GetLayerImages(context, primaryImageHandle, imageHandles, layerImages);
 
-                    using (HeifImage image = primaryImageHandle.Decode(HeifColorSpace.Undefined, HeifChroma.Undefined))
+                    if (layerImages.Count > 1)
                     {
-                        switch (image.ColorSpace)
+                        // The decoder thread count is a context setting that libheif reads while it
+                        // decodes, so it is set for all of the images before any decode starts.
+                        HeicNative.SetConcurrentDecodes(context, layerImages.Count);
+
+                        // The other images are decoded at the same time as the first image.
+                        Task[] tasks = new Task[layerImages.Count - 1];
+
+                        for (int i = 0; i < tasks.Length; i++)
                         {
-                            case HeifColorSpace.YCbCr:
-                                YCbCrImageDecoder.SetImageData(imagingFactory, primaryImageHandle, surface);
-                                break;
-                            case HeifColorSpace.Rgb:
-                                RgbImageDecoder.SetImageData(imagingFactory, image, surface);
-                                break;
-                            case HeifColorSpace.Monochrome:
-                                MonochromeImageDecoder.SetImageData(imagingFactory, image, surface);
-                                break;
-                            case HeifColorSpace.Undefined:
-                            default:
-                                throw new FormatException("Unknown HEIF image color space.");
+                            LayerImage layerImage = layerImages[i + 1];
+
+                            tasks[i] = Task.Run(() =>
+                            {
+                                using (IImagingFactory taskImagingFactory = ImagingFactory.CreateRef())
+                                {
+                                    layerImage.Decode(taskImagingFactory, null, null);
+                                }
+                            });
                         }
+
+                        additionalImagesTask = Task.WhenAll(tasks);
                     }
 
-                    doc = new Document(surface.Width, surface.Height);
+                    // The cancellation is checked between the decode stages, the native decoder
+                    // cannot be stopped while it is decoding the tiles and the alpha image.
+                    HeifProgressCallback? decodeProgress = null;
+                    HeifProgressCallback? conversionProgress = null;
+
+                    if (progressEventHandler != null)
+                    {
+                        decodeProgress = (double progress) => ReportProgress(progress * 0.5);
+                        conversionProgress = (double progress) => ReportProgress(50.0 + (progress * 0.4));
+                    }
+
+                    layerImages[0].Decode(imagingFactory, decodeProgress, conversionProgress);
+
+                    ThrowIfCanceled(90.0);
+
+                    additionalImagesTask?.GetAwaiter().GetResult();
+
+                    doc = new Document(primaryImageHandle.Width, primaryImageHandle.Height);
                     AddMetadataToDocument(doc, primaryImageHandle, imagingFactory);
-                    doc.Layers.Add(Layer.CreateBackgroundLayer(surface, true));
-                    disposeSurface = false;
+
+                    foreach (LayerImage layerImage in layerImages)
+                    {
+                        doc.Layers.Add(layerImage.CreateLayer());
+                    }
                 }
                 finally
                 {
-                    primaryImageHandle?.Dispose();
+                    if (additionalImagesTask != null && !additionalImagesTask.IsCompleted)
+                    {
+                        // The native decoder uses the image handles and the surfaces until it has finished.
+                        ((IAsyncResult)additionalImagesTask).AsyncWaitHandle.WaitOne();
+                    }
 
-                    if (disposeSurface)
+                    foreach (LayerImage layerImage in layerImages)
                     {
-                        surface?.Dispose();
+                        layerImage.Dispose();
+                    }
+
+                    foreach (HeifImageHandle imageHandle in imageHandles)
+                    {
+                        imageHandle.Dispose();
                     }
                 }
             }
 
+            // The load has finished, so a cancellation of the final report is ignored.
+            ReportProgress(100.0);
+
             return doc;
+
+            void ThrowIfCanceled(double progress)
+            {
+                if (!ReportProgress(progress))
+                {
+                    throw new OperationCanceledException();
+                }
+            }
+
+            bool ReportProgress(double progress)
+            {
+                try
+                {
+                    progressEventHandler?.Invoke(null, new ProgressEventArgs(progress, true));
+                    return true;
+                }
+                catch (OperationCanceledException)
+                {
+                    return false;
+                }
+            }
         }
 
+        private static void DecodeImage(
+            IImagingFactory imagingFactory,
+            HeifImageHandle imageHandle,
+            Surface output,
+            HeifProgressCallback? decodeProgress,
+            HeifProgressCallback? conversionProgress)
+        {
+            using (HeifImage image = imageHandle.Decode(HeifColorSpace.Undefined, HeifChroma.Undefined, decodeProgress))
+            {
+                switch (image.ColorSpace)
+                {
+                    case HeifColorSpace.YCbCr:
+                        YCbCrImageDecoder.SetImageData(imagingFactory, imageHandle, output, conversionProgress);
+                        break;
+                    case HeifColorSpace.Rgb:
+                        RgbImageDecoder.SetImageData(imagingFactory, image, output);
+                        break;
+                    case HeifColorSpace.Monochrome:
+                        MonochromeImageDecoder.SetImageData(imagingFactory, image, output);
+                        break;
+                    case HeifColorSpace.Undefined:
+                    default:
+                        throw new FormatException("Unknown HEIF image color space.");
+                }
+            }
+        }
+
+        /// <summary>
+        /// Gets the images that are loaded as the document layers.
+        /// </summary>
+        /// <remarks>
+        /// When every other top-level image has the layer properties that the layered save writes, the layers
+        /// are restored from those images and the primary image is skipped because it is the flattened image.
+        /// Otherwise the primary image is the background layer and the other images are added as hidden layers.
+        /// </remarks>
+        private static void GetLayerImages(
+            SafeHeifContext context,
+            HeifImageHandle primaryImageHandle,
+            List<HeifImageHandle> imageHandles,
+            List<LayerImage> layerImages)
+        {
+            uint[] imageIds = HeicNative.GetTopLevelImageIds(context);
+
+            List<(HeifImageHandle ImageHandle, string Name, HeifLayerProperties? LayerProperties)> additionalImages = new(imageIds.Length);
+            bool savedLayers = imageIds.Length > 1;
+
+            for (int i = 1; i < imageIds.Length; i++)
+            {
+                HeifImageHandle imageHandle = HeicNative.GetImage(context, imageIds[i]);
+                imageHandles.Add(imageHandle);
+
+                // The images are loaded as layers of the document, so an image
+                // that is not the same size as the primary image is skipped.
+                if (imageHandle.Width != primaryImageHandle.Width || imageHandle.Height != primaryImageHandle.Height)
+                {
+                    savedLayers = false;
+                    continue;
+                }
+
+                HeifLayerProperties? layerProperties;
+
+                using (HeifMetadataBundle metadata = imageHandle.GetMetadataBundle())
+                {
+                    layerProperties = HeifLayerProperties.TryParse(metadata.Xmp);
+                }
+
+                if (layerProperties is null)
+                {
+                    savedLayers = false;
+                }
+
+                additionalImages.Add((imageHandle, $"Image {i + 1}", layerProperties));
+            }
+
+            if (!savedLayers)
+            {
+                layerImages.Add(new LayerImage(primaryImageHandle, null, null));
+            }
+
+            foreach ((HeifImageHandle imageHandle, string name, HeifLayerProperties? layerProperties) in additionalImages)
+            {
+                // The layer properties are only used when all of the layers can be restored.
+                layerImages.Add(new LayerImage(imageHandle, name, savedLayers ? layerProperties : null));
+            }
+        }
 
         private static void AddMetadataToDocument(
             Document document,
             HeifImageHandle primaryImageHandle,
             IImagingFactory imagingFactory)
         {
-            byte[]? exifData = primaryImageHandle.GetExif();
+            using (HeifMetadataBundle metadata = primaryImageHandle.GetMetadataBundle())
+            {
+                AddMetadataToDocument(document, primaryImageHandle, metadata, imagingFactory);
+            }
+        }
 
-            if (exifData != null)
+        private static void AddMetadataToDocument(
+            Document document,
+            HeifImageHandle primaryImageHandle,
+            HeifMetadataBundle metadata,
+            IImagingFactory imagingFactory)
+        {
+            ReadOnlySpan<byte> exifData = metadata.Exif;
+
+            if (!exifData.IsEmpty)
             {
                 ExifValueCollection? metadataEntries = TryParseExifData(exifData);
 
@@ -130,9 +298,9 @@ namespace HeicFileTypePlus
 
                 if (profileType == ImageHandleColorProfileType.Icc)
                 {
-                    byte[]? iccProfile = primaryImageHandle.GetIccProfile();
+                    ReadOnlySpan<byte> iccProfile = metadata.IccProfile;
 
-                    if (iccProfile != null)
+                    if (!iccProfile.IsEmpty)
                     {
                         IColorContext? colorContext = ColorContextUtil.TryCreateFromRgbProfile(iccProfile, imagingFactory);
 
@@ -151,7 +319,7 @@ namespace HeicFileTypePlus
                 }
                 else if (profileType == ImageHandleColorProfileType.Cicp)
                 {
-                    CICPColorData colorData = primaryImageHandle.CICPColorData;
+                    CICPColorData colorData = metadata.CICPColorData;
 
                     IColorContext? colorContext = ColorContextUtil.TryCreateFromCICP(colorData, imagingFactory);
 
@@ -169,11 +337,12 @@ namespace HeicFileTypePlus
                 }
             }
 
-            byte[]? xmpData = primaryImageHandle.GetXmp();
+            ReadOnlySpan<byte> xmpData = metadata.Xmp;
 
-            if (xmpData != null)
+            if (!xmpData.IsEmpty)
             {
-                XmpPacket? packet = XmpPacket.TryParse(xmpData);
+                // The packet text is decoded directly from the native metadata arena.
+                XmpPacket? packet = XmpPacket.TryParse(Encoding.UTF8.GetString(xmpData));
 
                 if (packet != null)
                 {
@@ -182,13 +351,8 @@ namespace HeicFileTypePlus
             }
         }
 
-        private static ExifValueCollection? TryParseExifData(byte[] exifData)
+        private static unsafe ExifValueCollection? TryParseExifData(ReadOnlySpan<byte> exifData)
         {
-            if (exifData is null)
-            {
-                return null;
-            }
-
             ExifValueCollection? metadataEntries = null;
 
             // The EXIF data block has a header that indicates the number of bytes
@@ -207,9 +371,13 @@ namespace HeicFileTypePlus
 
                 if (dataLength > 0)
                 {
-                    using (MemoryStream stream = new(exifData, startIndex, dataLength))
+                    // The EXIF data is read directly from the native metadata arena.
+                    fixed (byte* ptr = exifData.Slice(startIndex))
                     {
-                        metadataEntries = ExifParser.Parse(stream);
+                        using (UnmanagedMemoryStream stream = new(ptr, dataLength))
+                        {
+                            metadataEntries = ExifParser.Parse(stream);
+                        }
                     }
                 }
             }
@@ -229,5 +397,88 @@ namespace HeicFileTypePlus
                 return true;
             }
         }
+
+        private sealed class LayerImage : Disposable
+        {
+            private readonly HeifLayerProperties? layerProperties;
+            private Surface? surface;
+
+            /// <summary>
+            /// Initializes a new instance of the <see cref="LayerImage"/> class.
+            /// </summary>
+            /// <param name="imageHandle">The image handle, it is owned by the caller.</param>
+            /// <param name="name">The layer name, or <see langword="null"/> for the background layer.</param>
+            /// <param name="layerProperties">The layer properties that were saved with the image.</param>
+            public LayerImage(HeifImageHandle imageHandle, string? name, HeifLayerProperties? layerProperties)
+            {
+                this.ImageHandle = imageHandle;
+                this.Name = name;
+                this.layerProperties = layerProperties;
+            }
+
+            public HeifImageHandle ImageHandle { get; }
+
+            public string? Name { get; }
+
+            public void Decode(
+                IImagingFactory imagingFactory,
+                HeifProgressCallback? decodeProgress,
+                HeifProgressCallback? conversionProgress)
+            {
+                ObjectDisposedException.ThrowIf(this.IsDisposed, this);
+
+                this.surface = new Surface(this.ImageHandle.Width, this.ImageHandle.Height);
+
+                DecodeImage(imagingFactory, this.ImageHandle, this.surface, decodeProgress, conversionProgress);
+            }
+
+            /// <summary>
+            /// Creates the document layer, the layer takes ownership of the decoded image.
+            /// </summary>
+            public Layer CreateLayer()
+            {
+                ObjectDisposedException.ThrowIf(this.IsDisposed, this);
+
+                Surface layerSurface = this.surface ?? throw new InvalidOperationException("The image has not been decoded.");
+                Layer layer;
+
+                if (this.Name is null)
+                {
+                    layer = Layer.CreateBackgroundLayer(layerSurface, true);
+                }
+                else
+                {
+                    BitmapLayer bitmapLayer = new(layerSurface, takeOwnership: true);
+
+                    if (this.layerProperties != null)
+                    {
+                        this.layerProperties.ApplyTo(bitmapLayer);
+                    }
+                    else
+                    {
+                        // The additional images are hidden so that the document looks the same as the primary image.
+                        bitmapLayer.Name = this.Name;
+                        bitmapLayer.Visible = false;
+                    }
+
+                    layer = bitmapLayer;
+                }
+
+                this.surface = null;
+
+                return layer;
+            }
+
+            protected override void Dispose(bool disposing)
+            {
+                if (disposing)
+                {
+                    this.surface?.Dispose();
+                    this.surface = null;
+                }
+
+                base.Dispose(disposing);
+            }
+        }
     }
 }
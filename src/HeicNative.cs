@@ -19,6 +19,7 @@
 using HeicFileTypePlus.Interop;
 using PaintDotNet;
 using System;
+using System.Collections.Generic;
 using System.Globalization;
 using System.IO;
 using System.Runtime.InteropServices;
@@ -52,6 +53,35 @@ namespace HeicFileTypePlus
             return context;
         }
 
+        internal static unsafe SniffResult SniffFile(ReadOnlySpan<byte> data)
+        {
+            SniffResult result;
+            Status status;
+
+            fixed (byte* ptr = data)
+            {
+                if (RuntimeInformation.ProcessArchitecture == Architecture.X64)
+                {
+                    status = HeicIO_x64.SniffFile(ptr, (nuint)data.Length, out result);
+                }
+                else if (RuntimeInformation.ProcessArchitecture == Architecture.Arm64)
+                {
+                    status = HeicIO_ARM64.SniffFile(ptr, (nuint)data.Length, out result);
+                }
+                else
+                {
+                    throw new PlatformNotSupportedException();
+                }
+            }
+
+            if (status != Status.Ok)
+            {
+                HandleReadError(status);
+            }
+
+            return result;
+        }
+
         internal static unsafe void LoadFileIntoContext(SafeHeifContext context, HeifFileIO fileIO)
         {
             Status status;
@@ -152,7 +182,138 @@ namespace HeicFileTypePlus
             return imageHandle;
         }
 
-        internal static unsafe HeifImage DecodeImage(IHeifImageHandle imageHandle, HeifColorSpace colorSpace, HeifChroma chroma)
+        internal static HeifImageHandle GetImage(SafeHeifContext context, uint id)
+        {
+            SafeHeifImageHandle? safeImageHandle = null;
+            ImageHandleInfo info = new();
+
+            HeicErrorDetails errorDetails = new();
+            HeicErrorDetailsCopy copyErrorDetailsCallback = new(errorDetails.Copy);
+
+            if (RuntimeInformation.ProcessArchitecture == Architecture.X64)
+            {
+                Status status = HeicIO_x64.GetImage(context,
+                                                    id,
+                                                    out SafeHeifImageHandleX64 handle,
+                                                    info,
+                                                    copyErrorDetailsCallback);
+
+                if (status == Status.Ok)
+                {
+                    safeImageHandle = handle;
+                }
+                else
+                {
+                    HandleReadError(status, errorDetails.Message);
+                }
+            }
+            else if (RuntimeInformation.ProcessArchitecture == Architecture.Arm64)
+            {
+                Status status = HeicIO_ARM64.GetImage(context,
+                                                      id,
+                                                      out SafeHeifImageHandleARM64 handle,
+                                                      info,
+                                                      copyErrorDetailsCallback);
+
+                if (status == Status.Ok)
+                {
+                    safeImageHandle = handle;
+                }
+                else
+                {
+                    HandleReadError(status, errorDetails.Message);
+                }
+            }
+            else
+            {
+                throw new PlatformNotSupportedException();
+            }
+            GC.KeepAlive(copyErrorDetailsCallback);
+
+            HeifImageHandle? imageHandle = null;
+
+            try
+            {
+                imageHandle = new(safeImageHandle!, info);
+                safeImageHandle = null;
+            }
+            finally
+            {
+                safeImageHandle?.Dispose();
+            }
+
+            return imageHandle;
+        }
+
+        internal static uint[] GetTopLevelImageIds(SafeHeifContext context)
+        {
+            Status status;
+            int count;
+
+            if (RuntimeInformation.ProcessArchitecture == Architecture.X64)
+            {
+                status = HeicIO_x64.GetTopLevelImageCount(context, out count);
+            }
+            else if (RuntimeInformation.ProcessArchitecture == Architecture.Arm64)
+            {
+                status = HeicIO_ARM64.GetTopLevelImageCount(context, out count);
+            }
+            else
+            {
+                throw new PlatformNotSupportedException();
+            }
+
+            if (status != Status.Ok)
+            {
+                HandleReadError(status);
+            }
+
+            uint[] ids = new uint[count];
+
+            if (RuntimeInformation.ProcessArchitecture == Architecture.X64)
+            {
+                status = HeicIO_x64.GetTopLevelImageIds(context, ids, ids.Length);
+            }
+            else
+            {
+                status = HeicIO_ARM64.GetTopLevelImageIds(context, ids, ids.Length);
+            }
+
+            if (status != Status.Ok)
+            {
+                HandleReadError(status);
+            }
+
+            return ids;
+        }
+
+        internal static void SetConcurrentDecodes(SafeHeifContext context, int imageCount)
+        {
+            Status status;
+
+            if (RuntimeInformation.ProcessArchitecture == Architecture.X64)
+            {
+                status = HeicIO_x64.SetConcurrentDecodes(context, imageCount);
+            }
+            else if (RuntimeInformation.ProcessArchitecture == Architecture.Arm64)
+            {
+                status = HeicIO_ARM64.SetConcurrentDecodes(context, imageCount);
+            }
+            else
+            {
+                throw new PlatformNotSupportedException();
+            }
+
+            if (status != Status.Ok)
+            {
+                HandleReadError(status);
+            }
+        }
+
+        internal static unsafe HeifImage DecodeImage(IHeifImageHandle imageHandle,
+                                                     HeifColorSpace colorSpace,
+                                                     HeifChroma chroma,
+                                                     HeifProgressCallback? progressCallback)
         {
             SafeHeifImage? safeHeifImage = null;
             HeifImageInfo info = new();
@@ -162,8 +323,10 @@ namespace HeicFileTypePlus
                 Status status = HeicIO_x64.DecodeImage(imageHandle.SafeHeifImageHandle,
                                                        colorSpace,
                                                        chroma,
+                                                       0,
                                                        out SafeHeifImageX64 safeImage,
-                                                       info);
+                                                       info,
+                                                       progressCallback);
 
                 if (status == Status.Ok)
                 {
@@ -179,8 +342,10 @@ namespace HeicFileTypePlus
                 Status status = HeicIO_ARM64.DecodeImage(imageHandle.SafeHeifImageHandle,
                                                          colorSpace,
                                                          chroma,
+                                                         0,
                                                          out SafeHeifImageARM64 safeImage,
-                                                         info);
+                                                         info,
+                                                         progressCallback);
 
                 if (status == Status.Ok)
                 {
@@ -196,6 +361,8 @@ namespace HeicFileTypePlus
                 throw new PlatformNotSupportedException();
             }
 
+            GC.KeepAlive(progressCallback);
+
             HeifImage? image = null;
 
             try
@@ -233,18 +400,17 @@ namespace HeicFileTypePlus
             return scan0;
         }
 
-        internal static nuint GetICCProfileSize(SafeHeifImageHandle imageHandle)
+        internal static void GetCICPColorData(SafeHeifImageHandle imageHandle, out CICPColorData colorData)
         {
-            nuint size;
             Status status;
 
             if (RuntimeInformation.ProcessArchitecture == Architecture.X64)
             {
-                status = HeicIO_x64.GetICCProfileSize(imageHandle, out size);
+                status = HeicIO_x64.GetCICPColorData(imageHandle, out colorData);
             }
             else if (RuntimeInformation.ProcessArchitecture == Architecture.Arm64)
             {
-                status = HeicIO_ARM64.GetICCProfileSize(imageHandle, out size);
+                status = HeicIO_ARM64.GetCICPColorData(imageHandle, out colorData);
             }
             else
             {
@@ -255,21 +421,20 @@ namespace HeicFileTypePlus
             {
                 HandleReadError(status);
             }
-
-            return size;
         }
 
-        internal static void GetICCProfile(SafeHeifImageHandle imageHandle, byte[] buffer)
+        internal static HeifMetadataBundle GetAllMetadata(SafeHeifImageHandle imageHandle)
         {
+            MetadataBundle bundle;
             Status status;
 
             if (RuntimeInformation.ProcessArchitecture == Architecture.X64)
             {
-                status = HeicIO_x64.GetICCProfile(imageHandle, buffer, (uint)buffer.Length);
+                status = HeicIO_x64.GetAllMetadata(imageHandle, out bundle);
             }
             else if (RuntimeInformation.ProcessArchitecture == Architecture.Arm64)
             {
-                status = HeicIO_ARM64.GetICCProfile(imageHandle, buffer, (uint)buffer.Length);
+                status = HeicIO_ARM64.GetAllMetadata(imageHandle, out bundle);
             }
             else
             {
@@ -280,19 +445,38 @@ namespace HeicFileTypePlus
             {
                 HandleReadError(status);
             }
+
+            return new HeifMetadataBundle(bundle);
         }
 
-        internal static void GetCICPColorData(SafeHeifImageHandle imageHandle, out CICPColorData colorData)
+        internal static void FreeMetadataBundle(ref MetadataBundle bundle)
+        {
+            if (RuntimeInformation.ProcessArchitecture == Architecture.X64)
+            {
+                HeicIO_x64.FreeMetadataBundle(ref bundle);
+            }
+            else if (RuntimeInformation.ProcessArchitecture == Architecture.Arm64)
+            {
+                HeicIO_ARM64.FreeMetadataBundle(ref bundle);
+            }
+            else
+            {
+                throw new PlatformNotSupportedException();
+            }
+        }
+
+        internal static MemoryEstimate EstimateMemory(int width, int height, EncoderOptions options)
         {
+            MemoryEstimate estimate;
             Status status;
 
             if (RuntimeInformation.ProcessArchitecture == Architecture.X64)
             {
-                status = HeicIO_x64.GetCICPColorData(imageHandle, out colorData);
+                status = HeicIO_x64.EstimateMemory(width, height, options, out estimate);
             }
             else if (RuntimeInformation.ProcessArchitecture == Architecture.Arm64)
             {
-                status = HeicIO_ARM64.GetCICPColorData(imageHandle, out colorData);
+                status = HeicIO_ARM64.EstimateMemory(width, height, options, out estimate);
             }
             else
             {
@@ -301,77 +485,207 @@ namespace HeicFileTypePlus
 
             if (status != Status.Ok)
             {
-                HandleReadError(status);
+                HandleWriteError(status);
             }
+
+            return estimate;
         }
 
-        internal static bool GetMetadataId(SafeHeifImageHandle imageHandle, MetadataType type, out uint id)
+        internal static unsafe void SaveToFile(Surface surface,
+                                               EncoderOptions options,
+                                               EncoderMetadata metadata,
+                                               ref CICPColorData colorData,
+                                               HeifFileIO fileIO,
+                                               HeifProgressCallback progressCallback)
         {
-            bool result = false;
+            BitmapData bitmapData = new()
+            {
+                scan0 = (byte*)surface.Scan0.VoidStar,
+                width = surface.Width,
+                height = surface.Height,
+                stride = surface.Stride
+            };
+
             Status status;
 
             if (RuntimeInformation.ProcessArchitecture == Architecture.X64)
             {
-                status = HeicIO_x64.GetMetadataId(imageHandle, type, out id);
+                status = HeicIO_x64.SaveToFile(ref bitmapData, options, metadata, ref colorData, fileIO.IOCallbacksHandle, progressCallback);
             }
             else if (RuntimeInformation.ProcessArchitecture == Architecture.Arm64)
             {
-                status = HeicIO_ARM64.GetMetadataId(imageHandle, type, out id);
+                status = HeicIO_ARM64.SaveToFile(ref bitmapData, options, metadata, ref colorData, fileIO.IOCallbacksHandle, progressCallback);
             }
             else
             {
                 throw new PlatformNotSupportedException();
             }
 
-            if (status == Status.Ok)
+            if (status != Status.Ok)
             {
-                result = true;
+                if (fileIO.CallbackExceptionInfo != null)
+                {
+                    fileIO.CallbackExceptionInfo.Throw();
+                }
+                else
+                {
+                    HandleWriteError(status);
+                }
             }
-            else if (status != Status.NoMatchingMetadata)
+        }
+
+        internal static unsafe void SaveLayersToFile(Surface composite,
+                                                     IReadOnlyList<Surface> layers,
+                                                     IReadOnlyList<byte[]> layerXmp,
+                                                     EncoderOptions options,
+                                                     EncoderMetadata metadata,
+                                                     ref CICPColorData colorData,
+                                                     HeifFileIO fileIO,
+                                                     HeifProgressCallback progressCallback)
+        {
+            BitmapData compositeData = new()
             {
-                HandleReadError(status);
+                scan0 = (byte*)composite.Scan0.VoidStar,
+                width = composite.Width,
+                height = composite.Height,
+                stride = composite.Stride
+            };
+
+            BitmapData[] layerData = new BitmapData[layers.Count];
+
+            for (int i = 0; i < layerData.Length; i++)
+            {
+                Surface layer = layers[i];
+
+                layerData[i] = new BitmapData
+                {
+                    scan0 = (byte*)layer.Scan0.VoidStar,
+                    width = layer.Width,
+                    height = layer.Height,
+                    stride = layer.Stride
+                };
             }
 
-            return result;
+            // The XMP packets are copied into a single buffer so that only one array needs to be pinned.
+            int xmpBufferSize = 0;
+
+            for (int i = 0; i < layerXmp.Count; i++)
+            {
+                xmpBufferSize += layerXmp[i].Length;
+            }
+
+            byte[] xmpBuffer = new byte[xmpBufferSize];
+            LayerMetadata[] layerMetadata = new LayerMetadata[layers.Count];
+
+            Status status;
+
+            fixed (byte* xmpScan0 = xmpBuffer)
+            {
+                int offset = 0;
+
+                for (int i = 0; i < layerMetadata.Length; i++)
+                {
+                    byte[] xmp = layerXmp[i];
+
+                    xmp.CopyTo(xmpBuffer, offset);
+
+                    layerMetadata[i] = new LayerMetadata
+                    {
+                        xmp = xmpScan0 + offset,
+                        xmpSize = xmp.Length
+                    };
+
+                    offset += xmp.Length;
+                }
+
+                if (RuntimeInformation.ProcessArchitecture == Architecture.X64)
+                {
+                    status = HeicIO_x64.SaveLayersToFile(ref compositeData,
+                                                         layerData,
+                                                         layerMetadata,
+                                                         layerData.Length,
+                                                         options,
+                                                         metadata,
+                                                         ref colorData,
+                                                         fileIO.IOCallbacksHandle,
+                                                         progressCallback);
+                }
+                else if (RuntimeInformation.ProcessArchitecture == Architecture.Arm64)
+                {
+                    status = HeicIO_ARM64.SaveLayersToFile(ref compositeData,
+                                                           layerData,
+                                                           layerMetadata,
+                                                           layerData.Length,
+                                                           options,
+                                                           metadata,
+                                                           ref colorData,
+                                                           fileIO.IOCallbacksHandle,
+                                                           progressCallback);
+                }
+                else
+                {
+                    throw new PlatformNotSupportedException();
+                }
+            }
+
+            if (status != Status.Ok)
+            {
+                if (fileIO.CallbackExceptionInfo != null)
+                {
+                    fileIO.CallbackExceptionInfo.Throw();
+                }
+                else
+                {
+                    HandleWriteError(status);
+                }
+            }
         }
 
-        internal static nuint GetMetadataSize(SafeHeifImageHandle imageHandle, uint id)
+        internal static SafeEncoderSession CreateEncoderSession()
         {
-            nuint size;
-            Status status;
+            SafeEncoderSession session;
 
             if (RuntimeInformation.ProcessArchitecture == Architecture.X64)
             {
-                status = HeicIO_x64.GetMetadataSize(imageHandle, id, out size);
+                session = HeicIO_x64.CreateEncoderSession();
             }
             else if (RuntimeInformation.ProcessArchitecture == Architecture.Arm64)
             {
-                status = HeicIO_ARM64.GetMetadataSize(imageHandle, id, out size);
+                session = HeicIO_ARM64.CreateEncoderSession();
             }
             else
             {
                 throw new PlatformNotSupportedException();
             }
 
-            if (status != Status.Ok)
+            if (session is null || session.IsInvalid)
             {
-                HandleReadError(status);
+                throw new OutOfMemoryException();
             }
 
-            return size;
+            return session;
         }
 
-        internal static void GetMetadata(SafeHeifImageHandle imageHandle, uint id, byte[] buffer)
+        internal static unsafe ImageAnalysis AnalyzeImage(Surface surface)
         {
+            BitmapData bitmapData = new()
+            {
+                scan0 = (byte*)surface.Scan0.VoidStar,
+                width = surface.Width,
+                height = surface.Height,
+                stride = surface.Stride
+            };
+
+            ImageAnalysis analysis;
             Status status;
 
             if (RuntimeInformation.ProcessArchitecture == Architecture.X64)
             {
-                status = HeicIO_x64.GetMetadata(imageHandle, id, buffer, (uint)buffer.Length);
+                status = HeicIO_x64.AnalyzeImage(ref bitmapData, out analysis);
             }
             else if (RuntimeInformation.ProcessArchitecture == Architecture.Arm64)
             {
-                status = HeicIO_ARM64.GetMetadata(imageHandle, id, buffer, (uint)buffer.Length);
+                status = HeicIO_ARM64.AnalyzeImage(ref bitmapData, out analysis);
             }
             else
             {
@@ -380,11 +694,15 @@ namespace HeicFileTypePlus
 
             if (status != Status.Ok)
             {
-                HandleReadError(status);
+                HandleWriteError(status);
             }
+
+            return analysis;
         }
 
-        internal static unsafe void SaveToFile(Surface surface,
+        internal static unsafe void SaveToFile(SafeEncoderSession session,
+                                               Surface surface,
+                                               ref ImageAnalysis analysis,
                                                EncoderOptions options,
                                                EncoderMetadata metadata,
                                                ref CICPColorData colorData,
@@ -403,11 +721,25 @@ namespace HeicFileTypePlus
 
             if (RuntimeInformation.ProcessArchitecture == Architecture.X64)
             {
-                status = HeicIO_x64.SaveToFile(ref bitmapData, options, metadata, ref colorData, fileIO.IOCallbacksHandle, progressCallback);
+                status = HeicIO_x64.SaveToFileWithSession(session,
+                                                          ref bitmapData,
+                                                          ref analysis,
+                                                          options,
+                                                          metadata,
+                                                          ref colorData,
+                                                          fileIO.IOCallbacksHandle,
+                                                          progressCallback);
             }
             else if (RuntimeInformation.ProcessArchitecture == Architecture.Arm64)
             {
-                status = HeicIO_ARM64.SaveToFile(ref bitmapData, options, metadata, ref colorData, fileIO.IOCallbacksHandle, progressCallback);
+                status = HeicIO_ARM64.SaveToFileWithSession(session,
+                                                            ref bitmapData,
+                                                            ref analysis,
+                                                            options,
+                                                            metadata,
+                                                            ref colorData,
+                                                            fileIO.IOCallbacksHandle,
+                                                            progressCallback);
             }
             else
             {
@@ -530,6 +862,8 @@ namespace HeicFileTypePlus
                     throw new FormatException("Unable to get the image metadata.");
                 case Status.NoFtypBox:
                     throw new NoFtypeBoxException("The HEIC file is invalid: No 'ftyp' box.");
+                case Status.UserCanceled:
+                    throw new OperationCanceledException();
                 case Status.UnknownError:
                 default:
                     throw new FormatException("An unknown error occurred when loading the image.");
@@ -24,6 +24,7 @@ using PaintDotNet.Rendering;
 using System;
 using System.Collections.Generic;
 using System.IO;
+using System.Threading;
 
 namespace HeicFileTypePlus
 {
@@ -33,6 +34,17 @@ namespace HeicFileTypePlus
         // with dimensions that are smaller than this value.
         private const int MinimumEncodeSize = 64;
 
+        // The save dialog preview saves the same document each time an option changes,
+        // the session allows it to reuse the converted image of the last document.
+        // Paint.NET does not tell a file type whether a save is a preview, so the session
+        // is released when the document has not been saved for this amount of time.
+        private static readonly TimeSpan EncoderSessionLifetime = TimeSpan.FromSeconds(30);
+
+        private static readonly object encoderSessionLock = new();
+        private static WeakReference<Document>? encoderSessionDocument;
+        private static SafeEncoderSession? encoderSession;
+        private static Timer? encoderSessionTimer;
+
         public static void Save(
             Document input,
             Stream output,
@@ -40,8 +52,10 @@ namespace HeicFileTypePlus
             int quality,
             YUVChromaSubsampling chromaSubsampling,
             EncoderPreset preset,
+            int timeBudgetSeconds,
             EncoderTuning tuning,
             int tuIntraDepth,
+            bool saveLayers,
             ProgressEventHandler progressEventHandler)
         {
             if (input.Width < MinimumEncodeSize || input.Height < MinimumEncodeSize)
@@ -52,7 +66,35 @@ namespace HeicFileTypePlus
             scratchSurface.Clear();
             input.CreateRenderer().Render(scratchSurface);
 
-            bool grayscale = IsGrayscaleImage(scratchSurface);
+            ImageAnalysis analysis = HeicNative.AnalyzeImage(scratchSurface);
+            bool grayscale = analysis.grayscale;
+
+            List<Surface>? layers = null;
+            List<byte[]>? layerXmp = null;
+
+            if (saveLayers && input.Layers.Count > 1)
+            {
+                // The flattened image is saved as the primary image, each layer is saved as a
+                // separate image with its name, visibility, opacity and blend mode in an XMP packet.
+                layers = new List<Surface>(input.Layers.Count);
+                layerXmp = new List<byte[]>(input.Layers.Count);
+
+                foreach (Layer layer in input.Layers)
+                {
+                    BitmapLayer bitmapLayer = (BitmapLayer)layer;
+                    Surface layerSurface = bitmapLayer.Surface;
+
+                    // The same encoder options are used for every image, so YUV 4:0:0 can only
+                    // be used when all of the layers are gray-scale.
+                    if (grayscale)
+                    {
+                        grayscale = HeicNative.AnalyzeImage(layerSurface).grayscale;
+                    }
+
+                    layers.Add(layerSurface);
+                    layerXmp.Add(HeifLayerProperties.FromLayer(bitmapLayer).ToXmpPacket());
+                }
+            }
 
             EncoderOptions options = new()
             {
@@ -61,6 +103,7 @@ namespace HeicFileTypePlus
                 // produces the smallest file size with no quality loss.
                 yuvFormat = grayscale ? YUVChromaSubsampling.Subsampling400 : chromaSubsampling,
                 preset = preset,
+                timeBudgetMilliseconds = timeBudgetSeconds * 1000,
                 tuning = tuning,
                 tuIntraDepth = tuIntraDepth
             };
@@ -93,7 +136,35 @@ namespace HeicFileTypePlus
 
             using (HeifFileIO fileIO = new(output, leaveOpen: true))
             {
-                HeicNative.SaveToFile(scratchSurface, options, metadata, ref colorData, fileIO, ReportProgress);
+                if (layers != null && layerXmp != null)
+                {
+                    HeicNative.SaveLayersToFile(scratchSurface,
+                                                layers,
+                                                layerXmp,
+                                                options,
+                                                metadata,
+                                                ref colorData,
+                                                fileIO,
+                                                ReportProgress);
+                }
+                else
+                {
+                    try
+                    {
+                        HeicNative.SaveToFile(GetEncoderSession(input),
+                                              scratchSurface,
+                                              ref analysis,
+                                              options,
+                                              metadata,
+                                              ref colorData,
+                                              fileIO,
+                                              ReportProgress);
+                    }
+                    finally
+                    {
+                        ScheduleEncoderSessionRelease();
+                    }
+                }
             }
 
             bool ReportProgress(double progress)
@@ -165,25 +236,46 @@ namespace HeicFileTypePlus
             return items;
         }
 
-        private static unsafe bool IsGrayscaleImage(Surface surface)
+        private static SafeEncoderSession GetEncoderSession(Document document)
         {
-            for (int y = 0; y < surface.Height; y++)
+            lock (encoderSessionLock)
             {
-                ColorBgra* ptr = surface.GetRowPointerUnchecked(y);
-                ColorBgra* ptrEnd = ptr + surface.Width;
+                // The session is not released while a save is using it.
+                encoderSessionTimer?.Change(Timeout.InfiniteTimeSpan, Timeout.InfiniteTimeSpan);
 
-                while (ptr < ptrEnd)
+                if (encoderSession is null
+                    || encoderSessionDocument is null
+                    || !encoderSessionDocument.TryGetTarget(out Document? sessionDocument)
+                    || !ReferenceEquals(sessionDocument, document))
                 {
-                    if (!(ptr->R == ptr->G && ptr->G == ptr->B))
-                    {
-                        return false;
-                    }
-
-                    ptr++;
+                    // The session handle is reference counted, so a save that is using the
+                    // previous session will finish before it is released.
+                    encoderSession?.Dispose();
+                    encoderSession = HeicNative.CreateEncoderSession();
+                    encoderSessionDocument = new WeakReference<Document>(document);
                 }
+
+                return encoderSession;
             }
+        }
 
-            return true;
+        private static void ScheduleEncoderSessionRelease()
+        {
+            lock (encoderSessionLock)
+            {
+                encoderSessionTimer ??= new Timer(ReleaseEncoderSession);
+                encoderSessionTimer.Change(EncoderSessionLifetime, Timeout.InfiniteTimeSpan);
+            }
+        }
+
+        private static void ReleaseEncoderSession(object? state)
+        {
+            lock (encoderSessionLock)
+            {
+                encoderSession?.Dispose();
+                encoderSession = null;
+                encoderSessionDocument = null;
+            }
         }
     }
 }
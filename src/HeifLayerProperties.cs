@@ -0,0 +1,145 @@
+﻿// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+using PaintDotNet;
+using System;
+using System.Globalization;
+using System.Linq;
+using System.Text;
+using System.Xml;
+using System.Xml.Linq;
+
+namespace HeicFileTypePlus
+{
+    /// <summary>
+    /// The layer properties that are stored in the XMP packet of each layer image.
+    /// </summary>
+    internal sealed class HeifLayerProperties
+    {
+        private static readonly XNamespace XmpMetaNamespace = "adobe:ns:meta/";
+        private static readonly XNamespace RdfNamespace = "http://www.w3.org/1999/02/22-rdf-syntax-ns#";
+        private static readonly XNamespace LayerNamespace = "https://github.com/0xC0000054/pdn-heicfiletype-plus/ns/layer/1.0/";
+
+        private HeifLayerProperties(string name, bool visible, byte opacity, LayerBlendMode blendMode)
+        {
+            Name = name;
+            Visible = visible;
+            Opacity = opacity;
+            BlendMode = blendMode;
+        }
+
+        public string Name { get; }
+
+        public bool Visible { get; }
+
+        public byte Opacity { get; }
+
+        public LayerBlendMode BlendMode { get; }
+
+        public static HeifLayerProperties FromLayer(BitmapLayer layer)
+        {
+            ArgumentNullException.ThrowIfNull(layer, nameof(layer));
+
+            return new HeifLayerProperties(layer.Name, layer.Visible, layer.Opacity, layer.BlendMode);
+        }
+
+        /// <summary>
+        /// Parses the layer properties from an XMP packet.
+        /// </summary>
+        /// <param name="xmp">The XMP packet.</param>
+        /// <returns>
+        /// The layer properties, or <see langword="null"/> if the XMP packet was not written by <see cref="ToXmpPacket"/>.
+        /// </returns>
+        public static HeifLayerProperties? TryParse(ReadOnlySpan<byte> xmp)
+        {
+            if (xmp.IsEmpty)
+            {
+                return null;
+            }
+
+            XDocument document;
+
+            try
+            {
+                document = XDocument.Parse(Encoding.UTF8.GetString(xmp));
+            }
+            catch (XmlException)
+            {
+                return null;
+            }
+
+            XElement? description = document.Descendants(RdfNamespace + "Description")
+                                            .FirstOrDefault(static e => e.Element(LayerNamespace + "Name") != null);
+
+            if (description is null)
+            {
+                return null;
+            }
+
+            string name = (string?)description.Element(LayerNamespace + "Name") ?? string.Empty;
+
+            if (!bool.TryParse((string?)description.Element(LayerNamespace + "Visible"), out bool visible))
+            {
+                visible = true;
+            }
+
+            if (!byte.TryParse((string?)description.Element(LayerNamespace + "Opacity"),
+                               NumberStyles.None,
+                               CultureInfo.InvariantCulture,
+                               out byte opacity))
+            {
+                opacity = 255;
+            }
+
+            if (!Enum.TryParse((string?)description.Element(LayerNamespace + "BlendMode"), out LayerBlendMode blendMode)
+                || !Enum.IsDefined(blendMode))
+            {
+                blendMode = LayerBlendMode.Normal;
+            }
+
+            return new HeifLayerProperties(name, visible, opacity, blendMode);
+        }
+
+        public void ApplyTo(BitmapLayer layer)
+        {
+            ArgumentNullException.ThrowIfNull(layer, nameof(layer));
+
+            layer.Name = Name;
+            layer.Visible = Visible;
+            layer.Opacity = Opacity;
+            layer.BlendMode = BlendMode;
+        }
+
+        public byte[] ToXmpPacket()
+        {
+            XElement xmpMeta = new(XmpMetaNamespace + "xmpmeta",
+                                   new XAttribute(XNamespace.Xmlns + "x", XmpMetaNamespace),
+                                   new XElement(RdfNamespace + "RDF",
+                                                new XAttribute(XNamespace.Xmlns + "rdf", RdfNamespace),
+                                                new XElement(RdfNamespace + "Description",
+                                                             new XAttribute(RdfNamespace + "about", string.Empty),
+                                                             new XAttribute(XNamespace.Xmlns + "pdnLayer", LayerNamespace),
+                                                             new XElement(LayerNamespace + "Name", Name),
+                                                             new XElement(LayerNamespace + "Visible", Visible.ToString()),
+                                                             new XElement(LayerNamespace + "Opacity", Opacity.ToString(CultureInfo.InvariantCulture)),
+                                                             new XElement(LayerNamespace + "BlendMode", BlendMode.ToString()))));
+
+            return Encoding.UTF8.GetBytes(xmpMeta.ToString(SaveOptions.DisableFormatting));
+        }
+    }
+}
@@ -16,6 +16,7 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+using System;
 using System.Runtime.InteropServices;
 
 namespace HeicFileTypePlus.Interop
@@ -28,5 +29,9 @@ namespace HeicFileTypePlus.Interop
         public EncoderPreset preset;
         public EncoderTuning tuning;
         public int tuIntraDepth;
+        public ulong memoryBudget;
+        public IntPtr parameters;
+        public int parameterCount;
+        public int timeBudgetMilliseconds;
     }
 }
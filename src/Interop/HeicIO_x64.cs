@@ -40,6 +40,9 @@ namespace HeicFileTypePlus.Interop
         [return: MarshalAs(UnmanagedType.U1)]
         internal static extern bool DeleteImage(IntPtr handle);
 
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+        internal static extern unsafe Status SniffFile(byte* data, nuint length, out SniffResult result);
+
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
         internal static extern Status LoadFileIntoContext(
             SafeHeifContext context,
@@ -53,32 +56,41 @@ namespace HeicFileTypePlus.Interop
                                                       [MarshalAs(UnmanagedType.FunctionPtr)] HeicErrorDetailsCopy copyErrorDetails);
 
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
-        internal static extern Status DecodeImage(SafeHeifImageHandle imageHandle,
-                                                  HeifColorSpace colorSpace,
-                                                  HeifChroma chroma,
-                                                  out SafeHeifImageX64 outImage,
-                                                  [In, Out] HeifImageInfo info);
+        internal static extern Status GetImage(SafeHeifContext context,
+                                               uint id,
+                                               out SafeHeifImageHandleX64 imageHandle,
+                                               [In, Out] ImageHandleInfo info,
+                                               [MarshalAs(UnmanagedType.FunctionPtr)] HeicErrorDetailsCopy copyErrorDetails);
 
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
-        internal static extern unsafe byte* GetHeifImageChannel(SafeHeifImage image, HeifChannel channel, out int stride);
+        internal static extern Status GetTopLevelImageCount(SafeHeifContext context, out int count);
 
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
-        internal static extern Status GetICCProfileSize(SafeHeifImageHandle imageHandle, out nuint size);
+        internal static extern Status GetTopLevelImageIds(SafeHeifContext context, [Out] uint[] ids, int count);
 
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
-        internal static extern Status GetICCProfile(SafeHeifImageHandle imageHandle, byte[] buffer, nuint bufferSize);
+        internal static extern Status SetConcurrentDecodes(SafeHeifContext context, int imageCount);
 
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
-        internal static extern Status GetCICPColorData(SafeHeifImageHandle imageHandle, out CICPColorData colorData);
+        internal static extern Status DecodeImage(SafeHeifImageHandle imageHandle,
+                                                  HeifColorSpace colorSpace,
+                                                  HeifChroma chroma,
+                                                  ulong memoryBudget,
+                                                  out SafeHeifImageX64 outImage,
+                                                  [In, Out] HeifImageInfo info,
+                                                  [MarshalAs(UnmanagedType.FunctionPtr)] HeifProgressCallback? progress);
 
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
-        internal static extern Status GetMetadataId(SafeHeifImageHandle imageHandle, MetadataType type, out uint id);
+        internal static extern unsafe byte* GetHeifImageChannel(SafeHeifImage image, HeifChannel channel, out int stride);
 
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
-        internal static extern Status GetMetadataSize(SafeHeifImageHandle imageHandle, uint id, out nuint size);
+        internal static extern Status GetCICPColorData(SafeHeifImageHandle imageHandle, out CICPColorData colorData);
 
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
-        internal static extern Status GetMetadata(SafeHeifImageHandle imageHandle, uint id, byte[] buffer, nuint bufferSize);
+        internal static extern Status GetAllMetadata(SafeHeifImageHandle imageHandle, out MetadataBundle bundle);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+        internal static extern void FreeMetadataBundle(ref MetadataBundle bundle);
 
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
         internal static extern Status SaveToFile([In] ref BitmapData bitmapData,
@@ -88,6 +100,40 @@ namespace HeicFileTypePlus.Interop
                                                  SafeHandle callbacks,
                                                  [MarshalAs(UnmanagedType.FunctionPtr)] HeifProgressCallback progressCallback);
 
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+        internal static extern Status SaveLayersToFile([In] ref BitmapData composite,
+                                                       [In] BitmapData[] layers,
+                                                       [In] LayerMetadata[] layerMetadata,
+                                                       int layerCount,
+                                                       EncoderOptions options,
+                                                       [MarshalAs(UnmanagedType.CustomMarshaler, MarshalTypeRef = typeof(EncoderMetadataCustomMarshaler))] EncoderMetadata metadata,
+                                                       [In] ref CICPColorData colorData,
+                                                       SafeHandle callbacks,
+                                                       [MarshalAs(UnmanagedType.FunctionPtr)] HeifProgressCallback progressCallback);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+        internal static extern SafeEncoderSessionX64 CreateEncoderSession();
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+        [return: MarshalAs(UnmanagedType.U1)]
+        internal static extern bool DeleteEncoderSession(IntPtr session);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+        internal static extern Status AnalyzeImage([In] ref BitmapData bitmapData, out ImageAnalysis analysis);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+        internal static extern Status SaveToFileWithSession(SafeEncoderSession session,
+                                                            [In] ref BitmapData bitmapData,
+                                                            [In] ref ImageAnalysis analysis,
+                                                            EncoderOptions options,
+                                                            [MarshalAs(UnmanagedType.CustomMarshaler, MarshalTypeRef = typeof(EncoderMetadataCustomMarshaler))] EncoderMetadata metadata,
+                                                            [In] ref CICPColorData colorData,
+                                                            SafeHandle callbacks,
+                                                            [MarshalAs(UnmanagedType.FunctionPtr)] HeifProgressCallback progressCallback);
+
+        [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
+        internal static extern Status EstimateMemory(int width, int height, EncoderOptions options, out MemoryEstimate estimate);
+
         [DllImport(DllName, CallingConvention = CallingConvention.StdCall)]
         internal static extern unsafe nuint GetLibDe265VersionString(byte* buffer, nuint length);
 
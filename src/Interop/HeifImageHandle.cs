@@ -62,40 +62,22 @@ namespace HeicFileTypePlus.Interop
             }
         }
 
-        public HeifImage Decode(HeifColorSpace colorSpace, HeifChroma chroma)
+        public HeifImage Decode(HeifColorSpace colorSpace, HeifChroma chroma, HeifProgressCallback? progressCallback = null)
         {
             ObjectDisposedException.ThrowIf(this.IsDisposed, this);
 
-            return HeicNative.DecodeImage(this, colorSpace, chroma);
+            return HeicNative.DecodeImage(this, colorSpace, chroma, progressCallback);
         }
 
-        public byte[]? GetExif()
+        /// <summary>
+        /// Gets the color information and all metadata blocks of the image.
+        /// </summary>
+        /// <returns>The metadata bundle, the caller is responsible for disposing it.</returns>
+        public HeifMetadataBundle GetMetadataBundle()
         {
-            return TryGetMetadata(MetadataType.Exif);
-        }
-
-        public byte[]? GetIccProfile()
-        {
-            byte[]? profileBytes = null;
-
-            if (!this.IsDisposed && this.ColorProfileType == ImageHandleColorProfileType.Icc)
-            {
-                nuint size = HeicNative.GetICCProfileSize(this.safeHeifImageHandle);
-
-                if (size > 0 && size <= int.MaxValue)
-                {
-                    profileBytes = new byte[size];
-
-                    HeicNative.GetICCProfile(this.safeHeifImageHandle, profileBytes);
-                }
-            }
-
-            return profileBytes;
-        }
+            ObjectDisposedException.ThrowIf(this.IsDisposed, this);
 
-        public byte[]? GetXmp()
-        {
-            return TryGetMetadata(MetadataType.Xmp);
+            return HeicNative.GetAllMetadata(this.safeHeifImageHandle);
         }
 
         protected override void Dispose(bool disposing)
@@ -148,28 +130,5 @@ namespace HeicFileTypePlus.Interop
 
             return hdrFormat;
         }
-
-        private byte[]? TryGetMetadata(MetadataType metadataType)
-        {
-            byte[]? data = null;
-
-            if (!this.IsDisposed)
-            {
-                if (HeicNative.GetMetadataId(this.safeHeifImageHandle, metadataType, out uint id))
-                {
-                    nuint size = HeicNative.GetMetadataSize(this.safeHeifImageHandle, id);
-
-                    if (size > 0 && size <= int.MaxValue)
-                    {
-                        data = new byte[size];
-
-                        HeicNative.GetMetadata(this.safeHeifImageHandle, id, data);
-                    }
-                }
-            }
-
-            return data;
-        }
-
     }
 }
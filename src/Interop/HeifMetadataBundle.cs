@@ -0,0 +1,107 @@
+﻿// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+using PaintDotNet;
+using System;
+using System.Text;
+
+namespace HeicFileTypePlus.Interop
+{
+    /// <summary>
+    /// Provides access to the metadata of an image that is stored in a native memory arena.
+    /// </summary>
+    /// <remarks>
+    /// The spans returned by this class are only valid until the instance is disposed.
+    /// The native arena is not released by a finalizer, callers must dispose the instance.
+    /// </remarks>
+    internal sealed unsafe class HeifMetadataBundle : Disposable
+    {
+        private MetadataBundle bundle;
+
+        public HeifMetadataBundle(MetadataBundle bundle)
+        {
+            this.bundle = bundle;
+        }
+
+        public int BlockCount => this.bundle.blockCount;
+
+        public CICPColorData CICPColorData => this.bundle.cicp;
+
+        public ReadOnlySpan<byte> Exif => this.bundle.exifIndex >= 0 ? GetBlockData(this.bundle.exifIndex) : default;
+
+        public ReadOnlySpan<byte> IccProfile => GetArenaSpan(this.bundle.iccProfile);
+
+        public ReadOnlySpan<byte> Xmp => this.bundle.xmpIndex >= 0 ? GetBlockData(this.bundle.xmpIndex) : default;
+
+        public ReadOnlySpan<byte> GetBlockData(int index)
+        {
+            return GetArenaSpan(GetBlockInfo(index).data);
+        }
+
+        public MetadataType GetBlockType(int index)
+        {
+            return GetBlockInfo(index).type;
+        }
+
+        public string GetBlockContentType(int index)
+        {
+            ReadOnlySpan<byte> contentType = GetArenaSpan(GetBlockInfo(index).contentType);
+
+            // The content type is stored with a NUL terminator.
+            if (contentType.Length > 0)
+            {
+                contentType = contentType.Slice(0, contentType.Length - 1);
+            }
+
+            return Encoding.UTF8.GetString(contentType);
+        }
+
+        protected override void Dispose(bool disposing)
+        {
+            // The arena is native memory and this class has no finalizer, so the arena
+            // is only released when the bundle is disposed.
+            if (this.bundle.arena != null)
+            {
+                HeicNative.FreeMetadataBundle(ref this.bundle);
+            }
+
+            base.Dispose(disposing);
+        }
+
+        private MetadataBlockInfo GetBlockInfo(int index)
+        {
+            ObjectDisposedException.ThrowIf(this.IsDisposed, this);
+            ArgumentOutOfRangeException.ThrowIfNegative(index);
+            ArgumentOutOfRangeException.ThrowIfGreaterThanOrEqual(index, this.bundle.blockCount);
+
+            return this.bundle.blocks[index];
+        }
+
+        private ReadOnlySpan<byte> GetArenaSpan(MetadataBlockLocation location)
+        {
+            ObjectDisposedException.ThrowIf(this.IsDisposed, this);
+
+            if (location.size == 0 || location.size > int.MaxValue)
+            {
+                return default;
+            }
+
+            return new ReadOnlySpan<byte>(this.bundle.arena + location.offset, (int)location.size);
+        }
+    }
+}
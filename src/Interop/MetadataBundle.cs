@@ -0,0 +1,52 @@
+﻿// This file is part of pdn-heicfiletype-plus, a libheif-based HEIC
+// FileType plugin for Paint.NET.
+//
+// Copyright (C) 2020, 2021, 2022, 2024, 2025 Nicholas Hayes
+//
+// pdn-heicfiletype-plus is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdn-heicfiletype-plus is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+using System.Runtime.InteropServices;
+
+namespace HeicFileTypePlus.Interop
+{
+    [StructLayout(LayoutKind.Sequential)]
+    internal struct MetadataBlockLocation
+    {
+        public ulong offset;
+        public ulong size;
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    internal struct MetadataBlockInfo
+    {
+        public MetadataType type;
+        public uint id;
+        public MetadataBlockLocation data;
+        public MetadataBlockLocation contentType;
+    }
+
+    // This must be kept in sync with the MetadataBundle structure in HeicFileTypePlusIO.h.
+    [StructLayout(LayoutKind.Sequential)]
+    internal unsafe struct MetadataBundle
+    {
+        public CICPColorData cicp;
+        public MetadataBlockLocation iccProfile;
+        public int exifIndex;
+        public int xmpIndex;
+        public MetadataBlockInfo* blocks;
+        public int blockCount;
+        public byte* arena;
+        public ulong arenaSize;
+    }
+}
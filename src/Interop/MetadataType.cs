@@ -18,9 +18,12 @@
 
 namespace HeicFileTypePlus.Interop
 {
+    // This must be kept in sync with the MetadataType enumeration in HeicFileTypePlusIO.h.
     internal enum MetadataType
     {
         Exif,
-        Xmp
+        Xmp,
+        Mime,
+        Other
     }
 }
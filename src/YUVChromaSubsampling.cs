@@ -50,6 +50,11 @@ namespace HeicFileTypePlus
         /// <remarks>
         /// Used internally for lossless RGB encoding, not shown to the user.
         /// </remarks>
-        IdentityMatrix
+        IdentityMatrix,
+
+        /// <summary>
+        /// The chroma subsampling is selected based on the image content.
+        /// </summary>
+        Automatic
     }
 }
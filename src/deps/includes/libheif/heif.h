@@ -2147,6 +2147,26 @@ struct heif_error heif_context_encode_grid(struct heif_context* ctx,
                                            const struct heif_encoding_options* input_options,
                                            struct heif_image_handle** out_image_handle);
 
+// Add a grid image with the specified output size to the context, the tiles are added
+// with heif_context_add_image_tile(). The tiles in the last row and column may extend
+// past the output size, the decoded image is cropped to 'image_width' x 'image_height'.
+LIBHEIF_API
+struct heif_error heif_context_add_grid_image(struct heif_context* ctx,
+                                              uint32_t image_width,
+                                              uint32_t image_height,
+                                              uint32_t tile_columns,
+                                              uint32_t tile_rows,
+                                              const struct heif_encoding_options* encoding_options,
+                                              struct heif_image_handle** out_grid_image_handle);
+
+// Encode the 'image' as the tile at 'tile_x', 'tile_y' of a grid image.
+LIBHEIF_API
+struct heif_error heif_context_add_image_tile(struct heif_context* ctx,
+                                              struct heif_image_handle* tiled_image,
+                                              uint32_t tile_x, uint32_t tile_y,
+                                              const struct heif_image* image,
+                                              struct heif_encoder* encoder);
+
 LIBHEIF_API
 struct heif_error heif_context_set_primary_image(struct heif_context*,
                                                  struct heif_image_handle* image_handle);